@@ -0,0 +1,48 @@
+# - Try to find ZSTD
+# Once done this will define
+#
+#  ZSTD_FOUND - system has zstd
+#  ZSTD_INCLUDE_DIR - the zstd include directory
+#  ZSTD_LIBRARIES - Link these to use zstd
+#
+# Redistribution and use is allowed according to the terms of the BSD license.
+# For details see the accompanying COPYING-CMAKE-SCRIPTS file.
+
+if (ZSTD_INCLUDE_DIR AND ZSTD_LIBRARIES)
+
+  # in cache already
+  set(ZSTD_FOUND TRUE)
+  message(STATUS "Found libzstd: ${ZSTD_LIBRARIES}")
+
+else (ZSTD_INCLUDE_DIR AND ZSTD_LIBRARIES)
+
+  find_path(ZSTD_INCLUDE_DIR zstd.h
+    ${_obIncDir}
+    ${GNUWIN32_DIR}/include
+  )
+
+  find_library(ZSTD_LIBRARIES NAMES zstd
+    PATHS
+    ${_obLinkDir}
+    ${GNUWIN32_DIR}/lib
+  )
+
+  if(ZSTD_INCLUDE_DIR AND ZSTD_LIBRARIES)
+    set(ZSTD_FOUND TRUE)
+  else (ZSTD_INCLUDE_DIR AND ZSTD_LIBRARIES)
+    set(ZSTD_FOUND FALSE)
+  endif(ZSTD_INCLUDE_DIR AND ZSTD_LIBRARIES)
+
+  if (ZSTD_FOUND)
+    if (NOT ZSTD_FIND_QUIETLY)
+      message(STATUS "Found libzstd: ${ZSTD_LIBRARIES}")
+    endif (NOT ZSTD_FIND_QUIETLY)
+  else (ZSTD_FOUND)
+    if (ZSTD_FIND_REQUIRED)
+      message(FATAL_ERROR "libzstd not found. Please install libzstd development package.")
+    endif (ZSTD_FIND_REQUIRED)
+  endif (ZSTD_FOUND)
+
+  mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARIES)
+
+endif (ZSTD_INCLUDE_DIR AND ZSTD_LIBRARIES)
@@ -30,13 +30,14 @@
 */
 
 #include <ctype.h>
+#include <string.h>
 #include "base64.h"
 
 static const char base64digits[] =
    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 #define BAD     (-1)
-static const char base64val[] = {
+static const signed char base64val[] = {
     BAD,BAD,BAD,BAD, BAD,BAD,BAD,BAD, BAD,BAD,BAD,BAD, BAD,BAD,BAD,BAD,
     BAD,BAD,BAD,BAD, BAD,BAD,BAD,BAD, BAD,BAD,BAD,BAD, BAD,BAD,BAD,BAD,
     BAD,BAD,BAD,BAD, BAD,BAD,BAD,BAD, BAD,BAD,BAD, 62, BAD,BAD,BAD, 63,
@@ -48,6 +49,175 @@ static const char base64val[] = {
 };
 #define DECODE64(c)  (isascii(c) ? base64val[c] : BAD)
 
+/* SIMD kernels each encode as many whole blocks of in as they can without
+ * reading past in+inlen, returning the number of bytes of in they consumed,
+ * always a multiple of 3. the scalar loop in to64frombits() does the rest.
+ * the fastest one this cpu supports is picked the first time we are called.
+ */
+typedef int (*EncKernel)(unsigned char *out, const unsigned char *in, int inlen);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+#define BASE64_X86
+
+/* spread each 3 bytes to 4 16-bit halves holding one 6 bit value per byte,
+ * see http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+ */
+__attribute__((target("ssse3"))) static inline __m128i
+enc_reshuffle (__m128i in)
+{
+    in = _mm_shuffle_epi8 (in, _mm_set_epi8 (10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1));
+    return (_mm_or_si128 (
+        _mm_mulhi_epu16 (_mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00)),
+                                        _mm_set1_epi32 (0x04000040)),
+        _mm_mullo_epi16 (_mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0)),
+                                        _mm_set1_epi32 (0x01000010))));
+}
+
+/* turn each 6 bit value into its base64 digit by adding the offset of its
+ * range: A-Z, a-z, 0-9, + and /
+ */
+__attribute__((target("ssse3"))) static inline __m128i
+enc_translate (__m128i in)
+{
+    const __m128i lut = _mm_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+                                        -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i idx = _mm_subs_epu8 (in, _mm_set1_epi8 (51));
+
+    idx = _mm_sub_epi8 (idx, _mm_cmpgt_epi8 (in, _mm_set1_epi8 (25)));
+    return (_mm_add_epi8 (in, _mm_shuffle_epi8 (lut, idx)));
+}
+
+/* 12 bytes to 16 digits at a time, reading 16 */
+__attribute__((target("ssse3"))) static int
+enc_ssse3 (unsigned char *out, const unsigned char *in, int inlen)
+{
+    int n = 0;
+
+    for (; inlen - n >= 16; n += 12, out += 16) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(in + n));
+        _mm_storeu_si128 ((__m128i *)out, enc_translate (enc_reshuffle (v)));
+    }
+
+    return (n);
+}
+
+/* same as enc_reshuffle() and enc_translate() in each 128 bit lane */
+__attribute__((target("avx2"))) static inline __m256i
+enc_reshuffle2 (__m256i in)
+{
+    in = _mm256_shuffle_epi8 (in, _mm256_set_epi8 (
+                10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1,
+                10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1));
+    return (_mm256_or_si256 (
+        _mm256_mulhi_epu16 (_mm256_and_si256 (in, _mm256_set1_epi32 (0x0fc0fc00)),
+                                        _mm256_set1_epi32 (0x04000040)),
+        _mm256_mullo_epi16 (_mm256_and_si256 (in, _mm256_set1_epi32 (0x003f03f0)),
+                                        _mm256_set1_epi32 (0x01000010))));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+enc_translate2 (__m256i in)
+{
+    const __m256i lut = _mm256_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+                                        -4, -4, -4, -4, -19, -16, 0, 0,
+                                        65, 71, -4, -4, -4, -4, -4, -4,
+                                        -4, -4, -4, -4, -19, -16, 0, 0);
+    __m256i idx = _mm256_subs_epu8 (in, _mm256_set1_epi8 (51));
+
+    idx = _mm256_sub_epi8 (idx, _mm256_cmpgt_epi8 (in, _mm256_set1_epi8 (25)));
+    return (_mm256_add_epi8 (in, _mm256_shuffle_epi8 (lut, idx)));
+}
+
+/* 24 bytes to 32 digits at a time, 12 in each lane, reading 28 */
+__attribute__((target("avx2"))) static int
+enc_avx2 (unsigned char *out, const unsigned char *in, int inlen)
+{
+    int n = 0;
+
+    for (; inlen - n >= 28; n += 24, out += 32) {
+        __m256i v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (
+                    _mm_loadu_si128 ((const __m128i *)(in + n))),
+                    _mm_loadu_si128 ((const __m128i *)(in + n + 12)), 1);
+        _mm256_storeu_si256 ((__m256i *)out, enc_translate2 (enc_reshuffle2 (v)));
+    }
+
+    return (n);
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+#define BASE64_NEON
+
+/* 48 bytes to 64 digits at a time: split by 3 on load, look each 6 bit
+ * value up in all 64 digits at once, interleave by 4 on store.
+ */
+static int
+enc_neon (unsigned char *out, const unsigned char *in, int inlen)
+{
+    const uint8_t *digits = (const uint8_t *) base64digits;
+    const uint8x16_t m6 = vdupq_n_u8 (0x3f);
+    uint8x16x4_t lut;
+    int n = 0;
+
+    lut.val[0] = vld1q_u8 (digits);
+    lut.val[1] = vld1q_u8 (digits + 16);
+    lut.val[2] = vld1q_u8 (digits + 32);
+    lut.val[3] = vld1q_u8 (digits + 48);
+
+    for (; inlen - n >= 48; n += 48, out += 64) {
+        uint8x16x3_t v = vld3q_u8 (in + n);
+        uint8x16x4_t r;
+
+        r.val[0] = vshrq_n_u8 (v.val[0], 2);
+        r.val[1] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (v.val[0], 4),
+                                        vshrq_n_u8 (v.val[1], 4)), m6);
+        r.val[2] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (v.val[1], 2),
+                                        vshrq_n_u8 (v.val[2], 6)), m6);
+        r.val[3] = vandq_u8 (v.val[2], m6);
+
+        r.val[0] = vqtbl4q_u8 (lut, r.val[0]);
+        r.val[1] = vqtbl4q_u8 (lut, r.val[1]);
+        r.val[2] = vqtbl4q_u8 (lut, r.val[2]);
+        r.val[3] = vqtbl4q_u8 (lut, r.val[3]);
+        vst4q_u8 (out, r);
+    }
+
+    return (n);
+}
+
+#endif
+
+/* kernel that does nothing, leaving it all to the scalar loop */
+static int
+enc_none (unsigned char *out, const unsigned char *in, int inlen)
+{
+    (void) out;
+    (void) in;
+    (void) inlen;
+    return (0);
+}
+
+/* return the fastest kernel this cpu can run */
+static EncKernel
+pickEncKernel (void)
+{
+#if defined(BASE64_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2"))
+        return (enc_avx2);
+    if (__builtin_cpu_supports ("ssse3"))
+        return (enc_ssse3);
+#elif defined(BASE64_NEON)
+    return (enc_neon);
+#endif
+    return (enc_none);
+}
+
+static EncKernel enckernel;
+
 /* convert inlen raw bytes at in to base64 string (NUL-terminated) at out. 
  * out size should be at least 4*inlen/3 + 4.
  * return length of out (sans trailing NUL).
@@ -56,6 +226,17 @@ int
 to64frombits(unsigned char *out, const unsigned char *in, int inlen)
 {
     unsigned char *out0 = out;
+    int n;
+
+    /* bulk with the best kernel we have, it's the same result each time so
+     * racing threads may safely both set it
+     */
+    if (!enckernel)
+        enckernel = pickEncKernel();
+    n = (*enckernel) (out, in, inlen);
+    out += n/3*4;
+    in += n;
+    inlen -= n;
 
     for (; inlen >= 3; inlen -= 3)
     {
@@ -82,6 +263,32 @@ to64frombits(unsigned char *out, const unsigned char *in, int inlen)
     return (out-out0);
 }
 
+/* same as to64frombits() but with a newline after each linelen digits and
+ * after the last line. linelen must be a multiple of 4.
+ * out size should be at least 4*inlen/3 + 4 + (4*inlen/3 + 4)/linelen + 1.
+ * return length of out (sans trailing NUL).
+ */
+int
+to64lines(unsigned char *out, const unsigned char *in, int inlen, int linelen)
+{
+    int l = (inlen+2)/3*4;			/* digits */
+    int nlines = (l + linelen-1)/linelen;
+    int i;
+
+    /* encode all past where the newlines go, then slide each line down to
+     * its place, always to lower addresses.
+     */
+    to64frombits (out + nlines, in, inlen);
+    for (i = 0; i < nlines; i++) {
+        int ll = l - i*linelen < linelen ? l - i*linelen : linelen;
+        memmove (out + i*(linelen+1), out + nlines + i*linelen, ll);
+        out[i*(linelen+1) + ll] = '\n';
+    }
+    out[l + nlines] = '\0';
+
+    return (l + nlines);
+}
+
 /* convert base64 at in to raw bytes out, returning count or <0 on error.
  * base64 may contain any embedded whitespace.
  * out should be at least 3/4 the length of in.
@@ -124,6 +331,97 @@ from64tobits(char *out, const char *in)
     return (len);
 }
 
+/* start converting base64 to raw bytes a piece at a time with from64part() */
+void
+from64init(From64State *sp)
+{
+    memset (sp, 0, sizeof(*sp));
+}
+
+/* convert the next inlen chars of base64 at in to raw bytes at out,
+ * carrying a quad split between pieces over in sp. whitespace is skipped,
+ * and all that follows a '=' ignored as from64tobits() stops there.
+ * out should be at least 3*inlen/4 + 3.
+ * return count of bytes at out or <0 on error.
+ */
+int
+from64part(From64State *sp, unsigned char *out, const char *in, int inlen)
+{
+    const unsigned char *p = (const unsigned char *) in;
+    unsigned char *out0 = out;
+    int i = 0;
+
+    if (sp->pad)
+        return (0);
+
+    while (i < inlen)
+    {
+        int d;
+
+        /* whole quads at once while they are plain digits */
+        if (sp->ndigits == 0)
+        {
+            for (; inlen - i >= 4; i += 4)
+            {
+                int d1 = DECODE64(p[i]), d2 = DECODE64(p[i+1]);
+                int d3 = DECODE64(p[i+2]), d4 = DECODE64(p[i+3]);
+
+                if (d1 == BAD || d2 == BAD || d3 == BAD || d4 == BAD)
+                    break;
+                *out++ = (d1 << 2) | (d2 >> 4);
+                *out++ = ((d2 << 4) & 0xf0) | (d3 >> 2);
+                *out++ = ((d3 << 6) & 0xc0) | d4;
+            }
+            if (i == inlen)
+                break;
+        }
+
+        /* then one char at a time up to the next whole quad */
+        if (isspace(p[i]))
+        {
+            i++;
+            continue;
+        }
+        if (p[i] == '=')
+        {
+            /* "xx==" ends with one byte, "xxx=" with two */
+            if (sp->ndigits < 2)
+                return (-1);
+            if (sp->ndigits == 2)
+                sp->bits <<= 6;
+            *out++ = sp->bits >> 10;
+            if (sp->ndigits == 3)
+                *out++ = sp->bits >> 2;
+            sp->ndigits = 0;
+            sp->pad = 1;
+            break;
+        }
+        if ((d = DECODE64(p[i])) == BAD)
+            return (-1);
+        i++;
+        sp->bits = (sp->bits << 6) | d;
+        if (++sp->ndigits == 4)
+        {
+            *out++ = sp->bits >> 16;
+            *out++ = sp->bits >> 8;
+            *out++ = sp->bits;
+            sp->bits = 0;
+            sp->ndigits = 0;
+        }
+    }
+
+    return (out-out0);
+}
+
+/* finish what from64part() started.
+ * return 0 if the base64 ended on a whole quad, else -1.
+ */
+int
+from64end(From64State *sp)
+{
+    return (sp->ndigits == 0 ? 0 : -1);
+}
+
 #ifdef BASE64_PROGRAM
 /* standalone program that converts to/from base64.
  * cc -o base64 -DBASE64_PROGRAM base64.c
@@ -244,5 +542,94 @@ main (int ac, char *av[])
 	return (0);
 }
 #endif
+
+#ifdef BASE64_BENCHMARK
+/* standalone micro-benchmark that times each encoder kernel this cpu can
+ * run against the scalar loop and checks they all agree.
+ * cc -O2 -o base64_benchmark -DBASE64_BENCHMARK base64.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec*1e-6);
+}
+
+int
+main (int ac, char *av[])
+{
+	struct {
+	    const char *name;
+	    EncKernel k;
+	    int ok;
+	} kernels[] = {
+	    {"scalar", enc_none, 1},
+#if defined(BASE64_X86)
+	    {"ssse3", enc_ssse3, 0},
+	    {"avx2", enc_avx2, 0},
+#elif defined(BASE64_NEON)
+	    {"neon", enc_neon, 1},
+#endif
+	};
+	int nk = sizeof(kernels)/sizeof(kernels[0]);
+	int size = ac > 1 ? atoi(av[1]) : 1<<20;
+	int reps = ac > 2 ? atoi(av[2]) : 200;
+	unsigned char *raw, *b64, *ref;
+	int i, j, n;
+
+#if defined(BASE64_X86)
+	__builtin_cpu_init();
+	kernels[1].ok = __builtin_cpu_supports ("ssse3");
+	kernels[2].ok = __builtin_cpu_supports ("avx2");
+#endif
+
+	/* random raw, reference from the scalar loop */
+	raw = malloc (size);
+	b64 = malloc (4*size/3 + 4);
+	ref = malloc (4*size/3 + 4);
+	for (i = 0; i < size; i++)
+	    raw[i] = rand();
+	enckernel = enc_none;
+	n = to64frombits (ref, raw, size);
+
+	for (i = 0; i < nk; i++) {
+	    double t0, dt;
+
+	    if (!kernels[i].ok) {
+		printf ("%-8s not supported\n", kernels[i].name);
+		continue;
+	    }
+
+	    /* every length up to a few blocks must match too */
+	    enckernel = kernels[i].k;
+	    for (j = 0; j < 200 && j <= size; j++)
+		if (to64frombits (b64, raw, j) != (j+2)/3*4
+				|| memcmp (b64, ref, j/3*4)) {
+		    printf ("%-8s wrong at length %d\n", kernels[i].name, j);
+		    return (1);
+		}
+	    if (to64frombits (b64, raw, size) != n || memcmp (b64, ref, n)) {
+		printf ("%-8s wrong\n", kernels[i].name);
+		return (1);
+	    }
+
+	    t0 = now();
+	    for (j = 0; j < reps; j++)
+		to64frombits (b64, raw, size);
+	    dt = now() - t0;
+	    printf ("%-8s %8.1f MB/s\n", kernels[i].name, 1e-6*size*reps/dt);
+	}
+
+	return (0);
+}
+#endif
 /* For RCS Only -- Do Not Edit */
 static char *rcsid[2] = {(char *)rcsid, "@(#) $RCSfile$ $Date: 2006-09-30 14:19:41 +0300 (Sat, 30 Sep 2006) $ $Revision: 590506 $ $Name:  $"};
@@ -38,6 +38,16 @@ extern "C" {
  */
 extern int to64frombits(unsigned char *out, const unsigned char *in,
     int inlen);
+
+/** \brief Convert bytes array to base64 lines.
+    \param out output buffer in base64. The buffer size must be at least (4 * inlen / 3 + 4) bytes long plus one for each line.
+    \param in input binary buffer
+    \param inlen number of bytes to convert
+    \param linelen digits per line, a multiple of 4. Each line, including the last, ends with a newline.
+    \return length of out, sans trailing NUL.
+ */
+extern int to64lines(unsigned char *out, const unsigned char *in,
+    int inlen, int linelen);
     
 /** \brief Convert base64 to bytes array.
     \param out output buffer in bytes. The buffer size must be at least (3 * size_of_in_buffer / 4) bytes long.
@@ -47,6 +57,36 @@ extern int to64frombits(unsigned char *out, const unsigned char *in,
 
 extern int from64tobits(char *out, const char *in);
 
+/** \brief State of a base64 conversion done a piece at a time. */
+typedef struct
+{
+    unsigned int bits;      /*!< digits of the quad so far, 6 bits each */
+    int ndigits;            /*!< number of digits in bits */
+    int pad;                /*!< 1 once a '=' ended the base64 */
+} From64State;
+
+/** \brief Start converting base64 to bytes a piece at a time.
+    \param sp state to set up for from64part().
+ */
+extern void from64init(From64State *sp);
+
+/** \brief Convert the next piece of base64 to bytes.
+
+    A quad of digits may be split between pieces, so base64 may be converted as it arrives, e.g. from the pcdata of a BLOB.
+    \param sp state from from64init().
+    \param out output buffer in bytes. The buffer size must be at least (3 * inlen / 4 + 3) bytes long.
+    \param in next piece of base64, it may contain whitespace.
+    \param inlen number of chars in in.
+    \return number of bytes put in out, or -1 on failure.
+ */
+extern int from64part(From64State *sp, unsigned char *out, const char *in, int inlen);
+
+/** \brief Finish converting base64 a piece at a time.
+    \param sp state used with from64part().
+    \return 0 if the base64 ended with a whole quad, -1 if not.
+ */
+extern int from64end(From64State *sp);
+
 /*@}*/
 
 #ifdef __cplusplus
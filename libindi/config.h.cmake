@@ -7,12 +7,21 @@
 /* Define if you have termios.h */
 #cmakedefine   HAVE_TERMIOS_H 1
 
+/* Define if you have sys/epoll.h, indiserver and the driver event loop then use epoll instead of select */
+#cmakedefine   HAVE_SYS_EPOLL_H 1
+
 /* Define if you have fitsio.h */
 #cmakedefine   HAVE_CFITSIO_H 1
 
 /* Define if you have libnova.h */
 #cmakedefine   HAVE_NOVA_H 1
 
+/* Define if you have lz4frame.h */
+#cmakedefine   HAVE_LZ4_H 1
+
+/* Define if you have zstd.h */
+#cmakedefine   HAVE_ZSTD_H 1
+
 /* Set INDI Library version */
 #cmakedefine CMAKE_INDI_VERSION_STRING "@CMAKE_INDI_VERSION_STRING@"
 
@@ -29,20 +29,37 @@
  * work procedures may be registered that are called when there is nothing
  *   else to do;
  *
+ * each pass of the loop waits once, in epoll_wait() where available else in
+ *   select(), then runs every timer that has come due and every callback
+ *   whose fd is ready, so a busy fd can not hold off the timers or other fds.
+ *   timers are timed on the monotonic clock so they do not jump with the
+ *   time of day.
+ *
  #define MAIN_TEST for a stand-alone test program.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "config.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define USE_EPOLL			/* else fall back to select() */
+#endif
+
 #include "eventloop.h"
 
+#define	EVMAX	64			/* max ready fds taken per epoll_wait() */
+
 /* info about one registered callback.
  * the malloced array cback is never shrunk, entries are reused. new id's are
  * the index of first unused slot in array (and thus reused like unix' open(2)).
@@ -50,29 +67,35 @@
 typedef struct {
     int in_use;				/* flag to mark this record is active */
     int fd;				/* fd descriptor to watch for read */
+    int pfd;				/* fd given to epoll, a dup if fd is shared */
+    unsigned gen;			/* cbgen when added, to spot reused slots */
     void *ud;				/* user's data handle */
     CBF *fp;				/* callback function */
 } CB;
 static CB *cback;			/* malloced list of callbacks */
 static int ncback;			/* n entries in cback[] */
 static int ncbinuse;			/* n entries in cback[] marked in_use */
-static int lastcb;			/* cback index of last cb called */
+static unsigned cbgen;			/* source of CB.gen */
+#ifdef USE_EPOLL
+static int epfd = -1;			/* epoll instance watching all cback fds */
+static int nready;			/* n in-use cback[] epoll can not watch */
+#define	NOPOLL	(-2)			/* CB.pfd of those, they are always ready */
+#endif
 
 /* info about one registered timer function.
- * the entries are kept sorted by decreasing time from epoch, ie,
- *   the next entry to fire is at the end of the array.
+ * the entries form a binary heap on tgo, then tid, so timef[0] is always the
+ *   next to fire and those due at the same moment fire in the order added.
  */
 typedef struct {
-    double tgo;				/* trigger time, ms from epoch */
+    double tgo;				/* trigger time, ms on monotonic clock */
     void *ud;				/* user's data handle */
     TCF *fp;				/* timer function */
     int tid;				/* unique id for this timer */
 } TF;
-static TF *timef;			/* malloced list of timer functions */
-static int ntimef;			/* n entries in ntimef[] */
+static TF *timef;			/* malloced heap of timer functions */
+static int ntimef;			/* n entries in timef[] */
+static int mtimef;			/* n entries room in timef[] */
 static int tid;				/* source of unique timer ids */
-#define	EPOCHDT(tp) 			/* ms from epoch to timeval *tp */  \
-	(((tp)->tv_usec)/1000.0 + ((tp)->tv_sec)*1000.0)
 
 /* info about one registered work procedure.
  * the malloced array wproc is never shrunk, entries are reused. new id's are
@@ -89,10 +112,17 @@ static int nwpinuse;			/* n entries in wproc[] marked in-use */
 static int lastwp;			/* wproc index of last workproc called*/
 
 static void runWorkProc (void);
-static void callCallback(fd_set *rfdp);
-static void checkTimer();
+static void runCallback (int cid, unsigned gen);
+static void checkTimers (void);
 static void oneLoop(void);
 static void deferTO (void *p);
+static double nowMS (void);
+static int tfBefore (TF *a, TF *b);
+static void tfUp (int i);
+static void tfDown (int i);
+static void tfRemove (int i);
+static int pollFD (int fd, int cid);
+static void unpollFD (CB *cp);
 
 /* inf loop to dispatch callbacks, work procs and timers as necessary.
  * never returns.
@@ -152,12 +182,14 @@ deferLoop0 (int maxms, int *flagp)
 }
 
 /* register a new callback, fp, to be called with ud as arg when fd is ready.
- * return a unique callback id for use with rmCallback().
+ * return a unique callback id for use with rmCallback(), or -1 if fd can not
+ * be watched.
  */
 int
 addCallback (int fd, CBF *fp, void *ud)
 {
 	CB *cp;
+	int cid, pfd;
 
 	/* reuse first unused slot or grow */
 	for (cp = cback; cp < &cback[ncback]; cp++)
@@ -168,16 +200,26 @@ addCallback (int fd, CBF *fp, void *ud)
 	    		  : (CB *) malloc (sizeof(CB));
 	    cp = &cback[ncback++];
 	}
+	cid = cp - cback;
+
+	/* start watching fd */
+	cp->gen = ++cbgen;
+	pfd = pollFD (fd, cid);
+	if (pfd == -1) {
+	    cp->in_use = 0;
+	    return (-1);
+	}
 
 	/* init new entry */
 	cp->in_use = 1;
 	cp->fp = fp;
 	cp->ud = ud;
 	cp->fd = fd;
+	cp->pfd = pfd;
 	ncbinuse++;
 
 	/* id is index into array */
-	return (cp - cback);
+	return (cid);
 }
 
 /* remove the callback with the given id, as returned from addCallback().
@@ -198,40 +240,37 @@ rmCallback (int cid)
 	/* mark for reuse */
 	cp->in_use = 0;
 	ncbinuse--;
+	unpollFD (cp);
 }
 
 /* register a new timer function, fp, to be called with ud as arg after ms
- * milliseconds. add to list in order of decreasing time from epoch, ie,
- * last entry runs soonest. return id for use with rmTimer().
+ * milliseconds. add to the heap of timers.
+ * return id for use with rmTimer().
  */
 int
 addTimer (int ms, TCF *fp, void *ud)
 {
-	struct timeval t;
 	TF *tp;
 
-	/* get time now */
-	gettimeofday (&t, NULL);
-
-	/* add one entry */
-	timef = timef ? (TF *) realloc (timef, (ntimef+1)*sizeof(TF))
-		      : (TF *) malloc (sizeof(TF));
-	tp = &timef[ntimef++];
+	/* make room for one more entry */
+	if (ntimef == mtimef) {
+	    mtimef = mtimef ? 2*mtimef : 16;
+	    timef = timef ? (TF *) realloc (timef, mtimef*sizeof(TF))
+			  : (TF *) malloc (mtimef*sizeof(TF));
+	}
 
 	/* init new entry */
+	tp = &timef[ntimef];
 	tp->ud = ud;
 	tp->fp = fp;
-	tp->tgo = EPOCHDT(&t) + ms;
+	tp->tgo = nowMS() + ms;
+	tp->tid = ++tid;
 
-	/* insert maintaining sort */
-	for ( ; tp > timef && tp[0].tgo > tp[-1].tgo; tp--) {
-	    TF tmptf = tp[-1];
-	    tp[-1] = tp[0];
-	    tp[0] = tmptf;
-	}
+	/* insert maintaining heap */
+	tfUp (ntimef++);
 
-	/* store and return new unique id */
-	return (tp->tid = ++tid);
+	/* return new unique id */
+	return (tid);
 }
 
 /* remove the timer with the given id, as returned from addTimer().
@@ -240,21 +279,16 @@ addTimer (int ms, TCF *fp, void *ud)
 void
 rmTimer (int timer_id)
 {
-	TF *tp;
+	int i;
 
 	/* find it */
-	for (tp = timef; tp < &timef[ntimef]; tp++)
-	    if (tp->tid == timer_id)
+	for (i = 0; i < ntimef; i++)
+	    if (timef[i].tid == timer_id)
 		break;
-	if (tp == &timef[ntimef])
+	if (i == ntimef)
 	    return;
 
-	/* bubble it out */
-	for (++tp; tp < &timef[ntimef]; tp++)
-	    tp[-1] = tp[0];
-
-	/* shrink list */
-	timef = (TF *) realloc (timef, (--ntimef)*sizeof(TF));
+	tfRemove (i);
 }
 
 /* add a new work procedure, fp, to be called with ud when nothing else to do.
@@ -326,61 +360,103 @@ runWorkProc ()
 	(*wp->fp) (wp->ud);
 }
 
-/* run next callback whose fd is listed as ready to go in rfdp */
+/* run callback cid for its ready fd, unless it has been removed, or removed
+ * and its slot reused, by the callbacks and timers run since the wait.
+ */
 static void
-callCallback(fd_set *rfdp)
+runCallback (int cid, unsigned gen)
 {
 	CB *cp;
 
-	/* skip if list is empty */
-	if (!ncbinuse)
+	if (cid < 0 || cid >= ncback)
+	    return;
+	cp = &cback[cid];
+	if (!cp->in_use || cp->gen != gen)
 	    return;
 
-	/* find next */
-	do {
-	    lastcb = (lastcb+1) % ncback;
-	    cp = &cback[lastcb];
-	} while (!cp->in_use || !FD_ISSET (cp->fd, rfdp));
-
-	/* run */
 	(*cp->fp) (cp->fd, cp->ud);
 }
 
-/* run the next timer callback whose time has come, if any. all we have to do
- * is is check the last entry in timef[] because it is sorted in decreasing
- * order of time from epoch to run, ie, last entry runs soonest.
+/* run every timer callback whose time has come, soonest first.
+ * timers added meanwhile wait for the next pass, even if already due, so
+ *   one that keeps adding itself again can not starve the fds.
  */
 static void
-checkTimer()
+checkTimers()
 {
-	struct timeval now;
-	double tgonow;
-	TF *tp;
-
-	/* skip if list is empty */
-	if (!ntimef)
-	    return;
+	double tgonow = nowMS();
+	int lasttid = tid;
 
-	gettimeofday (&now, NULL);
-	tgonow = EPOCHDT (&now);
-	tp = &timef[ntimef-1];
-	if (tp->tgo <= tgonow) {
-	    ntimef--;			/* pop then call */
-	    (*tp->fp) (tp->ud);
+	while (ntimef > 0 && timef[0].tgo <= tgonow && timef[0].tid <= lasttid) {
+	    TF tf = timef[0];
+	    tfRemove (0);		/* pop then call */
+	    (*tf.fp) (tf.ud);
 	}
 }
 
-/* check fd's from each active callback.
- * if any ready, call their callbacks else call each registered work procedure.
+/* wait for an fd to be ready or the soonest timer to come due, then run
+ * all due timers and the callbacks of all ready fds.
+ * if no fd was ready, call the next registered work procedure.
  */
 static void
 oneLoop()
 {
+	double late = -1;		/* ms to wait, forever if < 0 */
+	unsigned gen = cbgen;		/* newest callback before the wait */
+	int ns, n, i;
+#ifdef USE_EPOLL
+	struct epoll_event ev[EVMAX];
+#else
 	struct timeval tv, *tvp;
 	fd_set rfd;
+	int maxfd;
 	CB *cp;
-	int maxfd, ns;
+#endif
+
+	/* determine timeout:
+	 * if there are work procs
+	 *   set delay = 0
+	 * else if there is at least one timer func
+	 *   set delay = time until soonest timer func expires
+	 * else
+	 *   set delay = forever
+	 */
+	if (nwpinuse > 0)
+	    late = 0;
+#ifdef USE_EPOLL
+	else if (nready > 0)
+	    late = 0;
+#endif
+	else if (ntimef > 0) {
+	    late = timef[0].tgo - nowMS();
+	    if (late < 0)
+		late = 0;
+	}
 
+#ifdef USE_EPOLL
+	/* wait whole ms, rounded up so timers are never run early */
+	if (pollFD (-1, 0) < 0)
+	    return;
+	ns = epoll_wait (epfd, ev, EVMAX, late < 0 ? -1 : (int)ceil(late));
+	if (ns < 0) {
+	    if (errno != EINTR)
+		perror ("epoll_wait");
+            return;
+	}
+
+	/* dispatch, then run the callbacks of files epoll can not watch, but not
+	 * any added since the wait
+	 */
+	checkTimers();
+	for (i = 0; i < ns; i++)
+	    runCallback ((int)(ev[i].data.u64 & 0xffffffff),
+	    				(unsigned)(ev[i].data.u64 >> 32));
+	for (i = 0, n = ncback; nready > 0 && i < n; i++)
+	    if (cback[i].in_use && cback[i].gen <= gen && cback[i].pfd == NOPOLL) {
+		runCallback (i, cback[i].gen);
+		ns++;
+	    }
+#else
 	/* build list of callback file descriptors to check */
 	FD_ZERO (&rfd);
 	maxfd = -1;
@@ -392,44 +468,32 @@ oneLoop()
 	    }
 	}
 
-	/* determine timeout:
-	 * if there are work procs
-	 *   set delay = 0
-	 * else if there is at least one timer func
-	 *   set delay = time until soonest timer func expires
-	 * else
-	 *   set delay = forever
-	 */
-	if (nwpinuse > 0) {
+	if (late >= 0) {
+	    long us = (long)ceil(late*1000.0);			/* us late */
 	    tvp = &tv;
-	    tvp->tv_sec = tvp->tv_usec = 0;
-	} else if (ntimef > 0) {
-	    struct timeval now;
-	    double late;
-	    gettimeofday (&now, NULL);
-	    late = timef[ntimef-1].tgo - EPOCHDT (&now);	/* ms late */
-	    if (late < 0)
-		late = 0;
-	    late /= 1000.0;					/* secs late */
-	    tvp = &tv;
-	    tvp->tv_sec = (long)floor(late);
-	    tvp->tv_usec = (long)floor((late - tvp->tv_sec)*1000000.0);
+	    tvp->tv_sec = us/1000000;
+	    tvp->tv_usec = us%1000000;
 	} else
 	    tvp = NULL;
 
 	/* check file descriptors, timeout depending on pending work */
 	ns = select (maxfd+1, &rfd, NULL, NULL, tvp);
 	if (ns < 0) {
-	    perror ("select");
+	    if (errno != EINTR)
+		perror ("select");
             return;
 	}
-	
-	/* dispatch */
-	checkTimer();
+
+	/* dispatch, skipping callbacks added since the wait */
+	checkTimers();
+	for (i = 0, n = ncback; i < n; i++)
+	    if (cback[i].in_use && cback[i].gen <= gen
+	    				&& FD_ISSET (cback[i].fd, &rfd))
+		runCallback (i, cback[i].gen);
+#endif
+
 	if (ns == 0)
 	    runWorkProc();
-	else
-	    callCallback(&rfd);
 }
 
 /* timer callback used to implement deferLoop().
@@ -441,6 +505,159 @@ deferTO (void *p)
 	*(int*)p = 1;
 }
 
+/* return ms on a clock that only goes forward, to sub-ms resolution */
+static double
+nowMS()
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+	    return (ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0);
+#endif
+	{
+	    struct timeval tv;
+
+	    gettimeofday (&tv, NULL);
+	    return (tv.tv_sec*1000.0 + tv.tv_usec/1000.0);
+	}
+}
+
+/* return whether timer a fires before timer b */
+static int
+tfBefore (TF *a, TF *b)
+{
+	return (a->tgo < b->tgo || (a->tgo == b->tgo && a->tid < b->tid));
+}
+
+/* move timef[i] up the heap to its place */
+static void
+tfUp (int i)
+{
+	TF tf = timef[i];
+
+	while (i > 0) {
+	    int up = (i-1)/2;
+	    if (!tfBefore (&tf, &timef[up]))
+		break;
+	    timef[i] = timef[up];
+	    i = up;
+	}
+	timef[i] = tf;
+}
+
+/* move timef[i] down the heap to its place */
+static void
+tfDown (int i)
+{
+	TF tf = timef[i];
+
+	while (2*i+1 < ntimef) {
+	    int down = 2*i+1;
+	    if (down+1 < ntimef && tfBefore (&timef[down+1], &timef[down]))
+		down++;
+	    if (!tfBefore (&timef[down], &tf))
+		break;
+	    timef[i] = timef[down];
+	    i = down;
+	}
+	timef[i] = tf;
+}
+
+/* remove timef[i] from the heap, filling its place with the last entry */
+static void
+tfRemove (int i)
+{
+	if (i != --ntimef) {
+	    timef[i] = timef[ntimef];
+	    tfUp (i);
+	    tfDown (i);
+	}
+}
+
+/* start watching fd for callback cid, whose gen is set.
+ * return the fd given to epoll, a dup of fd if another callback already has
+ *   it, NOPOLL if fd is always ready, or -1 if trouble.
+ * just make sure there is an epoll instance if fd < 0.
+ * nothing to do for select() but check fd fits in an fd_set.
+ */
+static int
+pollFD (int fd, int cid)
+{
+#ifdef USE_EPOLL
+	struct epoll_event ev;
+	int pfd;
+
+	if (epfd < 0) {
+	    epfd = epoll_create1 (EPOLL_CLOEXEC);
+	    if (epfd < 0) {
+		perror ("epoll_create1");
+		return (-1);
+	    }
+	}
+	if (fd < 0)
+	    return (epfd);
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = ((uint64_t)cback[cid].gen << 32) | (uint32_t)cid;
+	if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+	    return (fd);
+
+	switch (errno) {
+	case EEXIST:
+	    /* epoll watches an fd once, but a dup of it may be watched too */
+	    pfd = dup (fd);
+	    if (pfd >= 0 && epoll_ctl (epfd, EPOLL_CTL_ADD, pfd, &ev) == 0)
+		return (pfd);
+	    if (pfd >= 0)
+		close (pfd);
+	    break;
+	case EPERM:
+	    /* regular files can not be watched, but are always ready */
+	    nready++;
+	    return (NOPOLL);
+	}
+
+	fprintf (stderr, "epoll_ctl(%d): %s\n", fd, strerror(errno));
+	return (-1);
+#else
+	(void) cid;
+	if (fd >= FD_SETSIZE) {
+	    fprintf (stderr, "select: fd %d too large\n", fd);
+	    return (-1);
+	}
+	return (fd);
+#endif
+}
+
+/* stop watching the fd of the just removed callback cp.
+ * the fd may already be closed and its number reused by another callback,
+ *   whose watch is then left alone.
+ */
+static void
+unpollFD (CB *cp)
+{
+#ifdef USE_EPOLL
+	struct epoll_event ev;
+	CB *op;
+
+	if (cp->pfd == NOPOLL) {
+	    nready--;
+	    return;
+	}
+	for (op = cback; op < &cback[ncback]; op++)
+	    if (op->in_use && op->pfd == cp->pfd)
+		return;
+
+	(void) epoll_ctl (epfd, EPOLL_CTL_DEL, cp->pfd, &ev);
+	if (cp->pfd != cp->fd)
+	    close (cp->pfd);
+#else
+	(void) cp;
+#endif
+}
+
 #if defined(MAIN_TEST)
 /* make a small stand-alone test program.
  */
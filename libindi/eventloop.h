@@ -57,7 +57,7 @@ extern void eventLoop(void);
 * \param fd file descriptor.
 * \param fp a pointer to the callback function.
 * \param ud a pointer to be passed to the callback function when called.
-* \return a unique callback id for use with rmCallback().
+* \return a unique callback id for use with rmCallback(), or -1 if \e fd can not be watched.
 */
 extern int addCallback (int fd, CBF *fp, void *ud);
 
@@ -81,7 +81,7 @@ extern int addWorkProc (WPF *fp, void *ud);
 */
 extern void rmWorkProc (int wid);
 
-/** Register a new timer function, \e fp, to be called with \e ud as argument after \e ms. Add to list in order of decreasing time from epoch, ie, last entry runs soonest. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
+/** Register a new timer function, \e fp, to be called with \e ud as argument after \e ms, timed on a monotonic clock so it does not move with changes to the time of day. Timers due at the same moment run in the order they were added. The timer will only invoke the callback function \b once. You need to call addTimer again if you want to repeat the process.
 *
 * \param ms timer period in milliseconds.
 * \param fp a pointer to the callback function.
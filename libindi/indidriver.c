@@ -772,10 +772,18 @@ IUSnoopBLOB (XMLEle *root, IBLOBVectorProperty *bvp)
 		    if (!strcmp (bp->name, name)) {
 			strcpy (bp->format, findXMLAttValu (ep,"format"));
 			bp->size = atof (findXMLAttValu (ep,"size"));
-			bp->bloblen = pcdatalenXMLEle(ep)+1;
 			if (bp->blob)
 			    free (bp->blob);
-			bp->blob = strcpy(malloc(bp->bloblen),pcdataXMLEle(ep));
+			if (!strcmp (findXMLAttValu (ep,"encoding"), "binary")) {
+			    /* snooped blobs are always handed over in base64 */
+			    int l = pcdatalenXMLEle(ep);
+			    bp->blob = malloc (4*l/3+4);
+			    bp->bloblen = to64frombits (bp->blob,
+				    (unsigned char *)pcdataXMLEle(ep), l) + 1;
+			} else {
+			    bp->bloblen = pcdatalenXMLEle(ep)+1;
+			    bp->blob = strcpy(malloc(bp->bloblen),pcdataXMLEle(ep));
+			}
 			break;
 		    }
 		}
@@ -786,6 +794,19 @@ IUSnoopBLOB (XMLEle *root, IBLOBVectorProperty *bvp)
 	return (0);
 }
 
+/* readXMLBuf() callback to dispatch and delete one complete element */
+static int
+dispatchEle (XMLEle *root, void *arg)
+{
+	char msg[1024];
+
+	(void) arg;
+	if (dispatch (root, msg) < 0)
+	    fprintf (stderr, "%s dispatch error: %s\n", me, msg);
+	delXMLEle (root);
+	return (0);
+}
+
 /* callback when INDI client message arrives on stdin.
  * collect and dispatch when see outter element closure.
  * exit if OS trouble or see incompatable INDI version.
@@ -794,7 +815,7 @@ IUSnoopBLOB (XMLEle *root, IBLOBVectorProperty *bvp)
 void
 clientMsgCB (int fd, void *arg)
 {
-	char buf[1024], msg[1024], *bp;
+	char buf[32768], msg[1024], *bp;
 	int nr;
 	arg=arg;
 
@@ -809,15 +830,13 @@ clientMsgCB (int fd, void *arg)
 	    exit(1);
 	}
 
-	/* crack and dispatch when complete */
-	for (bp = buf; nr-- > 0; bp++) {
-	    XMLEle *root = readXMLEle (clixml, *bp, msg);
-	    if (root) {
-		if (dispatch (root, msg) < 0)
-		    fprintf (stderr, "%s dispatch error: %s\n", me, msg);
-		delXMLEle (root);
-	    } else if (msg[0])
+	/* crack and dispatch when complete, carry on past errors */
+	for (bp = buf; nr > 0; ) {
+	    int n = readXMLBuf (clixml, bp, nr, dispatchEle, NULL, msg);
+	    if (msg[0])
 		fprintf (stderr, "%s XML error: %s\n", me, msg);
+	    bp += n;
+	    nr -= n;
 	}
 
 }
@@ -1067,8 +1086,14 @@ dispatch (XMLEle *root, char msg[])
                             sizes = (int *) realloc(sizes,newsz);
                             blobsizes = (int *) realloc(blobsizes,newsz);
                         }
-                        blobs[n] = malloc (3*pcdatalenXMLEle(ep)/4);
-                        blobsizes[n] = from64tobits(blobs[n], pcdataXMLEle(ep));
+                        if (!strcmp (findXMLAttValu (ep, "encoding"), "binary")) {
+                            blobsizes[n] = pcdatalenXMLEle(ep);
+                            blobs[n] = malloc (blobsizes[n]+1);
+                            memcpy (blobs[n], pcdataXMLEle(ep), blobsizes[n]);
+                        } else {
+                            blobs[n] = malloc (3*pcdatalenXMLEle(ep)/4);
+                            blobsizes[n] = from64tobits(blobs[n], pcdataXMLEle(ep));
+                        }
                         names[n] = valuXMLAtt(na);
                         formats[n] = valuXMLAtt(fa);
                         sizes[n] = atoi(valuXMLAtt(sa));
@@ -1402,17 +1427,16 @@ void IUSaveConfigBLOB (FILE *fp, const IBLOBVectorProperty *bvp)
     {
         IBLOB *bp = &bvp->bp[i];
         unsigned char *encblob;
-        int j, l;
+        int l;
 
         fprintf (fp, "  <oneBLOB\n");
         fprintf (fp, "    name='%s'\n", bp->name);
         fprintf (fp, "    size='%d'\n", bp->size);
         fprintf (fp, "    format='%s'>\n", bp->format);
 
-        encblob = malloc (4*bp->bloblen/3+4);
-        l = to64frombits(encblob, bp->blob, bp->bloblen);
-        for (j = 0; j < l; j += 72)
-            fprintf (fp, "%.72s\n", encblob+j);
+        encblob = malloc (4*bp->bloblen/3 + 4 + bp->bloblen/54 + 2);
+        l = to64lines(encblob, bp->blob, bp->bloblen, 72);
+        fwrite (encblob, 1, l, fp);
         free (encblob);
 
         fprintf (fp, "  </oneBLOB>\n");
@@ -1864,12 +1888,81 @@ IDSetLight (const ILightVectorProperty *lvp, const char *fmt, ...)
         pthread_mutex_unlock(&stdout_mutex);
 }
 
+/* return 1 if our indiserver accepts BLOBs in binary, else 0 */
+static int
+binaryBLOBs (void)
+{
+        static int binary = -1;
+
+        if (binary < 0) {
+            const char *e = getenv ("INDIBINARYBLOB");
+            binary = e && atoi(e) > 0;
+        }
+        return (binary);
+}
+
+/* return len bytes at blob malloced as base64 in lines of 72 digits, with
+ * its length in *enclen, or NULL if out of memory.
+ */
+static unsigned char *
+encodeBLOB64 (const unsigned char *blob, int len, int *enclen)
+{
+        unsigned char *enc = malloc (4*len/3 + 4 + len/54 + 2);
+
+        if (enc)
+            *enclen = to64lines (enc, blob, len, 72);
+        return (enc);
+}
+
+/* write len bytes at buf straight to the stdout fd, after anything stdio has.
+ * N.B. caller must hold stdout_mutex.
+ */
+static void
+writeStdout (const void *buf, int len)
+{
+        int fd = fileno(stdout);
+        int n, nw;
+
+        fflush (stdout);
+        for (n = 0; n < len; n += nw) {
+            nw = write (fd, (const char *)buf + n, len - n);
+            if (nw < 0) {
+                if (errno == EINTR) {
+                    nw = 0;
+                    continue;
+                }
+                fprintf (stderr, "BLOB write: %s\n", strerror(errno));
+                return;
+            }
+        }
+}
+
 /* tell client to update an existing BLOB vector property */
 void
 IDSetBLOB (const IBLOBVectorProperty *bvp, const char *fmt, ...)
 {
+        unsigned char **enc = NULL;
+        int *enclen = NULL;
+        int binary = binaryBLOBs();
         int i;
 
+        /* encode before taking the lock, others may write meanwhile */
+        if (!binary) {
+            enc = (unsigned char **) calloc (bvp->nbp, sizeof(unsigned char *));
+            enclen = (int *) calloc (bvp->nbp, sizeof(int));
+            for (i = 0; enc && enclen && i < bvp->nbp; i++)
+                if (!(enc[i] = encodeBLOB64 (bvp->bp[i].blob, bvp->bp[i].bloblen, &enclen[i])))
+                    break;
+            if (!enc || !enclen || i < bvp->nbp) {
+                fprintf (stderr, "%s.%s: no memory to encode BLOB\n", bvp->device, bvp->name);
+                for (i = 0; enc && i < bvp->nbp; i++)
+                    free (enc[i]);
+                free (enc);
+                free (enclen);
+                return;
+            }
+        }
+
         pthread_mutex_lock(&stdout_mutex);
 
         xmlv1();
@@ -1892,19 +1985,22 @@ IDSetBLOB (const IBLOBVectorProperty *bvp, const char *fmt, ...)
 
         for (i = 0; i < bvp->nbp; i++) {
             IBLOB *bp = &bvp->bp[i];
-            unsigned char *encblob;
-            int j, l;
 
             printf ("  <oneBLOB\n");
             printf ("    name='%s'\n", bp->name);
             printf ("    size='%d'\n", bp->size);
-            printf ("    format='%s'>\n", bp->format);
 
-            encblob = malloc (4*bp->bloblen/3+4);
-            l = to64frombits(encblob, bp->blob, bp->bloblen);
-            for (j = 0; j < l; j += 72)
-                printf ("%.72s\n", encblob+j);
-            free (encblob);
+            /* indiserver tells us when it takes raw bytes, saves encoding */
+            if (binary) {
+                printf ("    format='%s'\n", bp->format);
+                printf ("    enclen='%d'\n", bp->bloblen);
+                printf ("    encoding='binary'>");
+                writeStdout (bp->blob, bp->bloblen);
+                printf ("\n");
+            } else {
+                printf ("    format='%s'>\n", bp->format);
+                writeStdout (enc[i], enclen[i]);
+            }
 
             printf ("  </oneBLOB>\n");
         }
@@ -1914,6 +2010,11 @@ IDSetBLOB (const IBLOBVectorProperty *bvp, const char *fmt, ...)
   fflush (stdout);
 
   pthread_mutex_unlock(&stdout_mutex);
+
+  for (i = 0; enc && i < bvp->nbp; i++)
+      free (enc[i]);
+  free (enc);
+  free (enclen);
 }
 
 /* tell client to update min/max elements of an existing number vector property */
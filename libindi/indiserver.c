@@ -38,7 +38,21 @@
  * one client or device, they are queued and only removed after the last
  * consumer is finished. XMLEle are converted to linear strings before being
  * sent to optimize write system calls and avoid blocking to slow clients.
- * Clients that get more than maxqsiz bytes behind are shut down.
+ * setBLOBVector from drivers are never parsed beyond their opening tag, their
+ * raw text is copied once from the read buffer and routed as is.
+ * Each client has a second queue just for setBLOBVector, written only when its
+ * other queue is empty so other messages never wait behind more than the one
+ * BLOB already being sent.
+ * Clients that get more than maxqsiz bytes behind are shut down, unless they
+ * asked with enableBLOB keep='n' (or -b n) to instead only have the newest n
+ * queued BLOBs of each property kept, in which case BLOBs do not count.
+ * With -t each client and driver is read and parsed by its own thread, which
+ * hands complete elements to the main thread through a lock-free queue. The
+ * main thread still does all routing and writing, so none of the tables above
+ * are shared, and a driver busy sending a large BLOB never holds up parsing
+ * of the others.
+ *
+ * #define FRAMER_TEST for a stand-alone test of driver input framing.
  */
 
 #include "config.h"
@@ -49,6 +63,7 @@
 #include <signal.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <time.h>
 #include <fcntl.h>
@@ -56,11 +71,19 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <pthread.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define USE_EPOLL			/* else fall back to select() */
+#endif
 
 #include "lilxml.h"
+#include "base64.h"
 #include "indiapi.h"
 #include "fq.h"
 
@@ -68,9 +91,13 @@
 #define	REMOTEDVR       (-1234)	/* invalid PID to flag remote drivers */
 #define MAXSBUF         512
 #define	MAXRBUF         4096	/* max read buffering here */
-#define	MAXWSIZ         4096	/* max bytes/write */
+#define	MAXWSIZ         4096	/* local buf size of each Msg */
+#define	DEFWBUDGET      64		/* default max KB/write to one peer */
+#define	MAXIOV          64		/* max Msgs gathered in one write */
 #define	DEFMAXQSIZ      64		/* default max q behind, MB */
 #define DEFMAXRESTART   10      /* default max restarts */
+#define MAXEVENTS       64      /* max fds serviced per epoll_wait() */
+#define MAXRDMSGS       64      /* max elements taken from one reader thread at a time */
 
 #ifdef OSX_EMBEDED_MODE
 #define LOGNAME "/Users/%s/Library/Logs/indiserver.log"
@@ -83,9 +110,62 @@ typedef struct {
     int count;				/* number of consumers left */
     unsigned long cl;			/* content length */
     char *cp;				/* content: buf or malloced */
+    int binary;				/* 1 if BLOBs in content are binary */
+    void *alt;				/* Msg with BLOBs in other encoding */
+    struct _SubKey *bkey;		/* device and property of a BLOB */
     char buf[MAXWSIZ];		/* local buf for most messages */
 } Msg;
 
+/* raw framing state of driver input, see frameBLOB() */
+typedef enum {
+    BF_XML=0,				/* feeding lilxml one char at a time */
+    BF_PREFIX,				/* saw '<' between elements, matching tag */
+    BF_HEAD,				/* copying opening tag of a setBLOBVector */
+    BF_BODY				/* copying body, looking for closing tag */
+} BLOBFraming;
+
+/* parsing state of driver input */
+typedef struct {
+    LilXML *lp;				/* XML parsing context */
+    int attop;				/* 1 when lp is between elements */
+    BLOBFraming bf;			/* raw BLOB framing state */
+    int nbf;				/* n chars of blobtag matched */
+    int bquote;				/* open quote char in BLOB opening tag */
+    Msg *bmp;				/* raw BLOB being framed, if any */
+    unsigned long bmsz;			/* malloced bytes at bmp->cp */
+    int bhl;				/* length of bmp opening tag */
+    unsigned long bscan;		/* bmp->cp offset to look for end tag */
+} Framer;
+
+/* one element, or the end of input, passed from a reader thread */
+typedef struct _RdMsg {
+    struct _RdMsg *next;		/* next newer in Reader queue */
+    XMLEle *root;			/* complete element, NULL at end */
+    Msg *rmp;				/* raw text of root, see frameBLOB() */
+    int errnum;				/* errno if read failed at end */
+    char *xerr;				/* malloced XML error at end, if any */
+    char *raw;				/* malloced input that caused xerr */
+    int nraw;				/* bytes in raw */
+} RdMsg;
+
+/* thread reading and parsing one client or driver, see -t.
+ * the queue always holds one consumed RdMsg at head so the thread only ever
+ * touches tail and the main thread only head.
+ */
+typedef struct {
+    pthread_t tid;			/* reading thread */
+    int fd;				/* fd it reads */
+    int isdvr;				/* 1 to frame BLOBs as for a driver */
+    int stop[2];			/* pipe to tell thread to quit */
+    Framer fr;				/* parsing state, thread's own */
+    RdMsg *head;			/* consumed, next is the oldest */
+    RdMsg *tail;			/* newest */
+} Reader;
+
+/* tags of the only element framed without parsing */
+static const char blobtag[] = "<setBLOBVector";
+static const char blobetag[] = "</setBLOBVector";
+
 /* BLOB handling, NEVER is the default */
 typedef enum {B_NEVER=0, B_ALSO, B_ONLY} BLOBHandling;
 
@@ -97,6 +177,27 @@ typedef struct {
 } Property;
 
 
+/* one party interested in a device property, see SubKey */
+typedef struct {
+    int who;				/* index into clinfo[] or dvrinfo[] */
+    int pi;				/* index into its props[] or sprops[] */
+} Sub;
+
+/* interned device + property name with everyone interested in it, so
+ * routing is one hash lookup. name is empty for all of the device.
+ */
+typedef struct _SubKey {
+    char *dev, *name;			/* malloced */
+    Sub *csubs;				/* malloced clients */
+    int ncsubs;				/* n entries in csubs[] */
+    Sub *dsubs;				/* malloced snooping drivers */
+    int ndsubs;				/* n entries in dsubs[] */
+    struct _SubKey *next;		/* hash chain */
+} SubKey;
+#define NSUBHASH        1024            /* SubKey hash buckets, power of 2 */
+static SubKey *subhash[NSUBHASH];
+static unsigned routegen;		/* bumped for each message routed */
+
 /* record of each snooped property
 typedef struct {
     Property prop;
@@ -118,10 +219,20 @@ typedef struct {
     int nprops;				/* n entries in props[] */
     int allprops;			/* saw getProperties w/o device */
     BLOBHandling blob;			/* when to send setBLOBs */
+    int binblob;			/* 1 if accepts binary BLOBs */
     int s;				/* socket for this client */
     LilXML *lp;				/* XML parsing context */
+    Reader *rd;				/* reader thread, if -t */
     FQ *msgq;				/* Msg queue */
     unsigned int nsent;				/* bytes of current Msg sent so far */
+    FQ *blobq;				/* setBLOBVector Msg queue, after msgq */
+    unsigned int bsent;			/* bytes of current blobq Msg sent */
+    unsigned long qbytes;		/* bytes of all Msgs in msgq and blobq */
+    unsigned long bbytes;		/* bytes of all Msgs in blobq */
+    int bkeep;				/* n newest BLOBs per property kept, or 0 */
+    unsigned long ndropped;		/* BLOBs dropped for being stale */
+    int wwatch;				/* 1 when event loop waits to write */
+    unsigned mark;			/* routegen when last routed to */
 } ClInfo;
 static ClInfo *clinfo;			/*  malloced pool of clients */
 static int nclinfo;			/* n total (not active) */
@@ -139,14 +250,19 @@ typedef struct {
     int active;				/* 1 when this record is in use */
     Property *sprops;			/* malloced array of props we snoop */
     int nsprops;			/* n entries in sprops[] */
+    int binblob;			/* 1 if accepts binary BLOBs */
     int pid;				/* process id or REMOTEDVR if remote */
     int rfd;				/* read pipe fd */
     int wfd;				/* write pipe fd */
     int efd;				/* stderr from driver, if local */
     int restarts;			/* times process has been restarted */
-    LilXML *lp;				/* XML parsing context */
+    Framer fr;				/* input parsing state */
+    Reader *rd;				/* reader thread, if -t */
     FQ *msgq;				/* Msg queue */
     unsigned int nsent;			/* bytes of current Msg sent so far */
+    unsigned long qbytes;		/* bytes of all Msgs in msgq */
+    int wwatch;				/* 1 when event loop waits to write */
+    unsigned mark;			/* routegen when last routed to */
 } DvrInfo;
 static DvrInfo *dvrinfo;		/* malloced array of drivers */
 static int ndvrinfo;			/* n total */
@@ -157,8 +273,20 @@ static int verbose;			/* chattiness */
 static int lsocket;			/* listen socket */
 static char *ldir;			/* where to log driver messages */
 static int maxqsiz = (DEFMAXQSIZ*1024*1024); /* kill if these bytes behind */
+static int bkeep;			/* default ClInfo.bkeep */
+static int wbudget = (DEFWBUDGET*1024);	/* max bytes per write to one peer */
 static int maxrestarts = DEFMAXRESTART;
 static int terminateddrv = 0;
+static int threaded;			/* 1 to read each peer on its own thread */
+static int wakefd[2] = {-1, -1};	/* pipe from reader threads to main */
+static int wakeup;			/* 1 while a byte is in wakefd */
+#ifdef USE_EPOLL
+static int epfd = -1;			/* epoll instance for all our fds */
+#endif
+
+/* what an fd is to the event loop, kept with its index in epoll data */
+typedef enum {EV_FIFO, EV_LISTEN, EV_CLIENT, EV_DVRR, EV_DVRW, EV_DVRE,
+    EV_WAKE} EVKind;
 
 static void logStartup(int ac, char *av[]);
 static void usage (void);
@@ -166,12 +294,20 @@ static void noZombies (void);
 static void noSIGPIPE (void);
 static void indiFIFO(void);
 static void indiRun (void);
+static void evInit (void);
+static void evAdd (int fd, EVKind kind, int idx, int wr);
+static void evDel (int fd);
+static void evAddDvr (DvrInfo *dp);
+static void evClWrite (ClInfo *cp);
+static void evDvrWrite (DvrInfo *dp);
 static void indiListen (void);
 static void newFIFO(void);
 static void newClient (void);
 static int newClSocket (void);
 static void shutdownClient (ClInfo *cp);
 static int readFromClient (ClInfo *cp);
+static int routeClientMsg (ClInfo *cp, XMLEle *root);
+static int takeXMLEle (XMLEle *root, void *arg);
 static void startDvr (DvrInfo *dp);
 static void startLocalDvr (DvrInfo *dp);
 static void startRemoteDvr (DvrInfo *dp);
@@ -188,15 +324,56 @@ static void addSDevice (DvrInfo *dp, const char *dev, const char *name);
 static Property *findSDevice (DvrInfo *dp, const char *dev, const char *name);
 static void addClDevice (ClInfo *cp, const char *dev, const char *name, int isblob);
 static int findClDevice (ClInfo *cp, const char *dev, const char *name);
+static int q2Client (ClInfo *cp, int isblob, BLOBHandling bh, Msg *mp,
+    XMLEle *root);
+static SubKey *findSubKey (const char *dev, const char *name, int create);
+static void addSub (Sub **subsp, int *nsubsp, int who, int pi);
+static void rmSub (Sub *subs, int *nsubsp, int who);
 static int readFromDriver (DvrInfo *dp);
+static int routeDriverMsg (DvrInfo *dp, XMLEle *root, Msg *rmp);
+static void initFramer (Framer *fp);
+static void freeFramer (Framer *fp);
+static XMLEle *nextDvrEle (Framer *fp, const char *buf, int nbuf, int *ip,
+    Msg **rmpp, char err[]);
+static int frameBLOB (Framer *fp, const char *buf, int nbuf, Msg **mpp,
+    char err[]);
+static void appendMsg (Msg *mp, unsigned long *szp, const char *s,
+    unsigned long n);
+static XMLEle *crackBLOBHead (const char *head, int hl, char err[]);
+static long rawBLOBLength (const char *tag, unsigned long n, int *binp);
+static int isBinaryBLOB (XMLEle *root);
+static Msg *blobMsg (Msg *mp, int binary);
+static Msg *convertBLOBMsg (Msg *mp, int binary);
+static void dropAltMsg (Msg *mp);
 static int stderrFromDriver (DvrInfo *dp);
-static int msgQSize (FQ *q);
+static void pushClMsg (ClInfo *cp, int isblob, Msg *mp, XMLEle *root);
+static int nClMsgs (ClInfo *cp);
+static unsigned long clBehind (ClInfo *cp);
+static void dropBLOBs (ClInfo *cp, struct _SubKey *kp);
+static void pushDvrMsg (DvrInfo *dp, Msg *mp, XMLEle *root);
+static void logQStats (void);
+static void initThreads (void);
+static Reader *startReader (int fd, int isdvr);
+static void stopReader (Reader *rp);
+static void *readerThread (void *arg);
+static void pushRdMsg (Reader *rp, XMLEle *root, Msg *rmp, int errnum,
+    const char *xerr, const char *raw, int nraw);
+static int popRdMsg (Reader *rp, RdMsg *rm);
+static void wakeMain (void);
+static int readThreads (void);
+static int rdClientMsg (ClInfo *cp, RdMsg *rm);
+static int rdDriverMsg (DvrInfo *dp, RdMsg *rm);
 static void setMsgXMLEle (Msg *mp, XMLEle *root);
 static void setMsgStr (Msg *mp, char *str);
 static void freeMsg (Msg *mp);
 static Msg *newMsg (void);
 static int sendClientMsg (ClInfo *cp);
 static int sendDriverMsg (DvrInfo *cp);
+static int gatherMsgs (FQ *q, unsigned int nsent, struct iovec iov[],
+    int maxiov);
+static ssize_t writeMsgs (int fd, int issock, struct iovec iov[], int niov);
+static unsigned int sentMsgs (FQ *q, unsigned int nsent, ssize_t nw,
+    unsigned long *bbytesp, unsigned long *qbytesp, const char *who);
 static void crackBLOB (const char *enableBLOB, BLOBHandling *bp);
 static void crackBLOBHandling(const char *dev, const char *name, const char *enableBLOB, ClInfo *cp);
 static void traceMsg (XMLEle *root);
@@ -204,6 +381,7 @@ static char *indi_tstamp (char *s);
 static void logDMsg (XMLEle *root, const char *dev);
 static void Bye(void);
 
+#if !defined(FRAMER_TEST)
 int
 main (int ac, char *av[])
 {
@@ -233,6 +411,16 @@ main (int ac, char *av[])
         char *s;
         for (s = av[0]+1; *s != '\0'; s++)
             switch (*s) {
+            case 'b':
+                if (ac < 2) {
+                    fprintf (stderr, "-b requires number of BLOBs\n");
+                    usage();
+                }
+                bkeep = atoi(*++av);
+                if (bkeep < 0)
+                    bkeep = 0;
+                ac--;
+                break;
             case 'l':
                 if (ac < 2) {
                     fprintf (stderr, "-l requires log directory\n");
@@ -257,6 +445,18 @@ main (int ac, char *av[])
                 port = atoi(*++av);
                 ac--;
                 break;
+            case 'w':
+                if (ac < 2) {
+                    fprintf (stderr, "-w requires max KB per write\n");
+                    usage();
+                }
+                wbudget = 1024*atoi(*++av);
+                if (wbudget <= 0) {
+                    fprintf (stderr, "-w must be at least 1 KB\n");
+                    usage();
+                }
+                ac--;
+                break;
             case 'f':
                 if (ac < 2) {
                     fprintf (stderr, "-f requires fifo node\n");
@@ -275,6 +475,9 @@ main (int ac, char *av[])
                     maxrestarts=0;
                 ac--;
                 break;
+            case 't':
+                threaded = 1;
+                break;
             case 'v':
                 verbose++;
                 break;
@@ -293,6 +496,11 @@ main (int ac, char *av[])
     noZombies();
     noSIGPIPE();
 
+    /* ready the event loop before any fds come along */
+    evInit();
+    if (threaded)
+        initThreads();
+
     /* realloc seed for client pool */
     clinfo = (ClInfo *) malloc (1);
     nclinfo = 0;
@@ -321,6 +529,7 @@ main (int ac, char *av[])
     fprintf (stderr, "unexpected return from main\n");
     return (1);
 }
+#endif /* !FRAMER_TEST */
 
 /* record we have started and our args */
 static void
@@ -342,11 +551,16 @@ usage(void)
     fprintf (stderr, "Purpose: server for local and remote INDI drivers\n");
     fprintf (stderr, "INDI Library: %s\nCode %s. Protocol %g.\n", CMAKE_INDI_VERSION_STRING, "$Rev$", INDIV);
     fprintf (stderr, "Options:\n");
+        fprintf (stderr, " -b n     : keep only the newest n queued BLOBs of each property for each client\n");
+        fprintf (stderr, "            instead of shutting it down when behind, default 0 is never drop\n");
         fprintf (stderr, " -l d     : log driver messages to <d>/YYYY-MM-DD.islog\n");
         fprintf (stderr, " -m m     : kill client if gets more than this many MB behind, default %d\n", DEFMAXQSIZ);
         fprintf (stderr, " -p p     : alternate IP port, default %d\n", INDIPORT);
         fprintf (stderr, " -r r     : maximum driver restarts on error, default %d\n", DEFMAXRESTART);
+        fprintf (stderr, " -t       : read and parse each client and driver on its own thread\n");
+        fprintf (stderr, " -w w     : max KB written to one client or driver at a time, default %d\n", DEFWBUDGET);
         fprintf (stderr, " -f path  : Path to fifo for dynamic startup and shutdown of drivers.\n");
+        fprintf (stderr, "            Writing 'stats' to it logs bytes queued per client and driver.\n");
         fprintf (stderr, " -v       : show key events, no traffic\n");
         fprintf (stderr, " -vv      : -v + key message content\n");
         fprintf (stderr, " -vvv     : -vv + complete xml\n");
@@ -419,6 +633,9 @@ startDvr (DvrInfo *dp)
         startRemoteDvr (dp);
     else
         startLocalDvr (dp);
+    if (threaded)
+        dp->rd = startReader (dp->rfd, 1);
+    evAddDvr (dp);
 }
 
 /* start the given local INDI driver process.
@@ -483,6 +700,8 @@ startLocalDvr (DvrInfo *dp)
           setenv("INDISKEL", dp->envSkel, 1);
         else if (fifo.fd > 0)
           unsetenv("INDISKEL");
+        /* we can take BLOBs from local drivers in binary */
+        setenv("INDIBINARYBLOB", "1", 1);
         char executable[MAXSBUF];
         if (*dp->envPrefix)
         {
@@ -517,16 +736,21 @@ startLocalDvr (DvrInfo *dp)
     close (rp[1]);
     close (ep[1]);
 
+    /* never block writing to a slow driver, see sendDriverMsg() */
+    fcntl (wp[1], F_SETFL, fcntl (wp[1], F_GETFL) | O_NONBLOCK);
+
     /* record pid, io channels, init lp and snoop list */
     dp->pid = pid;
     dp->rfd = rp[0];
     dp->wfd = wp[1];
     dp->efd = ep[0];
-    dp->lp = newLilXML();
+    initFramer (&dp->fr);
     dp->msgq = newFQ(1);
     dp->sprops = (Property*) malloc (1);	/* seed for realloc */
     dp->nsprops = 0;
     dp->nsent = 0;
+    dp->qbytes = 0;
+    dp->wwatch = 0;
     dp->active = 1;
     dp->ndev = 0;
     dp->dev = (char **) malloc(sizeof(char *));
@@ -535,10 +759,9 @@ startLocalDvr (DvrInfo *dp)
      * if restarting
      */
     mp = newMsg();
-    pushFQ (dp->msgq, mp);
     sprintf (buf, "<getProperties version='%g'/>\n", INDIV);
     setMsgStr (mp, buf);
-    mp->count++;
+    pushDvrMsg (dp, mp, NULL);
 
     if (verbose > 0)
         fprintf (stderr, "%s: Driver %s: pid=%d rfd=%d wfd=%d efd=%d\n",
@@ -571,11 +794,13 @@ startRemoteDvr (DvrInfo *dp)
     dp->pid = REMOTEDVR;
     dp->rfd = sockfd;
     dp->wfd = sockfd;
-    dp->lp = newLilXML();
+    initFramer (&dp->fr);
     dp->msgq = newFQ(1);
     dp->sprops = (Property*) malloc (1);	/* seed for realloc */
     dp->nsprops = 0;
     dp->nsent = 0;
+    dp->qbytes = 0;
+    dp->wwatch = 0;
     dp->active = 1;
     dp->ndev = 1;
     dp->dev = (char **) malloc(sizeof(char *));
@@ -591,11 +816,10 @@ startRemoteDvr (DvrInfo *dp)
      * outbound (and our inbound) traffic on this socket to this device.
      */
     mp = newMsg();
-    pushFQ (dp->msgq, mp);
     sprintf (buf, "<getProperties device='%s' version='%g'/>\n",
              dp->dev[0], INDIV);
     setMsgStr (mp, buf);
-    mp->count++;
+    pushDvrMsg (dp, mp, NULL);
 
     if (verbose > 0)
         fprintf (stderr, "%s: Driver %s: socket=%d\n", indi_tstamp(NULL),
@@ -683,6 +907,7 @@ indiListen ()
 
     /* ok */
     lsocket = sfd;
+    evAdd (lsocket, EV_LISTEN, 0, 0);
     if (verbose > 0)
         fprintf (stderr, "%s: listening to port %d on fd %d\n",
                             indi_tstamp(NULL), port, sfd);
@@ -691,6 +916,8 @@ indiListen ()
 /* Attempt to open up FIFO */
 static void indiFIFO(void)
 {
+    if (fifo.fd >= 0)
+        evDel(fifo.fd);
     close(fifo.fd);
     fifo.fd=-1;
 
@@ -704,10 +931,95 @@ static void indiFIFO(void)
            fprintf(stderr, "%s: open(%s): %s.\n", indi_tstamp(NULL), fifo.name, strerror(errno));
            Bye();
        }
+
+       evAdd(fifo.fd, EV_FIFO, 0, 0);
+    }
+
+}
+
+#ifdef USE_EPOLL
+
+/* service traffic from clients and drivers.
+ * only the fds epoll reports ready are visited, each tagged with what it is
+ * and the index of its clinfo[] or dvrinfo[] entry.
+ */
+static void
+indiRun(void)
+{
+    struct epoll_event ev[MAXEVENTS];
+    int i, n;
+
+    /* wait for action */
+    n = epoll_wait (epfd, ev, MAXEVENTS, -1);
+    if (n < 0) {
+        if (errno == EINTR)
+            return;
+        fprintf (stderr, "%s: epoll_wait: %s\n", indi_tstamp(NULL),
+                                strerror(errno));
+        Bye();
     }
 
+    for (i = 0; i < n; i++) {
+        EVKind kind = (EVKind) (ev[i].data.u64 >> 32);
+        int idx = (int) (ev[i].data.u64 & 0xffffffff);
+        int rd = ev[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR);
+        int wr = ev[i].events & EPOLLOUT;
+        ClInfo *cp;
+        DvrInfo *dp;
+
+        switch (kind) {
+        case EV_FIFO:
+            /* new command from FIFO, may start or stop drivers */
+            newFIFO();
+            return;
+
+        case EV_LISTEN:
+            newClient();
+            break;
+
+        case EV_CLIENT:
+            cp = &clinfo[idx];
+            if (!cp->active)
+                break;
+            if (rd && !cp->rd && readFromClient(cp) < 0)
+                return;	/* fds effected */
+            if (wr && nClMsgs(cp) > 0 && sendClientMsg(cp) < 0)
+                return;	/* fds effected */
+            break;
+
+        case EV_DVRR:
+            /* remote drivers read and write on this one socket */
+            dp = &dvrinfo[idx];
+            if (!dp->active)
+                break;
+            if (rd && readFromDriver(dp) < 0)
+                return;	/* fds effected */
+            if (wr && nFQ(dp->msgq) > 0 && sendDriverMsg(dp) < 0)
+                return;	/* fds effected */
+            break;
+
+        case EV_DVRW:
+            dp = &dvrinfo[idx];
+            if (dp->active && nFQ(dp->msgq) > 0 && sendDriverMsg(dp) < 0)
+                return;	/* fds effected */
+            break;
+
+        case EV_DVRE:
+            dp = &dvrinfo[idx];
+            if (dp->active && stderrFromDriver(dp) < 0)
+                return;	/* fds effected */
+            break;
+
+        case EV_WAKE:
+            if (readThreads() < 0)
+                return;	/* fds effected */
+            break;
+        }
+    }
 }
 
+#else
+
 /* service traffic from clients and drivers */
 static void
 indiRun(void)
@@ -731,12 +1043,20 @@ indiRun(void)
         if (lsocket > maxfd)
                 maxfd = lsocket;
 
+    /* and for reader threads */
+    if (threaded) {
+        FD_SET(wakefd[0], &rs);
+        if (wakefd[0] > maxfd)
+            maxfd = wakefd[0];
+    }
+
     /* add all client readers and client writers with work to send */
     for (i = 0; i < nclinfo; i++) {
         ClInfo *cp = &clinfo[i];
         if (cp->active) {
-        FD_SET(cp->s, &rs);
-        if (nFQ(cp->msgq) > 0)
+        if (!cp->rd)
+            FD_SET(cp->s, &rs);
+        if (nClMsgs(cp) > 0)
             FD_SET(cp->s, &ws);
         if (cp->s > maxfd)
             maxfd = cp->s;
@@ -749,7 +1069,8 @@ indiRun(void)
         DvrInfo *dp = &dvrinfo[i];
             if (dp->active)
             {
-                FD_SET(dp->rfd, &rs);
+                if (!dp->rd)
+                    FD_SET(dp->rfd, &rs);
                 if (dp->rfd > maxfd)
                    maxfd = dp->rfd;
                 if (dp->pid != REMOTEDVR)
@@ -789,6 +1110,13 @@ indiRun(void)
         s--;
     }
 
+    /* news from reader threads? */
+    if (s > 0 && threaded && FD_ISSET(wakefd[0], &rs)) {
+        if (readThreads() < 0)
+            return;	/* fds effected */
+        s--;
+    }
+
     /* message to/from client? */
     for (i = 0; s > 0 && i < nclinfo; i++) {
         ClInfo *cp = &clinfo[i];
@@ -827,6 +1155,145 @@ indiRun(void)
     }
 }
 
+#endif /* USE_EPOLL */
+
+/* create the epoll instance. nothing to do for select().
+ * exit if trouble.
+ */
+static void
+evInit (void)
+{
+#ifdef USE_EPOLL
+    epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        fprintf (stderr, "%s: epoll_create1: %s\n", indi_tstamp(NULL),
+                                strerror(errno));
+        Bye();
+    }
+#endif
+}
+
+/* start watching fd for reading, or for writing if wr.
+ * kind and idx are handed back to indiRun() when fd is ready.
+ * exit if trouble.
+ */
+static void
+evAdd (int fd, EVKind kind, int idx, int wr)
+{
+#ifdef USE_EPOLL
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof(ev));
+    ev.events = wr ? EPOLLOUT : EPOLLIN;
+    ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)idx;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        fprintf (stderr, "%s: epoll_ctl(%d): %s\n", indi_tstamp(NULL), fd,
+                                strerror(errno));
+        Bye();
+    }
+#endif
+}
+
+/* stop watching fd, before it is closed.
+ * N.B. closing is not always enough: forked drivers may still hold it.
+ */
+static void
+evDel (int fd)
+{
+#ifdef USE_EPOLL
+    struct epoll_event ev;
+
+    (void) epoll_ctl (epfd, EPOLL_CTL_DEL, fd, &ev);
+#endif
+}
+
+/* start watching the fds of the newly started driver dp */
+static void
+evAddDvr (DvrInfo *dp)
+{
+    if (!dp->rd)
+        evAdd (dp->rfd, EV_DVRR, dp - dvrinfo, 0);
+    if (dp->pid != REMOTEDVR)
+        evAdd (dp->efd, EV_DVRE, dp - dvrinfo, 0);
+    evDvrWrite (dp);
+}
+
+/* wait for cp to be writable iff it has messages queued.
+ * call whenever its queue may have changed between empty and not.
+ */
+static void
+evClWrite (ClInfo *cp)
+{
+#ifdef USE_EPOLL
+    struct epoll_event ev;
+    int want;
+
+    if (!cp->active)
+        return;
+    want = nClMsgs(cp) > 0;
+
+    if (want == cp->wwatch)
+        return;
+    cp->wwatch = want;
+
+    /* its reader thread does the reading, so only watch it to write */
+    if (cp->rd) {
+        if (want)
+            evAdd (cp->s, EV_CLIENT, cp - clinfo, 1);
+        else
+            evDel (cp->s);
+        return;
+    }
+
+    memset (&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.u64 = ((uint64_t)EV_CLIENT << 32) | (uint32_t)(cp - clinfo);
+    if (epoll_ctl (epfd, EPOLL_CTL_MOD, cp->s, &ev) < 0) {
+        fprintf (stderr, "%s: Client %d: epoll_ctl: %s\n", indi_tstamp(NULL),
+                                cp->s, strerror(errno));
+        Bye();
+    }
+#endif
+}
+
+/* same as evClWrite() for driver dp. remote drivers share one socket for
+ * reading and writing, local drivers have a pipe just for writing. with a
+ * reader thread we only ever watch for writing either way.
+ */
+static void
+evDvrWrite (DvrInfo *dp)
+{
+#ifdef USE_EPOLL
+    struct epoll_event ev;
+    int want;
+
+    if (!dp->active)
+        return;
+    want = nFQ(dp->msgq) > 0;
+
+    if (want == dp->wwatch)
+        return;
+    dp->wwatch = want;
+
+    if (dp->pid != REMOTEDVR || dp->rd) {
+        if (want)
+            evAdd (dp->wfd, EV_DVRW, dp - dvrinfo, 1);
+        else
+            evDel (dp->wfd);
+        return;
+    }
+
+    memset (&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.u64 = ((uint64_t)EV_DVRR << 32) | (uint32_t)(dp - dvrinfo);
+    if (epoll_ctl (epfd, EPOLL_CTL_MOD, dp->rfd, &ev) < 0) {
+        fprintf (stderr, "%s: Driver %s: epoll_ctl: %s\n", indi_tstamp(NULL),
+                                dp->name, strerror(errno));
+        Bye();
+    }
+#endif
+}
+
 int isDeviceInDriver(const char *dev, DvrInfo *dp)
 {
     int i=0;
@@ -948,6 +1415,13 @@ static void newFIFO(void)
          }
      }
 
+     /* report queue backlogs, nothing to start or stop */
+     if (!strcmp(cmd, "stats"))
+     {
+         logQStats();
+         continue;
+     }
+
      if (!strcmp(cmd, "start"))
          startCmd = 1;
      else
@@ -970,7 +1444,7 @@ static void newFIFO(void)
               startDvr (dp);
           }
           else
-              startRemoteDvr(dp);
+              startDvr(dp);
     }
     else
     {
@@ -998,9 +1472,7 @@ static void newFIFO(void)
                 Msg * mp = newMsg();
 
                 q2Clients(NULL, 0, dp->dev[i], NULL, mp, root);
-               if (mp->count > 0)
-                   setMsgXMLEle (mp, root);
-               else
+               if (mp->count == 0)
                    freeMsg (mp);
               delXMLEle (root);
             }
@@ -1045,8 +1517,15 @@ newClient()
     cp->s = s;
     cp->lp = newLilXML();
     cp->msgq = newFQ(1);
+    cp->blobq = newFQ(1);
     cp->props = malloc (1);
     cp->nsent = 0;
+    cp->bsent = 0;
+    cp->bkeep = bkeep;
+    if (threaded)
+        cp->rd = startReader (cp->s, 0);
+    else
+        evAdd (cp->s, EV_CLIENT, cli, 0);
 
     if (verbose > 0) {
         struct sockaddr_in addr;
@@ -1090,66 +1569,14 @@ readFromClient (ClInfo *cp)
     }
 
     /* process XML, sending when find closure */
-    for (i = 0; i < nr; i++) {
+    for (i = 0; i < nr; ) {
         char err[1024];
-        XMLEle *root = readXMLEle (cp->lp, buf[i], err);
-        if (root) {
-        char *roottag = tagXMLEle(root);
-        const char *dev = findXMLAttValu (root, "device");
-        const char *name = findXMLAttValu (root, "name");
-        int isblob = !strcmp (tagXMLEle(root), "setBLOBVector");
-        Msg *mp;
-
-        if (verbose > 2) {
-            fprintf (stderr, "%s: Client %d: read ",indi_tstamp(NULL),cp->s);
-            traceMsg (root);
-        } else if (verbose > 1) {
-            fprintf (stderr, "%s: Client %d: read <%s device='%s' name='%s'>\n",
-                    indi_tstamp(NULL), cp->s, tagXMLEle(root),
-                    findXMLAttValu (root, "device"),
-                    findXMLAttValu (root, "name"));
-        }
+        XMLEle *root = NULL;
 
-        /* snag interested properties.
-         * N.B. don't open to alldevs if seen specific dev already, else
-         *   remote client connections start returning too much.
-         */
-        if (dev[0])
-                    addClDevice (cp, dev, name, isblob);
-        else if (!strcmp (roottag, "getProperties") && !cp->nprops)
-            cp->allprops = 1;
-
-        /* snag enableBLOB -- send to remote drivers too */
-        if (!strcmp (roottag, "enableBLOB"))
-                   // crackBLOB (pcdataXMLEle(root), &cp->blob);
-                     crackBLOBHandling (dev, name, pcdataXMLEle(root), cp);
-
-        /* build a new message -- set content iff anyone cares */
-        mp = newMsg();
-
-        /* send message to driver(s) responsible for dev */
-        q2RDrivers (dev, mp, root);
-
-        /* JM 2016-05-18: Upstream client can be a chained INDI server. If any driver locally is snooping
-         * on any remote drivers, we should catch it and forward it to the responsible snooping driver. */
-        /* send to snooping drivers. */
-        // JM 2016-05-26: Only forward setXXX messages
-        if (!strncmp (roottag, "set", 3))
-            q2SDrivers (isblob, dev, name, mp, root);
-
-        /* echo new* commands back to other clients */
-        if (!strncmp (roottag, "new", 3)) {
-                    if (q2Clients (cp, isblob, dev, name, mp, root) < 0)
+        i += readXMLBuf (cp->lp, &buf[i], nr-i, takeXMLEle, &root, err);
+        if (root) {
+        if (routeClientMsg (cp, root) < 0)
             shutany++;
-        }
-
-        /* set message content if anyone cares else forget it */
-        if (mp->count > 0)
-            setMsgXMLEle (mp, root);
-        else
-            freeMsg (mp);
-        delXMLEle (root);
-
         } else if (err[0]) {
         char *ts = indi_tstamp(NULL);
         fprintf (stderr, "%s: Client %d: XML error: %s\n", ts,
@@ -1164,8 +1591,92 @@ readFromClient (ClInfo *cp)
     return (shutany ? -1 : 0);
 }
 
+/* readXMLBuf() callback to stop at each complete element, left in *arg */
+static int
+takeXMLEle (XMLEle *root, void *arg)
+{
+    *(XMLEle **)arg = root;
+    return (1);
+}
+
+/* send the complete element root from client cp to each interested party.
+ * root is deleted when done.
+ * return -1 if had to shut down anything, else 0.
+ */
+static int
+routeClientMsg (ClInfo *cp, XMLEle *root)
+{
+    char *roottag = tagXMLEle(root);
+    const char *dev = findXMLAttValu (root, "device");
+    const char *name = findXMLAttValu (root, "name");
+    int isblob = !strcmp (tagXMLEle(root), "setBLOBVector");
+    int shutany = 0;
+    Msg *mp;
+
+    if (verbose > 2) {
+        fprintf (stderr, "%s: Client %d: read ",indi_tstamp(NULL),cp->s);
+        traceMsg (root);
+    } else if (verbose > 1) {
+        fprintf (stderr, "%s: Client %d: read <%s device='%s' name='%s'>\n",
+                indi_tstamp(NULL), cp->s, tagXMLEle(root),
+                findXMLAttValu (root, "device"),
+                findXMLAttValu (root, "name"));
+    }
+
+    /* snag interested properties.
+     * N.B. don't open to alldevs if seen specific dev already, else
+     *   remote client connections start returning too much.
+     */
+    if (dev[0])
+                addClDevice (cp, dev, name, isblob);
+    else if (!strcmp (roottag, "getProperties") && !cp->nprops)
+        cp->allprops = 1;
+
+    /* snag enableBLOB -- send to remote drivers too */
+    if (!strcmp (roottag, "enableBLOB")) {
+               // crackBLOB (pcdataXMLEle(root), &cp->blob);
+                 crackBLOBHandling (dev, name, pcdataXMLEle(root), cp);
+        cp->binblob = !strcmp (findXMLAttValu (root, "encoding"), "binary");
+        if (findXMLAttValu (root, "keep")[0])
+            cp->bkeep = atoi (findXMLAttValu (root, "keep"));
+    }
+
+    /* build a new message -- content is set when first queued.
+     * BLOBs may be converted while queuing so they need it now.
+     */
+    mp = newMsg();
+    mp->binary = isBinaryBLOB (root);
+    if (isblob || mp->binary)
+        setMsgXMLEle (mp, root);
+
+    /* send message to driver(s) responsible for dev */
+    q2RDrivers (dev, mp, root);
+
+    /* JM 2016-05-18: Upstream client can be a chained INDI server. If any driver locally is snooping
+     * on any remote drivers, we should catch it and forward it to the responsible snooping driver. */
+    /* send to snooping drivers. */
+    // JM 2016-05-26: Only forward setXXX messages
+    if (!strncmp (roottag, "set", 3))
+        q2SDrivers (isblob, dev, name, mp, root);
+
+    /* echo new* commands back to other clients */
+    if (!strncmp (roottag, "new", 3)) {
+                if (q2Clients (cp, isblob, dev, name, mp, root) < 0)
+        shutany++;
+    }
+
+    /* forget message if no one cared */
+    dropAltMsg (mp);
+    if (mp->count == 0)
+        freeMsg (mp);
+    delXMLEle (root);
+
+    return (shutany ? -1 : 0);
+}
+
 /* read more from the given driver, send to each interested client when see
  * xml closure. if driver dies, try restarting.
+ * setBLOBVector elements are framed raw by frameBLOB() instead of being parsed.
  * return 0 if ok else -1 if had to shut down anything.
  */
 static int
@@ -1173,7 +1684,7 @@ readFromDriver (DvrInfo *dp)
 {
     char buf[MAXRBUF];
     int shutany = 0;
-    ssize_t i, nr;
+    int i, nr;
 
     /* read driver */
     nr = read (dp->rfd, buf, sizeof(buf));
@@ -1189,102 +1700,22 @@ readFromDriver (DvrInfo *dp)
     }
 
     /* process XML, sending when find closure */
-    for (i = 0; i < nr; i++)
+    for (i = 0; i < nr; )
     {
         char err[1024];
-        XMLEle *root = readXMLEle (dp->lp, buf[i], err);
-        if (root)
-        {
-        char *roottag = tagXMLEle(root);
-        const char *dev = findXMLAttValu (root, "device");
-        const char *name = findXMLAttValu (root, "name");
-        int isblob = !strcmp (tagXMLEle(root), "setBLOBVector");
-        Msg *mp;
+        Msg *rmp;
+        XMLEle *root = nextDvrEle (&dp->fr, buf, nr, &i, &rmp, err);
 
-        if (verbose > 2)
-        {
-            fprintf(stderr, "%s: Driver %s: read ", indi_tstamp(0),dp->name);
-            traceMsg (root);
-        } else if (verbose > 1) {
-            fprintf (stderr, "%s: Driver %s: read <%s device='%s' name='%s'>\n",
-                    indi_tstamp(NULL), dp->name, tagXMLEle(root),
-                    findXMLAttValu (root, "device"),
-                    findXMLAttValu (root, "name"));
-        }
-
-
-        /* that's all if driver is just registering a snoop */
-        /* JM 2016-05-18: Send getProperties to upstream chained servers as well.*/
-        if (!strcmp (roottag, "getProperties"))
-        {
-            addSDevice (dp, dev, name);
-            mp = newMsg();
-            /* send to interested chained servers upstream */
-            if (q2Servers(NULL, mp, root) < 0)
-                shutany++;
-            if (mp->count > 0)
-                setMsgXMLEle (mp, root);
-            else
-                freeMsg (mp);
-            delXMLEle (root);
-            continue;
-        }
-
-        /* that's all if driver is just registering a BLOB mode */
-        if (!strcmp (roottag, "enableBLOB"))
-        {
-                    Property *sp = findSDevice (dp, dev, name);
-            if (sp)
-            crackBLOB (pcdataXMLEle (root), &sp->blob);
-            delXMLEle (root);
-
-            continue;
-        }
-
-        /* Found a new device? Let's add it to driver info */
-        if (dev[0] && isDeviceInDriver(dev, dp) == 0)
+        if (root)
         {
-            dp->dev = (char **) realloc(dp->dev, (dp->ndev+1) * sizeof(char *));
-            dp->dev[dp->ndev] = (char *) malloc(MAXINDIDEVICE * sizeof(char));
-
-            strncpy (dp->dev[dp->ndev], dev, MAXINDIDEVICE-1);
-            dp->dev[dp->ndev][MAXINDIDEVICE-1] = '\0';
-
-#ifdef OSX_EMBEDED_MODE
-            if (!dp->ndev)
-              fprintf(stderr, "STARTED \"%s\"\n", dp->name); fflush(stderr);
-#endif
-
-            dp->ndev++;
-        }
-
-        /* log messages if any and wanted */
-        if (ldir)
-            logDMsg (root, dev);
-
-        /* build a new message -- set content iff anyone cares */
-        mp = newMsg();
-
-        /* send to interested clients */
-         if (q2Clients (NULL, isblob, dev, name, mp, root) < 0)
+        if (routeDriverMsg (dp, root, rmp) < 0)
             shutany++;
-
-        /* send to snooping drivers */
-        q2SDrivers (isblob, dev, name, mp, root);
-
-        /* set message content if anyone cares else forget it */
-        if (mp->count > 0)
-            setMsgXMLEle (mp, root);
-        else
-            freeMsg (mp);
-        delXMLEle (root);
-
         } else if (err[0]) {
         char *ts = indi_tstamp(NULL);
         fprintf (stderr, "%s: Driver %s: XML error: %s\n", ts,
                                 dp->name, err);
         fprintf (stderr, "%s: Driver %s: XML read: %.*s\n", ts,
-                                dp->name, (int)nr, buf);
+                                dp->name, nr, buf);
                 shutdownDvr (dp, 1);
         return (-1);
         }
@@ -1293,33 +1724,617 @@ readFromDriver (DvrInfo *dp)
     return (shutany ? -1 : 0);
 }
 
-/* read more from the given driver stderr, add prefix and send to our stderr.
- * return 0 if ok else -1 if had to restart.
+/* send the complete element root from driver dp to each interested party.
+ * if rmp is set it already holds the raw text of root and root only carries
+ * the attributes of its opening tag. root is deleted when done.
+ * return 0 if ok else -1 if had to shut down anything.
  */
 static int
-stderrFromDriver (DvrInfo *dp)
+routeDriverMsg (DvrInfo *dp, XMLEle *root, Msg *rmp)
 {
-    static char exbuf[MAXRBUF];
-    static int nexbuf;
-    ssize_t i, nr;
+    char *roottag = tagXMLEle(root);
+    const char *dev = findXMLAttValu (root, "device");
+    const char *name = findXMLAttValu (root, "name");
+    int isblob = !strcmp (tagXMLEle(root), "setBLOBVector");
+    int shutany = 0;
+    Msg *mp;
 
-    /* read more */
-    nr = read (dp->efd, exbuf+nexbuf, sizeof(exbuf)-nexbuf);
-    if (nr <= 0) {
-        if (nr < 0)
-        fprintf (stderr, "%s: Driver %s: stderr %s\n", indi_tstamp(NULL),
-                            dp->name, strerror(errno));
-        else
-        fprintf (stderr, "%s: Driver %s: stderr EOF\n",
-                            indi_tstamp(NULL), dp->name);
-            shutdownDvr (dp, 1);
-        return (-1);
+    if (verbose > 2)
+    {
+        fprintf(stderr, "%s: Driver %s: read ", indi_tstamp(0),dp->name);
+        traceMsg (root);
+    } else if (verbose > 1) {
+        fprintf (stderr, "%s: Driver %s: read <%s device='%s' name='%s'>\n",
+                indi_tstamp(NULL), dp->name, tagXMLEle(root),
+                findXMLAttValu (root, "device"),
+                findXMLAttValu (root, "name"));
     }
-    nexbuf += nr;
 
-    /* prefix each whole line to our stderr, save extra for next time */
-    for (i = 0; i < nexbuf; i++) {
-        if (exbuf[i] == '\n') {
+
+    /* that's all if driver is just registering a snoop */
+    /* JM 2016-05-18: Send getProperties to upstream chained servers as well.*/
+    if (!strcmp (roottag, "getProperties"))
+    {
+        addSDevice (dp, dev, name);
+        mp = newMsg();
+        /* send to interested chained servers upstream */
+        if (q2Servers(NULL, mp, root) < 0)
+            shutany++;
+        if (mp->count == 0)
+            freeMsg (mp);
+        delXMLEle (root);
+        return (shutany ? -1 : 0);
+    }
+
+    /* that's all if driver is just registering a BLOB mode */
+    if (!strcmp (roottag, "enableBLOB"))
+    {
+                Property *sp = findSDevice (dp, dev, name);
+        if (sp)
+        crackBLOB (pcdataXMLEle (root), &sp->blob);
+        dp->binblob = !strcmp (findXMLAttValu (root, "encoding"), "binary");
+        delXMLEle (root);
+
+        return (0);
+    }
+
+    /* Found a new device? Let's add it to driver info */
+    if (dev[0] && isDeviceInDriver(dev, dp) == 0)
+    {
+        dp->dev = (char **) realloc(dp->dev, (dp->ndev+1) * sizeof(char *));
+        dp->dev[dp->ndev] = (char *) malloc(MAXINDIDEVICE * sizeof(char));
+
+        strncpy (dp->dev[dp->ndev], dev, MAXINDIDEVICE-1);
+        dp->dev[dp->ndev][MAXINDIDEVICE-1] = '\0';
+
+#ifdef OSX_EMBEDED_MODE
+        if (!dp->ndev)
+          fprintf(stderr, "STARTED \"%s\"\n", dp->name); fflush(stderr);
+#endif
+
+        dp->ndev++;
+    }
+
+    /* log messages if any and wanted */
+    if (ldir)
+        logDMsg (root, dev);
+
+    /* build a new message -- content is set when first queued.
+     * BLOBs may be converted while queuing so they need it now.
+     */
+    mp = rmp ? rmp : newMsg();
+    if (isblob && !rmp)
+    {
+        setMsgXMLEle (mp, root);
+        mp->binary = isBinaryBLOB (root);
+    }
+
+    /* a driver sending binary BLOBs can take them too */
+    if (mp->binary)
+        dp->binblob = 1;
+
+    /* send to interested clients */
+     if (q2Clients (NULL, isblob, dev, name, mp, root) < 0)
+        shutany++;
+
+    /* send to snooping drivers */
+    q2SDrivers (isblob, dev, name, mp, root);
+
+    /* forget message if no one cared */
+    dropAltMsg (mp);
+    if (mp->count == 0)
+        freeMsg (mp);
+    delXMLEle (root);
+
+    return (shutany ? -1 : 0);
+}
+
+/* ready fp to parse driver input from the start */
+static void
+initFramer (Framer *fp)
+{
+    fp->lp = newLilXML();
+    fp->attop = 1;
+    fp->bf = BF_XML;
+    fp->bmp = NULL;
+}
+
+/* free what fp holds */
+static void
+freeFramer (Framer *fp)
+{
+    delLilXML (fp->lp);
+    if (fp->bmp)
+        freeMsg (fp->bmp);
+    fp->bmp = NULL;
+}
+
+/* parse the nbuf bytes of driver input at buf from *ip on, framing each
+ * setBLOBVector raw with frameBLOB() and feeding the rest to lilxml.
+ * return the next complete element with *ip just past it and *rmpp set if
+ * it was framed raw, else NULL with *ip at nbuf or with reason in err.
+ */
+static XMLEle *
+nextDvrEle (Framer *fp, const char *buf, int nbuf, int *ip, Msg **rmpp,
+char err[])
+{
+    XMLEle *root = NULL;
+    int i = *ip;
+    int n;
+
+    *rmpp = NULL;
+    err[0] = '\0';
+
+    while (i < nbuf && !root && !err[0])
+    {
+        /* BLOBs bypass lilxml, the raw text becomes the Msg content */
+        if (fp->bf != BF_XML || (fp->attop && buf[i] == '<'))
+        {
+            Msg *mp;
+
+            n = frameBLOB (fp, &buf[i], nbuf-i, &mp, err);
+
+            if (n < 0)
+            break;
+            i += n;
+            if (mp)
+            {
+            root = crackBLOBHead (mp->cp, fp->bhl, err);
+            if (root)
+                *rmpp = mp;
+            else
+                freeMsg (mp);
+            }
+            continue;
+        }
+
+        /* between elements lilxml only gets up to the next '<', which must
+         * come back here to be checked for a BLOB first
+         */
+        n = nbuf-i;
+        if (fp->attop)
+        {
+            const char *lt = memchr (&buf[i], '<', n);
+            if (lt)
+                n = lt - &buf[i];
+        }
+        i += readXMLBuf (fp->lp, &buf[i], n, takeXMLEle, &root, err);
+        if (root)
+        fp->attop = 1;
+    }
+
+    *ip = i;
+    return (root);
+}
+
+/* frame one setBLOBVector element from driver dp without parsing it.
+ * called with buf starting with '<' while fp->lp is between elements, then
+ * with each following chunk until the element is complete. the raw text is
+ * copied once into fp->bmp, which becomes the Msg sent to all consumers.
+ * return number of bytes consumed from buf, with *mpp set to the finished
+ * Msg when the closing tag was found, else NULL. return 0 if buf turns out
+ * not to be a setBLOBVector, the bytes seen so far are then replayed to
+ * fp->lp and buf must be fed to it as usual. return -1 with reason in err
+ * if trouble.
+ */
+static int
+frameBLOB (Framer *fp, const char *buf, int nbuf, Msg **mpp, char err[])
+{
+    int i, j;
+
+    *mpp = NULL;
+    err[0] = '\0';
+
+    if (fp->bf == BF_XML)
+    {
+        fp->bf = BF_PREFIX;
+        fp->nbf = 0;
+    }
+
+    for (i = 0; i < nbuf && fp->bf == BF_PREFIX; i++)
+    {
+        if (fp->nbf < (int)sizeof(blobtag)-1)
+        {
+            if (buf[i] == blobtag[fp->nbf])
+            {
+                fp->nbf++;
+                continue;
+            }
+        }
+        else if (isspace(buf[i]) || buf[i] == '>' || buf[i] == '/')
+        {
+            /* it's ours, start the raw Msg with the tag seen so far */
+            fp->bmp = newMsg();
+            fp->bmsz = 0;
+            appendMsg (fp->bmp, &fp->bmsz, blobtag, fp->nbf);
+            fp->bquote = 0;
+            fp->bf = BF_HEAD;
+            break;
+        }
+
+        /* not a BLOB after all, let lilxml have what we swallowed */
+        for (j = 0; j < fp->nbf; j++)
+        {
+            readXMLEle (fp->lp, blobtag[j], err);
+            if (err[0])
+                return (-1);
+        }
+        fp->bf = BF_XML;
+        fp->attop = 0;
+        return (i);
+    }
+    if (fp->bf == BF_PREFIX)
+        return (nbuf);
+
+    /* collect opening tag up to its closing '>', honoring quoted values */
+    for (j = i; j < nbuf && fp->bf == BF_HEAD; j++)
+    {
+        if (fp->bquote)
+        {
+            if (buf[j] == fp->bquote)
+                fp->bquote = 0;
+        }
+        else if (buf[j] == '\'' || buf[j] == '"')
+            fp->bquote = buf[j];
+        else if (buf[j] == '>')
+        {
+            appendMsg (fp->bmp, &fp->bmsz, &buf[i], j+1-i);
+            fp->bhl = fp->bmp->cl;
+            fp->bscan = fp->bhl;
+            if (fp->bmp->cp[fp->bhl-2] == '/')
+            {
+                /* empty element, done already */
+                *mpp = fp->bmp;
+                fp->bmp = NULL;
+                fp->bf = BF_XML;
+                fp->attop = 1;
+                return (j+1);
+            }
+            fp->bf = BF_BODY;
+            i = j+1;
+        }
+    }
+    if (fp->bf == BF_HEAD)
+    {
+        appendMsg (fp->bmp, &fp->bmsz, &buf[i], nbuf-i);
+        return (nbuf);
+    }
+
+    /* copy body, watching for the closing tag */
+    appendMsg (fp->bmp, &fp->bmsz, &buf[i], nbuf-i);
+    while (fp->bscan < fp->bmp->cl)
+    {
+        char *cp = fp->bmp->cp;
+        unsigned long cl = fp->bmp->cl;
+        char *lt = memchr (&cp[fp->bscan], '<', cl - fp->bscan);
+        unsigned long k;
+
+        if (!lt)
+        {
+            fp->bscan = cl;
+            break;
+        }
+        fp->bscan = lt - cp;
+
+        /* need the whole closing tag to decide */
+        k = fp->bscan + sizeof(blobetag)-1;
+        if (k > cl)
+            break;
+
+        /* binary pcdata may contain anything, skip it by its length */
+        if (!memcmp (lt, "<oneBLOB", 8))
+        {
+            int bin;
+            long rl = rawBLOBLength (lt, cl - fp->bscan, &bin);
+            if (rl < 0)
+                break;
+            if (bin)
+                fp->bmp->binary = 1;
+            fp->bscan += rl;
+            continue;
+        }
+        if (memcmp (lt, blobetag, sizeof(blobetag)-1))
+        {
+            fp->bscan++;
+            continue;
+        }
+        while (k < cl && isspace(cp[k]))
+            k++;
+        if (k == cl)
+            break;
+        if (cp[k] != '>')
+        {
+            sprintf (err, "Bogus end tag char %c", cp[k]);
+            freeMsg (fp->bmp);
+            fp->bmp = NULL;
+            fp->bf = BF_XML;
+            fp->attop = 1;
+            return (-1);
+        }
+
+        /* found it: give back any bytes beyond the element */
+        k++;
+        fp->bmp->cl = k;
+        cp[k] = '\0';
+        *mpp = fp->bmp;
+        fp->bmp = NULL;
+        fp->bf = BF_XML;
+        fp->attop = 1;
+        return (nbuf - (int)(cl - k));
+    }
+
+    return (nbuf);
+}
+
+/* append n bytes at s to the malloced content of mp, keeping it \0
+ * terminated. *szp is the malloced size of mp->cp, 0 to start.
+ * grows by doubling so large BLOBs cost few reallocs.
+ */
+static void
+appendMsg (Msg *mp, unsigned long *szp, const char *s, unsigned long n)
+{
+    if (mp->cl + n + 1 > *szp)
+    {
+        unsigned long newsz = *szp ? *szp : MAXWSIZ;
+        while (mp->cl + n + 1 > newsz)
+            newsz *= 2;
+        mp->cp = (char *) realloc (mp->cp, newsz);
+        if (!mp->cp)
+        {
+            fprintf (stderr, "no memory for %lu byte BLOB\n", newsz);
+            Bye();
+        }
+        *szp = newsz;
+    }
+    memcpy (&mp->cp[mp->cl], s, n);
+    mp->cl += n;
+    mp->cp[mp->cl] = '\0';
+}
+
+/* parse just the opening tag at head, hl bytes long including its '>'.
+ * return an element with its attributes and no children, else NULL with
+ * reason in err.
+ */
+static XMLEle *
+crackBLOBHead (const char *head, int hl, char err[])
+{
+    LilXML *lp = newLilXML();
+    XMLEle *root = NULL;
+    int i;
+
+    /* feed it as an empty element */
+    err[0] = '\0';
+    for (i = 0; i < hl-1 && !root && !err[0]; i++)
+        root = readXMLEle (lp, head[i], err);
+    if (!root && !err[0] && head[hl-2] != '/')
+        root = readXMLEle (lp, '/', err);
+    if (!root && !err[0])
+        root = readXMLEle (lp, '>', err);
+    if (!root && !err[0])
+        sprintf (err, "incomplete %.64s", head);
+
+    delLilXML (lp);
+    return (root);
+}
+
+/* given n bytes at tag starting with the opening tag of a oneBLOB, return
+ * the number of bytes to skip over it and its binary pcdata if any, or -1
+ * if the opening tag is not all there yet. *binp is set to 1 if binary.
+ */
+static long
+rawBLOBLength (const char *tag, unsigned long n, int *binp)
+{
+    char err[1024];
+    XMLEle *ep;
+    unsigned long i;
+    int quote = 0;
+    long l;
+
+    for (i = 0; i < n; i++)
+    {
+        if (quote)
+        {
+            if (tag[i] == quote)
+                quote = 0;
+        }
+        else if (tag[i] == '\'' || tag[i] == '"')
+            quote = tag[i];
+        else if (tag[i] == '>')
+            break;
+    }
+    if (i == n)
+        return (-1);
+    l = i+1;
+    *binp = 0;
+
+    ep = crackBLOBHead (tag, l, err);
+    if (ep)
+    {
+        if (!strcmp (findXMLAttValu (ep, "encoding"), "binary"))
+        {
+            l += atol (findXMLAttValu (ep, "enclen"));
+            *binp = 1;
+        }
+        delXMLEle (ep);
+    }
+
+    return (l);
+}
+
+/* return 1 if any oneBLOB in root carries binary pcdata, else 0 */
+static int
+isBinaryBLOB (XMLEle *root)
+{
+    XMLEle *ep;
+
+    for (ep = nextXMLEle (root, 1); ep; ep = nextXMLEle (root, 0))
+        if (!strcmp (findXMLAttValu (ep, "encoding"), "binary"))
+            return (1);
+    return (0);
+}
+
+/* return mp if its BLOBs are already in the encoding wanted, else a Msg
+ * with the same content in the other encoding, made once from mp on first
+ * use. falls back to mp if it can not be converted.
+ */
+static Msg *
+blobMsg (Msg *mp, int binary)
+{
+    if (mp->binary == binary)
+        return (mp);
+    if (!mp->alt)
+        mp->alt = convertBLOBMsg (mp, binary);
+    return (mp->alt ? (Msg *) mp->alt : mp);
+}
+
+/* return a new Msg with the setBLOBVector in mp rewritten with all its
+ * BLOBs in binary or base64 encoding, else NULL if trouble.
+ */
+static Msg *
+convertBLOBMsg (Msg *mp, int binary)
+{
+    LilXML *lp = newLilXML();
+    XMLEle *root = NULL, *ep;
+    XMLAtt *ap;
+    char err[1024];
+    char tmp[128];
+    unsigned long i, sz = 0;
+    Msg *nmp;
+
+    err[0] = '\0';
+    for (i = 0; i < mp->cl && !root && !err[0]; i++)
+        root = readXMLEle (lp, mp->cp[i], err);
+    delLilXML (lp);
+    if (!root)
+    {
+        fprintf (stderr, "%s: BLOB conversion: %s\n", indi_tstamp(NULL),
+                                err[0] ? err : "incomplete element");
+        return (NULL);
+    }
+
+    nmp = newMsg();
+    nmp->binary = binary;
+    nmp->bkey = mp->bkey;
+
+    appendMsg (nmp, &sz, "<", 1);
+    appendMsg (nmp, &sz, tagXMLEle(root), strlen(tagXMLEle(root)));
+    for (ap = nextXMLAtt (root, 1); ap; ap = nextXMLAtt (root, 0))
+    {
+        char *v;
+        appendMsg (nmp, &sz, "\n  ", 3);
+        appendMsg (nmp, &sz, nameXMLAtt(ap), strlen(nameXMLAtt(ap)));
+        appendMsg (nmp, &sz, "='", 2);
+        v = entityXML (valuXMLAtt(ap));
+        appendMsg (nmp, &sz, v, strlen(v));
+        appendMsg (nmp, &sz, "'", 1);
+    }
+    appendMsg (nmp, &sz, ">\n", 2);
+
+    for (ep = nextXMLEle (root, 1); ep; ep = nextXMLEle (root, 0))
+    {
+        char *data = pcdataXMLEle (ep);
+        int datalen = pcdatalenXMLEle (ep);
+        char *raw = NULL;
+
+        if (strcmp (tagXMLEle(ep), "oneBLOB"))
+            continue;
+
+        appendMsg (nmp, &sz, "  <oneBLOB", 10);
+        for (ap = nextXMLAtt (ep, 1); ap; ap = nextXMLAtt (ep, 0))
+        {
+            char *v;
+            if (!strcmp (nameXMLAtt(ap), "encoding") ||
+                                        !strcmp (nameXMLAtt(ap), "enclen"))
+                continue;
+            appendMsg (nmp, &sz, "\n    ", 5);
+            appendMsg (nmp, &sz, nameXMLAtt(ap), strlen(nameXMLAtt(ap)));
+            appendMsg (nmp, &sz, "='", 2);
+            v = entityXML (valuXMLAtt(ap));
+            appendMsg (nmp, &sz, v, strlen(v));
+            appendMsg (nmp, &sz, "'", 1);
+        }
+
+        /* get raw bytes */
+        if (strcmp (findXMLAttValu (ep, "encoding"), "binary"))
+        {
+            raw = malloc (3*datalen/4 + 4);
+            datalen = from64tobits (raw, data);
+            if (datalen < 0)
+                datalen = 0;
+            data = raw;
+        }
+
+        if (binary)
+        {
+            sprintf (tmp, "\n    enclen='%d'\n    encoding='binary'>", datalen);
+            appendMsg (nmp, &sz, tmp, strlen(tmp));
+            appendMsg (nmp, &sz, data, datalen);
+            appendMsg (nmp, &sz, "\n", 1);
+        }
+        else
+        {
+            char *enc = malloc (4*datalen/3 + 4 + datalen/54 + 2);
+            int l = to64lines ((unsigned char *)enc,
+                                    (unsigned char *)data, datalen, 72);
+
+            appendMsg (nmp, &sz, ">\n", 2);
+            appendMsg (nmp, &sz, enc, l);
+            free (enc);
+        }
+        appendMsg (nmp, &sz, "  </oneBLOB>\n", 13);
+
+        if (raw)
+            free (raw);
+    }
+
+    appendMsg (nmp, &sz, "</", 2);
+    appendMsg (nmp, &sz, tagXMLEle(root), strlen(tagXMLEle(root)));
+    appendMsg (nmp, &sz, ">\n", 2);
+
+    delXMLEle (root);
+    return (nmp);
+}
+
+/* forget the alternate encoding of mp once routing is done, free it if no
+ * one ended up using it.
+ */
+static void
+dropAltMsg (Msg *mp)
+{
+    Msg *alt = (Msg *) mp->alt;
+
+    if (alt && alt->count == 0)
+        freeMsg (alt);
+    mp->alt = NULL;
+}
+
+/* read more from the given driver stderr, add prefix and send to our stderr.
+ * return 0 if ok else -1 if had to restart.
+ */
+static int
+stderrFromDriver (DvrInfo *dp)
+{
+    static char exbuf[MAXRBUF];
+    static int nexbuf;
+    ssize_t i, nr;
+
+    /* read more */
+    nr = read (dp->efd, exbuf+nexbuf, sizeof(exbuf)-nexbuf);
+    if (nr <= 0) {
+        if (nr < 0)
+        fprintf (stderr, "%s: Driver %s: stderr %s\n", indi_tstamp(NULL),
+                            dp->name, strerror(errno));
+        else
+        fprintf (stderr, "%s: Driver %s: stderr EOF\n",
+                            indi_tstamp(NULL), dp->name);
+            shutdownDvr (dp, 1);
+        return (-1);
+    }
+    nexbuf += nr;
+
+    /* prefix each whole line to our stderr, save extra for next time */
+    for (i = 0; i < nexbuf; i++) {
+        if (exbuf[i] == '\n') {
         fprintf (stderr, "%s: Driver %s: %.*s\n", indi_tstamp(NULL),
                                 dp->name, (int)i, exbuf);
         i++;				  /* count including nl */
@@ -1337,20 +2352,42 @@ static void
 shutdownClient (ClInfo *cp)
 {
     Msg *mp;
+    int i;
+
+    /* stop its reader before the fd goes away */
+    if (cp->rd) {
+        stopReader (cp->rd);
+        cp->rd = NULL;
+    }
 
     /* close connection */
+    evDel (cp->s);
     shutdown (cp->s, SHUT_RDWR);
     close (cp->s);
 
+    /* forget its subscriptions */
+    for (i = 0; i < cp->nprops; i++) {
+        SubKey *kp = findSubKey (cp->props[i].dev, cp->props[i].name, 0);
+        if (kp)
+            rmSub (kp->csubs, &kp->ncsubs, cp - clinfo);
+    }
+
     /* free memory */
     delLilXML (cp->lp);
     free (cp->props);
+    cp->nprops = 0;
 
     /* decrement and possibly free any unsent messages for this client */
     while ((mp = (Msg*) popFQ(cp->msgq)) != NULL)
         if (--mp->count == 0)
         freeMsg (mp);
     delFQ (cp->msgq);
+    while ((mp = (Msg*) popFQ(cp->blobq)) != NULL)
+        if (--mp->count == 0)
+        freeMsg (mp);
+    delFQ (cp->blobq);
+    cp->qbytes = 0;
+    cp->bbytes = 0;
 
     /* ok now to recycle */
     cp->active = 0;
@@ -1372,15 +2409,27 @@ static void
 shutdownDvr (DvrInfo *dp, int restart)
 {
     Msg *mp;
+    int i;
+
+    /* stop its reader before the fds go away */
+    if (dp->rd) {
+        stopReader (dp->rd);
+        dp->rd = NULL;
+    }
 
     /* make sure it's dead, reclaim resources */
     if (dp->pid == REMOTEDVR) {
         /* socket connection */
+        evDel (dp->wfd);
         shutdown (dp->wfd, SHUT_RDWR);
         close (dp->wfd);	/* same as rfd */
     } else {
         /* local pipe connection */
             kill (dp->pid, SIGKILL);	/* we've insured there are no zombies */
+        evDel (dp->rfd);
+        evDel (dp->efd);
+        if (dp->wwatch)
+            evDel (dp->wfd);
         close (dp->wfd);
         close (dp->rfd);
         close (dp->efd);
@@ -1390,10 +2439,18 @@ shutdownDvr (DvrInfo *dp, int restart)
   fprintf(stderr, "STOPPED \"%s\"\n", dp->name); fflush(stderr);
 #endif
 
+    /* forget its snoops */
+    for (i = 0; i < dp->nsprops; i++) {
+        SubKey *kp = findSubKey (dp->sprops[i].dev, dp->sprops[i].name, 0);
+        if (kp)
+            rmSub (kp->dsubs, &kp->ndsubs, dp - dvrinfo);
+    }
+
     /* free memory */
     free (dp->sprops);
+    dp->nsprops = 0;
     free(dp->dev);
-    delLilXML (dp->lp);
+    freeFramer (&dp->fr);
 
    /* ok now to recycle */
    dp->active = 0;
@@ -1404,6 +2461,7 @@ shutdownDvr (DvrInfo *dp, int restart)
         if (--mp->count == 0)
         freeMsg (mp);
     delFQ (dp->msgq);
+    dp->qbytes = 0;
 
         if (restart)
         {
@@ -1431,6 +2489,7 @@ q2RDrivers (const char *dev, Msg *mp, XMLEle *root)
 {
     int sawremote = 0;
     DvrInfo *dp;
+    Msg *qmp;
 
     /* queue message to each interested driver.
      * N.B. don't send generic getProps to more than one remote driver,
@@ -1448,9 +2507,9 @@ q2RDrivers (const char *dev, Msg *mp, XMLEle *root)
         if (isremote)
         sawremote = 1;
 
-        /* ok: queue message to this driver */
-        mp->count++;
-        pushFQ (dp->msgq, mp);
+        /* ok: queue message to this driver, base64 unless it knows binary */
+        qmp = blobMsg (mp, mp->binary && dp->binblob);
+        pushDvrMsg (dp, qmp, root);
         if (verbose > 1)
         fprintf (stderr, "%s: Driver %s: queuing responsible for <%s device='%s' name='%s'>\n",
                     indi_tstamp(NULL), dp->name, tagXMLEle(root),
@@ -1465,20 +2524,30 @@ q2RDrivers (const char *dev, Msg *mp, XMLEle *root)
 static void
 q2SDrivers (int isblob, const char *dev, const char *name, Msg *mp, XMLEle *root)
 {
-    DvrInfo *dp;
-
-    for (dp = dvrinfo; dp < &dvrinfo[ndvrinfo]; dp++) {
-            Property *sp = findSDevice (dp, dev, name);
-
-        /* nothing for dp if not snooping for dev/name or wrong BLOB mode */
-        if (!sp)
+    SubKey *kp[2];
+    Msg *qmp;
+    int i, k;
+
+    /* snoops on exactly dev/name come first, then those on all of dev */
+    kp[0] = findSubKey (dev, name, 0);
+    kp[1] = name[0] ? findSubKey (dev, "", 0) : NULL;
+    routegen++;
+
+    for (k = 0; k < 2; k++)
+    for (i = 0; kp[k] && i < kp[k]->ndsubs; i++) {
+        DvrInfo *dp = &dvrinfo[kp[k]->dsubs[i].who];
+        Property *sp = &dp->sprops[kp[k]->dsubs[i].pi];
+
+        /* nothing for dp if already seen or wrong BLOB mode */
+        if (dp->mark == routegen)
         continue;
+        dp->mark = routegen;
         if ((isblob && sp->blob==B_NEVER) || (!isblob && sp->blob==B_ONLY))
         continue;
 
-        /* ok: queue message to this device */
-        mp->count++;
-        pushFQ (dp->msgq, mp);
+        /* ok: queue message to this device, BLOBs in its encoding */
+        qmp = isblob ? blobMsg (mp, dp->binblob) : mp;
+        pushDvrMsg (dp, qmp, root);
         if (verbose > 1) {
         fprintf (stderr, "%s: Driver %s: queuing snooped <%s device='%s' name='%s'>\n",
                     indi_tstamp(NULL), dp->name, tagXMLEle(root),
@@ -1488,182 +2557,600 @@ q2SDrivers (int isblob, const char *dev, const char *name, Msg *mp, XMLEle *root
     }
 }
 
-/* add dev/name to dp's snooping list.
- * init with blob mode set to B_NEVER.
+/* add dev/name to dp's snooping list.
+ * init with blob mode set to B_NEVER.
+ */
+static void
+addSDevice (DvrInfo *dp, const char *dev, const char *name)
+{
+        Property *sp;
+    SubKey *kp;
+    char *ip;
+
+    /* no dups */
+    sp = findSDevice (dp, dev, name);
+    if (sp)
+        return;
+
+    /* add dev to sdevs list */
+    dp->sprops = (Property*) realloc (dp->sprops,
+                                            (dp->nsprops+1)*sizeof(Property));
+    sp = &dp->sprops[dp->nsprops++];
+
+    ip = sp->dev;
+    strncpy (ip, dev, MAXINDIDEVICE-1);
+    ip[MAXINDIDEVICE-1] = '\0';
+
+    ip = sp->name;
+    strncpy (ip, name, MAXINDINAME-1);
+    ip[MAXINDINAME-1] = '\0';
+
+    sp->blob = B_NEVER;
+
+    /* index for q2SDrivers() */
+    kp = findSubKey (dev, name, 1);
+    addSub (&kp->dsubs, &kp->ndsubs, dp - dvrinfo, dp->nsprops-1);
+
+    if (verbose)
+        fprintf (stderr, "%s: Driver %s: snooping on %s.%s\n", indi_tstamp(NULL),
+                            dp->name, dev, name);
+}
+
+/* return Property if dp is snooping dev/name, else NULL.
+ */
+static Property *
+findSDevice (DvrInfo *dp, const char *dev, const char *name)
+{
+    int i;
+
+    for (i = 0; i < dp->nsprops; i++) {
+            Property *sp = &dp->sprops[i];
+            if (!strcmp (sp->dev, dev) &&
+                    (!sp->name[0] || !strcmp(sp->name, name)))
+        return (sp);
+    }
+
+    return (NULL);
+}
+
+
+/* put Msg mp on queue of each client interested in dev/name, except notme.
+ * if BLOB always honor current mode.
+ * return -1 if had to shut down any clients, else 0.
+ */
+static int
+q2Clients (ClInfo *notme, int isblob, const char *dev, const char *name, Msg *mp, XMLEle *root)
+{
+    static ClInfo **rcl;		/* clients to queue to, malloced */
+    static BLOBHandling *rbh;		/* BLOB mode for each rcl[] */
+    static int mrcl;			/* n malloced in rcl[] and rbh[] */
+    int shutany = 0;
+    int i, nrcl = 0;
+    ClInfo *cp;
+    SubKey *kp;
+
+    /* collect who wants it first, queuing may shut some down and so
+     * change the subscriptions.
+     */
+    if (mrcl < nclinfo) {
+        mrcl = nclinfo;
+        rcl = (ClInfo **) realloc (rcl, mrcl*sizeof(ClInfo *));
+        rbh = (BLOBHandling *) realloc (rbh, mrcl*sizeof(BLOBHandling));
+    }
+    routegen++;
+
+    if (dev[0]) {
+        /* those asking for exactly dev/name, their own BLOB mode applies */
+        kp = findSubKey (dev, name, 0);
+        for (i = 0; kp && i < kp->ncsubs; i++) {
+            cp = &clinfo[kp->csubs[i].who];
+            cp->mark = routegen;
+            rcl[nrcl] = cp;
+            rbh[nrcl++] = cp->props[kp->csubs[i].pi].blob;
+        }
+
+        /* then those asking for all of dev */
+        kp = findSubKey (dev, "", 0);
+        for (i = 0; kp && i < kp->ncsubs; i++) {
+            cp = &clinfo[kp->csubs[i].who];
+            if (cp->mark == routegen)
+                continue;
+            cp->mark = routegen;
+            rcl[nrcl] = cp;
+            rbh[nrcl++] = cp->blob;
+        }
+    }
+
+    /* then those asking for everything, or everyone if no dev */
+    for (cp = clinfo; cp < &clinfo[nclinfo]; cp++) {
+        if (!cp->active || cp->mark == routegen || (dev[0] && !cp->allprops))
+            continue;
+        cp->mark = routegen;
+        rcl[nrcl] = cp;
+        rbh[nrcl++] = cp->blob;
+    }
+
+    /* note whose BLOB this is in case any client drops stale ones */
+    if (isblob)
+        mp->bkey = findSubKey (dev, name, 1);
+
+    /* queue message to each interested client */
+    for (i = 0; i < nrcl; i++)
+        if (rcl[i] != notme && q2Client (rcl[i], isblob, rbh[i], mp, root) < 0)
+            shutany++;
+
+    return (shutany ? -1 : 0);
+}
+
+/* put Msg mp on queue of client cp, bh is its BLOB mode for this property.
+ * return -1 if had to shut down cp, else 0.
+ */
+static int
+q2Client (ClInfo *cp, int isblob, BLOBHandling bh, Msg *mp, XMLEle *root)
+{
+    Msg *qmp;
+
+    /* cp still in use? blob? */
+    if (!cp->active)
+        return (0);
+    if ((isblob && bh == B_NEVER) || (!isblob && cp->blob == B_ONLY))
+        return (0);
+
+    /* shut down this client if its q is already too large */
+    if (clBehind (cp) > (unsigned long)maxqsiz) {
+        if (verbose)
+            fprintf (stderr, "%s: Client %d: %lu bytes behind, shutting down\n",
+                            indi_tstamp(NULL), cp->s, clBehind (cp));
+        shutdownClient (cp);
+        return (-1);
+    }
+
+    /* make room if it only wants the newest few of this BLOB */
+    if (isblob && cp->bkeep > 0)
+        dropBLOBs (cp, mp->bkey);
+
+    /* ok: queue message to this client, BLOBs in its encoding */
+    qmp = isblob ? blobMsg (mp, cp->binblob) : mp;
+    pushClMsg (cp, isblob, qmp, root);
+    if (verbose > 1)
+        fprintf (stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n",
+                    indi_tstamp(NULL), cp->s, tagXMLEle(root),
+                    findXMLAttValu (root, "device"),
+                    findXMLAttValu (root, "name"));
+
+    return (0);
+}
+
+/* put Msg mp on queue of each chained server client, except notme.
+  * return -1 if had to shut down any clients, else 0.
+ */
+static int
+q2Servers (ClInfo *notme, Msg *mp, XMLEle *root)
+{
+    int shutany = 0;
+    ClInfo *cp;
+
+    /* queue message to each interested client */
+    for (cp = clinfo; cp < &clinfo[nclinfo]; cp++)
+    {
+        /* cp in use? notme? chained server? */
+        if (!cp->active || cp == notme || cp->allprops == 1)
+            continue;
+
+        /* shut down this client if its q is already too large */
+        if (clBehind (cp) > (unsigned long)maxqsiz)
+        {
+        if (verbose)
+            fprintf (stderr, "%s: Client %d: %lu bytes behind, shutting down\n",
+                            indi_tstamp(NULL), cp->s, clBehind (cp));
+        shutdownClient (cp);
+        shutany++;
+        continue;
+        }
+
+        /* ok: queue message to this client */
+        pushClMsg (cp, 0, mp, root);
+        if (verbose > 1)
+        fprintf (stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n",
+                    indi_tstamp(NULL), cp->s, tagXMLEle(root),
+                    findXMLAttValu (root, "device"),
+                    findXMLAttValu (root, "name"));
+    }
+
+    return (shutany ? -1 : 0);
+}
+
+/* add Msg mp to the queue of client cp, its BLOB queue if isblob, printing
+ * root into it first if no one has needed its content yet. keeps count of
+ * bytes queued.
+ */
+static void
+pushClMsg (ClInfo *cp, int isblob, Msg *mp, XMLEle *root)
+{
+    if (!mp->cl && root)
+        setMsgXMLEle (mp, root);
+    mp->count++;
+    pushFQ (isblob ? cp->blobq : cp->msgq, mp);
+    cp->qbytes += mp->cl;
+    if (isblob)
+        cp->bbytes += mp->cl;
+    evClWrite (cp);
+}
+
+/* return number of Msgs queued for client cp */
+static int
+nClMsgs (ClInfo *cp)
+{
+    return (nFQ(cp->msgq) + nFQ(cp->blobq));
+}
+
+/* return bytes client cp is behind for the purpose of maxqsiz, not counting
+ * BLOBs if we drop those instead.
+ */
+static unsigned long
+clBehind (ClInfo *cp)
+{
+    return (cp->bkeep > 0 ? cp->qbytes - cp->bbytes : cp->qbytes);
+}
+
+/* make room for one more BLOB of kp on the queue of client cp by dropping
+ * the oldest not yet begun, so no more than cp->bkeep-1 of kp remain.
+ */
+static void
+dropBLOBs (ClInfo *cp, SubKey *kp)
+{
+    int first = cp->bsent > 0;		/* 1 if head is being sent */
+    int i, n = nFQ(cp->blobq);
+    int ndrop, nkp = 0;
+    Msg *mp;
+
+    for (i = first; i < n; i++)
+        if (((Msg *) peekiFQ (cp->blobq, i))->bkey == kp)
+            nkp++;
+    ndrop = nkp - (cp->bkeep - 1);
+    if (ndrop <= 0)
+        return;
+
+    /* cycle through the whole queue once, keeping order of those kept */
+    for (i = 0; i < n; i++) {
+        mp = (Msg *) popFQ (cp->blobq);
+        if (i >= first && mp->bkey == kp && ndrop > 0) {
+            ndrop--;
+            cp->qbytes -= mp->cl;
+            cp->bbytes -= mp->cl;
+            cp->ndropped++;
+            if (verbose > 1)
+                fprintf (stderr, "%s: Client %d: dropping stale %s.%s BLOB\n",
+                            indi_tstamp(NULL), cp->s, kp->dev, kp->name);
+            if (--mp->count == 0)
+                freeMsg (mp);
+        } else
+            pushFQ (cp->blobq, mp);
+    }
+}
+
+/* same as pushClMsg() for driver dp, which has just the one queue */
+static void
+pushDvrMsg (DvrInfo *dp, Msg *mp, XMLEle *root)
+{
+    if (!mp->cl && root)
+        setMsgXMLEle (mp, root);
+    mp->count++;
+    pushFQ (dp->msgq, mp);
+    dp->qbytes += mp->cl;
+    evDvrWrite (dp);
+}
+
+/* report how far behind each client and driver is */
+static void
+logQStats (void)
+{
+    char *ts = indi_tstamp(NULL);
+    ClInfo *cp;
+    DvrInfo *dp;
+
+    for (cp = clinfo; cp < &clinfo[nclinfo]; cp++)
+        if (cp->active)
+            fprintf (stderr, "%s: Client %d: %d messages %lu bytes queued, %d BLOBs, %lu dropped\n",
+                            ts, cp->s, nClMsgs(cp), cp->qbytes, nFQ(cp->blobq),
+                            cp->ndropped);
+    for (dp = dvrinfo; dp < &dvrinfo[ndvrinfo]; dp++)
+        if (dp->active)
+            fprintf (stderr, "%s: Driver %s: %d messages %lu bytes queued\n",
+                            ts, dp->name, nFQ(dp->msgq), dp->qbytes);
+}
+
+/* ready the pipe reader threads use to wake up the main thread.
+ * exit if trouble.
+ */
+static void
+initThreads (void)
+{
+    if (pipe (wakefd) < 0) {
+        fprintf (stderr, "%s: wake pipe: %s\n", indi_tstamp(NULL),
+                                strerror(errno));
+        Bye();
+    }
+    fcntl (wakefd[0], F_SETFL, fcntl (wakefd[0], F_GETFL) | O_NONBLOCK);
+    fcntl (wakefd[1], F_SETFL, fcntl (wakefd[1], F_GETFL) | O_NONBLOCK);
+    evAdd (wakefd[0], EV_WAKE, 0, 0);
+}
+
+/* start a thread to read and parse fd, framing BLOBs if isdvr.
+ * exit if trouble.
+ */
+static Reader *
+startReader (int fd, int isdvr)
+{
+    Reader *rp = (Reader *) calloc (1, sizeof(Reader));
+
+    rp->fd = fd;
+    rp->isdvr = isdvr;
+    initFramer (&rp->fr);
+    rp->head = rp->tail = (RdMsg *) calloc (1, sizeof(RdMsg));
+    if (pipe (rp->stop) < 0) {
+        fprintf (stderr, "%s: reader pipe: %s\n", indi_tstamp(NULL),
+                                strerror(errno));
+        Bye();
+    }
+    if ((errno = pthread_create (&rp->tid, NULL, readerThread, rp)) != 0) {
+        fprintf (stderr, "%s: reader thread: %s\n", indi_tstamp(NULL),
+                                strerror(errno));
+        Bye();
+    }
+
+    return (rp);
+}
+
+/* stop the reader thread rp, forget whatever it read that was not yet
+ * taken and free rp. its fd is left open.
  */
 static void
-addSDevice (DvrInfo *dp, const char *dev, const char *name)
+stopReader (Reader *rp)
 {
-        Property *sp;
-    char *ip;
+    RdMsg rm;
+
+    /* thread quits when it sees this, if it has not already */
+    (void) write (rp->stop[1], "", 1);
+    pthread_join (rp->tid, NULL);
+
+    while (popRdMsg (rp, &rm)) {
+        if (rm.root)
+            delXMLEle (rm.root);
+        if (rm.rmp)
+            freeMsg (rm.rmp);
+        free (rm.xerr);
+        free (rm.raw);
+    }
+    free (rp->head);
 
-    /* no dups */
-    sp = findSDevice (dp, dev, name);
-    if (sp)
-        return;
+    close (rp->stop[0]);
+    close (rp->stop[1]);
+    freeFramer (&rp->fr);
+    free (rp);
+}
 
-    /* add dev to sdevs list */
-    dp->sprops = (Property*) realloc (dp->sprops,
-                                            (dp->nsprops+1)*sizeof(Property));
-    sp = &dp->sprops[dp->nsprops++];
+/* body of each reader thread: read rp->fd and queue each complete element
+ * for the main thread until EOF, trouble or told to stop.
+ * N.B. nothing here may touch clinfo[], dvrinfo[] or anything else the main
+ *   thread owns.
+ */
+static void *
+readerThread (void *arg)
+{
+    Reader *rp = (Reader *) arg;
+    struct pollfd pfd[2];
+    char buf[MAXRBUF];
+    int i, nr;
 
-    ip = sp->dev;
-    strncpy (ip, dev, MAXINDIDEVICE-1);
-    ip[MAXINDIDEVICE-1] = '\0';
+    pfd[0].fd = rp->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = rp->stop[0];
+    pfd[1].events = POLLIN;
 
-    ip = sp->name;
-    strncpy (ip, name, MAXINDINAME-1);
-    ip[MAXINDINAME-1] = '\0';
+    while (1) {
+        /* wait for input or to be stopped */
+        if (poll (pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            pushRdMsg (rp, NULL, NULL, errno, NULL, NULL, 0);
+            break;
+        }
+        if (pfd[1].revents)
+            break;
 
-    sp->blob = B_NEVER;
+        nr = read (rp->fd, buf, sizeof(buf));
+        if (nr <= 0) {
+            if (nr < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            pushRdMsg (rp, NULL, NULL, nr < 0 ? errno : 0, NULL, NULL, 0);
+            break;
+        }
 
-    if (verbose)
-        fprintf (stderr, "%s: Driver %s: snooping on %s.%s\n", indi_tstamp(NULL),
-                            dp->name, dev, name);
+        /* same parsing as readFromClient() and readFromDriver() */
+        for (i = 0; i < nr; ) {
+            char err[1024];
+            Msg *rmp = NULL;
+            XMLEle *root;
+
+            if (rp->isdvr)
+                root = nextDvrEle (&rp->fr, buf, nr, &i, &rmp, err);
+            else {
+                root = NULL;
+                i += readXMLBuf (rp->fr.lp, &buf[i], nr-i, takeXMLEle, &root, err);
+            }
+            if (root)
+                pushRdMsg (rp, root, rmp, 0, NULL, NULL, 0);
+            else if (err[0]) {
+                pushRdMsg (rp, NULL, NULL, 0, err, buf, nr);
+                return (NULL);
+            }
+        }
+    }
+
+    return (NULL);
 }
 
-/* return Property if dp is snooping dev/name, else NULL.
+/* called by reader thread rp to pass the next element root, with its raw
+ * text in rmp if framed raw, on to the main thread. root is NULL at the end
+ * of input, with errnum or xerr and the raw input it concerns if trouble.
  */
-static Property *
-findSDevice (DvrInfo *dp, const char *dev, const char *name)
+static void
+pushRdMsg (Reader *rp, XMLEle *root, Msg *rmp, int errnum, const char *xerr,
+const char *raw, int nraw)
 {
-    int i;
-
-    for (i = 0; i < dp->nsprops; i++) {
-            Property *sp = &dp->sprops[i];
-            if (!strcmp (sp->dev, dev) &&
-                    (!sp->name[0] || !strcmp(sp->name, name)))
-        return (sp);
+    RdMsg *rm = (RdMsg *) calloc (1, sizeof(RdMsg));
+
+    rm->root = root;
+    rm->rmp = rmp;
+    rm->errnum = errnum;
+    if (xerr) {
+        rm->xerr = strcpy (malloc (strlen(xerr)+1), xerr);
+        rm->raw = memcpy (malloc (nraw), raw, nraw);
+        rm->nraw = nraw;
     }
 
-    return (NULL);
+    /* publish rm complete, then make sure main thread looks */
+    __atomic_store_n (&rp->tail->next, rm, __ATOMIC_RELEASE);
+    rp->tail = rm;
+    wakeMain();
 }
 
-
-/* put Msg mp on queue of each client interested in dev/name, except notme.
- * if BLOB always honor current mode.
- * return -1 if had to shut down any clients, else 0.
+/* called by the main thread to take the oldest RdMsg from rp into *rm.
+ * return 1 if found one, else 0.
  */
 static int
-q2Clients (ClInfo *notme, int isblob, const char *dev, const char *name, Msg *mp, XMLEle *root)
+popRdMsg (Reader *rp, RdMsg *rm)
 {
-    int shutany = 0;
-    ClInfo *cp;
-    int ql,i=0;
+    RdMsg *next = __atomic_load_n (&rp->head->next, __ATOMIC_ACQUIRE);
 
-    /* queue message to each interested client */
-    for (cp = clinfo; cp < &clinfo[nclinfo]; cp++) {
-        /* cp in use? notme? want this dev/name? blob? */
-        if (!cp->active || cp == notme)
-        continue;
-            if (findClDevice (cp, dev, name) < 0)
-        continue;
+    if (!next)
+        return (0);
 
-            //if ((isblob && cp->blob==B_NEVER) || (!isblob && cp->blob==B_ONLY))
-            if (!isblob && cp->blob==B_ONLY)
-                continue;
+    /* next becomes the consumed head */
+    *rm = *next;
+    free (rp->head);
+    rp->head = next;
+    return (1);
+}
 
-            if (isblob)
-            {
-                if (cp->nprops > 0)
-                {
-                Property *pp = NULL;
-                int blob_found=0;
-                for (i = 0; i < cp->nprops; i++)
-                {
-                    pp = &cp->props[i];
-                    if (!strcmp (pp->dev, dev) && (!strcmp(pp->name, name)))
-                    {
-                        blob_found = 1;
-                        break;
-                    }
-                }
+/* make sure the main thread runs readThreads() soon, at most one byte is
+ * ever waiting in wakefd.
+ */
+static void
+wakeMain (void)
+{
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (!__atomic_exchange_n (&wakeup, 1, __ATOMIC_SEQ_CST))
+        (void) write (wakefd[1], "", 1);
+}
 
-                if ( (blob_found && pp->blob == B_NEVER) || (blob_found==0 && cp->blob == B_NEVER) )
-                    continue;
-               }
-               else if (cp->blob == B_NEVER)
-                   continue;
-           }
+/* route what the reader threads have queued, up to MAXRDMSGS from each so
+ * writing is not held off for long.
+ * return -1 if had to shut down anything, else 0.
+ */
+static int
+readThreads (void)
+{
+    char junk[64];
+    int shutany = 0, more = 0;
+    RdMsg rm;
+    int i, n;
 
-        /* shut down this client if its q is already too large */
-        ql = msgQSize(cp->msgq);
-        if (ql > maxqsiz) {
-        if (verbose)
-            fprintf (stderr, "%s: Client %d: %d bytes behind, shutting down\n",
-                            indi_tstamp(NULL), cp->s, ql);
-        shutdownClient (cp);
-        shutany++;
+    /* rearm before looking so nothing queued from now on is missed */
+    while (read (wakefd[0], junk, sizeof(junk)) > 0)
         continue;
+    __atomic_store_n (&wakeup, 0, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+    /* N.B. handling one may shut down any client, or restart any driver */
+    for (i = 0; i < nclinfo; i++) {
+        ClInfo *cp = &clinfo[i];
+        for (n = 0; cp->active && cp->rd; n++) {
+            if (n == MAXRDMSGS) {
+                more = 1;
+                break;
+            }
+            if (!popRdMsg (cp->rd, &rm))
+                break;
+            if (rdClientMsg (cp, &rm) < 0)
+                shutany++;
         }
+    }
 
-        /* ok: queue message to this client */
-        mp->count++;
-        pushFQ (cp->msgq, mp);
-        if (verbose > 1)
-        fprintf (stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n",
-                    indi_tstamp(NULL), cp->s, tagXMLEle(root),
-                    findXMLAttValu (root, "device"),
-                    findXMLAttValu (root, "name"));
+    for (i = 0; i < ndvrinfo; i++) {
+        DvrInfo *dp = &dvrinfo[i];
+        for (n = 0; dp->active && dp->rd; n++) {
+            if (n == MAXRDMSGS) {
+                more = 1;
+                break;
+            }
+            if (!popRdMsg (dp->rd, &rm))
+                break;
+            if (rdDriverMsg (dp, &rm) < 0)
+                shutany++;
+        }
     }
 
+    /* come back for the rest after servicing everything else */
+    if (more)
+        wakeMain();
+
     return (shutany ? -1 : 0);
 }
 
-/* put Msg mp on queue of each chained server client, except notme.
-  * return -1 if had to shut down any clients, else 0.
+/* handle rm from the reader thread of client cp.
+ * return -1 if had to shut down anything, else 0.
  */
 static int
-q2Servers (ClInfo *notme, Msg *mp, XMLEle *root)
+rdClientMsg (ClInfo *cp, RdMsg *rm)
 {
-    int shutany = 0;
-    ClInfo *cp;
-    int ql=0;
-
-    /* queue message to each interested client */
-    for (cp = clinfo; cp < &clinfo[nclinfo]; cp++)
-    {
-        /* cp in use? notme? chained server? */
-        if (!cp->active || cp == notme || cp->allprops == 1)
-            continue;
-
-        /* shut down this client if its q is already too large */
-        ql = msgQSize(cp->msgq);
-        if (ql > maxqsiz)
-        {
-        if (verbose)
-            fprintf (stderr, "%s: Client %d: %d bytes behind, shutting down\n",
-                            indi_tstamp(NULL), cp->s, ql);
-        shutdownClient (cp);
-        shutany++;
-        continue;
-        }
-
-        /* ok: queue message to this client */
-        mp->count++;
-        pushFQ (cp->msgq, mp);
-        if (verbose > 1)
-        fprintf (stderr, "%s: Client %d: queuing <%s device='%s' name='%s'>\n",
-                    indi_tstamp(NULL), cp->s, tagXMLEle(root),
-                    findXMLAttValu (root, "device"),
-                    findXMLAttValu (root, "name"));
-    }
+    if (rm->root)
+        return (routeClientMsg (cp, rm->root));
 
-    return (shutany ? -1 : 0);
+    if (rm->xerr) {
+        char *ts = indi_tstamp(NULL);
+        fprintf (stderr, "%s: Client %d: XML error: %s\n", ts,
+                                cp->s, rm->xerr);
+        fprintf (stderr, "%s: Client %d: XML read: %.*s\n", ts,
+                                cp->s, rm->nraw, rm->raw);
+        free (rm->xerr);
+        free (rm->raw);
+    } else if (rm->errnum)
+        fprintf (stderr, "%s: Client %d: read: %s\n", indi_tstamp(NULL),
+                            cp->s, strerror(rm->errnum));
+    else if (verbose > 0)
+        fprintf (stderr, "%s: Client %d: read EOF\n", indi_tstamp(NULL),
+                                    cp->s);
+    shutdownClient (cp);
+    return (-1);
 }
 
-/* return size of all Msqs on the given q */
+/* handle rm from the reader thread of driver dp.
+ * return -1 if had to shut down anything, else 0.
+ */
 static int
-msgQSize (FQ *q)
+rdDriverMsg (DvrInfo *dp, RdMsg *rm)
 {
-    int i, l = 0;
+    if (rm->root)
+        return (routeDriverMsg (dp, rm->root, rm->rmp));
 
-    for (i = 0; i < nFQ(q); i++) {
-        Msg *mp = (Msg *) peekiFQ(q,i);
-        l += mp->cl;
-    }
-
-    return (l);
+    if (rm->xerr) {
+        char *ts = indi_tstamp(NULL);
+        fprintf (stderr, "%s: Driver %s: XML error: %s\n", ts,
+                                dp->name, rm->xerr);
+        fprintf (stderr, "%s: Driver %s: XML read: %.*s\n", ts,
+                                dp->name, rm->nraw, rm->raw);
+        free (rm->xerr);
+        free (rm->raw);
+    } else if (rm->errnum)
+        fprintf (stderr, "%s: Driver %s: stdin %s\n", indi_tstamp(NULL),
+                            dp->name, strerror(rm->errnum));
+    else
+        fprintf (stderr, "%s: Driver %s: stdin EOF\n",
+                            indi_tstamp(NULL), dp->name);
+    shutdownDvr (dp, 1);
+    return (-1);
 }
 
 /* print root as content in Msg mp.
@@ -1711,28 +3198,42 @@ freeMsg (Msg *mp)
     free (mp);
 }
 
-/* write the next chunk of the current message in the queue to the given
- * client. pop message from queue when complete and free the message if we are
- * the last one to use it. shut down this client if trouble.
- * N.B. we assume we will never be called with cp->msgq empty.
+/* write as much as the client will take now of the messages queued for it,
+ * up to wbudget bytes in one writev. pop each message when complete and free
+ * it if we are the last one to use it. shut down this client if trouble.
+ * BLOBs are only started when msgq is empty, and while anything waits on
+ * msgq only the rest of the BLOB already begun is written.
+ * N.B. we assume we will never be called with both queues empty.
  * return 0 if ok else -1 if had to shut down.
  */
 static int
 sendClientMsg (ClInfo *cp)
 {
-    ssize_t nsend, nw;
-    Msg *mp;
-
-    /* get current message */
-    mp = (Msg *) peekFQ (cp->msgq);
+    struct iovec iov[MAXIOV];
+    unsigned int *nsentp;
+    char who[64];
+    ssize_t nw;
+    int niov, maxiov;
+    FQ *q;
+
+    /* pick the queue to send from */
+    if (cp->bsent > 0 || nFQ(cp->msgq) == 0) {
+        q = cp->blobq;
+        nsentp = &cp->bsent;
+        maxiov = nFQ(cp->msgq) > 0 ? 1 : MAXIOV;
+    } else {
+        q = cp->msgq;
+        nsentp = &cp->nsent;
+        maxiov = MAXIOV;
+    }
 
-    /* send next chunk, never more than MAXWSIZ to reduce blocking */
-    nsend = mp->cl - cp->nsent;
-    if (nsend > MAXWSIZ)
-        nsend = MAXWSIZ;
-    nw = write (cp->s, &mp->cp[cp->nsent], nsend);
+    /* send from as many messages as fit, never blocking */
+    niov = gatherMsgs (q, *nsentp, iov, maxiov);
+    nw = writeMsgs (cp->s, 1, iov, niov);
 
     /* shut down if trouble */
+    if (nw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return (0);
     if (nw <= 0) {
         if (nw == 0)
         fprintf (stderr, "%s: Client %d: write returned 0\n",
@@ -1744,52 +3245,36 @@ sendClientMsg (ClInfo *cp)
         return (-1);
     }
 
-    /* trace */
-    if (verbose > 2) {
-        fprintf(stderr, "%s: Client %d: sending msg copy %d nq %d:\n%.*s\n",
-                indi_tstamp(NULL), cp->s, mp->count, nFQ(cp->msgq),
-                (int)nw, &mp->cp[cp->nsent]);
-    } else if (verbose > 1) {
-        fprintf(stderr, "%s: Client %d: sending %.50s\n", indi_tstamp(NULL),
-                            cp->s, &mp->cp[cp->nsent]);
-    }
-
-    /* update amount sent. when complete: free message if we are the last
-     * to use it and pop from our queue.
-     */
-    cp->nsent += nw;
-    if (cp->nsent == mp->cl) {
-        if (--mp->count == 0)
-        freeMsg (mp);
-        popFQ (cp->msgq);
-        cp->nsent = 0;
-    }
+    /* update amount sent, popping complete messages */
+    sprintf (who, "Client %d", cp->s);
+    *nsentp = sentMsgs (q, *nsentp, nw, q == cp->blobq ? &cp->bbytes : NULL,
+                                                        &cp->qbytes, who);
+    evClWrite (cp);
 
     return (0);
 }
 
-/* write the next chunk of the current message in the queue to the given
- * driver. pop message from queue when complete and free the message if we are
- * the last one to use it. restart this driver if touble.
+/* write as much as the driver will take now of the messages queued for it,
+ * up to wbudget bytes in one writev. pop each message when complete and free
+ * it if we are the last one to use it. restart this driver if touble.
  * N.B. we assume we will never be called with dp->msgq empty.
  * return 0 if ok else -1 if had to shut down.
  */
 static int
 sendDriverMsg (DvrInfo *dp)
 {
-    ssize_t nsend, nw;
-    Msg *mp;
-
-    /* get current message */
-    mp = (Msg *) peekFQ (dp->msgq);
+    struct iovec iov[MAXIOV];
+    char who[MAXINDINAME+16];
+    ssize_t nw;
+    int niov;
 
-    /* send next chunk, never more than MAXWSIZ to reduce blocking */
-    nsend = mp->cl - dp->nsent;
-    if (nsend > MAXWSIZ)
-        nsend = MAXWSIZ;
-    nw = write (dp->wfd, &mp->cp[dp->nsent], nsend);
+    /* send from as many messages as fit, never blocking */
+    niov = gatherMsgs (dp->msgq, dp->nsent, iov, MAXIOV);
+    nw = writeMsgs (dp->wfd, dp->pid == REMOTEDVR, iov, niov);
 
     /* restart if trouble */
+    if (nw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return (0);
     if (nw <= 0) {
         if (nw == 0)
         fprintf (stderr, "%s: Driver %s: write returned 0\n",
@@ -1801,28 +3286,100 @@ sendDriverMsg (DvrInfo *dp)
         return (-1);
     }
 
-    /* trace */
-    if (verbose > 2) {
-        fprintf(stderr, "%s: Driver %s: sending msg copy %d nq %d:\n%.*s\n",
-                indi_tstamp(NULL), dp->name, mp->count, nFQ(dp->msgq),
-                (int)nw, &mp->cp[dp->nsent]);
-    } else if (verbose > 1) {
-        fprintf(stderr, "%s: Driver %s: sending %.50s\n", indi_tstamp(NULL),
-                        dp->name, &mp->cp[dp->nsent]);
+    /* update amount sent, popping complete messages */
+    sprintf (who, "Driver %s", dp->name);
+    dp->nsent = sentMsgs (dp->msgq, dp->nsent, nw, NULL, &dp->qbytes, who);
+    evDvrWrite (dp);
+
+    return (0);
+}
+
+/* point iov at the unsent content of the messages on q, the first starting
+ * nsent bytes in, in all no more than wbudget bytes or maxiov messages.
+ * return number of iov entries used.
+ */
+static int
+gatherMsgs (FQ *q, unsigned int nsent, struct iovec iov[], int maxiov)
+{
+    unsigned long tot = 0;
+    int i, n = nFQ(q);
+
+    for (i = 0; i < n && i < maxiov && tot < (unsigned long)wbudget; i++) {
+        Msg *mp = (Msg *) peekiFQ (q, i);
+        unsigned long l = mp->cl - (i ? 0 : nsent);
+
+        if (l > wbudget - tot)
+            l = wbudget - tot;
+        iov[i].iov_base = &mp->cp[i ? 0 : nsent];
+        iov[i].iov_len = l;
+        tot += l;
     }
 
-    /* update amount sent. when complete: free message if we are the last
-     * to use it and pop from our queue.
-     */
-    dp->nsent += nw;
-    if (dp->nsent == mp->cl) {
-        if (--mp->count == 0)
-        freeMsg (mp);
-        popFQ (dp->msgq);
-        dp->nsent = 0;
+    return (i);
+}
+
+/* write iov to fd without blocking, sockets with sendmsg(), pipes are
+ * non-blocking already. return as write(2).
+ */
+static ssize_t
+writeMsgs (int fd, int issock, struct iovec iov[], int niov)
+{
+    struct msghdr mh;
+
+    if (!issock)
+        return (writev (fd, iov, niov));
+
+    memset (&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = niov;
+    return (sendmsg (fd, &mh, MSG_DONTWAIT));
+}
+
+/* nw bytes were just sent from q starting nsent bytes into its first
+ * message. pop each message now complete, freeing it if we are the last
+ * one to use it, and take them off *qbytesp, and *bbytesp if set. who is
+ * used for tracing.
+ * return bytes sent so far of the message now first on q.
+ */
+static unsigned int
+sentMsgs (FQ *q, unsigned int nsent, ssize_t nw, unsigned long *bbytesp,
+unsigned long *qbytesp, const char *who)
+{
+    while (nw > 0) {
+        Msg *mp = (Msg *) peekFQ (q);
+        unsigned long l = mp->cl - nsent;
+
+        if (l > (unsigned long)nw)
+            l = nw;
+
+        /* trace */
+        if (verbose > 2) {
+            fprintf(stderr, "%s: %s: sending msg copy %d nq %d:\n%.*s\n",
+                    indi_tstamp(NULL), who, mp->count, nFQ(q),
+                    (int)l, &mp->cp[nsent]);
+        } else if (verbose > 1) {
+            fprintf(stderr, "%s: %s: sending %.50s\n", indi_tstamp(NULL),
+                                who, &mp->cp[nsent]);
+        }
+
+        nsent += l;
+        nw -= l;
+
+        /* when complete: free message if we are the last to use it and
+         * pop from our queue.
+         */
+        if (nsent == mp->cl) {
+            *qbytesp -= mp->cl;
+            if (bbytesp)
+                *bbytesp -= mp->cl;
+            if (--mp->count == 0)
+                freeMsg (mp);
+            popFQ (q);
+            nsent = 0;
+        }
     }
 
-    return (0);
+    return (nsent);
 }
 
 /* return 0 if cp may be interested in dev/name else -1
@@ -1849,6 +3406,7 @@ static void
 addClDevice (ClInfo *cp, const char *dev, const char *name, int isblob)
 {
     Property *pp;
+    SubKey *kp;
     //char *ip;
         int i=0;
 
@@ -1881,6 +3439,63 @@ addClDevice (ClInfo *cp, const char *dev, const char *name, int isblob)
         strncpy (pp->dev, dev, MAXINDIDEVICE);
         strncpy (pp->name, name, MAXINDINAME);
         pp->blob = B_NEVER;
+
+    /* index for q2Clients() */
+    kp = findSubKey (dev, name, 1);
+    addSub (&kp->csubs, &kp->ncsubs, cp - clinfo, cp->nprops-1);
+}
+
+/* return the SubKey for dev/name, adding it if not found and create,
+ * else NULL.
+ */
+static SubKey *
+findSubKey (const char *dev, const char *name, int create)
+{
+    unsigned h = 2166136261u;		/* FNV-1a */
+    const char *p;
+    SubKey *kp;
+
+    for (p = dev; *p; p++)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    h = (h ^ '.') * 16777619u;
+    for (p = name; *p; p++)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    h &= NSUBHASH-1;
+
+    for (kp = subhash[h]; kp; kp = kp->next)
+        if (!strcmp (kp->dev, dev) && !strcmp (kp->name, name))
+            return (kp);
+    if (!create)
+        return (NULL);
+
+    kp = (SubKey *) calloc (1, sizeof(SubKey));
+    kp->dev = strcpy (malloc (strlen(dev)+1), dev);
+    kp->name = strcpy (malloc (strlen(name)+1), name);
+    kp->next = subhash[h];
+    subhash[h] = kp;
+    return (kp);
+}
+
+/* add who, with its property index pi, to the *nsubsp entries at *subsp */
+static void
+addSub (Sub **subsp, int *nsubsp, int who, int pi)
+{
+    *subsp = (Sub *) realloc (*subsp, (*nsubsp+1)*sizeof(Sub));
+    (*subsp)[*nsubsp].who = who;
+    (*subsp)[*nsubsp].pi = pi;
+    (*nsubsp)++;
+}
+
+/* remove all entries for who from the *nsubsp entries at subs */
+static void
+rmSub (Sub *subs, int *nsubsp, int who)
+{
+    int i, n = 0;
+
+    for (i = 0; i < *nsubsp; i++)
+        if (subs[i].who != who)
+            subs[n++] = subs[i];
+    *nsubsp = n;
 }
 
 
@@ -2047,3 +3662,111 @@ Bye()
     exit(1);
 }
 
+
+#if defined(FRAMER_TEST)
+/* stand-alone test that feeds driver input to nextDvrEle() in every chunk
+ * size from 1 byte to all of it. each setBLOBVector must come out framed raw
+ * and intact, whatever whitespace separates it from the element before,
+ * and every other element must be parsed. exit 0 if all good else 1.
+ */
+
+static const char ftinput[] =
+    "<defBLOBVector device='D' name='B' state='Idle'>\n"
+    "    <defBLOB name='b'/>\n"
+    "</defBLOBVector>\n"
+    "<setBLOBVector device='D' name='B'>\n"
+    "    <oneBLOB name='b' size='3' format='.x'>\nYWJj\n    </oneBLOB>\n"
+    "</setBLOBVector>\n"
+    "\n\t<setBLOBVector device='D' name='B' state='Ok'><oneBLOB name='b' size='3' format='.x'>ZGVm</oneBLOB></setBLOBVector>\r\n"
+    "<message device='D' message='a &lt;b&gt;'/>\n"
+    "  <setBLOBVector device='D' name='B'/>\n"
+    "<setBLOBVector device='D' name='B'><oneBLOB name='b' size='0' format='.x'></oneBLOB></setBLOBVector>";
+
+/* tag and 1 if framed raw of each element in ftinput */
+static const struct {
+    const char *tag;
+    int raw;
+} ftwant[] = {
+    {"defBLOBVector", 0},
+    {"setBLOBVector", 1},
+    {"setBLOBVector", 1},
+    {"message", 0},
+    {"setBLOBVector", 1},
+    {"setBLOBVector", 1},
+};
+
+int
+main (int ac, char *av[])
+{
+    int nin = sizeof(ftinput)-1;
+    int nwant = sizeof(ftwant)/sizeof(ftwant[0]);
+    int chunk, nbad = 0;
+
+    for (chunk = 1; chunk <= nin; chunk++)
+    {
+        Framer fr;
+        char err[1024];
+        int start, ngot = 0;
+
+        initFramer (&fr);
+        err[0] = '\0';
+
+        for (start = 0; start < nin && !err[0]; start += chunk)
+        {
+            int nbuf = start + chunk > nin ? nin - start : chunk;
+            int i = 0;
+
+            while (i < nbuf)
+            {
+                Msg *rmp;
+                XMLEle *root = nextDvrEle (&fr, &ftinput[start], nbuf, &i, &rmp, err);
+
+                if (err[0])
+                {
+                    fprintf (stderr, "chunk %d: %s\n", chunk, err);
+                    break;
+                }
+                if (!root)
+                    continue;
+
+                if (ngot >= nwant || strcmp (tagXMLEle(root), ftwant[ngot].tag)
+                                || (rmp != NULL) != ftwant[ngot].raw)
+                {
+                    fprintf (stderr, "chunk %d: element %d is %s%s\n", chunk, ngot,
+                                    rmp ? "raw " : "", tagXMLEle(root));
+                    err[0] = 'x';
+                }
+                else if (rmp && (strncmp (rmp->cp, "<setBLOBVector", 14)
+                                || !strstr (ftinput, rmp->cp)))
+                {
+                    fprintf (stderr, "chunk %d: element %d raw text is %s\n", chunk, ngot, rmp->cp);
+                    err[0] = 'x';
+                }
+
+                ngot++;
+                delXMLEle (root);
+                if (rmp)
+                    freeMsg (rmp);
+            }
+        }
+
+        if (!err[0] && ngot != nwant)
+        {
+            fprintf (stderr, "chunk %d: %d elements, want %d\n", chunk, ngot, nwant);
+            err[0] = 'x';
+        }
+        if (err[0])
+            nbad++;
+
+        freeFramer (&fr);
+    }
+
+    if (nbad)
+    {
+        fprintf (stderr, "%d of %d chunk sizes failed\n", nbad, nin);
+        return (1);
+    }
+
+    return (0);
+}
+#endif /* FRAMER_TEST */
@@ -0,0 +1,487 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+/* Software binning of image frames.
+ *
+ * Each output row is made in two passes over a row of accumulators as wide as the input: the
+ * biny input rows are added down into it, then each binx accumulators are added across into
+ * one output pixel, which is saturated or averaged as it is stored. 8 and 16 bit pixels are
+ * added down in 32 bits by an SSE2 or AVX2 kernel, 32 bit pixels in 64 bits and floats in
+ * doubles. The output rows are split between a few threads, each with its own accumulators.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "binning.h"
+
+#define MAXTHREADS  16              /* most threads one call starts */
+#define MINPIXELS   (256*1024)      /* fewest input pixels worth a thread of their own */
+#define MAXBIN      65536           /* most pixels in one bin, 65536*UINT16_MAX fits 32 bits */
+
+/* add n 8 or 16 bit pixels at row to the 32 bit accumulators at acc, returning how many
+ * were done. the scalar loops in addDown() do the rest.
+ */
+typedef int (*AddKernel)(uint32_t *acc, const void *row, int n);
+
+/* output rows row0 up to row1 of one call */
+typedef struct
+{
+    int type;
+    int mode;
+    int binx, biny;
+    void *out;
+    const void *in;
+    int width;
+    int row0, row1;
+    int failed;
+} BinJob;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+#define BINNING_X86
+
+__attribute__((target("sse2"))) static int
+add8_sse2 (uint32_t *acc, const void *row, int n)
+{
+	const uint8_t *p = (const uint8_t *)row;
+	const __m128i zero = _mm_setzero_si128 ();
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+	    __m128i v = _mm_loadu_si128 ((const __m128i *)(p + i));
+	    __m128i lo = _mm_unpacklo_epi8 (v, zero);
+	    __m128i hi = _mm_unpackhi_epi8 (v, zero);
+	    __m128i *a = (__m128i *)(acc + i);
+
+	    _mm_storeu_si128 (a, _mm_add_epi32 (_mm_loadu_si128 (a), _mm_unpacklo_epi16 (lo, zero)));
+	    _mm_storeu_si128 (a + 1, _mm_add_epi32 (_mm_loadu_si128 (a + 1), _mm_unpackhi_epi16 (lo, zero)));
+	    _mm_storeu_si128 (a + 2, _mm_add_epi32 (_mm_loadu_si128 (a + 2), _mm_unpacklo_epi16 (hi, zero)));
+	    _mm_storeu_si128 (a + 3, _mm_add_epi32 (_mm_loadu_si128 (a + 3), _mm_unpackhi_epi16 (hi, zero)));
+	}
+
+	return (i);
+}
+
+__attribute__((target("sse2"))) static int
+add16_sse2 (uint32_t *acc, const void *row, int n)
+{
+	const uint16_t *p = (const uint16_t *)row;
+	const __m128i zero = _mm_setzero_si128 ();
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+	    __m128i v = _mm_loadu_si128 ((const __m128i *)(p + i));
+	    __m128i *a = (__m128i *)(acc + i);
+
+	    _mm_storeu_si128 (a, _mm_add_epi32 (_mm_loadu_si128 (a), _mm_unpacklo_epi16 (v, zero)));
+	    _mm_storeu_si128 (a + 1, _mm_add_epi32 (_mm_loadu_si128 (a + 1), _mm_unpackhi_epi16 (v, zero)));
+	}
+
+	return (i);
+}
+
+__attribute__((target("avx2"))) static int
+add8_avx2 (uint32_t *acc, const void *row, int n)
+{
+	const uint8_t *p = (const uint8_t *)row;
+	int i, j;
+
+	for (i = 0; i + 32 <= n; i += 32)
+	    for (j = 0; j < 32; j += 8) {
+		__m256i v = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(p + i + j)));
+		__m256i *a = (__m256i *)(acc + i + j);
+		_mm256_storeu_si256 (a, _mm256_add_epi32 (_mm256_loadu_si256 (a), v));
+	    }
+
+	return (i);
+}
+
+__attribute__((target("avx2"))) static int
+add16_avx2 (uint32_t *acc, const void *row, int n)
+{
+	const uint16_t *p = (const uint16_t *)row;
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+	    __m256i lo = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)(p + i)));
+	    __m256i hi = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)(p + i + 8)));
+	    __m256i *a = (__m256i *)(acc + i);
+
+	    _mm256_storeu_si256 (a, _mm256_add_epi32 (_mm256_loadu_si256 (a), lo));
+	    _mm256_storeu_si256 (a + 1, _mm256_add_epi32 (_mm256_loadu_si256 (a + 1), hi));
+	}
+
+	return (i);
+}
+
+#endif
+
+/* kernel that does nothing, leaving it all to the scalar loops */
+static int
+add_none (uint32_t *acc, const void *row, int n)
+{
+	(void) acc;
+	(void) row;
+	(void) n;
+	return (0);
+}
+
+static AddKernel add8kernel, add16kernel;
+
+/* pick the fastest kernels this cpu can run. they are the same each time,
+ * so racing threads may safely both set them. add16kernel goes last, binPixels() tests it.
+ */
+static void
+pickAddKernels (void)
+{
+#if defined(BINNING_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports ("avx2")) {
+	    add8kernel = add8_avx2;
+	    add16kernel = add16_avx2;
+	    return;
+	}
+	if (__builtin_cpu_supports ("sse2")) {
+	    add8kernel = add8_sse2;
+	    add16kernel = add16_sse2;
+	    return;
+	}
+#endif
+	add8kernel = add_none;
+	add16kernel = add_none;
+}
+
+/* size of one pixel of type */
+static int
+pixelSize (int type)
+{
+	return type == BIN_PIXEL_U8 ? 1 : type == BIN_PIXEL_U16 ? 2 : 4;
+}
+
+/* size of one accumulator for type */
+static int
+accSize (int type)
+{
+	return type == BIN_PIXEL_U8 || type == BIN_PIXEL_U16 ? 4 : 8;
+}
+
+/* add the n pixels of one input row down into acc */
+static void
+addDown (int type, void *acc, const void *row, int n)
+{
+	int i;
+
+	switch (type) {
+	case BIN_PIXEL_U8: {
+	    uint32_t *a = (uint32_t *)acc;
+	    const uint8_t *p = (const uint8_t *)row;
+	    for (i = add8kernel (a, p, n); i < n; i++)
+		a[i] += p[i];
+	    }
+	    break;
+	case BIN_PIXEL_U16: {
+	    uint32_t *a = (uint32_t *)acc;
+	    const uint16_t *p = (const uint16_t *)row;
+	    for (i = add16kernel (a, p, n); i < n; i++)
+		a[i] += p[i];
+	    }
+	    break;
+	case BIN_PIXEL_U32: {
+	    uint64_t *a = (uint64_t *)acc;
+	    const uint32_t *p = (const uint32_t *)row;
+	    for (i = 0; i < n; i++)
+		a[i] += p[i];
+	    }
+	    break;
+	case BIN_PIXEL_FLOAT: {
+	    double *a = (double *)acc;
+	    const float *p = (const float *)row;
+	    for (i = 0; i < n; i++)
+		a[i] += p[i];
+	    }
+	    break;
+	}
+}
+
+/* add each binx accumulators across into one of the n pixels of the output row,
+ * saturating at max or dividing by npix for an average
+ */
+#define ADDACROSS(acctype, pixtype, max)					\
+	do {									\
+	    const acctype *a = (const acctype *)acc;				\
+	    pixtype *o = (pixtype *)orow;					\
+	    for (x = 0; x < n; x++, a += binx) {				\
+		acctype s = a[0];						\
+		for (k = 1; k < binx; k++)					\
+		    s += a[k];							\
+		if (mode == BIN_MODE_AVERAGE)					\
+		    o[x] = (pixtype) ((s + npix/2) / npix);			\
+		else								\
+		    o[x] = (pixtype) (s > (max) ? (max) : s);			\
+	    }									\
+	} while (0)
+
+static void
+addAcross (int type, int mode, int binx, int npix, void *orow, const void *acc, int n)
+{
+	int x, k;
+
+	switch (type) {
+	case BIN_PIXEL_U8:
+	    ADDACROSS (uint32_t, uint8_t, UINT8_MAX);
+	    break;
+	case BIN_PIXEL_U16:
+	    ADDACROSS (uint32_t, uint16_t, UINT16_MAX);
+	    break;
+	case BIN_PIXEL_U32:
+	    ADDACROSS (uint64_t, uint32_t, UINT32_MAX);
+	    break;
+	case BIN_PIXEL_FLOAT: {
+	    const double *a = (const double *)acc;
+	    float *o = (float *)orow;
+	    for (x = 0; x < n; x++, a += binx) {
+		double s = a[0];
+		for (k = 1; k < binx; k++)
+		    s += a[k];
+		o[x] = (float) (mode == BIN_MODE_AVERAGE ? s / npix : s);
+	    }
+	    }
+	    break;
+	}
+}
+
+/* bin the output rows of one job */
+static void *
+binRows (void *arg)
+{
+	BinJob *jp = (BinJob *)arg;
+	int psize = pixelSize (jp->type);
+	int owidth = jp->width / jp->binx;
+	int nacc = owidth * jp->binx;
+	size_t inrow = (size_t)jp->width * psize;
+	void *acc;
+	int y, k;
+
+	acc = malloc ((size_t)nacc * accSize (jp->type));
+	if (!acc) {
+	    jp->failed = 1;
+	    return NULL;
+	}
+
+	for (y = jp->row0; y < jp->row1; y++) {
+	    const uint8_t *row = (const uint8_t *)jp->in + (size_t)y * jp->biny * inrow;
+	    memset (acc, 0, (size_t)nacc * accSize (jp->type));
+	    for (k = 0; k < jp->biny; k++, row += inrow)
+		addDown (jp->type, acc, row, nacc);
+	    addAcross (jp->type, jp->mode, jp->binx, jp->binx * jp->biny,
+		(uint8_t *)jp->out + (size_t)y * owidth * psize, acc, owidth);
+	}
+
+	free (acc);
+	jp->failed = 0;
+	return NULL;
+}
+
+/* number of threads to use for npixels input pixels in nrows output rows */
+static int
+nThreads (int threads, size_t npixels, int nrows)
+{
+	if (threads <= 0) {
+	    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	    threads = ncpu > 0 ? (int)ncpu : 1;
+	    if ((size_t)threads > npixels / MINPIXELS)
+		threads = (int)(npixels / MINPIXELS);
+	}
+	if (threads > MAXTHREADS)
+	    threads = MAXTHREADS;
+	if (threads > nrows)
+	    threads = nrows;
+	return threads > 0 ? threads : 1;
+}
+
+int
+binPixels(int type, int mode, int binx, int biny, void *out, const void *in,
+int width, int height, int threads)
+{
+	pthread_t tids[MAXTHREADS];
+	int started[MAXTHREADS];
+	BinJob jobs[MAXTHREADS];
+	int nrows, nt, i;
+
+	if (type < BIN_PIXEL_U8 || type > BIN_PIXEL_FLOAT || binx < 1 || biny < 1
+		|| binx > MAXBIN / biny || width < 0 || height < 0)
+	    return (-1);
+
+	nrows = height / biny;
+	if (width / binx == 0 || nrows == 0)
+	    return (0);
+
+	if (!add16kernel)
+	    pickAddKernels ();
+
+	/* contiguous runs of output rows, the caller doing the first */
+	nt = nThreads (threads, (size_t)width * height, nrows);
+	for (i = 0; i < nt; i++) {
+	    jobs[i].type = type;
+	    jobs[i].mode = mode;
+	    jobs[i].binx = binx;
+	    jobs[i].biny = biny;
+	    jobs[i].out = out;
+	    jobs[i].in = in;
+	    jobs[i].width = width;
+	    jobs[i].row0 = (int)((long)nrows * i / nt);
+	    jobs[i].row1 = (int)((long)nrows * (i+1) / nt);
+	    jobs[i].failed = 1;
+	    started[i] = i > 0 && pthread_create (&tids[i], NULL, binRows, &jobs[i]) == 0;
+	}
+
+	for (i = 0; i < nt; i++) {
+	    if (started[i])
+		pthread_join (tids[i], NULL);
+	    else
+		binRows (&jobs[i]);	/* ours, or a thread that would not start */
+	}
+
+	for (i = 0; i < nt; i++)
+	    if (jobs[i].failed)
+		return (-1);
+	return (0);
+}
+
+#ifdef BINNING_BENCHMARK
+/* standalone benchmark that bins a large 8 and 16 bit frame with the scalar loops
+ * CCDChip::binFrame() used to have and with binPixels(), and checks they agree.
+ * cc -O2 -o binning_benchmark -DBINNING_BENCHMARK binning.c -lpthread
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec*1e-6);
+}
+
+/* the old binFrame(): square bins, saturating as it goes */
+static void
+oldBin8 (uint8_t *bin_buf, const uint8_t *raw, int w, int h, int bin)
+{
+	uint8_t val;
+	int i, j, k, l;
+
+	memset (bin_buf, 0, (size_t)w * h);
+	for (i = 0; i < h; i += bin)
+	    for (j = 0; j < w; j += bin) {
+		for (k = 0; k < bin; k++)
+		    for (l = 0; l < bin; l++) {
+			val = *(raw + j + (i+k) * w + l);
+			if (val + *bin_buf > UINT8_MAX)
+			    *bin_buf = UINT8_MAX;
+			else
+			    *bin_buf += val;
+		    }
+		bin_buf++;
+	    }
+}
+
+static void
+oldBin16 (uint16_t *bin_buf, const uint16_t *raw, int w, int h, int bin)
+{
+	uint16_t val;
+	int i, j, k, l;
+
+	memset (bin_buf, 0, (size_t)w * h * 2);
+	for (i = 0; i < h; i += bin)
+	    for (j = 0; j < w; j += bin) {
+		for (k = 0; k < bin; k++)
+		    for (l = 0; l < bin; l++) {
+			val = *(raw + j + (i+k) * w + l);
+			if (val + *bin_buf > UINT16_MAX)
+			    *bin_buf = UINT16_MAX;
+			else
+			    *bin_buf += val;
+		    }
+		bin_buf++;
+	    }
+}
+
+int
+main (int ac, char *av[])
+{
+	int w = ac > 1 ? atoi(av[1]) : 6048;	/* a full frame 24 MP sensor */
+	int h = ac > 2 ? atoi(av[2]) : 4032;
+	int reps = ac > 3 ? atoi(av[3]) : 5;
+	int threads = ac > 4 ? atoi(av[4]) : 0;
+	int bins[] = { 2, 3, 4 };
+	uint8_t *raw, *ref, *bin;
+	double t0, told, t1, tmt;
+	int b, bpp, r;
+	size_t i, n;
+
+	raw = malloc ((size_t)w * h * 2);
+	ref = malloc ((size_t)w * h * 2);
+	bin = malloc ((size_t)w * h * 2);
+	for (i = 0; i < (size_t)w * h * 2; i++)
+	    raw[i] = rand();
+
+	printf ("%dx%d, %d reps, %d threads (0 for one per cpu)\n", w, h, reps, threads);
+	for (bpp = 8; bpp <= 16; bpp += 8)
+	    for (b = 0; b < (int)(sizeof(bins)/sizeof(bins[0])); b++) {
+		int bn = bins[b], bw = w - w % bn, bh = h - h % bn;
+
+		/* the old loops want whole bins */
+		t0 = now();
+		for (r = 0; r < reps; r++)
+		    if (bpp == 8)
+			oldBin8 (ref, raw, bw, bh, bn);
+		    else
+			oldBin16 ((uint16_t *)ref, (const uint16_t *)raw, bw, bh, bn);
+		told = (now() - t0) / reps;
+
+		t0 = now();
+		for (r = 0; r < reps; r++)
+		    binPixels (bpp == 8 ? BIN_PIXEL_U8 : BIN_PIXEL_U16, BIN_MODE_SUM, bn, bn,
+			bin, raw, bw, bh, 1);
+		t1 = (now() - t0) / reps;
+
+		t0 = now();
+		for (r = 0; r < reps; r++)
+		    binPixels (bpp == 8 ? BIN_PIXEL_U8 : BIN_PIXEL_U16, BIN_MODE_SUM, bn, bn,
+			bin, raw, bw, bh, threads);
+		tmt = (now() - t0) / reps;
+
+		n = (size_t)(bw/bn) * (bh/bn) * (bpp/8);
+		printf ("%2d bit %dx%d: old %7.2f ms, 1 thread %6.2f ms, threaded %6.2f ms, x%.1f%s\n",
+		    bpp, bn, bn, told*1e3, t1*1e3, tmt*1e3, told/tmt,
+		    memcmp (ref, bin, n) ? "  MISMATCH" : "");
+	    }
+
+	return (0);
+}
+#endif
@@ -0,0 +1,75 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+#ifndef BINNING_H
+#define BINNING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \defgroup binning Binning Functions: Software binning of image frames
+ *
+ * Each binx by biny block of pixels becomes one output pixel, either their sum, saturated at
+ * the largest value of the pixel type, or their rounded average. Columns and rows left over
+ * when width or height is not a multiple of the bin are dropped. Rows of output are binned by
+ * several threads at once, with SSE2 or AVX2 doing the summing where the CPU has them.
+ */
+/*@{*/
+
+/** \brief Pixel types binPixels() works on */
+typedef enum
+{
+    BIN_PIXEL_U8 = 0,       /*!< 8 bit unsigned */
+    BIN_PIXEL_U16,          /*!< 16 bit unsigned */
+    BIN_PIXEL_U32,          /*!< 32 bit unsigned */
+    BIN_PIXEL_FLOAT         /*!< 32 bit float */
+} BinPixelType;
+
+/** \brief How binPixels() combines the pixels of a bin */
+typedef enum
+{
+    BIN_MODE_SUM = 0,       /*!< Sum, saturated at the largest value of the pixel type. Floats are not saturated. */
+    BIN_MODE_AVERAGE        /*!< Average, rounded to the nearest integer for integer pixel types */
+} BinMode;
+
+/** \brief Bin a frame.
+    \param type pixel type of in and out, one of BinPixelType.
+    \param mode how to combine the pixels of a bin, one of BinMode.
+    \param binx horizontal bin factor.
+    \param biny vertical bin factor.
+    \param out output frame of (width/binx) x (height/biny) pixels. It must not overlap in.
+    \param in input frame of width x height pixels, rows packed.
+    \param width input width in pixels.
+    \param height input height in pixels.
+    \param threads number of threads to use, 0 to use one for each CPU.
+    \return 0 on success, -1 if an argument is out of range. binx*biny may be at most 65536.
+ */
+extern int binPixels(int type, int mode, int binx, int biny, void *out, const void *in,
+    int width, int height, int threads);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
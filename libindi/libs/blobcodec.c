@@ -0,0 +1,983 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+/* Compression codecs for BLOBs.
+ *
+ * zlib data is one zlib stream. Past ZBLOCKSIZE bytes, pigz style, the input is cut into
+ * blocks which a few threads deflate at once, each from scratch and all but the last ending
+ * with a sync flush, so the blocks simply join into one deflate stream. An index of where the
+ * blocks start follows the zlib trailer. zlib itself stops at the trailer, so any client still
+ * reads the data, and we use the index to inflate the blocks in parallel too:
+ *
+ *   78 xx | block 0 | ... | block n-1 | adler32 | n * compressed size | n | ZBLOCKSIZE | "INDZ"
+ *
+ * all numbers big endian 32 bit. lz4 and zstd data is a series of frames, one for each BLOCKSIZE
+ * bytes of input, compressed a few at once. Each frame records its uncompressed size, so zstd
+ * frames are also uncompressed in parallel.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "config.h"
+
+#ifdef HAVE_LZ4_H
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "blobcodec.h"
+
+#define BLOCKSIZE   (1024*1024)     /* input bytes in each lz4 or zstd frame */
+#define ZBLOCKSIZE  (256*1024)      /* input bytes in each zlib block */
+#define ZINDEXMAGIC "INDZ"          /* ends the zlib block index */
+#define ZINDEXLEN   12              /* bytes in the index after the block sizes */
+#define MAXTHREADS  16              /* most threads one call starts */
+
+/* one frame to compress or uncompress */
+typedef struct
+{
+    const unsigned char *in;
+    size_t inlen;
+    unsigned char *out;
+    size_t outlen;                  /* room at out, then bytes written */
+    int last;                       /* zlib: the block that ends the stream */
+    uLong check;                    /* zlib: adler32 of the uncompressed block */
+    int failed;
+} Block;
+
+/* compress or uncompress one block. ctx is the calling thread's codec context, NULL the first time. */
+typedef void (*BlockFunc)(int codec, int level, Block *bp, void **ctx);
+typedef void (*CtxFree)(int codec, void *ctx);
+
+/* blocks shared by the threads of one call */
+typedef struct
+{
+    BlockFunc func;
+    CtxFree ctxfree;
+    int codec;
+    int level;
+    Block *blocks;
+    int nblocks;
+    int next;                       /* next block to take */
+    pthread_mutex_t lock;
+} BlockQueue;
+
+static const char *codec_names[BLOB_CODEC_N] = { "none", "zlib", "lz4", "zstd" };
+static const char *codec_suffixes[BLOB_CODEC_N] = { "", ".z", ".lz4", ".zst" };
+
+const char *
+blobCodecName(int codec)
+{
+	if (codec < 0 || codec >= BLOB_CODEC_N)
+	    return "unknown";
+	return codec_names[codec];
+}
+
+const char *
+blobCodecSuffix(int codec)
+{
+	if (codec < 0 || codec >= BLOB_CODEC_N)
+	    return "";
+	return codec_suffixes[codec];
+}
+
+int
+blobCodecAvailable(int codec)
+{
+	switch (codec) {
+	case BLOB_CODEC_NONE:
+	case BLOB_CODEC_ZLIB:
+	    return 1;
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4:
+	    return 1;
+#endif
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    return 1;
+#endif
+	default:
+	    return 0;
+	}
+}
+
+int
+blobCodecFromFormat(const char *format)
+{
+	size_t len = strlen (format);
+	int codec;
+
+	for (codec = BLOB_CODEC_ZLIB; codec < BLOB_CODEC_N; codec++) {
+	    size_t slen = strlen (codec_suffixes[codec]);
+	    if (len >= slen && !strcmp (format + len - slen, codec_suffixes[codec]))
+		return codec;
+	}
+
+	return BLOB_CODEC_NONE;
+}
+
+/* number of frames inlen bytes are compressed to, the last may be short */
+static int
+nBlocks (size_t inlen)
+{
+	return inlen > BLOCKSIZE ? (inlen + BLOCKSIZE - 1) / BLOCKSIZE : 1;
+}
+
+/* number of threads to use for nblocks blocks */
+static int
+nThreads (int threads, int nblocks)
+{
+	if (threads <= 0) {
+	    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	    threads = ncpu > 0 ? (int)ncpu : 1;
+	}
+	if (threads > MAXTHREADS)
+	    threads = MAXTHREADS;
+	if (threads > nblocks)
+	    threads = nblocks;
+	return threads;
+}
+
+/* take blocks off q until there are none left */
+static void *
+blockWorker (void *arg)
+{
+	BlockQueue *q = (BlockQueue *)arg;
+	void *ctx = NULL;
+	int i;
+
+	for (;;) {
+	    pthread_mutex_lock (&q->lock);
+	    i = q->next++;
+	    pthread_mutex_unlock (&q->lock);
+	    if (i >= q->nblocks)
+		break;
+	    q->func (q->codec, q->level, &q->blocks[i], &ctx);
+	}
+
+	if (ctx)
+	    q->ctxfree (q->codec, ctx);
+
+	return NULL;
+}
+
+/* run func over all blocks with up to threads threads, the caller being one of them.
+ * return 0 if every block succeeded, else -1.
+ */
+static int
+runBlocks (BlockFunc func, CtxFree ctxfree, int codec, int level, Block *blocks,
+int nblocks, int threads)
+{
+	pthread_t tids[MAXTHREADS];
+	BlockQueue q;
+	int nt, started, i;
+
+	q.func = func;
+	q.ctxfree = ctxfree;
+	q.codec = codec;
+	q.level = level;
+	q.blocks = blocks;
+	q.nblocks = nblocks;
+	q.next = 0;
+	pthread_mutex_init (&q.lock, NULL);
+
+	nt = nThreads (threads, nblocks);
+	for (started = 0; started < nt-1; started++)
+	    if (pthread_create (&tids[started], NULL, blockWorker, &q) != 0)
+		break;		/* fewer helpers, same result */
+
+	blockWorker (&q);
+
+	for (i = 0; i < started; i++)
+	    pthread_join (tids[i], NULL);
+	pthread_mutex_destroy (&q.lock);
+
+	for (i = 0; i < nblocks; i++)
+	    if (blocks[i].failed)
+		return (-1);
+	return (0);
+}
+
+#ifdef HAVE_LZ4_H
+static void
+lz4Prefs (LZ4F_preferences_t *prefs, int level, size_t inlen)
+{
+	memset (prefs, 0, sizeof(*prefs));
+	prefs->frameInfo.blockSizeID = LZ4F_max1MB;
+	prefs->frameInfo.contentSize = inlen;
+	prefs->compressionLevel = level;
+}
+#endif
+
+/* most bytes one frame of inlen bytes may compress to */
+static size_t
+frameBound (int codec, size_t inlen)
+{
+	switch (codec) {
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4: {
+	    LZ4F_preferences_t prefs;
+	    lz4Prefs (&prefs, 0, inlen);
+	    return LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound (inlen, &prefs);
+	    }
+#endif
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    return ZSTD_compressBound (inlen);
+#endif
+	default:
+	    return inlen;
+	}
+}
+
+static void
+compressBlock (int codec, int level, Block *bp, void **ctx)
+{
+	size_t n = 0;
+
+	bp->failed = 1;
+
+	switch (codec) {
+	case BLOB_CODEC_ZLIB: {
+	    z_stream *zs = (z_stream *)*ctx;
+
+	    if (!zs) {
+		zs = (z_stream *) calloc (1, sizeof(z_stream));
+		if (zs && deflateInit2 (zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		    free (zs);
+		    zs = NULL;
+		}
+		*ctx = zs;
+	    }
+	    if (!zs || deflateReset (zs) != Z_OK)
+		break;
+
+	    /* raw deflate, all but the last block end on a byte boundary without the final bit */
+	    zs->next_in = (Bytef *)bp->in;
+	    zs->avail_in = bp->inlen;
+	    zs->next_out = bp->out;
+	    zs->avail_out = bp->outlen;
+	    if (deflate (zs, bp->last ? Z_FINISH : Z_SYNC_FLUSH) != (bp->last ? Z_STREAM_END : Z_OK)
+		    || zs->avail_in != 0 || zs->avail_out == 0)
+		break;
+	    n = bp->outlen - zs->avail_out;
+	    bp->check = adler32 (adler32 (0L, Z_NULL, 0), bp->in, bp->inlen);
+	    bp->failed = 0;
+	    }
+	    break;
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4: {
+	    LZ4F_cctx *cctx;
+	    LZ4F_preferences_t prefs;
+	    size_t r;
+
+	    if (!*ctx && LZ4F_isError (LZ4F_createCompressionContext ((LZ4F_cctx **)ctx, LZ4F_VERSION)))
+		*ctx = NULL;
+	    if (!*ctx)
+		break;
+	    cctx = (LZ4F_cctx *)*ctx;
+	    lz4Prefs (&prefs, level, bp->inlen);
+
+	    /* header, blocks, end mark */
+	    r = LZ4F_compressBegin (cctx, bp->out, bp->outlen, &prefs);
+	    if (LZ4F_isError (r))
+		break;
+	    n = r;
+	    r = LZ4F_compressUpdate (cctx, bp->out + n, bp->outlen - n, bp->in, bp->inlen, NULL);
+	    if (LZ4F_isError (r))
+		break;
+	    n += r;
+	    r = LZ4F_compressEnd (cctx, bp->out + n, bp->outlen - n, NULL);
+	    if (LZ4F_isError (r))
+		break;
+	    n += r;
+	    bp->failed = 0;
+	    }
+	    break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    if (!*ctx)
+		*ctx = ZSTD_createCCtx ();
+	    if (!*ctx)
+		break;
+	    n = ZSTD_compressCCtx ((ZSTD_CCtx *)*ctx, bp->out, bp->outlen, bp->in, bp->inlen, level);
+	    if (!ZSTD_isError (n))
+		bp->failed = 0;
+	    break;
+#endif
+	default:
+	    break;
+	}
+
+	bp->outlen = bp->failed ? 0 : n;
+}
+
+static void
+uncompressBlock (int codec, int level, Block *bp, void **ctx)
+{
+	size_t n = 0;
+
+	(void)level;
+	bp->failed = 1;
+
+	switch (codec) {
+	case BLOB_CODEC_ZLIB: {
+	    z_stream *zs = (z_stream *)*ctx;
+
+	    if (!zs) {
+		zs = (z_stream *) calloc (1, sizeof(z_stream));
+		if (zs && inflateInit2 (zs, -MAX_WBITS) != Z_OK) {
+		    free (zs);
+		    zs = NULL;
+		}
+		*ctx = zs;
+	    }
+	    if (!zs || inflateReset (zs) != Z_OK)
+		break;
+
+	    /* the block must fill out exactly, ending the stream if it is the last */
+	    zs->next_in = (Bytef *)bp->in;
+	    zs->avail_in = bp->inlen;
+	    zs->next_out = bp->out;
+	    zs->avail_out = bp->outlen;
+	    if (inflate (zs, Z_SYNC_FLUSH) != (bp->last ? Z_STREAM_END : Z_OK)
+		    || zs->avail_in != 0 || zs->avail_out != 0)
+		break;
+	    n = bp->outlen;
+	    bp->check = adler32 (adler32 (0L, Z_NULL, 0), bp->out, bp->outlen);
+	    bp->failed = 0;
+	    }
+	    break;
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    if (!*ctx)
+		*ctx = ZSTD_createDCtx ();
+	    if (!*ctx)
+		break;
+	    n = ZSTD_decompressDCtx ((ZSTD_DCtx *)*ctx, bp->out, bp->outlen, bp->in, bp->inlen);
+	    if (!ZSTD_isError (n))
+		bp->failed = 0;
+	    break;
+#endif
+	default:
+	    break;
+	}
+
+	bp->outlen = bp->failed ? 0 : n;
+}
+
+static void
+freeCompressCtx (int codec, void *ctx)
+{
+	switch (codec) {
+	case BLOB_CODEC_ZLIB:
+	    deflateEnd ((z_stream *)ctx);
+	    free (ctx);
+	    break;
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4:
+	    LZ4F_freeCompressionContext ((LZ4F_cctx *)ctx);
+	    break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    ZSTD_freeCCtx ((ZSTD_CCtx *)ctx);
+	    break;
+#endif
+	default:
+	    break;
+	}
+}
+
+static void
+freeUncompressCtx (int codec, void *ctx)
+{
+	switch (codec) {
+	case BLOB_CODEC_ZLIB:
+	    inflateEnd ((z_stream *)ctx);
+	    free (ctx);
+	    break;
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    ZSTD_freeDCtx ((ZSTD_DCtx *)ctx);
+	    break;
+#endif
+	default:
+	    break;
+	}
+}
+
+/* number of zlib blocks inlen bytes are deflated in */
+static int
+nZBlocks (size_t inlen)
+{
+	return inlen > ZBLOCKSIZE ? (inlen + ZBLOCKSIZE - 1) / ZBLOCKSIZE : 1;
+}
+
+/* most bytes one raw deflate block of inlen bytes, sync flush included, may take */
+static size_t
+zblockBound (size_t inlen)
+{
+	return compressBound (inlen) + 8;
+}
+
+static void
+put32 (unsigned char *p, uLong v)
+{
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+static uLong
+get32 (const unsigned char *p)
+{
+	return ((uLong)p[0] << 24) | ((uLong)p[1] << 16) | ((uLong)p[2] << 8) | p[3];
+}
+
+/* deflate in blocks of ZBLOCKSIZE in parallel, into one zlib stream followed by the block index */
+static int
+zlibCompress (int level, int threads, unsigned char *out, size_t *outlen, const unsigned char *in,
+size_t inlen)
+{
+	Block *blocks;
+	size_t fullbound, n;
+	uLong check;
+	int nblocks, i, r;
+
+	nblocks = nZBlocks (inlen);
+	blocks = (Block *) malloc (nblocks * sizeof(Block));
+	if (!blocks)
+	    return (-1);
+
+	fullbound = zblockBound (ZBLOCKSIZE);
+	for (i = 0; i < nblocks; i++) {
+	    blocks[i].in = in + (size_t)i*ZBLOCKSIZE;
+	    blocks[i].inlen = i < nblocks-1 ? ZBLOCKSIZE : inlen - (size_t)i*ZBLOCKSIZE;
+	    blocks[i].out = out + 2 + (size_t)i*fullbound;
+	    blocks[i].outlen = zblockBound (blocks[i].inlen);
+	    blocks[i].last = i == nblocks-1;
+	}
+
+	r = runBlocks (compressBlock, freeCompressCtx, BLOB_CODEC_ZLIB, level, blocks, nblocks, threads);
+
+	if (r == 0) {
+	    /* zlib header, FLEVEL as zlib would set it for level */
+	    out[0] = 0x78;
+	    out[1] = level == 1 ? 0x01 : level >= 2 && level <= 5 ? 0x5e : level >= 7 ? 0xda : 0x9c;
+	    n = 2;
+
+	    /* pack the blocks down, adding up their checks */
+	    check = adler32 (0L, Z_NULL, 0);
+	    for (i = 0; i < nblocks; i++) {
+		memmove (out + n, blocks[i].out, blocks[i].outlen);
+		n += blocks[i].outlen;
+		check = adler32_combine (check, blocks[i].check, blocks[i].inlen);
+	    }
+	    put32 (out + n, check);
+	    n += 4;
+
+	    for (i = 0; i < nblocks; i++, n += 4)
+		put32 (out + n, blocks[i].outlen);
+	    put32 (out + n, nblocks);
+	    put32 (out + n + 4, ZBLOCKSIZE);
+	    memcpy (out + n + 8, ZINDEXMAGIC, 4);
+	    *outlen = n + ZINDEXLEN;
+	}
+
+	free (blocks);
+	return (r);
+}
+
+/* inflate the blocks zlibCompress() indexed in parallel. return 0 if done, 1 if in has no
+ * usable index, -1 if the blocks are bad.
+ */
+static int
+zlibUncompressBlocks (int threads, unsigned char *out, size_t outlen, const unsigned char *in,
+size_t inlen)
+{
+	const unsigned char *index;
+	Block *blocks;
+	size_t bsize, inpos, outpos;
+	uLong nblocks, check;
+	int i, r;
+
+	if (inlen < 2 + 4 + ZINDEXLEN || memcmp (in + inlen - 4, ZINDEXMAGIC, 4))
+	    return (1);
+	nblocks = get32 (in + inlen - ZINDEXLEN);
+	bsize = get32 (in + inlen - ZINDEXLEN + 4);
+	if (nblocks < 2 || bsize == 0 || nblocks > (inlen - 2 - 4 - ZINDEXLEN) / 4
+		|| (outlen + bsize - 1) / bsize != nblocks)
+	    return (1);
+	index = in + inlen - ZINDEXLEN - 4*nblocks;
+
+	blocks = (Block *) malloc (nblocks * sizeof(Block));
+	if (!blocks)
+	    return (-1);
+
+	for (i = 0, inpos = 2, outpos = 0; i < (int)nblocks; i++) {
+	    blocks[i].in = in + inpos;
+	    blocks[i].inlen = get32 (index + 4*i);
+	    blocks[i].out = out + outpos;
+	    blocks[i].outlen = i < (int)nblocks-1 ? bsize : outlen - outpos;
+	    blocks[i].last = i == (int)nblocks-1;
+	    inpos += blocks[i].inlen;
+	    outpos += blocks[i].outlen;
+	    if (inpos > (size_t)(index - in) - 4)
+		break;
+	}
+
+	/* the blocks and the adler32 must fill the space before the index exactly */
+	if (i < (int)nblocks || inpos + 4 != (size_t)(index - in)) {
+	    free (blocks);
+	    return (1);
+	}
+
+	r = runBlocks (uncompressBlock, freeUncompressCtx, BLOB_CODEC_ZLIB, 0, blocks, nblocks, threads);
+
+	if (r == 0) {
+	    check = adler32 (0L, Z_NULL, 0);
+	    for (i = 0; i < (int)nblocks; i++)
+		check = adler32_combine (check, blocks[i].check, blocks[i].outlen);
+	    if (check != get32 (in + inpos))
+		r = -1;
+	}
+
+	free (blocks);
+	return (r);
+}
+
+size_t
+blobCompressBound(int codec, size_t inlen)
+{
+	size_t nfull;
+
+	switch (codec) {
+	case BLOB_CODEC_ZLIB:
+	    if (nZBlocks (inlen) == 1)
+		return compressBound (inlen);
+	    /* block i is deflated to 2+i*zblockBound(ZBLOCKSIZE), then packed down */
+	    nfull = nZBlocks (inlen) - 1;
+	    return 2 + nfull * zblockBound (ZBLOCKSIZE) + zblockBound (inlen - nfull*ZBLOCKSIZE)
+		+ 4 + 4*(nfull+1) + ZINDEXLEN;
+	case BLOB_CODEC_LZ4:
+	case BLOB_CODEC_ZSTD:
+	    /* frame i is compressed to i*frameBound(BLOCKSIZE), then packed down */
+	    nfull = nBlocks (inlen) - 1;
+	    return nfull * frameBound (codec, BLOCKSIZE) + frameBound (codec, inlen - nfull*BLOCKSIZE);
+	default:
+	    return inlen;
+	}
+}
+
+int
+blobCompress(int codec, int level, int threads, unsigned char *out, size_t *outlen,
+const unsigned char *in, size_t inlen)
+{
+	Block *blocks;
+	size_t fullbound, n;
+	int nblocks, i, r;
+
+	if (!blobCodecAvailable (codec) || *outlen < blobCompressBound (codec, inlen))
+	    return (-1);
+
+	switch (codec) {
+	case BLOB_CODEC_NONE:
+	    memcpy (out, in, inlen);
+	    *outlen = inlen;
+	    return (0);
+
+	case BLOB_CODEC_ZLIB: {
+	    uLongf zlen = *outlen;
+	    if (level <= 0)
+		level = Z_DEFAULT_COMPRESSION;
+	    else if (level > Z_BEST_COMPRESSION)
+		level = Z_BEST_COMPRESSION;
+	    if (nZBlocks (inlen) > 1)
+		return zlibCompress (level, threads, out, outlen, in, inlen);
+	    if (compress2 (out, &zlen, in, inlen, level) != Z_OK)
+		return (-1);
+	    *outlen = zlen;
+	    return (0);
+	    }
+
+	default:
+	    break;
+	}
+
+#ifdef HAVE_LZ4_H
+	if (codec == BLOB_CODEC_LZ4 && level > LZ4F_compressionLevel_max ())
+	    level = LZ4F_compressionLevel_max ();
+#endif
+#ifdef HAVE_ZSTD_H
+	if (codec == BLOB_CODEC_ZSTD && level > ZSTD_maxCLevel ())
+	    level = ZSTD_maxCLevel ();
+#endif
+	if (level < 0)
+	    level = 0;
+
+	nblocks = nBlocks (inlen);
+	blocks = (Block *) malloc (nblocks * sizeof(Block));
+	if (!blocks)
+	    return (-1);
+
+	fullbound = frameBound (codec, BLOCKSIZE);
+	for (i = 0; i < nblocks; i++) {
+	    blocks[i].in = in + (size_t)i*BLOCKSIZE;
+	    blocks[i].inlen = i < nblocks-1 ? BLOCKSIZE : inlen - (size_t)i*BLOCKSIZE;
+	    blocks[i].out = out + (size_t)i*fullbound;
+	    blocks[i].outlen = frameBound (codec, blocks[i].inlen);
+	}
+
+	r = runBlocks (compressBlock, freeCompressCtx, codec, level, blocks, nblocks, threads);
+
+	/* pack the frames down */
+	for (n = 0, i = 0; r == 0 && i < nblocks; i++) {
+	    memmove (out + n, blocks[i].out, blocks[i].outlen);
+	    n += blocks[i].outlen;
+	}
+	*outlen = n;
+
+	free (blocks);
+	return (r);
+}
+
+#ifdef HAVE_ZSTD_H
+/* uncompress zstd frames, in parallel if there are several and they record their sizes */
+static int
+zstdUncompress (int threads, unsigned char *out, size_t *outlen, const unsigned char *in,
+size_t inlen)
+{
+	Block *blocks = NULL;
+	int nblocks = 0, i, r;
+	size_t inpos, outpos, total;
+
+	for (inpos = 0, outpos = 0; inpos < inlen; nblocks++) {
+	    size_t flen = ZSTD_findFrameCompressedSize (in + inpos, inlen - inpos);
+	    unsigned long long ulen = ZSTD_getFrameContentSize (in + inpos, inlen - inpos);
+	    Block *newblocks;
+
+	    if (ZSTD_isError (flen) || ulen == ZSTD_CONTENTSIZE_UNKNOWN ||
+		    ulen == ZSTD_CONTENTSIZE_ERROR || outpos + ulen > *outlen) {
+		/* let zstd sort it out in one go */
+		free (blocks);
+		total = ZSTD_decompress (out, *outlen, in, inlen);
+		if (ZSTD_isError (total))
+		    return (-1);
+		*outlen = total;
+		return (0);
+	    }
+
+	    newblocks = (Block *) realloc (blocks, (nblocks+1) * sizeof(Block));
+	    if (!newblocks) {
+		free (blocks);
+		return (-1);
+	    }
+	    blocks = newblocks;
+	    blocks[nblocks].in = in + inpos;
+	    blocks[nblocks].inlen = flen;
+	    blocks[nblocks].out = out + outpos;
+	    blocks[nblocks].outlen = ulen;
+	    inpos += flen;
+	    outpos += ulen;
+	}
+
+	r = runBlocks (uncompressBlock, freeUncompressCtx, BLOB_CODEC_ZSTD, 0, blocks, nblocks, threads);
+
+	/* each frame must fill exactly the room its header promised */
+	for (i = 0, total = 0; i < nblocks; i++)
+	    total += blocks[i].outlen;
+	if (total != outpos)
+	    r = -1;
+
+	free (blocks);
+	*outlen = outpos;
+	return (r);
+}
+#endif
+
+#ifdef HAVE_LZ4_H
+/* uncompress lz4 frames one after the other */
+static int
+lz4Uncompress (unsigned char *out, size_t *outlen, const unsigned char *in, size_t inlen)
+{
+	LZ4F_dctx *dctx;
+	size_t inpos = 0, outpos = 0, r = 0;
+
+	if (LZ4F_isError (LZ4F_createDecompressionContext (&dctx, LZ4F_VERSION)))
+	    return (-1);
+
+	while (inpos < inlen) {
+	    size_t dstlen = *outlen - outpos;
+	    size_t srclen = inlen - inpos;
+
+	    r = LZ4F_decompress (dctx, out + outpos, &dstlen, in + inpos, &srclen, NULL);
+	    if (LZ4F_isError (r))
+		break;
+	    inpos += srclen;
+	    outpos += dstlen;
+	    if (srclen == 0 && dstlen == 0)
+		break;		/* out is full */
+	}
+
+	LZ4F_freeDecompressionContext (dctx);
+
+	/* r is 0 once the last frame is complete */
+	if (LZ4F_isError (r) || r != 0 || inpos != inlen)
+	    return (-1);
+	*outlen = outpos;
+	return (0);
+}
+#endif
+
+int
+blobUncompress(int codec, int threads, unsigned char *out, size_t *outlen,
+const unsigned char *in, size_t inlen)
+{
+	switch (codec) {
+	case BLOB_CODEC_NONE:
+	    if (inlen > *outlen)
+		return (-1);
+	    memcpy (out, in, inlen);
+	    *outlen = inlen;
+	    return (0);
+
+	case BLOB_CODEC_ZLIB: {
+	    uLongf zlen = *outlen;
+	    if (zlibUncompressBlocks (threads, out, *outlen, in, inlen) == 0)
+		return (0);
+	    /* one zlib stream, or blocks that did not check out and get a second opinion */
+	    if (uncompress (out, &zlen, in, inlen) != Z_OK)
+		return (-1);
+	    *outlen = zlen;
+	    return (0);
+	    }
+
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4:
+	    return lz4Uncompress (out, outlen, in, inlen);
+#endif
+
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    return zstdUncompress (threads, out, outlen, in, inlen);
+#endif
+
+	default:
+	    return (-1);
+	}
+}
+
+/* state of one BLOB uncompressed a piece at a time */
+struct _BLOBStream
+{
+    int codec;
+    unsigned char *out;
+    size_t outlen;                  /* room at out */
+    size_t outpos;                  /* bytes written */
+    size_t left;                    /* lz4, zstd: 0 once the last frame is complete */
+    int done;                       /* zlib: the stream ended, the rest is the block index */
+    int failed;
+    z_stream zs;
+#ifdef HAVE_LZ4_H
+    LZ4F_dctx *lz4;
+#endif
+#ifdef HAVE_ZSTD_H
+    ZSTD_DStream *zstd;
+#endif
+};
+
+BLOBStream *
+blobUncompressBegin(int codec, unsigned char *out, size_t outlen)
+{
+	BLOBStream *sp;
+
+	if (!blobCodecAvailable (codec))
+	    return NULL;
+	sp = (BLOBStream *) calloc (1, sizeof(BLOBStream));
+	if (!sp)
+	    return NULL;
+	sp->codec = codec;
+	sp->out = out;
+	sp->outlen = outlen;
+
+	switch (codec) {
+	case BLOB_CODEC_ZLIB:
+	    if (inflateInit (&sp->zs) != Z_OK)
+		sp->failed = 1;
+	    break;
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4:
+	    if (LZ4F_isError (LZ4F_createDecompressionContext (&sp->lz4, LZ4F_VERSION))) {
+		sp->lz4 = NULL;
+		sp->failed = 1;
+	    }
+	    break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    sp->zstd = ZSTD_createDStream ();
+	    if (!sp->zstd || ZSTD_isError (ZSTD_initDStream (sp->zstd)))
+		sp->failed = 1;
+	    break;
+#endif
+	default:
+	    break;
+	}
+
+	if (sp->failed) {
+	    size_t outlen;
+	    blobUncompressEnd (sp, &outlen);
+	    return NULL;
+	}
+	return sp;
+}
+
+int
+blobUncompressPart(BLOBStream *sp, const unsigned char *in, size_t inlen)
+{
+	if (sp->failed)
+	    return (-1);
+
+	switch (sp->codec) {
+	case BLOB_CODEC_NONE:
+	    if (inlen > sp->outlen - sp->outpos) {
+		sp->failed = 1;
+		break;
+	    }
+	    memcpy (sp->out + sp->outpos, in, inlen);
+	    sp->outpos += inlen;
+	    break;
+
+	case BLOB_CODEC_ZLIB: {
+	    int r;
+
+	    if (sp->done)
+		break;
+	    sp->zs.next_in = (Bytef *)in;
+	    sp->zs.avail_in = inlen;
+	    sp->zs.next_out = sp->out + sp->outpos;
+	    sp->zs.avail_out = sp->outlen - sp->outpos;
+	    r = inflate (&sp->zs, Z_NO_FLUSH);
+	    sp->outpos = sp->outlen - sp->zs.avail_out;
+	    if (r == Z_STREAM_END)
+		sp->done = 1;
+	    else if (r != Z_OK && !(r == Z_BUF_ERROR && sp->zs.avail_in == 0))
+		sp->failed = 1;
+	    else if (sp->zs.avail_in != 0)
+		sp->failed = 1;		/* more than outlen */
+	    }
+	    break;
+
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4: {
+	    size_t inpos = 0;
+
+	    while (inpos < inlen) {
+		size_t dstlen = sp->outlen - sp->outpos;
+		size_t srclen = inlen - inpos;
+
+		sp->left = LZ4F_decompress (sp->lz4, sp->out + sp->outpos, &dstlen, in + inpos, &srclen, NULL);
+		if (LZ4F_isError (sp->left) || (srclen == 0 && dstlen == 0)) {
+		    sp->failed = 1;
+		    break;
+		}
+		inpos += srclen;
+		sp->outpos += dstlen;
+	    }
+	    }
+	    break;
+#endif
+
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD: {
+	    ZSTD_inBuffer ib = { in, inlen, 0 };
+
+	    while (ib.pos < ib.size) {
+		ZSTD_outBuffer ob = { sp->out, sp->outlen, sp->outpos };
+		size_t inpos = ib.pos;
+
+		sp->left = ZSTD_decompressStream (sp->zstd, &ob, &ib);
+		if (ZSTD_isError (sp->left) || (ib.pos == inpos && ob.pos == sp->outpos)) {
+		    sp->failed = 1;
+		    break;
+		}
+		sp->outpos = ob.pos;
+	    }
+	    }
+	    break;
+#endif
+
+	default:
+	    sp->failed = 1;
+	    break;
+	}
+
+	return (sp->failed ? -1 : 0);
+}
+
+size_t
+blobUncompressedBytes(const BLOBStream *sp)
+{
+	return sp->outpos;
+}
+
+int
+blobUncompressEnd(BLOBStream *sp, size_t *outlen)
+{
+	int r = sp->failed ? -1 : 0;
+
+	switch (sp->codec) {
+	case BLOB_CODEC_ZLIB:
+	    if (!sp->done)
+		r = -1;
+	    inflateEnd (&sp->zs);
+	    break;
+#ifdef HAVE_LZ4_H
+	case BLOB_CODEC_LZ4:
+	    if (sp->left != 0)
+		r = -1;
+	    if (sp->lz4)
+		LZ4F_freeDecompressionContext (sp->lz4);
+	    break;
+#endif
+#ifdef HAVE_ZSTD_H
+	case BLOB_CODEC_ZSTD:
+	    if (sp->left != 0)
+		r = -1;
+	    ZSTD_freeDStream (sp->zstd);
+	    break;
+#endif
+	default:
+	    break;
+	}
+
+	*outlen = sp->outpos;
+	free (sp);
+	return (r);
+}
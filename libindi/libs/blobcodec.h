@@ -0,0 +1,133 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+#ifndef BLOBCODEC_H
+#define BLOBCODEC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \defgroup blobcodec BLOB Codec Functions: Compress and uncompress BLOB data
+ *
+ * A compressed BLOB carries the suffix of its codec at the end of its format, e.g. ".fits.zst",
+ * and its size attribute is the uncompressed size. lz4 and zstd data is a series of independent
+ * frames of at most 1 MiB of input each, so both ends may work on several frames at once. Each
+ * frame is a standard one, the stock lz4 and zstd tools read the data as is. Past 256 KiB, zlib
+ * data is deflated in independent blocks joined into a single zlib stream, followed by an index
+ * of the blocks that zlib ignores; any zlib reader uncompresses it, and blobUncompress() uses the
+ * index to inflate the blocks in parallel.
+ */
+/*@{*/
+
+/** \brief BLOB compression codecs */
+typedef enum
+{
+    BLOB_CODEC_NONE = 0,    /*!< Not compressed */
+    BLOB_CODEC_ZLIB,        /*!< zlib, suffix .z */
+    BLOB_CODEC_LZ4,         /*!< lz4 frames, suffix .lz4 */
+    BLOB_CODEC_ZSTD,        /*!< zstd frames, suffix .zst */
+    BLOB_CODEC_N
+} BLOBCodec;
+
+/** \brief Return the name of a codec, e.g. "zstd". */
+extern const char *blobCodecName(int codec);
+
+/** \brief Return the format suffix of a codec, e.g. ".zst". */
+extern const char *blobCodecSuffix(int codec);
+
+/** \brief Return 1 if this library was built with support for codec, 0 if not. */
+extern int blobCodecAvailable(int codec);
+
+/** \brief Find the codec a BLOB was compressed with.
+    \param format the BLOB format, e.g. ".fits.z".
+    \return the codec whose suffix ends format, BLOB_CODEC_NONE if there is none.
+ */
+extern int blobCodecFromFormat(const char *format);
+
+/** \brief Return the largest size blobCompress() may produce from inlen bytes with codec. */
+extern size_t blobCompressBound(int codec, size_t inlen);
+
+/** \brief Compress a buffer.
+    \param codec codec to use.
+    \param level compression level, clamped to what the codec supports. 0 picks the codec's default.
+    \param threads number of threads to use, 0 to use one for each CPU.
+    \param out output buffer.
+    \param outlen size of out, at least blobCompressBound() bytes. Set to the compressed size on return.
+    \param in input buffer.
+    \param inlen number of bytes to compress.
+    \return 0 on success, -1 on failure.
+ */
+extern int blobCompress(int codec, int level, int threads, unsigned char *out, size_t *outlen,
+    const unsigned char *in, size_t inlen);
+
+/** \brief Uncompress a buffer.
+    \param codec codec in was compressed with.
+    \param threads number of threads to use, 0 to use one for each CPU.
+    \param out output buffer.
+    \param outlen size of out, the uncompressed size of the BLOB. Set to the uncompressed size on return.
+    \param in compressed buffer.
+    \param inlen number of bytes in in.
+    \return 0 on success, -1 on failure.
+ */
+extern int blobUncompress(int codec, int threads, unsigned char *out, size_t *outlen,
+    const unsigned char *in, size_t inlen);
+
+/** \brief A BLOB being uncompressed a piece at a time. */
+typedef struct _BLOBStream BLOBStream;
+
+/** \brief Start uncompressing a BLOB a piece at a time, as its data arrives.
+
+    Frames and blocks are uncompressed one after the other as they come, on the calling thread.
+    \param codec codec the BLOB was compressed with.
+    \param out output buffer.
+    \param outlen size of out, the uncompressed size of the BLOB.
+    \return state for blobUncompressPart() and blobUncompressEnd(), NULL if codec is not available or memory runs out.
+ */
+extern BLOBStream *blobUncompressBegin(int codec, unsigned char *out, size_t outlen);
+
+/** \brief Uncompress the next piece of a BLOB.
+    \param sp state from blobUncompressBegin().
+    \param in next bytes of compressed data.
+    \param inlen number of bytes in in.
+    \return 0 on success, -1 if the data is bad or uncompresses to more than outlen. Once it fails, it goes on failing.
+ */
+extern int blobUncompressPart(BLOBStream *sp, const unsigned char *in, size_t inlen);
+
+/** \brief Return the number of bytes written to out so far, they are final as they come in order. */
+extern size_t blobUncompressedBytes(const BLOBStream *sp);
+
+/** \brief Finish uncompressing a BLOB and free sp.
+    \param sp state from blobUncompressBegin().
+    \param outlen set to the number of bytes written to out.
+    \return 0 if all the data was good and complete, else -1.
+ */
+extern int blobUncompressEnd(BLOBStream *sp, size_t *outlen);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
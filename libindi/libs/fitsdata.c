@@ -0,0 +1,183 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+/* FITS data units.
+ *
+ * A 16 or 32 bit pixel v is stored as the signed big-endian value v - BZERO, which has the
+ * same bits as v with the top one flipped. The kernels shuffle the bytes of a vector of pixels
+ * into big-endian order and flip the top bit, now in the first byte of each pixel, with an xor.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "fitsdata.h"
+
+/* convert n pixels from p to q, returning how many were done. the scalar loops in fitsPutPixels() do the rest. */
+typedef size_t (*PutKernel)(uint8_t *q, const uint8_t *p, size_t n);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+#define FITSDATA_X86
+
+__attribute__((target("ssse3"))) static size_t
+put16_ssse3 (uint8_t *q, const uint8_t *p, size_t n)
+{
+	const __m128i swap = _mm_setr_epi8 (1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	const __m128i flip = _mm_set1_epi16 (0x0080);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+	    __m128i v = _mm_loadu_si128 ((const __m128i *)(p + 2*i));
+	    _mm_storeu_si128 ((__m128i *)(q + 2*i), _mm_xor_si128 (_mm_shuffle_epi8 (v, swap), flip));
+	}
+	return (i);
+}
+
+__attribute__((target("ssse3"))) static size_t
+put32_ssse3 (uint8_t *q, const uint8_t *p, size_t n)
+{
+	const __m128i swap = _mm_setr_epi8 (3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	const __m128i flip = _mm_set1_epi32 (0x00000080);
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+	    __m128i v = _mm_loadu_si128 ((const __m128i *)(p + 4*i));
+	    _mm_storeu_si128 ((__m128i *)(q + 4*i), _mm_xor_si128 (_mm_shuffle_epi8 (v, swap), flip));
+	}
+	return (i);
+}
+
+__attribute__((target("avx2"))) static size_t
+put16_avx2 (uint8_t *q, const uint8_t *p, size_t n)
+{
+	const __m256i swap = _mm256_setr_epi8 (1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+					       1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	const __m256i flip = _mm256_set1_epi16 (0x0080);
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+	    __m256i v = _mm256_loadu_si256 ((const __m256i *)(p + 2*i));
+	    _mm256_storeu_si256 ((__m256i *)(q + 2*i), _mm256_xor_si256 (_mm256_shuffle_epi8 (v, swap), flip));
+	}
+	return (i);
+}
+
+__attribute__((target("avx2"))) static size_t
+put32_avx2 (uint8_t *q, const uint8_t *p, size_t n)
+{
+	const __m256i swap = _mm256_setr_epi8 (3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+					       3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	const __m256i flip = _mm256_set1_epi32 (0x00000080);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+	    __m256i v = _mm256_loadu_si256 ((const __m256i *)(p + 4*i));
+	    _mm256_storeu_si256 ((__m256i *)(q + 4*i), _mm256_xor_si256 (_mm256_shuffle_epi8 (v, swap), flip));
+	}
+	return (i);
+}
+
+#endif
+
+/* kernel that does nothing, leaving it all to the scalar loops */
+static size_t
+put_none (uint8_t *q, const uint8_t *p, size_t n)
+{
+	(void) q;
+	(void) p;
+	(void) n;
+	return (0);
+}
+
+static PutKernel put16kernel, put32kernel;
+
+/* pick the fastest kernels this cpu can run. they are the same each time,
+ * so racing threads may safely both set them. put32kernel goes last, fitsPutPixels() tests it.
+ */
+static void
+pickPutKernels (void)
+{
+#if defined(FITSDATA_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports ("avx2")) {
+	    put16kernel = put16_avx2;
+	    put32kernel = put32_avx2;
+	    return;
+	}
+	if (__builtin_cpu_supports ("ssse3")) {
+	    put16kernel = put16_ssse3;
+	    put32kernel = put32_ssse3;
+	    return;
+	}
+#endif
+	put16kernel = put_none;
+	put32kernel = put_none;
+}
+
+size_t
+fitsDataSize(int bpp, size_t npixels)
+{
+	size_t n = npixels * (bpp / 8);
+
+	return ((n + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK);
+}
+
+int
+fitsPutPixels(int bpp, void *fits, const void *pixels, size_t npixels)
+{
+	uint8_t *q = (uint8_t *)fits;
+	const uint8_t *p = (const uint8_t *)pixels;
+	size_t i;
+
+	if (!put32kernel)
+	    pickPutKernels ();
+
+	switch (bpp) {
+	case 8:
+	    memcpy (q, p, npixels);
+	    break;
+	case 16:
+	    for (i = put16kernel (q, p, npixels); i < npixels; i++) {
+		uint16_t v;
+		memcpy (&v, p + 2*i, 2);
+		q[2*i] = (v >> 8) ^ 0x80;
+		q[2*i+1] = v;
+	    }
+	    break;
+	case 32:
+	    for (i = put32kernel (q, p, npixels); i < npixels; i++) {
+		uint32_t v;
+		memcpy (&v, p + 4*i, 4);
+		q[4*i] = (v >> 24) ^ 0x80;
+		q[4*i+1] = v >> 16;
+		q[4*i+2] = v >> 8;
+		q[4*i+3] = v;
+	    }
+	    break;
+	default:
+	    return (-1);
+	}
+
+	i = npixels * (bpp / 8);
+	memset (q + i, 0, fitsDataSize (bpp, npixels) - i);
+	return (0);
+}
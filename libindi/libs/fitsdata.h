@@ -0,0 +1,63 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+#ifndef FITSDATA_H
+#define FITSDATA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \defgroup fitsdata FITS Data Functions: Write the data unit of a FITS image without cfitsio
+ *
+ * FITS stores pixels big-endian and signed, so unsigned 16 and 32 bit pixels are written less
+ * the BZERO of 32768 or 2147483648 that cfitsio puts in their header. fitsPutPixels() does both
+ * in one pass, swapping bytes with SSSE3 or AVX2 and flipping the top bit, so a frame can go
+ * straight from the camera's buffer into the block after its header.
+ */
+/*@{*/
+
+#define FITS_BLOCK      2880    /*!< FITS files are made of blocks of this many bytes */
+
+/** \brief Bytes the data unit of an image takes, padded to whole FITS blocks.
+    \param bpp bits per pixel, 8, 16 or 32.
+    \param npixels number of pixels.
+ */
+extern size_t fitsDataSize(int bpp, size_t npixels);
+
+/** \brief Write the data unit of an image of unsigned pixels.
+    \param bpp bits per pixel, 8, 16 or 32, as in a header with BITPIX of 8, 16 or 32 and BZERO of 0, 32768 or 2147483648.
+    \param fits set to fitsDataSize() bytes of FITS data, the last block filled out with zeros.
+    \param pixels native order pixels.
+    \param npixels number of pixels.
+    \return 0 on success, -1 if bpp is not 8, 16 or 32.
+ */
+extern int fitsPutPixels(int bpp, void *fits, const void *pixels, size_t npixels);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
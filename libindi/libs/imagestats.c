@@ -0,0 +1,478 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+/* Image statistics in one pass.
+ *
+ * Each thread walks its part of the frame a CHUNK of pixels at a time. A SIMD kernel finds
+ * the minimum, maximum, sum and sum of squares of the chunk, then a scalar loop counts it into
+ * the histogram while it is still in the L1 cache. The kernels keep 32 bit lane sums, which a
+ * CHUNK cannot overflow, and widen them to 64 bits at the end of each call.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "imagestats.h"
+
+#define MAXTHREADS  16              /* most threads one call starts */
+#define MINPIXELS   (256*1024)      /* fewest pixels worth a thread of their own */
+#define CHUNK       4096            /* pixels each kernel call takes */
+#define NHIST       4               /* histograms counted in turn, so runs of like pixels do not wait on each other */
+
+/* running statistics of part of a frame */
+typedef struct
+{
+    uint32_t min, max;
+    uint64_t sum;
+    uint64_t sumsq;                 /* 8 and 16 bit only */
+    double dsumsq;                  /* 32 bit only */
+} Acc;
+
+/* fold n pixels at p into a, returning how many were done. the scalar loop in statsChunk() does the rest. */
+typedef int (*StatsKernel)(const void *p, int n, Acc *a);
+
+/* part of a frame taken by one thread */
+typedef struct
+{
+    int bpp;
+    const uint8_t *p;
+    size_t n;
+    Acc acc;
+    uint32_t hist[NHIST][IMAGESTATS_BINS];
+} Part;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+#define IMAGESTATS_X86
+
+static uint64_t
+sum64_sse2 (__m128i v)
+{
+	uint64_t l[2];
+
+	_mm_storeu_si128 ((__m128i *)l, v);
+	return (l[0] + l[1]);
+}
+
+__attribute__((target("sse2"))) static int
+stats8_sse2 (const void *row, int n, Acc *a)
+{
+	const uint8_t *p = (const uint8_t *)row;
+	const __m128i zero = _mm_setzero_si128 ();
+	__m128i vmin = _mm_set1_epi8 ((char)0xff), vmax = zero, vsum = zero, vsq = zero;
+	uint8_t m[16];
+	int i, k;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+	    __m128i v = _mm_loadu_si128 ((const __m128i *)(p + i));
+	    __m128i lo = _mm_unpacklo_epi8 (v, zero), hi = _mm_unpackhi_epi8 (v, zero);
+	    vmin = _mm_min_epu8 (vmin, v);
+	    vmax = _mm_max_epu8 (vmax, v);
+	    vsum = _mm_add_epi64 (vsum, _mm_sad_epu8 (v, zero));
+	    vsq = _mm_add_epi32 (vsq, _mm_add_epi32 (_mm_madd_epi16 (lo, lo), _mm_madd_epi16 (hi, hi)));
+	}
+	if (i == 0)
+	    return (0);
+
+	_mm_storeu_si128 ((__m128i *)m, vmin);
+	for (k = 0; k < 16; k++)
+	    if (m[k] < a->min)
+		a->min = m[k];
+	_mm_storeu_si128 ((__m128i *)m, vmax);
+	for (k = 0; k < 16; k++)
+	    if (m[k] > a->max)
+		a->max = m[k];
+	a->sum += sum64_sse2 (vsum);
+	a->sumsq += sum64_sse2 (_mm_add_epi64 (_mm_unpacklo_epi32 (vsq, zero), _mm_unpackhi_epi32 (vsq, zero)));
+	return (i);
+}
+
+__attribute__((target("sse2"))) static int
+stats16_sse2 (const void *row, int n, Acc *a)
+{
+	const uint16_t *p = (const uint16_t *)row;
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i bias = _mm_set1_epi16 ((short)0x8000);
+	/* SSE2 only has signed 16 bit min and max, so compare with the top bit flipped */
+	__m128i vmin = _mm_set1_epi16 (0x7fff), vmax = _mm_set1_epi16 ((short)0x8000);
+	__m128i vsum = zero, vsq = zero;
+	uint16_t m[8];
+	int i, k;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+	    __m128i v = _mm_loadu_si128 ((const __m128i *)(p + i));
+	    __m128i s = _mm_xor_si128 (v, bias);
+	    __m128i lo = _mm_unpacklo_epi16 (v, zero), hi = _mm_unpackhi_epi16 (v, zero);
+	    vmin = _mm_min_epi16 (vmin, s);
+	    vmax = _mm_max_epi16 (vmax, s);
+	    vsum = _mm_add_epi32 (vsum, _mm_add_epi32 (lo, hi));
+	    /* squares of the even lanes, then of the odd ones, each 64 bits */
+	    vsq = _mm_add_epi64 (vsq, _mm_mul_epu32 (lo, lo));
+	    vsq = _mm_add_epi64 (vsq, _mm_mul_epu32 (_mm_srli_epi64 (lo, 32), _mm_srli_epi64 (lo, 32)));
+	    vsq = _mm_add_epi64 (vsq, _mm_mul_epu32 (hi, hi));
+	    vsq = _mm_add_epi64 (vsq, _mm_mul_epu32 (_mm_srli_epi64 (hi, 32), _mm_srli_epi64 (hi, 32)));
+	}
+	if (i == 0)
+	    return (0);
+
+	_mm_storeu_si128 ((__m128i *)m, _mm_xor_si128 (vmin, bias));
+	for (k = 0; k < 8; k++)
+	    if (m[k] < a->min)
+		a->min = m[k];
+	_mm_storeu_si128 ((__m128i *)m, _mm_xor_si128 (vmax, bias));
+	for (k = 0; k < 8; k++)
+	    if (m[k] > a->max)
+		a->max = m[k];
+	a->sum += sum64_sse2 (_mm_add_epi64 (_mm_unpacklo_epi32 (vsum, zero), _mm_unpackhi_epi32 (vsum, zero)));
+	a->sumsq += sum64_sse2 (vsq);
+	return (i);
+}
+
+__attribute__((target("avx2"))) static uint64_t
+sum64_avx2 (__m256i v)
+{
+	uint64_t l[4];
+
+	_mm256_storeu_si256 ((__m256i *)l, v);
+	return (l[0] + l[1] + l[2] + l[3]);
+}
+
+__attribute__((target("avx2"))) static int
+stats8_avx2 (const void *row, int n, Acc *a)
+{
+	const uint8_t *p = (const uint8_t *)row;
+	const __m256i zero = _mm256_setzero_si256 ();
+	__m256i vmin = _mm256_set1_epi8 ((char)0xff), vmax = zero, vsum = zero, vsq = zero;
+	uint8_t m[32];
+	int i, k;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+	    __m256i v = _mm256_loadu_si256 ((const __m256i *)(p + i));
+	    __m256i lo = _mm256_unpacklo_epi8 (v, zero), hi = _mm256_unpackhi_epi8 (v, zero);
+	    vmin = _mm256_min_epu8 (vmin, v);
+	    vmax = _mm256_max_epu8 (vmax, v);
+	    vsum = _mm256_add_epi64 (vsum, _mm256_sad_epu8 (v, zero));
+	    vsq = _mm256_add_epi32 (vsq, _mm256_add_epi32 (_mm256_madd_epi16 (lo, lo), _mm256_madd_epi16 (hi, hi)));
+	}
+	if (i == 0)
+	    return (0);
+
+	_mm256_storeu_si256 ((__m256i *)m, vmin);
+	for (k = 0; k < 32; k++)
+	    if (m[k] < a->min)
+		a->min = m[k];
+	_mm256_storeu_si256 ((__m256i *)m, vmax);
+	for (k = 0; k < 32; k++)
+	    if (m[k] > a->max)
+		a->max = m[k];
+	a->sum += sum64_avx2 (vsum);
+	a->sumsq += sum64_avx2 (_mm256_add_epi64 (_mm256_unpacklo_epi32 (vsq, zero), _mm256_unpackhi_epi32 (vsq, zero)));
+	return (i);
+}
+
+__attribute__((target("avx2"))) static int
+stats16_avx2 (const void *row, int n, Acc *a)
+{
+	const uint16_t *p = (const uint16_t *)row;
+	const __m256i zero = _mm256_setzero_si256 ();
+	__m256i vmin = _mm256_set1_epi16 ((short)0xffff), vmax = zero, vsum = zero, vsq = zero;
+	uint16_t m[16];
+	int i, k;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+	    __m256i v = _mm256_loadu_si256 ((const __m256i *)(p + i));
+	    __m256i lo = _mm256_cvtepu16_epi32 (_mm256_castsi256_si128 (v));
+	    __m256i hi = _mm256_cvtepu16_epi32 (_mm256_extracti128_si256 (v, 1));
+	    /* 65535 squared still fits 32 bits unsigned */
+	    __m256i sqlo = _mm256_mullo_epi32 (lo, lo), sqhi = _mm256_mullo_epi32 (hi, hi);
+	    vmin = _mm256_min_epu16 (vmin, v);
+	    vmax = _mm256_max_epu16 (vmax, v);
+	    vsum = _mm256_add_epi32 (vsum, _mm256_add_epi32 (lo, hi));
+	    vsq = _mm256_add_epi64 (vsq, _mm256_add_epi64 (_mm256_unpacklo_epi32 (sqlo, zero), _mm256_unpackhi_epi32 (sqlo, zero)));
+	    vsq = _mm256_add_epi64 (vsq, _mm256_add_epi64 (_mm256_unpacklo_epi32 (sqhi, zero), _mm256_unpackhi_epi32 (sqhi, zero)));
+	}
+	if (i == 0)
+	    return (0);
+
+	_mm256_storeu_si256 ((__m256i *)m, vmin);
+	for (k = 0; k < 16; k++)
+	    if (m[k] < a->min)
+		a->min = m[k];
+	_mm256_storeu_si256 ((__m256i *)m, vmax);
+	for (k = 0; k < 16; k++)
+	    if (m[k] > a->max)
+		a->max = m[k];
+	a->sum += sum64_avx2 (_mm256_add_epi64 (_mm256_unpacklo_epi32 (vsum, zero), _mm256_unpackhi_epi32 (vsum, zero)));
+	a->sumsq += sum64_avx2 (vsq);
+	return (i);
+}
+
+#endif
+
+/* kernel that does nothing, leaving it all to the scalar loop */
+static int
+stats_none (const void *p, int n, Acc *a)
+{
+	(void) p;
+	(void) n;
+	(void) a;
+	return (0);
+}
+
+static StatsKernel stats8kernel, stats16kernel;
+
+/* pick the fastest kernels this cpu can run. they are the same each time,
+ * so racing threads may safely both set them. stats16kernel goes last, imageStats() tests it.
+ */
+static void
+pickStatsKernels (void)
+{
+#if defined(IMAGESTATS_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports ("avx2")) {
+	    stats8kernel = stats8_avx2;
+	    stats16kernel = stats16_avx2;
+	    return;
+	}
+	if (__builtin_cpu_supports ("sse2")) {
+	    stats8kernel = stats8_sse2;
+	    stats16kernel = stats16_sse2;
+	    return;
+	}
+#endif
+	stats8kernel = stats_none;
+	stats16kernel = stats_none;
+}
+
+/* values in each histogram bin of a bpp bit frame, as a shift */
+static int
+binShift (int bpp)
+{
+	return bpp == 8 ? 0 : bpp == 16 ? 4 : 20;
+}
+
+/* count pixels v[0] to v[n-1] into the histograms of pp in turn */
+#define COUNT(v, shift) do {					\
+	    for (i = 0; i + NHIST <= n; i += NHIST) {		\
+		pp->hist[0][v[i] >> (shift)]++;			\
+		pp->hist[1][v[i+1] >> (shift)]++;		\
+		pp->hist[2][v[i+2] >> (shift)]++;		\
+		pp->hist[3][v[i+3] >> (shift)]++;		\
+	    }							\
+	    for (; i < n; i++)					\
+		pp->hist[0][v[i] >> (shift)]++;			\
+	} while (0)
+
+/* fold n pixels at p into the statistics and histogram of pp */
+static void
+statsChunk (Part *pp, const uint8_t *p, int n)
+{
+	Acc *a = &pp->acc;
+	int i;
+
+	switch (pp->bpp) {
+	case 8: {
+	    const uint8_t *v = p;
+	    for (i = stats8kernel (v, n, a); i < n; i++) {
+		if (v[i] < a->min)
+		    a->min = v[i];
+		if (v[i] > a->max)
+		    a->max = v[i];
+		a->sum += v[i];
+		a->sumsq += (uint32_t)v[i] * v[i];
+	    }
+	    COUNT (v, 0);
+	    }
+	    break;
+	case 16: {
+	    const uint16_t *v = (const uint16_t *)p;
+	    for (i = stats16kernel (v, n, a); i < n; i++) {
+		if (v[i] < a->min)
+		    a->min = v[i];
+		if (v[i] > a->max)
+		    a->max = v[i];
+		a->sum += v[i];
+		a->sumsq += (uint32_t)v[i] * v[i];
+	    }
+	    COUNT (v, 4);
+	    }
+	    break;
+	case 32: {
+	    const uint32_t *v = (const uint32_t *)p;
+	    for (i = 0; i < n; i++) {
+		if (v[i] < a->min)
+		    a->min = v[i];
+		if (v[i] > a->max)
+		    a->max = v[i];
+		a->sum += v[i];
+		a->dsumsq += (double)v[i] * v[i];
+	    }
+	    COUNT (v, 20);
+	    }
+	    break;
+	}
+}
+
+/* statistics of one part of a frame */
+static void *
+statsPart (void *arg)
+{
+	Part *pp = (Part *)arg;
+	size_t psize = pp->bpp / 8, i;
+
+	pp->acc.min = UINT32_MAX;
+	pp->acc.max = 0;
+	pp->acc.sum = pp->acc.sumsq = 0;
+	pp->acc.dsumsq = 0;
+	memset (pp->hist, 0, sizeof(pp->hist));
+
+	for (i = 0; i < pp->n; i += CHUNK)
+	    statsChunk (pp, pp->p + i * psize, pp->n - i < CHUNK ? (int)(pp->n - i) : CHUNK);
+
+	return NULL;
+}
+
+/* number of threads to use for npixels pixels */
+static int
+nThreads (int threads, size_t npixels)
+{
+	if (threads <= 0) {
+	    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	    threads = ncpu > 0 ? (int)ncpu : 1;
+	    if ((size_t)threads > npixels / MINPIXELS)
+		threads = (int)(npixels / MINPIXELS);
+	}
+	if (threads > MAXTHREADS)
+	    threads = MAXTHREADS;
+	return threads > 0 ? threads : 1;
+}
+
+int
+imageStats(int bpp, const void *frame, size_t npixels, ImageStats *st, int threads)
+{
+	pthread_t tids[MAXTHREADS];
+	int started[MAXTHREADS];
+	Part *parts;
+	uint32_t min = UINT32_MAX, max = 0;
+	uint64_t sum = 0, sumsq = 0;
+	double dsumsq = 0, var, half;
+	size_t count;
+	int nt, i, k;
+
+	if ((bpp != 8 && bpp != 16 && bpp != 32) || (!frame && npixels > 0))
+	    return (-1);
+
+	if (!stats16kernel)
+	    pickStatsKernels ();
+
+	nt = nThreads (threads, npixels);
+	parts = (Part *) malloc (nt * sizeof(Part));
+	if (!parts)
+	    return (-1);
+
+	/* contiguous parts, the caller doing the first */
+	for (i = 0; i < nt; i++) {
+	    size_t first = npixels / nt * i;
+	    parts[i].bpp = bpp;
+	    parts[i].p = (const uint8_t *)frame + first * (bpp / 8);
+	    parts[i].n = i < nt-1 ? npixels / nt : npixels - first;
+	    started[i] = i > 0 && pthread_create (&tids[i], NULL, statsPart, &parts[i]) == 0;
+	}
+
+	for (i = 0; i < nt; i++) {
+	    if (started[i])
+		pthread_join (tids[i], NULL);
+	    else
+		statsPart (&parts[i]);	/* ours, or a thread that would not start */
+	}
+
+	memset (st, 0, sizeof(*st));
+	for (i = 0; i < nt; i++) {
+	    if (parts[i].acc.min < min)
+		min = parts[i].acc.min;
+	    if (parts[i].acc.max > max)
+		max = parts[i].acc.max;
+	    sum += parts[i].acc.sum;
+	    sumsq += parts[i].acc.sumsq;
+	    dsumsq += parts[i].acc.dsumsq;
+	    for (k = 0; k < IMAGESTATS_BINS; k++)
+		st->histogram[k] += (size_t)parts[i].hist[0][k] + parts[i].hist[1][k] + parts[i].hist[2][k] + parts[i].hist[3][k];
+	}
+	free (parts);
+
+	st->bpp = bpp;
+	st->npixels = npixels;
+	st->binwidth = 1 << binShift (bpp);
+	if (npixels == 0)
+	    return (0);
+
+	st->min = min;
+	st->max = max;
+	st->mean = (double)sum / npixels;
+	var = (bpp == 32 ? dsumsq : (double)sumsq) / npixels - st->mean * st->mean;
+	st->stddev = var > 0 ? sqrt (var) : 0;
+
+	/* median from the histogram, in proportion along the bin it falls in.
+	 * 8 bit frames give the pixel at npixels/2, the upper median of an even count.
+	 */
+	half = npixels / 2.0;
+	for (k = 0, count = 0; k < IMAGESTATS_BINS - 1 && count + st->histogram[k] <= half; k++)
+	    count += st->histogram[k];
+	if (st->binwidth == 1)
+	    st->median = k;
+	else
+	    st->median = (k + (half - count) / st->histogram[k]) * st->binwidth;
+	if (st->median < st->min)
+	    st->median = st->min;
+	if (st->median > st->max)
+	    st->median = st->max;
+
+	return (0);
+}
+
+void
+imageStatsHistogram(const ImageStats *st, double lo, double hi, double *bins, int nbins)
+{
+	int nfine = st->bpp == 8 ? 256 : IMAGESTATS_BINS;
+	double span = hi - lo + 1;
+	int k, b;
+
+	memset (bins, 0, nbins * sizeof(double));
+	if (nbins <= 0 || span <= 0)
+	    return;
+
+	/* each fine bin goes into the bin its middle falls in */
+	for (k = 0; k < nfine; k++) {
+	    double mid = k * st->binwidth + (st->binwidth - 1) / 2.0;
+	    if (!st->histogram[k])
+		continue;
+	    b = (int) floor ((mid - lo) * nbins / span);
+	    if (b < 0)
+		b = 0;
+	    if (b >= nbins)
+		b = nbins - 1;
+	    bins[b] += st->histogram[k];
+	}
+}
@@ -0,0 +1,83 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+#ifndef IMAGESTATS_H
+#define IMAGESTATS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \defgroup imagestats Image Statistics Functions: Statistics of 8, 16 and 32 bit frames in one pass
+ *
+ * imageStats() reads each pixel once, several threads each taking a part of the frame, and
+ * finds the minimum, maximum, sum and sum of squares with SSE2 or AVX2 while counting a fine
+ * histogram over the whole range of the pixel type. The mean and standard deviation follow
+ * from the sums, the median from the histogram, and imageStatsHistogram() turns the fine
+ * histogram into a coarse one over any range, e.g. from the minimum to the maximum for
+ * stretching a preview.
+ */
+/*@{*/
+
+#define IMAGESTATS_BINS     4096    /*!< Bins in the fine histogram */
+
+/** \brief Statistics of one frame */
+typedef struct
+{
+    int bpp;                                /*!< Bits per pixel of the frame */
+    size_t npixels;                         /*!< Pixels in the frame */
+    double min;                             /*!< Smallest pixel */
+    double max;                             /*!< Largest pixel */
+    double mean;                            /*!< Mean pixel */
+    double stddev;                          /*!< Standard deviation of the pixels */
+    double median;                          /*!< Median pixel, for 8 bit frames the upper of the middle two of an even count, else to within a bin */
+    double binwidth;                        /*!< Pixel values in each bin of the histogram: 1, 16 or 2^20 */
+    size_t histogram[IMAGESTATS_BINS];      /*!< Pixels in each bin, bin i starts at i*binwidth. 8 bit frames only use 256. */
+} ImageStats;
+
+/** \brief Find the statistics of a frame.
+    \param bpp bits per pixel of frame, 8, 16 or 32.
+    \param frame pixels.
+    \param npixels number of pixels in frame.
+    \param st set to the statistics.
+    \param threads number of threads to use, 0 to use one for each CPU.
+    \return 0 on success, -1 if an argument is out of range or memory runs out.
+ */
+extern int imageStats(int bpp, const void *frame, size_t npixels, ImageStats *st, int threads);
+
+/** \brief Count the pixels of a frame into nbins equal bins from lo to hi.
+    \param st statistics from imageStats().
+    \param lo lowest pixel value of the first bin, e.g. st->min.
+    \param hi highest pixel value of the last bin, e.g. st->max. Pixels outside lo to hi are counted in the first or last bin.
+    \param bins set to the number of pixels in each bin. Bins narrower than the fine histogram may stay empty.
+    \param nbins number of bins.
+ */
+extern void imageStatsHistogram(const ImageStats *st, double lo, double hi, double *bins, int nbins);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
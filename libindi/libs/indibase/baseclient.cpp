@@ -34,7 +34,14 @@
 
 #include <errno.h>
 
-#define MAXINDIBUF 256
+#define MAXINDIBUF 32768
+
+/* readXMLBuf() callback to stop at each complete element, left in *arg */
+static int takeXMLEle(XMLEle *root, void *arg)
+{
+    *(XMLEle **)arg = root;
+    return 1;
+}
 
 INDI::BaseClient::BaseClient()
 {
@@ -43,6 +50,7 @@ INDI::BaseClient::BaseClient()
     svrwfp = NULL;    
     sConnected = false;
     verbose = false;
+    binaryBLOBs = false;
 
     timeout_sec=3;
     timeout_us=0;
@@ -340,6 +348,7 @@ void INDI::BaseClient::listenINDI()
 
 
     lillp = newLilXML();
+    streamXMLPCData(lillp, "oneBLOB", streamBLOBHelper, this);
 
     /* read from server, exit if find all requested properties */
     while (sConnected)
@@ -378,9 +387,10 @@ void INDI::BaseClient::listenINDI()
                     continue;
             }
 
-            for (int i=0; i < n; i++)
+            for (int i=0; i < n; )
             {
-               XMLEle *root = readXMLEle (lillp, buffer[i], msg);
+               XMLEle *root = NULL;
+               i += readXMLBuf (lillp, buffer+i, n-i, takeXMLEle, &root, msg);
 
                 if (root)
                 {
@@ -402,7 +412,7 @@ void INDI::BaseClient::listenINDI()
                 }
                 else if (msg[0])
                 {
-                   fprintf (stderr, "Bad XML from %s/%d: %s\n%s\n", cServer.c_str(), cPort, msg, buffer);
+                   fprintf (stderr, "Bad XML from %s/%d: %s\n%.*s\n", cServer.c_str(), cPort, msg, n, buffer);
                    return;
                 }
             }
@@ -412,6 +422,10 @@ void INDI::BaseClient::listenINDI()
 
     }
 
+    // BLOBs cut short
+    for (vector<INDI::BaseDevice *>::const_iterator devicei = cDevices.begin(); devicei != cDevices.end(); devicei++)
+        (*devicei)->dropBLOB();
+
     delLilXML(lillp);
 
     serverDisconnected( (sConnected == false) ? 0 : -1);
@@ -421,6 +435,24 @@ void INDI::BaseClient::listenINDI()
 
 }
 
+/* hand the pcdata of each oneBLOB to its device to decode as it arrives, see INDI::BaseDevice::openBLOB() */
+int INDI::BaseClient::streamBLOBHelper(XMLEle *ep, const char *data, int len, void *context)
+{
+    INDI::BaseClient *client = static_cast<INDI::BaseClient *> (context);
+    XMLEle *root = parentXMLEle(ep);
+    INDI::BaseDevice *dp;
+    char errmsg[MAXRBUF];
+
+    if (root == NULL || (dp = client->findDev(findXMLAttValu(root, "device"), errmsg)) == NULL)
+        return -1;
+
+    if (data == NULL)
+        return dp->openBLOB(ep);
+
+    dp->streamBLOB(ep, data, len);
+    return 0;
+}
+
 int INDI::BaseClient::dispatchCommand(XMLEle *root, char * errmsg)
 {
     if  (!strcmp (tagXMLEle(root), "message"))
@@ -451,9 +483,15 @@ int INDI::BaseClient::dispatchCommand(XMLEle *root, char * errmsg)
     else if (!strcmp (tagXMLEle(root), "setTextVector") ||
              !strcmp (tagXMLEle(root), "setNumberVector") ||
              !strcmp (tagXMLEle(root), "setSwitchVector") ||
-             !strcmp (tagXMLEle(root), "setLightVector") ||
-             !strcmp (tagXMLEle(root), "setBLOBVector"))
+             !strcmp (tagXMLEle(root), "setLightVector"))
             return dp->setValue(root, errmsg);
+    else if (!strcmp (tagXMLEle(root), "setBLOBVector"))
+    {
+        int rc = dp->setValue(root, errmsg);
+        // oneBLOBs setBLOB() did not get to close before root goes
+        dp->closeBLOBs(root);
+        return rc;
+    }
 
     return INDI_DISPATCH_ERROR;
 }
@@ -790,9 +828,11 @@ void INDI::BaseClient::setBLOBMode(BLOBHandling blobH, const char *dev, const ch
         return;
 
    if (prop != NULL)
-           snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s' name='%s'>", dev, prop);
+           snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s' name='%s'%s>", dev, prop,
+                    binaryBLOBs ? " encoding='binary'" : "");
    else
-          snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s'>", dev);
+          snprintf(blobOpenTag, MAXRBUF, "<enableBLOB device='%s'%s>", dev,
+                   binaryBLOBs ? " encoding='binary'" : "");
 
     switch (blobH)
     {
@@ -128,6 +128,19 @@ public:
     */
     void setBLOBMode(BLOBHandling blobH, const char *dev, const char *prop = NULL);
 
+    /**
+     * @brief setBinaryBLOBs Ask the server to send BLOBs as raw bytes instead of base64. Takes effect on the next
+     * setBLOBMode() call. Servers that do not know about binary BLOBs ignore the request and keep sending base64.
+     * @param enable If true, request binary BLOBs.
+     */
+    void setBinaryBLOBs(bool enable) { binaryBLOBs = enable; }
+
+    /**
+     * @brief isBinaryBLOBs Does the client request binary BLOBs?
+     * @return True if binary BLOBs are requested.
+     */
+    bool isBinaryBLOBs() const { return binaryBLOBs; }
+
     // Update
     static void * listenHelper(void *context);
 
@@ -208,6 +221,9 @@ private:
     // Listen to INDI server and process incoming messages
     void listenINDI();
 
+    // streamXMLPCData() callback to decode each oneBLOB as it arrives
+    static int streamBLOBHelper(XMLEle *ep, const char *data, int len, void *context);
+
     // Thread for listenINDI()
     pthread_t listen_thread;
 
@@ -218,6 +234,7 @@ private:
     unsigned int cPort;
     bool sConnected;
     bool verbose;
+    bool binaryBLOBs;
 
     // Parse & FILE buffers for IO
     int sockfd;
@@ -19,7 +19,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <zlib.h>
 #include <locale.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -30,8 +29,27 @@
 #include "baseclient.h"
 #include "indicom.h"
 #include "base64.h"
+#include "blobcodec.h"
 #include "indiproperty.h"
 
+#define BLOBPIECE   16384   /* base64 chars of a BLOB decoded at a time */
+
+/* a oneBLOB openBLOB() took, decoded by streamBLOB() as its pcdata arrives */
+struct INDI::BaseDevice::BLOBDecoder
+{
+    XMLEle *ep;                 // the oneBLOB, NULL once closed
+    XMLEle *root;               // its setBLOBVector
+    IBLOB *bp;                  // IBLOB it is decoded into
+    bool binary;                // pcdata is raw bytes, not base64
+    bool failed;
+    From64State b64;
+    BLOBStream *zs;             // uncompressing into bp->blob, NULL if not compressed
+    size_t len;                 // bytes in bp->blob if not compressed
+    size_t room;                // bytes bp->blob has room for
+    size_t sent;                // bytes passed on with newBLOBData()
+    unsigned char piece[3*BLOBPIECE/4+3];   // decoded on its way to zs or the end of bp->blob
+};
+
 INDI::BaseDevice::BaseDevice()
 {
     mediator = NULL;
@@ -52,6 +70,13 @@ INDI::BaseDevice::BaseDevice()
 INDI::BaseDevice::~BaseDevice()
 {
     delLilXML (lp);
+    for (std::map<IBLOB *, BLOBDecoder *>::iterator it = blobDecoders.begin(); it != blobDecoders.end(); it++)
+    {
+        size_t len;
+        if (it->second->zs)
+            blobUncompressEnd(it->second->zs, &len);
+        delete it->second;
+    }
     while(!pAll.empty()) { delete pAll.back(), pAll.pop_back(); }
     messageLog.clear();
 
@@ -1099,8 +1124,8 @@ int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * er
     IBLOB *blobEL;
     unsigned char * dataBuffer=NULL;
     XMLEle *ep;
-    int n=0, r=0;
-    uLongf dataSize=0;
+    int n=0, codec=BLOB_CODEC_NONE;
+    size_t dataSize=0;
 
     /* pull out each name/BLOB pair, decode */
     for (n = 0, ep = nextXMLEle(root,1); ep; ep = nextXMLEle(root,0))
@@ -1126,15 +1151,45 @@ int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * er
                     continue;
                 }
 
-                 blobEL->blob = (unsigned char *) realloc (blobEL->blob, 3*pcdatalenXMLEle(ep)/4);
+                 if (streamedXMLEle(ep))
+                 {
+                     // Decoded and uncompressed as it arrived
+                     if (closeBLOB(blobEL, ep, errmsg) < 0)
+                         return -1;
+
+                     if (mediator)
+                         mediator->newBLOB(blobEL);
+                     continue;
+                 }
+
+                 if (!strcmp(findXMLAttValu(ep, "encoding"), "binary"))
+                 {
+                     // Raw bytes, nothing to decode
+                     blobEL->bloblen = pcdatalenXMLEle(ep);
+                     blobEL->blob = (unsigned char *) realloc (blobEL->blob, blobEL->bloblen);
+                     memcpy(blobEL->blob, pcdataXMLEle(ep), blobEL->bloblen);
+                 }
+                 else
+                 {
+                     blobEL->blob = (unsigned char *) realloc (blobEL->blob, 3*pcdatalenXMLEle(ep)/4);
 
-                 blobEL->bloblen = from64tobits( static_cast<char *> (blobEL->blob), pcdataXMLEle(ep));
+                     blobEL->bloblen = from64tobits( static_cast<char *> (blobEL->blob), pcdataXMLEle(ep));
+                 }
 
                  strncpy(blobEL->format, valuXMLAtt(fa), MAXINDIFORMAT);
 
-                    if (strstr(blobEL->format, ".z"))
+                    // The format suffix names the codec, e.g. .fits.zst
+                    codec = blobCodecFromFormat(blobEL->format);
+                    if (codec != BLOB_CODEC_NONE)
                     {
-                        blobEL->format[strlen(blobEL->format)-2] = '\0';
+                        blobEL->format[strlen(blobEL->format)-strlen(blobCodecSuffix(codec))] = '\0';
+
+                        if (blobCodecAvailable(codec) == 0)
+                        {
+                            snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s %s compression is not supported.", blobEL->bvp->device, blobEL->bvp->name, blobEL->name, blobCodecName(codec));
+                            return -1;
+                        }
+
                         dataSize = blobEL->size * sizeof(unsigned char);
                         dataBuffer = (unsigned char *) malloc(dataSize);
 
@@ -1144,14 +1199,14 @@ int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * er
                                 return (-1);
                         }
 
-                        r = uncompress(dataBuffer, &dataSize, static_cast<unsigned char *> (blobEL->blob), (uLong) blobEL->bloblen);
-                        if (r != Z_OK)
+                        if (blobUncompress(codec, 0, dataBuffer, &dataSize, static_cast<unsigned char *> (blobEL->blob), blobEL->bloblen) < 0)
                         {
-                            snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s compression error: %d", blobEL->bvp->device, blobEL->bvp->name, blobEL->name, r);
+                            snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s %s decompression error.", blobEL->bvp->device, blobEL->bvp->name, blobEL->name, blobCodecName(codec));
                             free (dataBuffer);
                             return -1;
                         }
                         blobEL->size = dataSize;
+                        blobEL->bloblen = dataSize;
                         free(blobEL->blob);
                         blobEL->blob = dataBuffer;
                     }
@@ -1172,6 +1227,222 @@ int INDI::BaseDevice::setBLOB(IBLOBVectorProperty *bvp, XMLEle * root, char * er
 
 }
 
+/* Take a oneBLOB of a setBLOBVector to decode as its pcdata arrives, into a buffer
+ * sized from its size attribute so the BLOB is not also held encoded or compressed.
+ * Return 0 if taken, -1 to leave it for setBLOB() to decode once complete.
+*/
+int INDI::BaseDevice::openBLOB(XMLEle *ep)
+{
+    XMLEle *root = parentXMLEle(ep);
+    IBLOBVectorProperty *bvp;
+    IBLOB *blobEL;
+    unsigned char *blob;
+    size_t room;
+    int codec;
+
+    if (root == NULL || strcmp(tagXMLEle(root), "setBLOBVector") ||
+        (bvp = getBLOB(findXMLAttValu(root, "name"))) == NULL ||
+        (blobEL = IUFindBLOB(bvp, findXMLAttValu(ep, "name"))) == NULL)
+        return -1;
+
+    codec = blobCodecFromFormat(findXMLAttValu(ep, "format"));
+    if (findXMLAtt(ep, "format") == NULL || atoi(findXMLAttValu(ep, "size")) <= 0 || blobCodecAvailable(codec) == 0)
+        return -1;
+
+    BLOBDecoder *&bd = blobDecoders[blobEL];
+    if (bd == NULL)
+        bd = new BLOBDecoder();
+    else if (bd->ep)
+        return -1;      // the same BLOB twice in one vector, setBLOB() decodes the second
+
+    bd->binary = !strcmp(findXMLAttValu(ep, "encoding"), "binary");
+
+    // size is the uncompressed size, raw bytes that are not compressed number enclen
+    room = atoi(findXMLAttValu(ep, "size"));
+    if (codec == BLOB_CODEC_NONE && bd->binary && atoi(findXMLAttValu(ep, "enclen")) > 0)
+        room = atoi(findXMLAttValu(ep, "enclen"));
+
+    blob = (unsigned char *) realloc(blobEL->blob, room);
+    if (blob == NULL)
+        return -1;
+    blobEL->blob = blob;
+
+    if (codec != BLOB_CODEC_NONE && (bd->zs = blobUncompressBegin(codec, blob, room)) == NULL)
+        return -1;
+
+    from64init(&bd->b64);
+    bd->ep = ep;
+    bd->root = root;
+    bd->bp = blobEL;
+    bd->failed = false;
+    bd->len = 0;
+    bd->room = room;
+    bd->sent = 0;
+
+    blobEL->size = atoi(findXMLAttValu(ep, "size"));
+    blobEL->bloblen = 0;
+    strncpy(blobEL->format, findXMLAttValu(ep, "format"), MAXINDIFORMAT);
+    blobEL->format[strlen(blobEL->format)-strlen(blobCodecSuffix(codec))] = '\0';
+
+    if (mediator)
+        mediator->newBLOBBegin(blobEL);
+
+    return 0;
+}
+
+/* Pass on the bytes decoded since last time with newBLOBData() */
+void INDI::BaseDevice::sendBLOBData(BLOBDecoder *bd)
+{
+    size_t len = bd->zs ? blobUncompressedBytes(bd->zs) : bd->len;
+
+    if (len > bd->sent && mediator)
+        mediator->newBLOBData(bd->bp, static_cast<unsigned char *> (bd->bp->blob) + bd->sent, len - bd->sent);
+    bd->sent = len;
+}
+
+/* Finish the BLOBs of the complete setBLOBVector root still open because setBLOB() gave up
+ * on root, or never ran, e.g. for a bad state. They did arrive, so they end as they decoded.
+*/
+void INDI::BaseDevice::closeBLOBs(XMLEle *root)
+{
+    char errmsg[MAXRBUF];
+
+    for (std::map<IBLOB *, BLOBDecoder *>::iterator it = blobDecoders.begin(); it != blobDecoders.end(); it++)
+        if (it->second->ep && it->second->root == root)
+            closeBLOB(it->second->bp, it->second->ep, errmsg);
+}
+
+/* Give up on the BLOBs still being decoded when the connection they arrive on closes,
+ * the only way a BLOB ends before its closing tag
+*/
+void INDI::BaseDevice::dropBLOB()
+{
+    for (std::map<IBLOB *, BLOBDecoder *>::iterator it = blobDecoders.begin(); it != blobDecoders.end(); it++)
+    {
+        BLOBDecoder *bd = it->second;
+
+        if (bd->ep == NULL)
+            continue;
+
+        if (bd->zs)
+        {
+            size_t len;
+            blobUncompressEnd(bd->zs, &len);
+            bd->zs = NULL;
+        }
+        bd->ep = NULL;
+
+        if (mediator)
+            mediator->newBLOBEnd(bd->bp, false);
+    }
+}
+
+/* Add n decoded bytes at data to the BLOB being decoded, uncompressing them if need be.
+ * Return 0 if okay, -1 if they are bad or memory runs out.
+*/
+static int addBLOBBytes(BLOBStream *zs, IBLOB *bp, size_t *len, size_t *room, const unsigned char *data, size_t n)
+{
+    if (zs)
+        return blobUncompressPart(zs, data, n);
+
+    // More than the size attribute said
+    if (n > *room - *len)
+    {
+        size_t newroom = *len + n > *room + *room/4 ? *len + n : *room + *room/4;
+        unsigned char *blob = (unsigned char *) realloc(bp->blob, newroom);
+        if (blob == NULL)
+            return -1;
+        bp->blob = blob;
+        *room = newroom;
+    }
+
+    if (data != static_cast<unsigned char *> (bp->blob) + *len)
+        memcpy(static_cast<unsigned char *> (bp->blob) + *len, data, n);
+    *len += n;
+    return 0;
+}
+
+/* Decode the next len chars of pcdata of a oneBLOB openBLOB() took */
+void INDI::BaseDevice::streamBLOB(XMLEle *ep, const char *data, int len)
+{
+    BLOBDecoder *bd = NULL;
+
+    for (std::map<IBLOB *, BLOBDecoder *>::iterator it = blobDecoders.begin(); it != blobDecoders.end() && bd == NULL; it++)
+        if (it->second->ep == ep)
+            bd = it->second;
+
+    if (bd == NULL || bd->failed)
+        return;
+
+    if (bd->binary)
+    {
+        if (addBLOBBytes(bd->zs, bd->bp, &bd->len, &bd->room, (const unsigned char *) data, len) < 0)
+            bd->failed = true;
+        sendBLOBData(bd);
+        return;
+    }
+
+    for (int i = 0; i < len && !bd->failed; i += BLOBPIECE)
+    {
+        int l = len - i < BLOBPIECE ? len - i : BLOBPIECE;
+        unsigned char *out = bd->piece;
+        int n;
+
+        // Straight into the IBLOB while there is sure to be room
+        if (bd->zs == NULL && bd->room - bd->len >= (size_t) (3*l/4 + 3))
+            out = static_cast<unsigned char *> (bd->bp->blob) + bd->len;
+
+        n = from64part(&bd->b64, out, data + i, l);
+        if (n < 0 || addBLOBBytes(bd->zs, bd->bp, &bd->len, &bd->room, out, n) < 0)
+            bd->failed = true;
+    }
+
+    sendBLOBData(bd);
+}
+
+/* Finish the oneBLOB streamBLOB() decoded into blobEL.
+ * Return 0 if okay, -1 if error
+*/
+int INDI::BaseDevice::closeBLOB(IBLOB *blobEL, XMLEle *ep, char *errmsg)
+{
+    std::map<IBLOB *, BLOBDecoder *>::iterator it = blobDecoders.find(blobEL);
+    BLOBDecoder *bd = it == blobDecoders.end() ? NULL : it->second;
+    size_t len;
+
+    if (bd == NULL || bd->ep != ep)
+    {
+        snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s was not decoded.", blobEL->bvp->device, blobEL->bvp->name, blobEL->name);
+        return -1;
+    }
+    bd->ep = NULL;
+
+    if (bd->binary == false && from64end(&bd->b64) < 0)
+        bd->failed = true;
+
+    if (bd->zs)
+    {
+        if (blobUncompressEnd(bd->zs, &len) < 0)
+            bd->failed = true;
+        bd->zs = NULL;
+        blobEL->size = len;
+    }
+    else
+        len = bd->len;
+
+    if (bd->failed)
+    {
+        snprintf(errmsg, MAXRBUF, "INDI: %s.%s.%s decoding error.", blobEL->bvp->device, blobEL->bvp->name, blobEL->name);
+        if (mediator)
+            mediator->newBLOBEnd(blobEL, false);
+        return -1;
+    }
+
+    blobEL->bloblen = len;
+    if (mediator)
+        mediator->newBLOBEnd(blobEL, true);
+    return 0;
+}
+
 void INDI::BaseDevice::setDeviceName(const char *dev)
 {
     strncpy(deviceID, dev, MAXINDINAME);
@@ -20,6 +20,7 @@
 #define INDIBASEDRIVER_H
 
 #include <vector>
+#include <map>
 #include <string>
 
 #include <locale.h>
@@ -202,14 +203,33 @@ protected:
     /** \brief Parse and store BLOB in the respective vector */
     int setBLOB(IBLOBVectorProperty *pp, XMLEle * root, char * errmsg);
 
+    /** \brief Start decoding a oneBLOB of a setBLOBVector while its pcdata is still arriving.
+      \param ep oneBLOB element whose opening tag is complete.
+      \return 0 if streamBLOB() is to decode its pcdata straight into the IBLOB, -1 to leave it to setBLOB() */
+    int openBLOB(XMLEle *ep);
+    /** \brief Decode the next piece of pcdata of the oneBLOB openBLOB() took */
+    void streamBLOB(XMLEle *ep, const char *data, int len);
+
 private:
 
+    /** \brief Finish the BLOB streamBLOB() decoded, return 0 if it is good or -1 with reason in errmsg */
+    int closeBLOB(IBLOB *blobEL, XMLEle *ep, char *errmsg);
+    /** \brief Finish the BLOBs of root streamBLOB() decoded that setBLOB() did not */
+    void closeBLOBs(XMLEle *root);
+    /** \brief Give up on the BLOBs streamBLOB() is decoding, the connection they arrive on closed */
+    void dropBLOB();
+    struct BLOBDecoder;
+    /** \brief Pass newly decoded bytes of the BLOB to the mediator */
+    void sendBLOBData(BLOBDecoder *bd);
+
     char *deviceID;
 
     std::vector<INDI::Property *> pAll;
 
     LilXML *lp;
 
+    std::map<IBLOB *, BLOBDecoder *> blobDecoders;   // oneBLOBs being decoded as they arrive, one per IBLOB
+
     std::vector<std::string> messageLog;
 
     INDI::BaseMediator *mediator;
@@ -1,6 +1,7 @@
 #ifndef INDIBASE_H
 #define INDIBASE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "indiapi.h"
@@ -140,6 +141,29 @@ public:
 
     virtual ~BaseMediator() {}
 
+    // Added after all the others so the vtable slots of the older virtuals stay put
+
+    /** \brief Emitted when a BLOB starts arriving from INDI server, before newBLOBData() and newBLOBEnd().
+        \param bp Pointer to the BLOB. Its size, the uncompressed size, and format, without any compression suffix, are set.
+        \note Only BLOBs decoded as they arrive are announced, i.e. those of known properties. Newer data
+        arrives with newBLOBData() so the BLOB may be written out or previewed before newBLOB().
+    */
+    virtual void newBLOBBegin(IBLOB *bp) { INDI_UNUSED(bp); }
+
+    /** \brief Emitted with each piece of a BLOB as it arrives, decoded and uncompressed, in order.
+        \param bp Pointer to the BLOB.
+        \param data next bytes of the BLOB, within bp->blob. Only valid until the call returns, bp->blob may move.
+        \param len number of bytes at data.
+    */
+    virtual void newBLOBData(IBLOB *bp, const unsigned char *data, size_t len) { INDI_UNUSED(bp); INDI_UNUSED(data); INDI_UNUSED(len); }
+
+    /** \brief Emitted once a BLOB announced by newBLOBBegin() has arrived, before newBLOB() if it is good.
+        \param bp Pointer to the BLOB.
+        \param ok true if the whole BLOB arrived and decoded, false if it was bad or cut short by the connection closing.
+        \note newBLOB() does not follow if the rest of its setBLOBVector is bad.
+    */
+    virtual void newBLOBEnd(IBLOB *bp, bool ok) { INDI_UNUSED(bp); INDI_UNUSED(ok); }
+
 };
 
 #endif // INDIBASE_H
@@ -28,13 +28,18 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <zlib.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <libnova.h>
 #include <fitsio.h>
 
+#include "fitsdata.h"
+
 #ifdef __linux__
 #include "webcam/v4l2_record/stream_recorder.h"
 #else
@@ -48,6 +53,215 @@ const char *GUIDE_CONTROL_TAB   = "Guider Control";
 const char *RAPIDGUIDE_TAB      = "Rapid Guide";
 const char *WCS_TAB             = "WCS";
 
+// Frames each image pipeline stage may have waiting. Beyond that ExposureComplete() drops frames that are only
+// uploaded, e.g. rapid guide previews, so the event loop never waits for them. Frames to be saved are never
+// dropped, ExposureComplete() waits for room for them, as each stage waits for the next one to take its frame.
+#define PIPE_QUEUE 2
+#define SAVE_BLOCK  (8*1024*1024)       // Most bytes saved with one write()
+#define SYNC_IDLE   1                   // Seconds the save stage waits for more frames before syncing a partial batch
+
+#if defined(__APPLE__)
+#define fdatasync fsync                 // macOS has no fdatasync()
+#endif
+
+// Stars rapid guide follows, the half size of the window it looks for each in, and how far above the noise they must be
+#define RAPIDGUIDE_STARS    5
+#define RAPIDGUIDE_WINDOW   20
+#define RAPIDGUIDE_MINSNR   5.0
+
+// Codecs CCD_COMPRESSION_CODEC offers, those the library was built without are left out
+static const struct
+{
+    CCDChip::CCD_CODEC codec;
+    const char *name;
+    const char *label;
+} CCDCodecs[] =
+{
+    { CCDChip::CODEC_ZLIB, "CODEC_ZLIB", "zlib" },
+    { CCDChip::CODEC_LZ4, "CODEC_LZ4", "LZ4" },
+    { CCDChip::CODEC_ZSTD, "CODEC_ZSTD", "Zstandard" },
+    { CCDChip::CODEC_RICE, "CODEC_RICE", "Rice (FITS)" },
+};
+
+static void fillCodecSwitch(ISwitchVectorProperty *svp, ISwitch *sp, const char *dev, const char *name, const char *group)
+{
+    int nsp=0;
+
+    for (unsigned int i=0; i < sizeof(CCDCodecs)/sizeof(CCDCodecs[0]); i++)
+    {
+        if (CCDCodecs[i].codec != CCDChip::CODEC_RICE && blobCodecAvailable(CCDCodecs[i].codec) == 0)
+            continue;
+        IUFillSwitch(&sp[nsp], CCDCodecs[i].name, CCDCodecs[i].label, nsp == 0 ? ISS_ON : ISS_OFF);
+        nsp++;
+    }
+
+    IUFillSwitchVector(svp, sp, nsp, dev, name, "Codec", group, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+}
+
+static CCDChip::CCD_CODEC codecFromSwitch(ISwitchVectorProperty *svp)
+{
+    ISwitch *sp = IUFindOnSwitch(svp);
+
+    for (unsigned int i=0; sp && i < sizeof(CCDCodecs)/sizeof(CCDCodecs[0]); i++)
+        if (!strcmp(sp->name, CCDCodecs[i].name))
+            return CCDCodecs[i].codec;
+
+    return CCDChip::CODEC_ZLIB;
+}
+
+static void addFITSCard(std::string &header, const char *card)
+{
+    char padded[FLEN_CARD];
+
+    snprintf(padded, FLEN_CARD, "%-80s", card);
+    header.append(padded, 80);
+}
+
+/* Copy the header cfitsio built in fptr for an image with no axes, giving it the naxis axes of naxes
+ * pixels. The header ends with END padded with blanks to whole FITS blocks, ready for the pixels.
+ */
+static bool copyFITSHeader(fitsfile *fptr, int bpp, int naxis, long *naxes, std::string &header)
+{
+    char card[FLEN_CARD];
+    int nkeys=0, morekeys=0, status=0;
+    bool bzero=false;
+
+    fits_get_hdrspace(fptr, &nkeys, &morekeys, &status);
+    header.reserve((nkeys + naxis + 3) * 80 + FITS_BLOCK);
+
+    for (int i=1; i <= nkeys && status == 0; i++)
+    {
+        fits_read_record(fptr, i, card, &status);
+        if (strncmp(card, "NAXIS   ", 8))
+        {
+            bzero |= !strncmp(card, "BZERO   ", 8);
+            addFITSCard(header, card);
+            continue;
+        }
+
+        snprintf(card, FLEN_CARD, "NAXIS   = %20d / number of data axes", naxis);
+        addFITSCard(header, card);
+        for (int j=0; j < naxis; j++)
+        {
+            snprintf(card, FLEN_CARD, "NAXIS%d  = %20ld / length of data axis %d", j+1, naxes[j], j+1);
+            addFITSCard(header, card);
+        }
+    }
+
+    if (status)
+    {
+        fits_report_error(stderr, status);
+        return false;
+    }
+
+    // fitsPutPixels() writes unsigned pixels less the usual offset
+    if (bzero == false && bpp > 8)
+    {
+        snprintf(card, FLEN_CARD, "BZERO   = %20.0f / offset data range to that of unsigned", bpp == 16 ? 32768.0 : 2147483648.0);
+        addFITSCard(header, card);
+        addFITSCard(header, "BSCALE  =                    1 / default scaling factor");
+    }
+
+    addFITSCard(header, "END");
+    header.append((FITS_BLOCK - header.size() % FITS_BLOCK) % FITS_BLOCK, ' ');
+    return true;
+}
+
+// Statistics of each frame and its histogram, in nbins equal bins from the minimum to the maximum
+static void fillStatsNumbers(INumberVectorProperty *snp, INumber *sn, INumberVectorProperty *hnp, INumber *hn, int nbins, const char *dev, const char *prefix, const char *group)
+{
+    char name[MAXINDINAME], label[MAXINDILABEL];
+
+    IUFillNumber(&sn[0],"STATS_MIN","Minimum","%.f",0,4294967295.0,0,0);
+    IUFillNumber(&sn[1],"STATS_MAX","Maximum","%.f",0,4294967295.0,0,0);
+    IUFillNumber(&sn[2],"STATS_MEAN","Mean","%.2f",0,4294967295.0,0,0);
+    IUFillNumber(&sn[3],"STATS_STDDEV","Standard deviation","%.2f",0,4294967295.0,0,0);
+    IUFillNumber(&sn[4],"STATS_MEDIAN","Median","%.1f",0,4294967295.0,0,0);
+    snprintf(name, MAXINDINAME, "%s_IMAGE_STATS", prefix);
+    IUFillNumberVector(snp, sn, 5, dev, name, "Image Statistics", group, IP_RO, 60, IPS_IDLE);
+
+    for (int i=0; i < nbins; i++)
+    {
+        snprintf(name, MAXINDINAME, "HIST_%d", i);
+        snprintf(label, MAXINDILABEL, "Bin %d", i);
+        IUFillNumber(&hn[i], name, label, "%.f", 0, 1e12, 0, 0);
+    }
+    snprintf(name, MAXINDINAME, "%s_IMAGE_HISTOGRAM", prefix);
+    IUFillNumberVector(hnp, hn, nbins, dev, name, "Histogram", group, IP_RO, 60, IPS_IDLE);
+}
+
+/* One frame on its way through the image pipeline. ExposureComplete() fills in everything
+ * the stages need so they never look at the chip, which is busy with the next exposure.
+ */
+struct UploadJob
+{
+    UploadJob() : chip(NULL), fptr(NULL), memptr(NULL), memsize(0), byteType(0), bpp(0), nelements(0),
+        frame(NULL), frameSize(0), framePooled(false), data(NULL), size(0), compressed(NULL), compressedSize(0),
+        sendImage(false), saveImage(false), syncFrames(0), reportExposure(false), compress(false), codec(BLOB_CODEC_ZLIB),
+        level(0)
+    {
+        memset(ms, 0, sizeof(ms));
+    }
+
+    ~UploadJob()
+    {
+        int status=0;
+
+        if (fptr)
+            fits_close_file(fptr, &status);
+        free(memptr);
+        dropFrame();
+        free(compressed);
+    }
+
+    void dropFrame()
+    {
+        if (framePooled)
+            chip->releaseFrameBuffer(frame);
+        else
+            free(frame);
+        frame = NULL;
+    }
+
+    CCDChip *chip;
+
+    fitsfile *fptr;             // Rice compressed FITS header, the encode stage writes the image
+    std::string header;         // or the FITS header, the encode stage puts the pixels after it
+    void *memptr;
+    size_t memsize;
+    int byteType;
+    int bpp;
+    long nelements;
+
+    uint8_t *frame;             // the raw frame, from the chip's pool or a copy
+    int frameSize;
+    bool framePooled;
+
+    uint8_t *data;              // image to save and upload, memptr or frame
+    size_t size;
+
+    unsigned char *compressed;
+    size_t compressedSize;
+
+    bool sendImage;
+    bool saveImage;
+    int syncFrames;
+    bool reportExposure;        // finishUpload() sets the chip's exposure OK, or ALERT
+    bool compress;              // compress the BLOB with codec, Rice is done by the encode stage
+    int codec;
+    int level;
+    std::string uploadDir;
+    std::string prefix;
+    char ext[MAXINDIBLOBFMT];
+
+    IBLOBVectorProperty bvp;    // copy of the chip's FitsBP to send
+    IBLOB bp;
+
+    std::string fileName;       // results
+    std::string error;
+    double ms[4];               // time each stage took
+};
+
 // Create dir recursively
 static int _mkdir(const char *dir, mode_t mode)
 {
@@ -76,10 +290,15 @@ static int _mkdir(const char *dir, mode_t mode)
 CCDChip::CCDChip()
 {
     SendCompressed=false;
+    Codec=CODEC_ZLIB;
+    CodecLevel=0;
+    BinningMode=BIN_MODE_SUM;
     Interlaced=false;
 
-    RawFrame= (uint8_t *) malloc(sizeof(uint8_t)); // Seed for realloc
+    pthread_mutex_init(&FramePoolLock, NULL);
     RawFrameSize=0;
+    CurrentFrame = getFreeFrameBuffer();
+    RawFrame = CurrentFrame->data;
 
     BPP = 8;
     BinX = BinY = 1;
@@ -90,15 +309,23 @@ CCDChip::CCDChip()
     strncpy(imageExtention, "fits", MAXINDIBLOBFMT);
 
     FrameType=LIGHT_FRAME;
-    lastRapidX = lastRapidY = -1;
+    starTrackerInit(&RapidTracker, RAPIDGUIDE_STARS, RAPIDGUIDE_WINDOW, RAPIDGUIDE_MINSNR);
+    memset(&Stats, 0, sizeof(Stats));
 }
 
 CCDChip::~CCDChip()
 {
-    free(RawFrame);
+    for (unsigned int i=0; i < FramePool.size(); i++)
+    {
+        free(FramePool[i]->data);
+        delete (FramePool[i]);
+    }
+    FramePool.clear();
+    CurrentFrame=NULL;
     RawFrameSize=0;
     RawFrame=NULL;
     free (BinFrame);
+    pthread_mutex_destroy(&FramePoolLock);
 }
 
 void CCDChip::setFrameType(CCD_FRAME type)
@@ -210,17 +437,122 @@ void CCDChip::setFrameBufferSize(int nbuf, bool allocMem)
     if (nbuf == RawFrameSize)
         return;
 
+    pthread_mutex_lock(&FramePoolLock);
+
     RawFrameSize = nbuf;
 
-    if (allocMem == false)
-        return;
+    // Idle buffers are the wrong size now, busy ones are freed when released
+    for (unsigned int i=0; i < FramePool.size(); )
+    {
+        if (FramePool[i]->refs == 0)
+        {
+            free(FramePool[i]->data);
+            delete (FramePool[i]);
+            FramePool.erase(FramePool.begin() + i);
+        }
+        else
+            i++;
+    }
+
+    // Without allocMem the driver reads out to its own buffer, but until it sets one the chip's must fit too
+    if (allocMem || CurrentFrame->data == RawFrame)
+    {
+        if (CurrentFrame->refs == 1)
+        {
+            CurrentFrame->data = (uint8_t *) realloc(CurrentFrame->data, nbuf * sizeof(uint8_t));
+            CurrentFrame->size = nbuf;
+        }
+        else
+        {
+            CurrentFrame->refs--;
+            CurrentFrame = getFreeFrameBuffer();
+        }
+        RawFrame = CurrentFrame->data;
+    }
 
-    RawFrame = (uint8_t *) realloc(RawFrame, nbuf * sizeof(uint8_t));
+    pthread_mutex_unlock(&FramePoolLock);
 
-    if (BinFrame)
+    if (allocMem && BinFrame)
         BinFrame = (uint8_t *) realloc(BinFrame, nbuf * sizeof(uint8_t));
 }
 
+/* Return a pool buffer of RawFrameSize bytes that no one holds, with one reference taken. Caller holds FramePoolLock. */
+CCDChip::FrameBuffer *CCDChip::getFreeFrameBuffer()
+{
+    for (unsigned int i=0; i < FramePool.size(); i++)
+    {
+        if (FramePool[i]->refs == 0 && FramePool[i]->size == RawFrameSize)
+        {
+            FramePool[i]->refs = 1;
+            return FramePool[i];
+        }
+    }
+
+    FrameBuffer *fb = new FrameBuffer;
+    fb->data = (uint8_t *) malloc(RawFrameSize > 0 ? RawFrameSize : 1);
+    fb->size = RawFrameSize;
+    fb->refs = 1;
+    FramePool.push_back(fb);
+
+    return fb;
+}
+
+uint8_t * CCDChip::acquireFrameBuffer()
+{
+    pthread_mutex_lock(&FramePoolLock);
+
+    if (CurrentFrame->data == RawFrame && CurrentFrame->refs > 1)
+    {
+        CurrentFrame->refs--;
+        CurrentFrame = getFreeFrameBuffer();
+        RawFrame = CurrentFrame->data;
+    }
+
+    pthread_mutex_unlock(&FramePoolLock);
+
+    return RawFrame;
+}
+
+uint8_t * CCDChip::retainFrameBuffer()
+{
+    uint8_t *buffer = NULL;
+
+    pthread_mutex_lock(&FramePoolLock);
+
+    if (CurrentFrame->data == RawFrame)
+    {
+        CurrentFrame->refs++;
+        buffer = RawFrame;
+    }
+
+    pthread_mutex_unlock(&FramePoolLock);
+
+    return buffer;
+}
+
+void CCDChip::releaseFrameBuffer(uint8_t *buffer)
+{
+    pthread_mutex_lock(&FramePoolLock);
+
+    for (unsigned int i=0; i < FramePool.size(); i++)
+    {
+        FrameBuffer *fb = FramePool[i];
+
+        if (fb->data != buffer)
+            continue;
+
+        if (--fb->refs == 0 && fb->size != RawFrameSize)
+        {
+            free(fb->data);
+            delete (fb);
+            FramePool.erase(FramePool.begin() + i);
+        }
+        break;
+    }
+
+    pthread_mutex_unlock(&FramePoolLock);
+}
+
 void CCDChip::setExposureLeft(double duration)
 {
     ImageExposureN[0].value = duration;
@@ -242,12 +574,12 @@ const char *CCDChip::getFrameTypeName(CCD_FRAME fType)
 const char * CCDChip::getExposureStartTime()
 {
     static char ts[32];
-    struct tm *tp;
+    struct tm tm;
     time_t t = (time_t) startExposureTime.tv_sec;
 
     //time (&t);
-    tp = gmtime (&t);
-    strftime (ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", tp);
+    gmtime_r (&t, &tm);
+    strftime (ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
     return (ts);
 }
 
@@ -272,6 +604,11 @@ void CCDChip::setNAxis(int value)
     NAxis = value;
 }
 
+void CCDChip::setBinMode(BinMode mode)
+{
+    BinningMode = mode;
+}
+
 void CCDChip::setImageExtension(const char *ext)
 {
     strncpy(imageExtention, ext, MAXINDIBLOBFMT);
@@ -279,73 +616,65 @@ void CCDChip::setImageExtension(const char *ext)
 
 void CCDChip::binFrame()
 {
-    if (BinX == 1)
-        return;
-
-    // Jasem: Keep full frame shadow in memory to enhance performance and just swap frame pointers after operation is complete
-    if (BinFrame == NULL)
-        BinFrame = (uint8_t*) malloc(RawFrameSize);
+    int type;
 
-    memset(BinFrame, 0, RawFrameSize);
+    if (BinX == 1 && BinY == 1)
+        return;
 
     switch (getBPP())
     {
     case 8:
-    {
-        uint8_t *bin_buf = BinFrame;
-        uint8_t val;
-        for (int i=0; i < SubH; i+= BinX)
-            for (int j=0; j < SubW; j+= BinX)
-            {
-                for (int k=0; k < BinX; k++)
-                {
-                    for (int l=0; l < BinX; l++)
-                    {
-                        val = *(RawFrame + j + (i+k) * SubW + l);
-                        if (val + *bin_buf > UINT8_MAX)
-                            *bin_buf = UINT8_MAX;
-                        else
-                            *bin_buf  += val;
-                    }
-                }
-                bin_buf++;
-            }
+        type = BIN_PIXEL_U8;
+        break;
+    case 16:
+        type = BIN_PIXEL_U16;
+        break;
+    case 32:
+        type = BIN_PIXEL_U32;
+        break;
+    default:
+        return;
     }
-    break;
 
-    case 16:
+    // Bin into a free buffer from the pool and make that the frame, the raw one goes back to the pool.
+    // Jasem: Keep full frame shadow in memory to enhance performance and just swap frame pointers after operation is complete
+    FrameBuffer *binBuffer = NULL;
+    pthread_mutex_lock(&FramePoolLock);
+    if (CurrentFrame->data == RawFrame)
+        binBuffer = getFreeFrameBuffer();
+    pthread_mutex_unlock(&FramePoolLock);
+
+    if (binBuffer == NULL && BinFrame == NULL)
+        BinFrame = (uint8_t*) malloc(RawFrameSize);
+
+    uint8_t *binTarget = binBuffer ? binBuffer->data : BinFrame;
+
+    // Every binned pixel is written, only the leading (SubW/BinX)*(SubH/BinY) pixels of the buffer are used
+    if (binPixels(type, BinningMode, BinX, BinY, binTarget, RawFrame, SubW, SubH, 0) < 0)
     {
-        uint16_t *bin_buf = (uint16_t*) BinFrame;
-        uint16_t *RawFrame16 = (uint16_t*) RawFrame;
-        uint16_t val;
-        for (int i=0; i < SubH; i+= BinX)
-            for (int j=0; j < SubW; j+= BinX)
-            {
-                for (int k=0; k < BinX; k++)
-                {
-                    for (int l=0; l < BinX; l++)
-                    {
-                        val = *(RawFrame16 + j + (i+k) * SubW + l);
-                        if (val + *bin_buf > UINT16_MAX)
-                            *bin_buf = UINT16_MAX;
-                        else
-                            *bin_buf  += val;
-                    }
-                }
-                bin_buf++;
-            }
+        DEBUGFDEVICE(ImageFrameNP.device, INDI::Logger::DBG_ERROR, "Cannot bin frame %dx%d.", BinX, BinY);
+        if (binBuffer)
+        {
+            pthread_mutex_lock(&FramePoolLock);
+            binBuffer->refs--;
+            pthread_mutex_unlock(&FramePoolLock);
+        }
+        return;
     }
-    break;
 
-    default:
+    if (binBuffer)
+    {
+        pthread_mutex_lock(&FramePoolLock);
+        CurrentFrame->refs--;
+        CurrentFrame = binBuffer;
+        RawFrame = CurrentFrame->data;
+        pthread_mutex_unlock(&FramePoolLock);
         return;
-
     }
 
     // Swap frame pointers
     uint8_t *rawFramePointer = RawFrame;
     RawFrame = BinFrame;
-    // We just memset it next time we use it
     BinFrame = rawFramePointer;
 }
 
@@ -376,10 +705,24 @@ INDI::CCD::CCD()
     Aperture=FocalLength=-1;
 
     streamer = NULL;
+
+    pthread_mutex_init(&pipeLock, NULL);
+    pthread_cond_init(&pipeCond, NULL);
+    pipeRunning = false;
+    pipeCallback = -1;
+    pipeFrames = 0;
+    fitsReentrant = false;
+
+    nextIndex = 0;
 }
 
 INDI::CCD::~CCD()
 {
+    stopPipeline();
+    syncImageFiles();
+    pthread_mutex_destroy(&pipeLock);
+    pthread_cond_destroy(&pipeCond);
+
     delete (streamer);
 }
 
@@ -448,6 +791,10 @@ bool INDI::CCD::initProperties()
     IUFillSwitchVector(&PrimaryCCD.CompressSP,PrimaryCCD.CompressS,2,getDeviceName(),"CCD_COMPRESSION","Image",IMAGE_SETTINGS_TAB,IP_RW,ISR_1OFMANY,60,IPS_IDLE);
     PrimaryCCD.SendCompressed = false;
 
+    fillCodecSwitch(&PrimaryCCD.CodecSP, PrimaryCCD.CodecS, getDeviceName(), "CCD_COMPRESSION_CODEC", IMAGE_SETTINGS_TAB);
+    IUFillNumber(&PrimaryCCD.CodecLevelN[0],"LEVEL","Level (0 default)","%.f",0,22,1,0);
+    IUFillNumberVector(&PrimaryCCD.CodecLevelNP,PrimaryCCD.CodecLevelN,1,getDeviceName(),"CCD_COMPRESSION_LEVEL","Compression",IMAGE_SETTINGS_TAB,IP_RW,60,IPS_IDLE);
+
     IUFillBLOB(&PrimaryCCD.FitsB,"CCD1","Image","");
     IUFillBLOBVector(&PrimaryCCD.FitsBP,&PrimaryCCD.FitsB,1,getDeviceName(),"CCD1","Image Data",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
 
@@ -463,7 +810,13 @@ bool INDI::CCD::initProperties()
     IUFillNumber(&PrimaryCCD.RapidGuideDataN[0],"GUIDESTAR_X","Guide star position X","%5.2f",0,1024,0,0);
     IUFillNumber(&PrimaryCCD.RapidGuideDataN[1],"GUIDESTAR_Y","Guide star position Y","%5.2f",0,1024,0,0);
     IUFillNumber(&PrimaryCCD.RapidGuideDataN[2],"GUIDESTAR_FIT","Guide star fit","%5.2f",0,1024,0,0);
-    IUFillNumberVector(&PrimaryCCD.RapidGuideDataNP,PrimaryCCD.RapidGuideDataN,3,getDeviceName(),"CCD_RAPID_GUIDE_DATA","Rapid Guide Data",RAPIDGUIDE_TAB,IP_RO,60,IPS_IDLE);
+    IUFillNumber(&PrimaryCCD.RapidGuideDataN[3],"GUIDESTAR_HFR","Guide star HFR","%5.2f",0,100,0,0);
+    IUFillNumber(&PrimaryCCD.RapidGuideDataN[4],"GUIDESTAR_SNR","Guide star SNR","%5.1f",0,10000,0,0);
+    IUFillNumber(&PrimaryCCD.RapidGuideDataN[5],"GUIDESTAR_COUNT","Guide stars tracked","%.f",0,STAR_MAXTRACK,0,0);
+    IUFillNumberVector(&PrimaryCCD.RapidGuideDataNP,PrimaryCCD.RapidGuideDataN,6,getDeviceName(),"CCD_RAPID_GUIDE_DATA","Rapid Guide Data",RAPIDGUIDE_TAB,IP_RO,60,IPS_IDLE);
+
+    fillStatsNumbers(&PrimaryCCD.ImageStatsNP, PrimaryCCD.ImageStatsN, &PrimaryCCD.ImageHistogramNP, PrimaryCCD.ImageHistogramN,
+                     sizeof(PrimaryCCD.ImageHistogramN)/sizeof(INumber), getDeviceName(), "CCD", IMAGE_INFO_TAB);
 
     // Reset Frame Settings
     IUFillSwitch(&PrimaryCCD.ResetS[0], "RESET", "Reset", ISS_OFF);
@@ -506,6 +859,10 @@ bool INDI::CCD::initProperties()
     IUFillSwitchVector(&GuideCCD.CompressSP,GuideCCD.CompressS,2,getDeviceName(),"GUIDER_COMPRESSION","Image",GUIDE_HEAD_TAB,IP_RW,ISR_1OFMANY,60,IPS_IDLE);
     GuideCCD.SendCompressed = false;
 
+    fillCodecSwitch(&GuideCCD.CodecSP, GuideCCD.CodecS, getDeviceName(), "GUIDER_COMPRESSION_CODEC", GUIDE_HEAD_TAB);
+    IUFillNumber(&GuideCCD.CodecLevelN[0],"LEVEL","Level (0 default)","%.f",0,22,1,0);
+    IUFillNumberVector(&GuideCCD.CodecLevelNP,GuideCCD.CodecLevelN,1,getDeviceName(),"GUIDER_COMPRESSION_LEVEL","Compression",GUIDE_HEAD_TAB,IP_RW,60,IPS_IDLE);
+
     IUFillBLOB(&GuideCCD.FitsB,"CCD2","Guider Image","");
     IUFillBLOBVector(&GuideCCD.FitsBP,&GuideCCD.FitsB,1,getDeviceName(),"CCD2","Image Data",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
 
@@ -521,7 +878,13 @@ bool INDI::CCD::initProperties()
     IUFillNumber(&GuideCCD.RapidGuideDataN[0],"GUIDESTAR_X","Guide star position X","%5.2f",0,1024,0,0);
     IUFillNumber(&GuideCCD.RapidGuideDataN[1],"GUIDESTAR_Y","Guide star position Y","%5.2f",0,1024,0,0);
     IUFillNumber(&GuideCCD.RapidGuideDataN[2],"GUIDESTAR_FIT","Guide star fit","%5.2f",0,1024,0,0);
-    IUFillNumberVector(&GuideCCD.RapidGuideDataNP,GuideCCD.RapidGuideDataN,3,getDeviceName(),"GUIDER_RAPID_GUIDE_DATA","Rapid Guide Data",RAPIDGUIDE_TAB,IP_RO,60,IPS_IDLE);
+    IUFillNumber(&GuideCCD.RapidGuideDataN[3],"GUIDESTAR_HFR","Guide star HFR","%5.2f",0,100,0,0);
+    IUFillNumber(&GuideCCD.RapidGuideDataN[4],"GUIDESTAR_SNR","Guide star SNR","%5.1f",0,10000,0,0);
+    IUFillNumber(&GuideCCD.RapidGuideDataN[5],"GUIDESTAR_COUNT","Guide stars tracked","%.f",0,STAR_MAXTRACK,0,0);
+    IUFillNumberVector(&GuideCCD.RapidGuideDataNP,GuideCCD.RapidGuideDataN,6,getDeviceName(),"GUIDER_RAPID_GUIDE_DATA","Rapid Guide Data",RAPIDGUIDE_TAB,IP_RO,60,IPS_IDLE);
+
+    fillStatsNumbers(&GuideCCD.ImageStatsNP, GuideCCD.ImageStatsN, &GuideCCD.ImageHistogramNP, GuideCCD.ImageHistogramN,
+                     sizeof(GuideCCD.ImageHistogramN)/sizeof(INumber), getDeviceName(), "GUIDER", IMAGE_INFO_TAB);
 
     // CCD Class Init    
 
@@ -539,9 +902,19 @@ bool INDI::CCD::initProperties()
     IUFillText(&UploadSettingsT[1],"UPLOAD_PREFIX","Prefix","IMAGE_XXX");
     IUFillTextVector(&UploadSettingsTP,UploadSettingsT,2,getDeviceName(),"UPLOAD_SETTINGS","Upload Settings",OPTIONS_TAB,IP_RW,60,IPS_IDLE);
 
+    IUFillNumber(&UploadSyncN[0],"SYNC_FRAMES","Sync every (frames)","%.f",0,1000,1,0);
+    IUFillNumberVector(&UploadSyncNP,UploadSyncN,1,getDeviceName(),"UPLOAD_SYNC","Upload Sync",OPTIONS_TAB,IP_RW,60,IPS_IDLE);
+
     IUFillText(&FileNameT[0],"FILE_PATH","Path","");
     IUFillTextVector(&FileNameTP,FileNameT,1,getDeviceName(),"CCD_FILE_PATH","Filename",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
 
+    IUFillNumber(&PipelineN[0],"PIPE_ENCODE","Encode (ms)","%.1f",0,1e9,0,0);
+    IUFillNumber(&PipelineN[1],"PIPE_COMPRESS","Compress (ms)","%.1f",0,1e9,0,0);
+    IUFillNumber(&PipelineN[2],"PIPE_SAVE","Save (ms)","%.1f",0,1e9,0,0);
+    IUFillNumber(&PipelineN[3],"PIPE_UPLOAD","Upload (ms)","%.1f",0,1e9,0,0);
+    IUFillNumber(&PipelineN[4],"PIPE_FRAMES","Frames queued","%.0f",0,1e9,0,0);
+    IUFillNumberVector(&PipelineNP,PipelineN,5,getDeviceName(),"CCD_PIPELINE","Image Pipeline",IMAGE_INFO_TAB,IP_RO,60,IPS_IDLE);
+
     IUFillText(&ActiveDeviceT[0],"ACTIVE_TELESCOPE","Telescope","Telescope Simulator");
     IUFillText(&ActiveDeviceT[1],"ACTIVE_FOCUSER","Focuser","Focuser Simulator");
     IUFillText(&ActiveDeviceT[2],"ACTIVE_FILTER","Filter","CCD Simulator");
@@ -628,11 +1001,19 @@ bool INDI::CCD::updateProperties()
                 defineNumber(&GuideCCD.ImageBinNP);
         }
         defineSwitch(&PrimaryCCD.CompressSP);
+        defineSwitch(&PrimaryCCD.CodecSP);
+        defineNumber(&PrimaryCCD.CodecLevelNP);
         defineBLOB(&PrimaryCCD.FitsBP);
+        defineNumber(&PrimaryCCD.ImageStatsNP);
+        defineNumber(&PrimaryCCD.ImageHistogramNP);
         if(HasGuideHead())
         {
             defineSwitch(&GuideCCD.CompressSP);
+            defineSwitch(&GuideCCD.CodecSP);
+            defineNumber(&GuideCCD.CodecLevelNP);
             defineBLOB(&GuideCCD.FitsBP);
+            defineNumber(&GuideCCD.ImageStatsNP);
+            defineNumber(&GuideCCD.ImageHistogramNP);
         }
         if(HasST4Port())
         {
@@ -671,6 +1052,8 @@ bool INDI::CCD::updateProperties()
         if (UploadSettingsT[0].text == NULL)
             IUSaveText(&UploadSettingsT[0], getenv("HOME"));
         defineText(&UploadSettingsTP);                
+        defineNumber(&UploadSyncNP);
+        defineNumber(&PipelineNP);
     }
     else
     {
@@ -684,7 +1067,11 @@ bool INDI::CCD::updateProperties()
         if (CanAbort())
             deleteProperty(PrimaryCCD.AbortExposureSP.name);
         deleteProperty(PrimaryCCD.FitsBP.name);
+        deleteProperty(PrimaryCCD.ImageStatsNP.name);
+        deleteProperty(PrimaryCCD.ImageHistogramNP.name);
         deleteProperty(PrimaryCCD.CompressSP.name);
+        deleteProperty(PrimaryCCD.CodecSP.name);
+        deleteProperty(PrimaryCCD.CodecLevelNP.name);
         deleteProperty(PrimaryCCD.RapidGuideSP.name);
         if (RapidGuideEnabled)
         {
@@ -700,9 +1087,13 @@ bool INDI::CCD::updateProperties()
                 deleteProperty(GuideCCD.ImagePixelSizeNP.name);
 
             deleteProperty(GuideCCD.FitsBP.name);
+            deleteProperty(GuideCCD.ImageStatsNP.name);
+            deleteProperty(GuideCCD.ImageHistogramNP.name);
             if (CanBin())
                 deleteProperty(GuideCCD.ImageBinNP.name);
             deleteProperty(GuideCCD.CompressSP.name);
+            deleteProperty(GuideCCD.CodecSP.name);
+            deleteProperty(GuideCCD.CodecLevelNP.name);
             deleteProperty(GuideCCD.FrameTypeSP.name);
             deleteProperty(GuideCCD.RapidGuideSP.name);
             if (GuiderRapidGuideEnabled)
@@ -731,6 +1122,8 @@ bool INDI::CCD::updateProperties()
         deleteProperty(WorldCoordSP.name);
         deleteProperty(UploadSP.name);
         deleteProperty(UploadSettingsTP.name);
+        deleteProperty(UploadSyncNP.name);
+        deleteProperty(PipelineNP.name);
     }
 
     // Streamer
@@ -1105,6 +1498,42 @@ bool INDI::CCD::ISNewNumber (const char *dev, const char *name, double values[],
             return true;
         }
 
+        if (!strcmp(name, UploadSyncNP.name))
+        {
+            IUUpdateNumber(&UploadSyncNP, values, names, n);
+
+            // Each frame waiting for its sync keeps its file open, stay well clear of the open file limit
+            struct rlimit rl;
+            if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && UploadSyncN[0].value > rl.rlim_cur/4)
+            {
+                UploadSyncN[0].value = rl.rlim_cur/4;
+                DEBUGF(INDI::Logger::DBG_WARNING, "Syncing every %.f frames, the open file limit allows no more.", UploadSyncN[0].value);
+            }
+
+            UploadSyncNP.s = IPS_OK;
+            IDSetNumber(&UploadSyncNP, NULL);
+            return true;
+        }
+
+        // Compression level
+        if (!strcmp(name, PrimaryCCD.CodecLevelNP.name))
+        {
+            IUUpdateNumber(&PrimaryCCD.CodecLevelNP, values, names, n);
+            PrimaryCCD.CodecLevel = PrimaryCCD.CodecLevelN[0].value;
+            PrimaryCCD.CodecLevelNP.s = IPS_OK;
+            IDSetNumber(&PrimaryCCD.CodecLevelNP, NULL);
+            return true;
+        }
+
+        if (!strcmp(name, GuideCCD.CodecLevelNP.name))
+        {
+            IUUpdateNumber(&GuideCCD.CodecLevelNP, values, names, n);
+            GuideCCD.CodecLevel = GuideCCD.CodecLevelN[0].value;
+            GuideCCD.CodecLevelNP.s = IPS_OK;
+            IDSetNumber(&GuideCCD.CodecLevelNP, NULL);
+            return true;
+        }
+
         // CCD Rotation
         if (!strcmp(name, CCDRotationNP.name))
         {
@@ -1279,6 +1708,24 @@ bool INDI::CCD::ISNewSwitch (const char *dev, const char *name, ISState *states,
             return true;
         }
 
+        if(strcmp(name,PrimaryCCD.CodecSP.name)==0)
+        {
+            IUUpdateSwitch(&PrimaryCCD.CodecSP,states,names,n);
+            PrimaryCCD.Codec = codecFromSwitch(&PrimaryCCD.CodecSP);
+            PrimaryCCD.CodecSP.s = IPS_OK;
+            IDSetSwitch(&PrimaryCCD.CodecSP,NULL);
+            return true;
+        }
+
+        if(strcmp(name,GuideCCD.CodecSP.name)==0)
+        {
+            IUUpdateSwitch(&GuideCCD.CodecSP,states,names,n);
+            GuideCCD.Codec = codecFromSwitch(&GuideCCD.CodecSP);
+            GuideCCD.CodecSP.s = IPS_OK;
+            IDSetSwitch(&GuideCCD.CodecSP,NULL);
+            return true;
+        }
+
         if(strcmp(name,PrimaryCCD.FrameTypeSP.name)==0)
         {
             IUUpdateSwitch(&PrimaryCCD.FrameTypeSP,states,names,n);
@@ -1346,6 +1793,7 @@ bool INDI::CCD::ISNewSwitch (const char *dev, const char *name, ISState *states,
             RapidGuideEnabled=(PrimaryCCD.RapidGuideS[0].s==ISS_ON);
 
             if (RapidGuideEnabled) {
+              starTrackerInit(&PrimaryCCD.RapidTracker, RAPIDGUIDE_STARS, RAPIDGUIDE_WINDOW, RAPIDGUIDE_MINSNR);
               defineSwitch(&PrimaryCCD.RapidGuideSetupSP);
               defineNumber(&PrimaryCCD.RapidGuideDataNP);
             }
@@ -1365,6 +1813,7 @@ bool INDI::CCD::ISNewSwitch (const char *dev, const char *name, ISState *states,
             GuiderRapidGuideEnabled=(GuideCCD.RapidGuideS[0].s==ISS_ON);
 
             if (GuiderRapidGuideEnabled) {
+              starTrackerInit(&GuideCCD.RapidTracker, RAPIDGUIDE_STARS, RAPIDGUIDE_WINDOW, RAPIDGUIDE_MINSNR);
               defineSwitch(&GuideCCD.RapidGuideSetupSP);
               defineNumber(&GuideCCD.RapidGuideDataNP);
             }
@@ -1491,16 +1940,12 @@ void INDI::CCD::addFITSKeywords(fitsfile *fptr, CCDChip *targetChip)
     char frame_s[32];
     char dev_name[32];
     char exp_start[32];
-    double min_val, max_val;
     double exposureDuration;
     double pixSize1,pixSize2;
     unsigned int xbin, ybin;
 
     char *orig = setlocale(LC_NUMERIC,"C");
 
-    if (targetChip->getNAxis() == 2)
-        getMinMax(&min_val, &max_val, targetChip);
-
     xbin = targetChip->getBinX();
     ybin = targetChip->getBinY();
 
@@ -1552,10 +1997,15 @@ void INDI::CCD::addFITSKeywords(fitsfile *fptr, CCDChip *targetChip)
         fits_update_key_s(fptr, TSTRING, "FILTER", filter, "Filter", &status);
     }
 
+    // ExposureComplete() finds the statistics of the frame before the header is written
     if (targetChip->getNAxis() == 2)
     {
-        fits_update_key_s(fptr, TDOUBLE, "DATAMIN", &min_val, "Minimum value", &status);
-        fits_update_key_s(fptr, TDOUBLE, "DATAMAX", &max_val, "Maximum value", &status);
+        ImageStats *stats = &targetChip->Stats;
+        fits_update_key_s(fptr, TDOUBLE, "DATAMIN", &stats->min, "Minimum value", &status);
+        fits_update_key_s(fptr, TDOUBLE, "DATAMAX", &stats->max, "Maximum value", &status);
+        fits_update_key_s(fptr, TDOUBLE, "DATAMEAN", &stats->mean, "Mean value", &status);
+        fits_update_key_s(fptr, TDOUBLE, "DATASTD", &stats->stddev, "Standard deviation", &status);
+        fits_update_key_s(fptr, TDOUBLE, "DATAMED", &stats->median, "Median value", &status);
     }
 
     if (HasBayer() && targetChip->getNAxis() == 2)
@@ -1682,7 +2132,7 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
       saveImage = false;
     }
 
-    if (GuiderRapidGuideEnabled && targetChip == &GuideCCD && (GuideCCD.getBPP() == 16 || PrimaryCCD.getBPP() == 8))
+    if (GuiderRapidGuideEnabled && targetChip == &GuideCCD && (GuideCCD.getBPP() == 16 || GuideCCD.getBPP() == 8))
     {
       autoLoop = GuiderAutoLoop;
       sendImage = GuiderSendImage;
@@ -1693,156 +2143,43 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
 
     if (sendData)
     {
-      static double P0 = 0.906, P1 = 0.584, P2 = 0.365, P3 = 0.117, P4 = 0.049, P5 = -0.05, P6 = -0.064, P7 = -0.074, P8 = -0.094;
       targetChip->RapidGuideDataNP.s=IPS_BUSY;
       int width = targetChip->getSubW() / targetChip->getBinX();
       int height = targetChip->getSubH() / targetChip->getBinY();
       void *src = (unsigned short *) targetChip->getFrameBuffer();
-      int i0, i1, i2, i3, i4, i5, i6, i7, i8;
+      StarTracker *tracker = &targetChip->RapidTracker;
       int ix = 0, iy = 0;
-      int xM4;
-      double average, fit, bestFit = 0;
-      int minx = 4;
-      int maxx = width -4;
-      int miny = 4;
-      int maxy = height -4;
-      if (targetChip->lastRapidX > 0 && targetChip->lastRapidY > 0) {
-        minx = std::max(targetChip->lastRapidX - 20, 4);
-        maxx = std::min(targetChip->lastRapidX + 20, width - 4);
-        miny = std::max(targetChip->lastRapidY - 20, 4);
-        maxy = std::min(targetChip->lastRapidY + 20, height -4);
-      }
-      if (targetChip->getBPP() == 16) {
-        unsigned short *p;
-        for (int x = minx; x < maxx; x++)
-          for (int y = miny; y < maxy; y++) {
-            i0 = i1 = i2 = i3 = i4 = i5 = i6 = i7 = i8 = 0;
-            xM4 = x - 4;
-            p = (unsigned short *)src + (y - 4) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y - 3) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i7 += *p++; i6 += *p++; i7 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y - 2) * width + xM4; i8 += *p++; i8 += *p++; i5 += *p++; i4 += *p++; i3 += *p++; i4 += *p++; i5 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y - 1) * width + xM4; i8 += *p++; i7 += *p++; i4 += *p++; i2 += *p++; i1 += *p++; i2 += *p++; i4 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y + 0) * width + xM4; i8 += *p++; i6 += *p++; i3 += *p++; i1 += *p++; i0 += *p++; i1 += *p++; i3 += *p++; i6 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y + 1) * width + xM4; i8 += *p++; i7 += *p++; i4 += *p++; i2 += *p++; i1 += *p++; i2 += *p++; i4 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y + 2) * width + xM4; i8 += *p++; i8 += *p++; i5 += *p++; i4 += *p++; i3 += *p++; i4 += *p++; i5 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y + 3) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i7 += *p++; i6 += *p++; i7 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned short *)src + (y + 4) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            average = (i0 + i1 + i2 + i3 + i4 + i5 + i6 + i7 + i8) / 85.0;
-            fit = P0 * (i0 - average) + P1 * (i1 - 4 * average) + P2 * (i2 - 4 * average) + P3 * (i3 - 4 * average) + P4 * (i4 - 8 * average) + P5 * (i5 - 4 * average) + P6 * (i6 - 4 * average) + P7 * (i7 - 8 * average) + P8 * (i8 - 48 * average);
-            if (bestFit < fit) {
-              bestFit = fit;
-              ix = x;
-              iy = y;
-            }
-          }
-      } else {
-        unsigned char *p;
-        for (int x = minx; x < maxx; x++)
-          for (int y = miny; y < maxy; y++) {
-            i0 = i1 = i2 = i3 = i4 = i5 = i6 = i7 = i8 = 0;
-            xM4 = x - 4;
-            p = (unsigned char *)src + (y - 4) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y - 3) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i7 += *p++; i6 += *p++; i7 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y - 2) * width + xM4; i8 += *p++; i8 += *p++; i5 += *p++; i4 += *p++; i3 += *p++; i4 += *p++; i5 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y - 1) * width + xM4; i8 += *p++; i7 += *p++; i4 += *p++; i2 += *p++; i1 += *p++; i2 += *p++; i4 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y + 0) * width + xM4; i8 += *p++; i6 += *p++; i3 += *p++; i1 += *p++; i0 += *p++; i1 += *p++; i3 += *p++; i6 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y + 1) * width + xM4; i8 += *p++; i7 += *p++; i4 += *p++; i2 += *p++; i1 += *p++; i2 += *p++; i4 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y + 2) * width + xM4; i8 += *p++; i8 += *p++; i5 += *p++; i4 += *p++; i3 += *p++; i4 += *p++; i5 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y + 3) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i7 += *p++; i6 += *p++; i7 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            p = (unsigned char *)src + (y + 4) * width + xM4; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++; i8 += *p++;
-            average = (i0 + i1 + i2 + i3 + i4 + i5 + i6 + i7 + i8) / 85.0;
-            fit = P0 * (i0 - average) + P1 * (i1 - 4 * average) + P2 * (i2 - 4 * average) + P3 * (i3 - 4 * average) + P4 * (i4 - 8 * average) + P5 * (i5 - 4 * average) + P6 * (i6 - 4 * average) + P7 * (i7 - 8 * average) + P8 * (i8 - 48 * average);
-            if (bestFit < fit) {
-              bestFit = fit;
-              ix = x;
-              iy = y;
-            }
-          }
-      }
 
-      targetChip->RapidGuideDataN[0].value = ix;
-      targetChip->RapidGuideDataN[1].value = iy;
-      targetChip->RapidGuideDataN[2].value = bestFit;
-      targetChip->lastRapidX = ix;
-      targetChip->lastRapidY = iy;
-      if (bestFit > 50) {
-        int sumX = 0;
-        int sumY = 0;
-        int total = 0;
-        int max = 0;
-        int noiseThreshold = 0;
-        
-        if (targetChip->getBPP() == 16) {
-          unsigned short *p;
-          for (int y = iy - 4; y <= iy + 4; y++) {
-            p = (unsigned short *)src + y * width + ix - 4;
-            for (int x = ix - 4; x <= ix + 4; x++) {
-              int w = *p++;
-              noiseThreshold += w;
-              if (w > max)
-                max = w;
-            }
-          }
-          noiseThreshold = (noiseThreshold/81+max)/2; // set threshold between peak and average
-          for (int y = iy - 4; y <= iy + 4; y++) {
-            p = (unsigned short *)src + y * width + ix - 4;
-            for (int x = ix - 4; x <= ix + 4; x++) {
-              int w = *p++;
-              if (w < noiseThreshold)
-                w = 0;
-              sumX += x * w;
-              sumY += y * w;
-              total += w;
-            }
-          }
-        } else {
-          unsigned char *p;
-          for (int y = iy - 4; y <= iy + 4; y++) {
-            p = (unsigned char *)src + y * width + ix - 4;
-            for (int x = ix - 4; x <= ix + 4; x++) {
-              int w = *p++;
-              noiseThreshold += w;
-              if (w > max)
-                max = w;
-            }
-          }
-          noiseThreshold = (noiseThreshold/81+max)/2; // set threshold between peak and average
-          for (int y = iy - 4; y <= iy + 4; y++) {
-            p = (unsigned char *)src + y * width + ix - 4;
-            for (int x = ix - 4; x <= ix + 4; x++) {
-              int w = *p++;
-              if (w < noiseThreshold)
-                w = 0;
-              sumX += x * w;
-              sumY += y * w;
-              total += w;
-            }
-          }
-        }
-        
-        if (total > 0)
-        {
-          targetChip->RapidGuideDataN[0].value = ((double)sumX)/total;
-          targetChip->RapidGuideDataN[1].value = ((double)sumY)/total;
-          targetChip->RapidGuideDataNP.s=IPS_OK;
-
-          DEBUGF(INDI::Logger::DBG_DEBUG, "Guide Star X: %g Y: %g FIT: %g", targetChip->RapidGuideDataN[0].value, targetChip->RapidGuideDataN[1].value,
-                  targetChip->RapidGuideDataN[2].value);
-        }
-        else
-        {
-          targetChip->RapidGuideDataNP.s=IPS_ALERT;
-          targetChip->lastRapidX = targetChip->lastRapidY = -1;
-        }
+      // Follow the stars found so far, the whole frame is only searched until some are found
+      if (starTrackerUpdate(tracker, targetChip->getBPP(), src, width, height, 0) > 0)
+      {
+        // Report the guide star if it was seen, else the first star that was
+        int i = 0;
+        while (!tracker->found[i])
+          i++;
+
+        targetChip->RapidGuideDataN[0].value = tracker->x;
+        targetChip->RapidGuideDataN[1].value = tracker->y;
+        targetChip->RapidGuideDataN[2].value = tracker->stars[i].peak;
+        targetChip->RapidGuideDataN[3].value = tracker->stars[i].hfr;
+        targetChip->RapidGuideDataN[4].value = tracker->stars[i].snr;
+        targetChip->RapidGuideDataN[5].value = tracker->nfound;
+        targetChip->RapidGuideDataNP.s=IPS_OK;
+        ix = (int) (tracker->x + 0.5);
+        iy = (int) (tracker->y + 0.5);
+
+        DEBUGF(INDI::Logger::DBG_DEBUG, "Guide Star X: %g Y: %g FIT: %g HFR: %g SNR: %g Stars: %d", targetChip->RapidGuideDataN[0].value,
+                targetChip->RapidGuideDataN[1].value, targetChip->RapidGuideDataN[2].value, targetChip->RapidGuideDataN[3].value,
+                targetChip->RapidGuideDataN[4].value, tracker->nfound);
       }
       else
       {
+        targetChip->RapidGuideDataN[5].value = 0;
         targetChip->RapidGuideDataNP.s=IPS_ALERT;
-        targetChip->lastRapidX = targetChip->lastRapidY = -1;
       }
       IDSetNumber(&targetChip->RapidGuideDataNP,NULL);
 
-      if (showMarker)
+      if (showMarker && targetChip->RapidGuideDataNP.s == IPS_OK)
       {
         int xmin = std::max(ix - 10, 0);
         int xmax = std::min(ix + 10, width - 1);
@@ -1918,114 +2255,217 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
       }
     }
 
+    // Unless cfitsio is reentrant only this thread may call it, so Rice encoding is done here and the frame
+    // enters the pipeline at the compress stage
+    bool piped = (sendImage || saveImage) && startPipeline();
+    int entry = PIPE_ENCODE;
+    if (piped && fitsReentrant == false && targetChip->SendCompressed && targetChip->getCodec() == CCDChip::CODEC_RICE &&
+        !strcmp(targetChip->getImageExtension(), "fits"))
+        entry = PIPE_COMPRESS;
+
+    // Frames only uploaded never wait for the pipeline here, the event loop would stall behind slow uploads
+    bool dropped = piped && saveImage == false && pipelineFull(entry);
+    if (dropped)
+      sendImage = false;
+
     if (sendImage || saveImage)
     {
+      updateImageStats(targetChip);
+
+      UploadJob *job = new UploadJob;
+
+      job->chip = targetChip;
+      job->sendImage = sendImage;
+      job->saveImage = saveImage;
+      job->compress = targetChip->SendCompressed;
+      job->codec = targetChip->getCodec();
+      job->level = targetChip->getCodecLevel();
+      job->uploadDir = UploadSettingsT[0].text;
+      job->prefix = UploadSettingsT[1].text;
+      job->syncFrames = UploadSyncN[0].value;
+      job->reportExposure = !autoLoop;
+      snprintf(job->ext, MAXINDIBLOBFMT, ".%s", targetChip->getImageExtension());
+
+      // Rice compresses the FITS image itself, into a .fits.fz file any FITS reader opens
+      bool rice = job->compress && job->codec == CCDChip::CODEC_RICE;
+      if (rice)
+      {
+          job->compress = false;
+          job->codec = BLOB_CODEC_ZLIB;
+          if (strcmp(targetChip->getImageExtension(), "fits"))
+          {
+              DEBUGF(Logger::DBG_DEBUG, "Rice compression only applies to FITS, compressing %s with zlib.", job->ext);
+              job->compress = true;
+              rice = false;
+          }
+          else
+              strncat(job->ext, ".fz", MAXINDIBLOBFMT-strlen(job->ext)-1);
+      }
+      job->bvp = targetChip->FitsBP;
+      job->bp = targetChip->FitsB;
+      job->bvp.bp = &job->bp;
+
       if (!strcmp(targetChip->getImageExtension(), "fits"))
       {
-          void *memptr;
-          size_t memsize;
           int img_type=0;
-          int byte_type=0;
           int status=0;
           long naxis=targetChip->getNAxis();
           long naxes[naxis];
-          int nelements=0;
           std::string bit_depth;
 
-          fitsfile *fptr=NULL;
-
           naxes[0]=targetChip->getSubW()/targetChip->getBinX();
           naxes[1]=targetChip->getSubH()/targetChip->getBinY();
 
           switch (targetChip->getBPP())
           {
               case 8:
-                  byte_type = TBYTE;
+                  job->byteType = TBYTE;
                   img_type  = BYTE_IMG;
                   bit_depth = "8 bits per pixel";
                   break;
 
               case 16:
-                  byte_type = TUSHORT;
+                  job->byteType = TUSHORT;
                   img_type = USHORT_IMG;
                   bit_depth = "16 bits per pixel";
                   break;
 
               case 32:
-                  byte_type = TULONG;
+                  job->byteType = TULONG;
                   img_type = ULONG_IMG;
                   bit_depth = "32 bits per pixel";
                   break;
 
                default:
                   DEBUGF(Logger::DBG_WARNING, "Unsupported bits per pixel value %d\n", targetChip->getBPP() );
+                  delete job;
                   return false;
                   break;
           }
 
-          nelements = naxes[0] * naxes[1];
+          job->nelements = naxes[0] * naxes[1];
           if (naxis== 3)
           {
-              nelements *= 3;
+              job->nelements *= 3;
               naxes[2] = 3;
           }
 
           /*DEBUGF(Logger::DBG_DEBUG, "Exposure complete. Image Depth: %s. Width: %d Height: %d nelements: %d", bit_depth.c_str(), naxes[0],
                   naxes[1], nelements);*/
 
-          //  Now we have to send fits format data to the client
-          memsize=5760;
-          memptr=malloc(memsize);
-          if(!memptr)
+          //  The header records the state of the driver right now, the encode stage adds the pixels later
+          job->memsize=5760;
+          job->memptr=malloc(job->memsize);
+          if(!job->memptr)
           {
-              IDLog("Error: failed to allocate memory: %lu\n",(unsigned long)memsize);
+              IDLog("Error: failed to allocate memory: %lu\n",(unsigned long)job->memsize);
           }
 
-          fits_create_memfile(&fptr,&memptr,&memsize,2880,realloc,&status);
+          fits_create_memfile(&job->fptr,&job->memptr,&job->memsize,2880,realloc,&status);
+
+          if (rice)
+              fits_set_compression_type(job->fptr, RICE_1, &status);
 
           if(status)
           {
             IDLog("Error: Failed to create FITS image\n");
             fits_report_error(stderr, status);  /* print out any error messages */
+            delete job;
             return false;
           }
 
-          fits_create_img(fptr, img_type , naxis, naxes, &status);
+          // Without Rice cfitsio only writes the header, the axes go in as it is copied out
+          if (rice)
+              fits_create_img(job->fptr, img_type , naxis, naxes, &status);
+          else
+              fits_create_img(job->fptr, img_type , 0, NULL, &status);
 
           if (status)
           {
             IDLog("Error: Failed to create FITS image\n");
             fits_report_error(stderr, status);  /* print out any error messages */
+            delete job;
             return false;
           }
 
-          addFITSKeywords(fptr, targetChip);
-
-          fits_write_img(fptr,byte_type,1,nelements,targetChip->getFrameBuffer(),&status);
+          addFITSKeywords(job->fptr, targetChip);
 
-          if (status)
+          if (rice == false)
           {
-            IDLog("Error: Failed to write FITS image\n");
-            fits_report_error(stderr, status);  /* print out any error messages */
-            return false;
-          }
+              bool copied = copyFITSHeader(job->fptr, targetChip->getBPP(), naxis, naxes, job->header);
 
-          fits_close_file(fptr,&status);
+              fits_close_file(job->fptr, &status);
+              job->fptr = NULL;
+              free(job->memptr);
+              job->memptr = NULL;
+              job->memsize = 0;
 
-          uploadFile(targetChip, memptr, memsize, sendImage, saveImage);
+              if (copied == false)
+              {
+                IDLog("Error: Failed to create FITS header\n");
+                delete job;
+                return false;
+              }
+          }
+
+          job->bpp = targetChip->getBPP();
+          job->frameSize = job->nelements * (targetChip->getBPP() / 8);
+      }
+      else
+          job->frameSize = targetChip->getFrameBufferSize();
 
-          free(memptr);
+      // Keep the frame and give the chip another buffer for the next exposure, or copy it if the driver owns the buffer
+      job->frame = targetChip->retainFrameBuffer();
+      if (job->frame)
+      {
+          job->framePooled = true;
+          targetChip->acquireFrameBuffer();
       }
       else
       {
-          uploadFile(targetChip, targetChip->getFrameBuffer(), targetChip->getFrameBufferSize(), sendImage, saveImage);
+          job->frame = (uint8_t *) malloc(job->frameSize);
+          if (job->frame == NULL)
+          {
+              DEBUG(INDI::Logger::DBG_ERROR, "Error: Ran out of memory copying image");
+              delete job;
+              return false;
+          }
+          memcpy(job->frame, targetChip->getFrameBuffer(), job->frameSize);
       }
 
+      int stage = PIPE_ENCODE;
+      if (entry == PIPE_COMPRESS && job->fptr)
+          stage = runStage(job, PIPE_ENCODE) ? PIPE_COMPRESS : PIPE_STAGES;
 
+      // Frames to save wait for room, the others are dropped if a stage thread filled the stage meanwhile
+      if (piped && stage < PIPE_STAGES)
+      {
+          if (queueUpload(job, stage, saveImage))
+              pipeFrames++;
+          else
+          {
+              delete job;
+              dropped = true;
+          }
+      }
+      // Without a pipeline run each stage right here, as before. finishUpload() reports the exposure done.
+      else
+      {
+          for (; stage < PIPE_STAGES; stage++)
+              if (runStage(job, stage) == false)
+                  break;
+          finishUpload(job);
+      }
     }
 
-    targetChip->ImageExposureNP.s=IPS_OK;
-    IDSetNumber(&targetChip->ImageExposureNP,NULL);
+    if (dropped)
+      DEBUG(INDI::Logger::DBG_ERROR, "Image pipeline is full, frame dropped.");
+
+    if (dropped || autoLoop || (sendImage == false && saveImage == false))
+    {
+      targetChip->ImageExposureNP.s = dropped ? IPS_ALERT : IPS_OK;
+      IDSetNumber(&targetChip->ImageExposureNP,NULL);
+    }
 
     if (autoLoop)
     {
@@ -2062,98 +2502,415 @@ bool INDI::CCD::ExposureComplete(CCDChip *targetChip)
     return true;
 }
 
-bool INDI::CCD::uploadFile(CCDChip * targetChip, const void *fitsData, size_t totalBytes, bool sendImage, bool saveImage)
+bool INDI::CCD::startPipeline()
 {
-    unsigned char *compressedData = NULL;
-    uLongf compressedBytes=0;
+    if (pipeRunning)
+        return true;
 
-    if (saveImage)
+    if (pipe(pipeFd) == -1)
     {
-        targetChip->FitsB.blob=(unsigned char *)fitsData;
-        targetChip->FitsB.bloblen=totalBytes;
-        snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s", targetChip->getImageExtension());
+        DEBUGF(INDI::Logger::DBG_WARNING, "Image pipeline: %s, uploading in the foreground.", strerror(errno));
+        return false;
+    }
 
-        FILE *fp = NULL;
-        char imageFileName[MAXRBUF];
-        std::string prefix = UploadSettingsT[1].text;
-        int maxIndex = getFileIndex(UploadSettingsT[0].text, UploadSettingsT[1].text, targetChip->FitsB.format);
+    fitsReentrant = fits_is_reentrant();
+    if (fitsReentrant == false)
+        DEBUG(INDI::Logger::DBG_DEBUG, "Image pipeline: cfitsio is not reentrant, Rice compression is done in the foreground.");
 
-        if (maxIndex < 0)
-        {
-            DEBUGF(INDI::Logger::DBG_ERROR, "Error iterating directory %s. %s", UploadSettingsT[0].text, strerror(errno));
-            return false;
-        }
+    pipeRunning = true;
 
-        if (maxIndex > 0)
-        {
-            char indexString[4];
-            snprintf(indexString, 4, "%03d", maxIndex);
-            std::string prefixIndex = indexString;
-            prefix.replace(prefix.find("XXX"), 3, prefixIndex);
-        }
+    int stage;
+    for (stage=PIPE_ENCODE; stage < PIPE_STAGES; stage++)
+    {
+        pipeStages[stage].ccd = this;
+        pipeStages[stage].stage = stage;
+        if (pthread_create(&pipeStages[stage].thread, NULL, &INDI::CCD::pipelineHelper, &pipeStages[stage]) != 0)
+            break;
+    }
+
+    if (stage < PIPE_STAGES)
+    {
+        DEBUG(INDI::Logger::DBG_WARNING, "Image pipeline: cannot create thread, uploading in the foreground.");
+        pthread_mutex_lock(&pipeLock);
+        pipeRunning = false;
+        pthread_cond_broadcast(&pipeCond);
+        pthread_mutex_unlock(&pipeLock);
+        while (--stage >= 0)
+            pthread_join(pipeStages[stage].thread, NULL);
+        close(pipeFd[0]);
+        close(pipeFd[1]);
+        return false;
+    }
+
+    pipeCallback = IEAddCallback(pipeFd[0], &INDI::CCD::pipelineDoneHelper, this);
+
+    return true;
+}
+
+void INDI::CCD::stopPipeline()
+{
+    if (pipeRunning == false)
+        return;
+
+    pthread_mutex_lock(&pipeLock);
+    pipeRunning = false;
+    pthread_cond_broadcast(&pipeCond);
+    pthread_mutex_unlock(&pipeLock);
 
-        snprintf(imageFileName, MAXRBUF, "%s/%s%s", UploadSettingsT[0].text, prefix.c_str(), targetChip->FitsB.format);
-        fp = fopen(imageFileName, "w");
-        if (fp == NULL)
+    for (int stage=PIPE_ENCODE; stage < PIPE_STAGES; stage++)
+        pthread_join(pipeStages[stage].thread, NULL);
+
+    // Frames still queued are dropped
+    for (int stage=PIPE_ENCODE; stage < PIPE_STAGES; stage++)
+    {
+        while (pipeQueue[stage].empty() == false)
         {
-            DEBUGF(INDI::Logger::DBG_ERROR, "Unable to save image file (%s). %s", imageFileName, strerror(errno));
-            return false;
+            delete pipeQueue[stage].front();
+            pipeQueue[stage].pop_front();
         }
+    }
 
-        int n=0;
-        for (int nr=0; nr < (int) targetChip->FitsB.bloblen; nr += n)
-            n = fwrite( (static_cast<char *>(targetChip->FitsB.blob) + nr), 1, targetChip->FitsB.bloblen - nr, fp);
+    IERmCallback(pipeCallback);
+    close(pipeFd[1]);
+    UploadJob *job;
+    while (read(pipeFd[0], &job, sizeof(job)) == sizeof(job))
+        delete job;
+    close(pipeFd[0]);
+    pipeFrames = 0;
+}
 
-        DEBUGF(INDI::Logger::DBG_SESSION, "Image saved to %s", imageFileName);
-        IUSaveText(&FileNameT[0], imageFileName);
-        FileNameTP.s = IPS_OK;
-        IDSetText(&FileNameTP, NULL);
-        fclose(fp);
-    }
+/* Return whether the given stage already has PIPE_QUEUE frames waiting, so ExposureComplete() may drop
+ * a frame before doing any work on it. The stage before may still fill it, see queueUpload().
+ */
+bool INDI::CCD::pipelineFull(int stage)
+{
+    pthread_mutex_lock(&pipeLock);
+    bool full = pipeRunning && pipeQueue[stage].size() >= PIPE_QUEUE;
+    pthread_mutex_unlock(&pipeLock);
+
+    return full;
+}
 
-    if (targetChip->SendCompressed)
+/* Queue job for the given stage, waiting while the stage already has PIPE_QUEUE frames waiting if wait is set.
+ * Return false if there is no pipeline to take it, or the stage is full and wait is not set.
+ */
+bool INDI::CCD::queueUpload(UploadJob *job, int stage, bool wait)
+{
+    pthread_mutex_lock(&pipeLock);
+    while (wait && pipeRunning && pipeQueue[stage].size() >= PIPE_QUEUE)
+        pthread_cond_wait(&pipeCond, &pipeLock);
+    if (pipeRunning == false || pipeQueue[stage].size() >= PIPE_QUEUE)
     {
-        compressedBytes = sizeof(char) * totalBytes + totalBytes / 64 + 16 + 3;
-        compressedData = (unsigned char *) malloc (compressedBytes);
+        pthread_mutex_unlock(&pipeLock);
+        return false;
+    }
+    pipeQueue[stage].push_back(job);
+    pthread_cond_broadcast(&pipeCond);
+    pthread_mutex_unlock(&pipeLock);
+
+    return true;
+}
+
+void * INDI::CCD::pipelineHelper(void *context)
+{
+    PipeStage *ps = static_cast<PipeStage *>(context);
+    ps->ccd->runPipeline(ps->stage);
+    return NULL;
+}
+
+void INDI::CCD::runPipeline(int stage)
+{
+    pthread_mutex_lock(&pipeLock);
 
-        if (fitsData == NULL || compressedData == NULL)
+    while (true)
+    {
+        while (pipeRunning && pipeQueue[stage].empty())
         {
-            if (compressedData)
-                free(compressedData);
-            DEBUG(INDI::Logger::DBG_ERROR, "Error: Ran out of memory compressing image");
-            return false;
+            if (stage != PIPE_SAVE || unsyncedFiles.empty())
+            {
+                pthread_cond_wait(&pipeCond, &pipeLock);
+                continue;
+            }
+
+            // A partial batch of saved files is synced once the frames stop coming, e.g. at the end of a sequence
+            struct timeval now;
+            struct timespec deadline;
+            gettimeofday(&now, NULL);
+            deadline.tv_sec = now.tv_sec + SYNC_IDLE;
+            deadline.tv_nsec = now.tv_usec * 1000;
+            if (pthread_cond_timedwait(&pipeCond, &pipeLock, &deadline) == ETIMEDOUT && pipeQueue[stage].empty())
+            {
+                pthread_mutex_unlock(&pipeLock);
+                if (syncImageFiles() == false)
+                    IDLog("Unable to sync image files in %s. %s\n", unsyncedDir.c_str(), strerror(errno));
+                pthread_mutex_lock(&pipeLock);
+            }
         }
+        if (pipeRunning == false)
+            break;
 
-        int r = compress2(compressedData, &compressedBytes, (const Bytef*)fitsData, totalBytes, 9);
-        if (r != Z_OK)
+        UploadJob *job = pipeQueue[stage].front();
+        pipeQueue[stage].pop_front();
+        pthread_cond_broadcast(&pipeCond);
+        pthread_mutex_unlock(&pipeLock);
+
+        // A failed frame skips the remaining stages
+        if (runStage(job, stage) == false || stage == PIPE_UPLOAD)
         {
-            /* this should NEVER happen */
-            DEBUG(INDI::Logger::DBG_ERROR, "Error: Failed to compress image");
-            return false;
+            if (write(pipeFd[1], &job, sizeof(job)) != sizeof(job))
+                delete job;
         }
+        else if (queueUpload(job, stage+1, true) == false)
+            delete job;
 
-        targetChip->FitsB.blob=compressedData;
-        targetChip->FitsB.bloblen=compressedBytes;
-        snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s.z", targetChip->getImageExtension());
-    } else
-    {
-        targetChip->FitsB.blob=(unsigned char *)fitsData;
-        targetChip->FitsB.bloblen=totalBytes;
-        snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, ".%s", targetChip->getImageExtension());
+        pthread_mutex_lock(&pipeLock);
     }
 
-    targetChip->FitsB.size = totalBytes;
-    targetChip->FitsBP.s=IPS_OK;
+    pthread_mutex_unlock(&pipeLock);
+}
+
+/* Run one stage on job, recording how long it took. Only touches job, so it may run on any thread. */
+bool INDI::CCD::runStage(UploadJob *job, int stage)
+{
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+
+    switch (stage)
+    {
+        case PIPE_ENCODE:
+            if (job->fptr)
+            {
+                int status=0;
+
+                fits_write_img(job->fptr,job->byteType,1,job->nelements,job->frame,&status);
+
+                if (status)
+                {
+                  job->error = "Error: Failed to write FITS image";
+                  fits_report_error(stderr, status);  /* print out any error messages */
+                  return false;
+                }
+
+                fits_close_file(job->fptr,&status);
+                job->fptr = NULL;
+
+                job->dropFrame();
+                job->data = (uint8_t *) job->memptr;
+                job->size = job->memsize;
+            }
+            else if (job->header.empty() == false)
+            {
+                // One buffer for the whole file, the pixels go straight from the frame to after the header
+                job->memsize = job->header.size() + fitsDataSize(job->bpp, job->nelements);
+                job->memptr = malloc(job->memsize);
+                if (job->memptr == NULL)
+                {
+                    job->error = "Error: Ran out of memory encoding FITS image";
+                    return false;
+                }
+
+                memcpy(job->memptr, job->header.data(), job->header.size());
+                fitsPutPixels(job->bpp, (uint8_t *) job->memptr + job->header.size(), job->frame, job->nelements);
+
+                job->dropFrame();
+                job->data = (uint8_t *) job->memptr;
+                job->size = job->memsize;
+            }
+            else
+            {
+                job->data = job->frame;
+                job->size = job->frameSize;
+            }
+            break;
+
+        case PIPE_COMPRESS:
+            if (job->compress)
+            {
+                job->compressedSize = blobCompressBound(job->codec, job->size);
+                job->compressed = (unsigned char *) malloc (job->compressedSize);
+
+                if (job->compressed == NULL)
+                {
+                    job->error = "Error: Ran out of memory compressing image";
+                    return false;
+                }
+
+                if (blobCompress(job->codec, job->level, 0, job->compressed, &job->compressedSize, job->data, job->size) < 0)
+                {
+                    /* this should NEVER happen */
+                    job->error = "Error: Failed to compress image";
+                    return false;
+                }
+            }
+            break;
+
+        case PIPE_SAVE:
+            if (job->saveImage)
+            {
+                char imageFileName[MAXRBUF];
+                char errmsg[MAXRBUF];
+                int fd = -1;
+
+                // Creating the file checks the cached index, if another program took it scan the directory again
+                for (int tries=0; tries < 2; tries++)
+                {
+                    std::string prefix = job->prefix;
+                    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+                    int maxIndex = getFileIndex(job->uploadDir.c_str(), job->prefix.c_str(), job->ext);
+
+                    if (maxIndex < 0)
+                    {
+                        snprintf(errmsg, MAXRBUF, "Error iterating directory %s. %s", job->uploadDir.c_str(), strerror(errno));
+                        job->error = errmsg;
+                        return false;
+                    }
+
+                    if (maxIndex > 0)
+                    {
+                        char indexString[16];
+                        snprintf(indexString, 16, "%03d", maxIndex);
+                        std::string prefixIndex = indexString;
+                        prefix.replace(prefix.find("XXX"), 3, prefixIndex);
+                        flags |= O_EXCL;
+                    }
+
+                    snprintf(imageFileName, MAXRBUF, "%s/%s%s", job->uploadDir.c_str(), prefix.c_str(), job->ext);
+                    fd = open(imageFileName, flags, 0644);
+                    if (fd >= 0 || (errno != EEXIST && errno != ENOENT))
+                        break;
+                    nextIndex = 0;
+                }
 
-    if (sendImage)
-        IDSetBLOB(&targetChip->FitsBP,NULL);
+                if (fd < 0)
+                {
+                    snprintf(errmsg, MAXRBUF, "Unable to save image file (%s). %s", imageFileName, strerror(errno));
+                    job->error = errmsg;
+                    return false;
+                }
 
-    if (compressedData)
-        free (compressedData);
+                // Large writes straight from the frame, stdio would only copy it through a small buffer
+                for (size_t nr=0; nr < job->size; )
+                {
+                    ssize_t n = write(fd, job->data + nr, std::min(job->size - nr, (size_t) SAVE_BLOCK));
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n <= 0)
+                    {
+                        snprintf(errmsg, MAXRBUF, "Unable to save image file (%s). %s", imageFileName, n < 0 ? strerror(errno) : "Disk full");
+                        job->error = errmsg;
+                        close(fd);
+                        return false;
+                    }
+                    nr += n;
+                }
+
+                // Keep files open until syncFrames of them can be synced together, with 0 leave them to the OS.
+                // Files kept for another directory or under an earlier setting are synced first.
+                bool synced = true;
+                if (unsyncedFiles.empty() == false && (unsyncedDir != job->uploadDir || job->syncFrames == 0))
+                    synced = syncImageFiles();
+                if (job->syncFrames > 0)
+                {
+                    unsyncedFiles.push_back(fd);
+                    unsyncedDir = job->uploadDir;
+                    if ((int) unsyncedFiles.size() >= job->syncFrames && syncImageFiles() == false)
+                        synced = false;
+                }
+                else
+                    close(fd);
+                if (synced == false)
+                {
+                    snprintf(errmsg, MAXRBUF, "Unable to sync image files in %s. %s", job->uploadDir.c_str(), strerror(errno));
+                    job->error = errmsg;
+                    return false;
+                }
+
+                job->fileName = imageFileName;
+            }
+            break;
+
+        case PIPE_UPLOAD:
+            if (job->compress)
+            {
+                job->bp.blob=job->compressed;
+                job->bp.bloblen=job->compressedSize;
+                snprintf(job->bp.format, MAXINDIBLOBFMT, "%s%s", job->ext, blobCodecSuffix(job->codec));
+            } else
+            {
+                job->bp.blob=job->data;
+                job->bp.bloblen=job->size;
+                snprintf(job->bp.format, MAXINDIBLOBFMT, "%s", job->ext);
+            }
+
+            job->bp.size = job->size;
+            job->bvp.s=IPS_OK;
+
+            if (job->sendImage)
+                IDSetBLOB(&job->bvp,NULL);
+            break;
+    }
+
+    gettimeofday(&end, NULL);
+    job->ms[stage] = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
 
     return true;
 }
 
+void INDI::CCD::pipelineDoneHelper(int fd, void *context)
+{
+    INDI::CCD *ccd = static_cast<INDI::CCD *>(context);
+    UploadJob *job;
+
+    if (read(fd, &job, sizeof(job)) != sizeof(job))
+        return;
+
+    ccd->pipeFrames--;
+    ccd->finishUpload(job);
+}
+
+/* Report a frame that is through the pipeline, back on the event loop thread */
+void INDI::CCD::finishUpload(UploadJob *job)
+{
+    CCDChip *targetChip = job->chip;
+
+    if (job->error.empty() == false)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "%s", job->error.c_str());
+        targetChip->FitsBP.s = IPS_ALERT;
+    }
+    else
+    {
+        snprintf(targetChip->FitsB.format, MAXINDIBLOBFMT, "%s", job->bp.format);
+        targetChip->FitsB.size = job->bp.size;
+        targetChip->FitsBP.s = IPS_OK;
+    }
+
+    // The exposure is done once its image is out, clients may start the next one on OK
+    if (job->reportExposure)
+    {
+        targetChip->ImageExposureNP.s = job->error.empty() ? IPS_OK : IPS_ALERT;
+        IDSetNumber(&targetChip->ImageExposureNP, NULL);
+    }
+
+    if (job->fileName.empty() == false)
+    {
+        DEBUGF(INDI::Logger::DBG_SESSION, "Image saved to %s", job->fileName.c_str());
+        IUSaveText(&FileNameT[0], job->fileName.c_str());
+        FileNameTP.s = IPS_OK;
+        IDSetText(&FileNameTP, NULL);
+    }
+
+    for (int stage=PIPE_ENCODE; stage < PIPE_STAGES; stage++)
+        PipelineN[stage].value = job->ms[stage];
+    PipelineN[PIPE_STAGES].value = pipeFrames;
+    PipelineNP.s = job->error.empty() ? IPS_OK : IPS_ALERT;
+    if (isConnected())
+        IDSetNumber(&PipelineNP, NULL);
+
+    delete job;
+}
+
 void INDI::CCD::SetCCDParams(int x,int y,int bpp,float xf,float yf)
 {
     PrimaryCCD.setResolution(x, y);
@@ -2181,6 +2938,7 @@ bool INDI::CCD::saveConfigItems(FILE *fp)
     IUSaveConfigText(fp, &ActiveDeviceTP);
     IUSaveConfigSwitch(fp, &UploadSP);
     IUSaveConfigText(fp, &UploadSettingsTP);
+    IUSaveConfigNumber(fp, &UploadSyncNP);
     //IUSaveConfigSwitch(fp, &WorldCoordSP);
     IUSaveConfigSwitch(fp, &TelescopeTypeSP);
 
@@ -2188,9 +2946,15 @@ bool INDI::CCD::saveConfigItems(FILE *fp)
     //    IUSaveConfigNumber(fp, &CCDRotationNP);
 
     IUSaveConfigSwitch(fp, &PrimaryCCD.CompressSP);
+    IUSaveConfigSwitch(fp, &PrimaryCCD.CodecSP);
+    IUSaveConfigNumber(fp, &PrimaryCCD.CodecLevelNP);
 
     if (HasGuideHead())
+    {
         IUSaveConfigSwitch(fp, &GuideCCD.CompressSP);
+        IUSaveConfigSwitch(fp, &GuideCCD.CodecSP);
+        IUSaveConfigNumber(fp, &GuideCCD.CodecLevelNP);
+    }
 
     if (CanSubFrame())
         IUSaveConfigNumber(fp, &PrimaryCCD.ImageFrameNP);
@@ -2232,70 +2996,49 @@ IPState INDI::CCD::GuideWest(float ms)
     return IPS_ALERT;
 }
 
-void INDI::CCD::getMinMax(double *min, double *max, CCDChip *targetChip)
+bool INDI::CCD::updateImageStats(CCDChip *targetChip)
 {
-    int ind=0, i, j;
-    int imageHeight = targetChip->getSubH() / targetChip->getBinY();
-    int imageWidth  = targetChip->getSubW() / targetChip->getBinX();
-    double lmin, lmax;
-
-    switch (targetChip->getBPP())
-    {
-        case 8:
-        {
-            unsigned char *imageBuffer = (unsigned char *) targetChip->getFrameBuffer();
-            lmin = lmax = imageBuffer[0];
-
-
-            for (i= 0; i < imageHeight ; i++)
-                for (j= 0; j < imageWidth; j++)
-                {
-                    ind = (i * imageWidth) + j;
-                    if (imageBuffer[ind] < lmin) lmin = imageBuffer[ind];
-                    else if (imageBuffer[ind] > lmax) lmax = imageBuffer[ind];
-                }
+    ImageStats *stats = &targetChip->Stats;
+    double bins[sizeof(targetChip->ImageHistogramN)/sizeof(INumber)];
+    int nbins = targetChip->ImageHistogramNP.nnp;
+    size_t npixels = (size_t)(targetChip->getSubW() / targetChip->getBinX()) * (targetChip->getSubH() / targetChip->getBinY());
 
-        }
-        break;
+    if (targetChip->getNAxis() != 2)
+        return false;
 
-        case 16:
-        {
-            unsigned short *imageBuffer = (unsigned short* ) targetChip->getFrameBuffer();
-            lmin = lmax = imageBuffer[0];
-
-            for (i= 0; i < imageHeight ; i++)
-                for (j= 0; j < imageWidth; j++)
-                {
-                    ind = (i * imageWidth) + j;
-                    if (imageBuffer[ind] < lmin) lmin = imageBuffer[ind];
-                     else if (imageBuffer[ind] > lmax) lmax = imageBuffer[ind];
-                }
+    // A driver may hand over a frame smaller than the chip's subframe
+    if (npixels * (targetChip->getBPP() / 8) > (size_t)targetChip->getFrameBufferSize())
+        npixels = targetChip->getFrameBufferSize() / (targetChip->getBPP() / 8);
 
-        }
-        break;
-
-        case 32:
-        {
-            unsigned int *imageBuffer = (unsigned int* ) targetChip->getFrameBuffer();
-            lmin = lmax = imageBuffer[0];
-
-            for (i= 0; i < imageHeight ; i++)
-                for (j= 0; j < imageWidth; j++)
-                {
-                    ind = (i * imageWidth) + j;
-                    if (imageBuffer[ind] < lmin) lmin = imageBuffer[ind];
-                    else if (imageBuffer[ind] > lmax) lmax = imageBuffer[ind];
+    if (imageStats(targetChip->getBPP(), targetChip->getFrameBuffer(), npixels, stats, 0))
+    {
+        DEBUGF(Logger::DBG_WARNING, "Cannot find the statistics of a %d bits per pixel frame.", targetChip->getBPP());
+        memset(stats, 0, sizeof(*stats));
+        targetChip->ImageStatsNP.s = IPS_ALERT;
+        IDSetNumber(&targetChip->ImageStatsNP, NULL);
+        return false;
+    }
 
-                }
+    targetChip->ImageStatsN[0].value = stats->min;
+    targetChip->ImageStatsN[1].value = stats->max;
+    targetChip->ImageStatsN[2].value = stats->mean;
+    targetChip->ImageStatsN[3].value = stats->stddev;
+    targetChip->ImageStatsN[4].value = stats->median;
+    targetChip->ImageStatsNP.s = IPS_OK;
+    IDSetNumber(&targetChip->ImageStatsNP, NULL);
 
-        }
-        break;
+    imageStatsHistogram(stats, stats->min, stats->max, bins, nbins);
+    for (int i=0; i < nbins; i++)
+        targetChip->ImageHistogramN[i].value = bins[i];
+    targetChip->ImageHistogramNP.s = IPS_OK;
+    IDSetNumber(&targetChip->ImageHistogramNP, NULL);
 
-    }
-        *min = lmin;
-        *max = lmax;
+    return true;
 }
 
+/* Next index for a file named prefix with XXX replaced by the index, 0 if prefix has no XXX. The directory
+ * is only scanned for the highest index in use when dir, prefix or ext change, or nextIndex is reset.
+ */
 int INDI::CCD::getFileIndex(const char *dir, const char *prefix, const char *ext)
 {
     DIR *dpdf;
@@ -2306,6 +3049,9 @@ int INDI::CCD::getFileIndex(const char *dir, const char *prefix, const char *ext
     if (prefixIndex.find("XXX") == std::string::npos)
         return 0;
 
+    if (nextIndex > 0 && indexDir == dir && indexPrefix == prefix && indexExt == ext)
+        return nextIndex++;
+
     std::string prefixSearch = prefix;
     prefixSearch.replace(prefixSearch.find("XXX"), 3, "");
 
@@ -2326,6 +3072,7 @@ int INDI::CCD::getFileIndex(const char *dir, const char *prefix, const char *ext
           if (strstr(epdf->d_name, prefixSearch.c_str()))
               files.push_back(epdf->d_name);
        }
+       closedir(dpdf);
     }
     else
         return -1;
@@ -2344,10 +3091,44 @@ int INDI::CCD::getFileIndex(const char *dir, const char *prefix, const char *ext
             maxIndex=index;
     }
 
+    indexDir = dir;
+    indexPrefix = prefix;
+    indexExt = ext;
+    nextIndex = maxIndex+2;
+
     return (maxIndex+1);
 
 }
 
+/* Force the saved files still open and their directory to disk, then close the files.
+ * Syncing a batch at once lets slow cards and network disks write back in fewer, larger pieces.
+ */
+bool INDI::CCD::syncImageFiles()
+{
+    int error = 0;
+
+    for (unsigned int i=0; i < unsyncedFiles.size(); i++)
+    {
+        if (fdatasync(unsyncedFiles[i]) != 0 && error == 0)
+            error = errno;
+        close(unsyncedFiles[i]);
+    }
+
+    if (unsyncedFiles.empty() == false)
+    {
+        int dfd = open(unsyncedDir.c_str(), O_RDONLY);
+        if (dfd >= 0)
+        {
+            fsync(dfd);
+            close(dfd);
+        }
+    }
+
+    unsyncedFiles.clear();
+    errno = error;
+    return (error == 0);
+}
+
 void INDI::CCD::GuideComplete(INDI_EQ_AXIS axis)
 {
     INDI::GuiderInterface::GuideComplete(axis);
@@ -28,9 +28,17 @@
 
 #include <fitsio.h>
 #include <string.h>
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
 
 #include "defaultdevice.h"
 #include "indiguiderinterface.h"
+#include "blobcodec.h"
+#include "binning.h"
+#include "stardetect.h"
+#include "imagestats.h"
 
 extern const char *IMAGE_SETTINGS_TAB;
 extern const char *IMAGE_INFO_TAB;
@@ -38,6 +46,7 @@ extern const char *GUIDE_HEAD_TAB;
 extern const char *RAPIDGUIDE_TAB;
 
 class StreamRecorder;
+struct UploadJob;
 
 /**
  * @brief The CCDChip class provides functionality of a CCD Chip within a CCD.
@@ -53,6 +62,8 @@ public:
     typedef enum { LIGHT_FRAME=0, BIAS_FRAME, DARK_FRAME, FLAT_FRAME } CCD_FRAME;
     typedef enum { FRAME_X, FRAME_Y, FRAME_W, FRAME_H} CCD_FRAME_INDEX;
     typedef enum { BIN_W, BIN_H} CCD_BIN_INDEX;
+    /** Codecs a compressed frame is sent with. CODEC_RICE tile compresses FITS images with cfitsio, the others compress the whole BLOB (see blobcodec.h). */
+    typedef enum { CODEC_ZLIB=BLOB_CODEC_ZLIB, CODEC_LZ4=BLOB_CODEC_LZ4, CODEC_ZSTD=BLOB_CODEC_ZSTD, CODEC_RICE=BLOB_CODEC_N } CCD_CODEC;
     typedef enum { CCD_MAX_X, CCD_MAX_Y, CCD_PIXEL_SIZE, CCD_PIXEL_SIZE_X, CCD_PIXEL_SIZE_Y, CCD_BITSPERPIXEL} CCD_INFO_INDEX;
 
     /**
@@ -148,9 +159,32 @@ public:
     /**
      * @brief getFrameBuffer Get raw frame buffer of the CCD chip.
      * @return raw frame buffer of the CCD chip.
+     * \note ExposureComplete() passes the frame on to be uploaded and gives the chip another buffer from its pool, so call
+     *       this again for each readout rather than keeping the pointer.
      */
     inline uint8_t * getFrameBuffer() { return RawFrame; }
 
+    /**
+     * @brief acquireFrameBuffer Make sure the chip's frame buffer is not still in use by an earlier frame, taking a free one
+     * from the pool if it is. Drivers may call this before reading out a frame.
+     * @return frame buffer to read out to, same as getFrameBuffer().
+     */
+    uint8_t * acquireFrameBuffer();
+
+    /**
+     * @brief retainFrameBuffer Take a reference to the current frame buffer so it stays valid after the chip moves on to
+     * another one. Drop it with releaseFrameBuffer().
+     * @return the frame buffer, or NULL if it was set with setFrameBuffer() and is not the chip's to share.
+     */
+    uint8_t * retainFrameBuffer();
+
+    /**
+     * @brief releaseFrameBuffer Drop a reference taken with retainFrameBuffer(). The buffer goes back to the pool once
+     * no one holds it. May be called from any thread.
+     * @param buffer frame buffer returned by retainFrameBuffer()
+     */
+    void releaseFrameBuffer(uint8_t *buffer);
+
     /**
      * @brief setFrameBuffer Set raw frame buffer pointer.
      * @param buffer pointer to frame buffer
@@ -165,6 +199,30 @@ public:
      */
     inline bool isCompressed() { return SendCompressed; }
 
+    /**
+     * @brief getCodec
+     * @return Codec a frame is compressed with when compression is on.
+     */
+    inline CCD_CODEC getCodec() { return Codec; }
+
+    /**
+     * @brief getCodecLevel
+     * @return Compression level of the codec, 0 for the codec's default.
+     */
+    inline int getCodecLevel() { return CodecLevel; }
+
+    /**
+     * @brief getBinMode
+     * @return How binFrame() combines the pixels of a bin.
+     */
+    inline BinMode getBinMode() { return BinningMode; }
+
+    /**
+     * @brief getImageStats
+     * @return Statistics of the last frame sent or saved, with its histogram.
+     */
+    inline const ImageStats *getImageStats() { return &Stats; }
+
     /**
      * @brief isInterlaced
      * @return True if CCD chip is Interlaced, false otherwise.
@@ -292,6 +350,12 @@ public:
      */
     void setNAxis(int value);
 
+    /**
+     * @brief setBinMode Set how binFrame() combines the pixels of a bin.
+     * @param mode BIN_MODE_SUM to add them, saturating at the largest pixel value (the default), or BIN_MODE_AVERAGE to average them.
+     */
+    void setBinMode(BinMode mode);
+
     /**
      * @brief setImageExtension Set image exntension
      * @param ext extension (fits, jpeg, raw..etc)
@@ -310,11 +374,23 @@ public:
 
     /**
      * @brief binFrame Perform softwre binning on the CCD frame. Only use this function if hardware binning is not supported.
+     * The frame is binned BinX by BinY in the mode set by setBinMode(), by a few threads for large frames. 8, 16 and 32 bit
+     * frames are supported, drivers with float frames may call binPixels() themselves.
      */
     void binFrame();
 
 private:
 
+    // Frame buffer shared by the chip and frames still being uploaded
+    struct FrameBuffer
+    {
+        uint8_t *data;
+        int size;
+        int refs;
+    };
+
+    FrameBuffer *getFreeFrameBuffer();
+
     int XRes;   //  native resolution of the ccd
     int YRes;   //  ditto
     int SubX;   //  left side of the subframe we are requesting
@@ -331,12 +407,18 @@ private:
     uint8_t *RawFrame;
     uint8_t *BinFrame;
     int RawFrameSize;
+    std::vector<FrameBuffer *> FramePool;
+    FrameBuffer *CurrentFrame;  // pool buffer the chip holds, RawFrame unless the driver set its own
+    pthread_mutex_t FramePoolLock;
     bool SendCompressed;
+    CCD_CODEC Codec;
+    int CodecLevel;
+    BinMode BinningMode;
     CCD_FRAME FrameType;
     double exposureDuration;
     timeval startExposureTime;
-    int lastRapidX;
-    int lastRapidY;
+    StarTracker RapidTracker;   //  Guide stars followed in rapid guide mode
+    ImageStats Stats;           //  Statistics of the last frame sent or saved
     char imageExtention[MAXINDIBLOBFMT];
 
     INumberVectorProperty ImageExposureNP;
@@ -360,6 +442,12 @@ private:
     ISwitch CompressS[2];
     ISwitchVectorProperty CompressSP;
 
+    ISwitch CodecS[4];
+    ISwitchVectorProperty CodecSP;
+
+    INumber CodecLevelN[1];
+    INumberVectorProperty CodecLevelNP;
+
     IBLOB FitsB;
     IBLOBVectorProperty FitsBP;
 
@@ -369,9 +457,15 @@ private:
     ISwitch RapidGuideSetupS[3];
     ISwitchVectorProperty RapidGuideSetupSP;    
 
-    INumber RapidGuideDataN[3];
+    INumber RapidGuideDataN[6];
     INumberVectorProperty RapidGuideDataNP;
 
+    INumber ImageStatsN[5];
+    INumberVectorProperty ImageStatsNP;
+
+    INumber ImageHistogramN[64];
+    INumberVectorProperty ImageHistogramNP;
+
     ISwitch                 ResetS[1];
     ISwitchVectorProperty   ResetSP;
 
@@ -500,6 +594,10 @@ class INDI::CCD : public INDI::DefaultDevice, INDI::GuiderInterface
 
         /** \brief Uploads target Chip exposed buffer as FITS to the client. Dervied classes should class this functon when an exposure is complete.
          * @param targetChip chip that contains upload image data
+         * \note The frame is copied and encoded, compressed, saved and uploaded in the background, so the frame buffer may be
+         *       reused for the next exposure as soon as this returns. CCD_PIPELINE reports how long each stage took.
+         *       When the pipeline is behind, a frame that is only uploaded, e.g. a rapid guide preview, is dropped and the
+         *       exposure set to ALERT. A frame to be saved is never dropped, this waits until the pipeline has room for it.
              \note This function is not implemented in INDI::CCD, it must be implemented in the child class
         */
         virtual bool ExposureComplete(CCDChip *targetChip);
@@ -733,14 +831,62 @@ class INDI::CCD : public INDI::DefaultDevice, INDI::GuiderInterface
         IText   UploadSettingsT[2];
         ITextVectorProperty UploadSettingsTP;
 
+        // Frames to save before forcing them to disk together, 0 to leave it to the OS
+        INumber UploadSyncN[1];
+        INumberVectorProperty UploadSyncNP;
+
+        // Time in ms each image pipeline stage took on the last frame, and frames still in the pipeline
+        INumber PipelineN[5];
+        INumberVectorProperty PipelineNP;
+
      private:
         uint32_t capability;
 
         bool ValidCCDRotation;
 
-        bool uploadFile(CCDChip * targetChip, const void *fitsData, size_t totalBytes, bool sendImage, bool saveImage);
-        void getMinMax(double *min, double *max, CCDChip *targetChip);
+        /* Image pipeline. ExposureComplete() hands each frame to a thread per stage so the driver can start the next
+         * exposure at once, and frames overlap in different stages. Finished frames come back to the event loop.
+         */
+        typedef enum { PIPE_ENCODE, PIPE_COMPRESS, PIPE_SAVE, PIPE_UPLOAD, PIPE_STAGES } PIPE_STAGE;
+
+        struct PipeStage
+        {
+            INDI::CCD *ccd;
+            int stage;
+            pthread_t thread;
+        };
+
+        PipeStage pipeStages[PIPE_STAGES];
+        std::deque<UploadJob *> pipeQueue[PIPE_STAGES];
+        pthread_mutex_t pipeLock;
+        pthread_cond_t pipeCond;
+        bool pipeRunning;
+        int pipeFd[2];
+        int pipeCallback;
+        int pipeFrames;
+        bool fitsReentrant;             // cfitsio may be called from the stage threads
+
+        bool startPipeline();
+        void stopPipeline();
+        bool pipelineFull(int stage);
+        bool queueUpload(UploadJob *job, int stage, bool wait);
+        bool runStage(UploadJob *job, int stage);
+        void runPipeline(int stage);
+        void finishUpload(UploadJob *job);
+        static void * pipelineHelper(void *context);
+        static void pipelineDoneHelper(int fd, void *context);
+
+        bool updateImageStats(CCDChip *targetChip);
         int getFileIndex(const char *dir, const char *prefix, const char *ext);
+        bool syncImageFiles();
+
+        // Only the save stage touches these, one frame at a time
+        std::string indexDir;           //  directory, prefix and extension nextIndex is for
+        std::string indexPrefix;
+        std::string indexExt;
+        int nextIndex;                  //  next file index, 0 to scan the directory again
+        std::vector<int> unsyncedFiles; //  saved files still open, waiting to be synced
+        std::string unsyncedDir;
 
         friend class ::StreamRecorder;
 
@@ -242,12 +242,12 @@ const char *
 timestamp()
 {
 	static char ts[32];
-	struct tm *tp;
+	struct tm tm;
 	time_t t;
 
 	time (&t);
-	tp = gmtime (&t);
-	strftime (ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", tp);
+	gmtime_r (&t, &tm);
+	strftime (ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
 	return (ts);
 }
 
@@ -22,6 +22,24 @@
  * only handles elements, attributes and pcdata content.
  * <! ... > and <? ... > are silently ignored.
  * pcdata is collected into one string, sans leading whitespace first line.
+ * an element with attributes encoding="binary" and enclen="n" has exactly n
+ * bytes of raw pcdata immediately following its opening tag.
+ *
+ * readXMLBuf() takes a whole buffer at a time. runs of pcdata, attribute
+ * values, comments and binary pcdata that need nothing but copying or
+ * skipping are found with memchr() and copied with memcpy(), the state
+ * machine in oneXMLchar() only sees the few characters around them.
+ * readXMLEle() is the same one character at a time.
+ *
+ * the elements, attributes, their lists and short strings of a tree being
+ * parsed are handed out from blocks of arenasize bytes, see allocArena().
+ * the blocks go with the root when it is complete and delXMLEle() of the
+ * root frees them all at once. each part of a tree says whether it is in an
+ * arena, as trees may be edited later with parts that are malloced.
+ *
+ * streamXMLPCData() has the pcdata of elements with one tag passed on as it
+ * arrives instead of being collected. runs found by readXMLBuf() are passed
+ * straight from its buffer, single chars are collected up to STREAMCHUNK.
  *
  * #define MAIN_TST to create standalone test program
  */
@@ -38,22 +56,54 @@ typedef struct {
     char *s;				/* malloced memory for string */
     int sl;				/* string length, sans trailing \0 */
     int sm;				/* total malloced bytes */
+    int ar;				/* 1 if s is in an arena, not malloced */
 } String;
 #define	MINMEM	64			/* starting string length */
 
+/* one block of an arena, its data follows */
+typedef struct _Block {
+    struct _Block *next;		/* next older block of the same arena */
+    int size;				/* bytes of data */
+    int used;				/* bytes of data handed out */
+} Block;
+#define	BLOCKDATA(bp)	((char *)(bp) + sizeof(Block))
+#define	ARALIGN(n)	(((n) + 7) & ~7)	/* keep pointers aligned */
+#define	ARMINSTR	16			/* starting string length in arena */
+
+/* which parts of an XMLEle are in an arena */
+#define	AR_ELE		1			/* the XMLEle itself */
+#define	AR_EL		2			/* el[] */
+#define	AR_AT		4			/* at[] */
+
+#define	STREAMCHUNK	4096		/* most streamed pcdata collected */
+
 static int oneXMLchar (LilXML *lp, int c, char ynot[]);
+static XMLEle *readXMLChar (LilXML *lp, int newc, char ynot[]);
+static int scanXMLRun (LilXML *lp, const char *buf, int n);
+static int firstXMLEle (XMLEle *root, void *arg);
+static void openXMLEle (LilXML *lp);
+static void streamPCData (LilXML *lp, const char *buf, int n);
 static void initParser(LilXML *lp);
+static void freeParse(LilXML *lp);
 static void pushXMLEle(LilXML *lp);
 static void popXMLEle(LilXML *lp);
 static void resetEndTag(LilXML *lp);
-static XMLAtt *growAtt(XMLEle *e);
-static XMLEle *growEle(XMLEle *pe);
+static XMLAtt *growAtt(Block **ap, XMLEle *e);
+static XMLEle *growEle(Block **ap, XMLEle *pe);
+static void *growPtrs (Block **ap, void *a, int n, int *arp, int arbit);
 static void freeAtt (XMLAtt *a);
 static int isTokenChar (int start, int c);
-static void growString (String *sp, int c);
-static void appendString (String *sp, const char *str);
+static int rawLength (XMLEle *ep);
+static void growString (Block **ap, String *sp, int c);
+static void appendString (Block **ap, String *sp, const char *str);
+static void appendBytes (Block **ap, String *sp, const char *buf, int n);
+static void roomString (Block **ap, String *sp, int l);
 static void freeString (String *sp);
 static void newString (String *sp);
+static void arenaString (String *sp);
+static void *allocArena (Block **ap, int n);
+static void *growArena (Block **ap, void *p, int oldn, int newn);
+static void freeArena (Block *bp);
 static void *moremem (void *old, int n);
 
 typedef enum  {
@@ -71,7 +121,8 @@ typedef enum  {
     ENTINCON,				/* in entity in pcdata */
     SAWLTINCON,				/* saw < in content */
     LOOK4CLOSETAG,			/* looking for closing tag after < */
-    INCLOSETAG				/* reading closing tag */
+    INCLOSETAG,				/* reading closing tag */
+    INRAW				/* reading binary pcdata */
 } State;				/* parsing states */
 
 /* maintain state while parsing */
@@ -84,6 +135,11 @@ struct _LilXML {
     int delim;				/* attribute value delimiter */
     int lastc;				/* last char (just used wiht skipping)*/
     int skipping;			/* in comment or declaration */
+    int rawleft;			/* bytes of binary pcdata still to read */
+    Block *arena;			/* blocks of the tree being read */
+    char *streamtag;			/* tag whose pcdata is streamed */
+    XMLPCDataFn streamfn;		/* called with streamed pcdata */
+    void *streamarg;			/* passed on to streamfn */
 };
 
 /* internal representation of a (possibly nested) XML element */
@@ -98,6 +154,10 @@ struct _xml_ele {
     int eit;				/* used to iterate over el[] */
     String pcdata;			/* character data in this element */
     int pcdata_hasent;			/* 1 if pcdata contains an entity char*/
+    int pcdata_isbin;			/* 1 if pcdata is raw binary */
+    int pcdata_stream;			/* 1 if pcdata went to streamfn */
+    int ar;				/* AR_* parts that are in an arena */
+    Block *arena;			/* blocks of the tree this is root of */
 };
 
 /* internal representation of an attribute */
@@ -105,6 +165,7 @@ struct _xml_att {
     String name;			/* name */
     String valu;			/* value */
     XMLEle *ce;				/* containing element */
+    int ar;				/* 1 if this is in an arena */
 };
 
 /* characters that need escaping as "entities" in attr values and pcdata
@@ -116,6 +177,9 @@ static void *(*mymalloc)(size_t size) = malloc;
 static void *(*myrealloc)(void *ptr, size_t size) = realloc;
 static void (*myfree)(void *ptr) = free;
 
+/* bytes in each arena block, 0 to malloc each part of a tree */
+static int arenasize = 4096;
+
 /* install new version of malloc/realloc/free.
  * N.B. don't call after first use of any other lilxml function
  */
@@ -129,6 +193,17 @@ lilxmlMalloc (void *(*newmalloc)(size_t size),
         myfree = newfree;
 }
 
+/* set the size of the blocks parsed trees are built in, 0 to not use them.
+ * takes effect with the next element parsed.
+ */
+void
+lilxmlArena (int blocksize)
+{
+        if (blocksize > 0 && blocksize < 256)
+            blocksize = 256;
+        arenasize = blocksize;
+}
+
 /* pass back a fresh handle for use with our other functions */
 LilXML *
 newLilXML ()
@@ -143,8 +218,10 @@ newLilXML ()
 void
 delLilXML (LilXML *lp)
 {
-        delXMLEle (lp->ce);
+        freeParse (lp);
         freeString (&lp->endtag);
+        if (lp->streamtag)
+            (*myfree) (lp->streamtag);
         (*myfree) (lp);
 }
 
@@ -152,6 +229,7 @@ delLilXML (LilXML *lp)
 void
 delXMLEle (XMLEle *ep)
 {
+        Block *arena;
         int i;
 
         /* benign if NULL */
@@ -164,7 +242,8 @@ delXMLEle (XMLEle *ep)
         if (ep->at) {
             for (i = 0; i < ep->nat; i++)
                 freeAtt (ep->at[i]);
-            (*myfree) (ep->at);
+            if (!(ep->ar & AR_AT))
+                (*myfree) (ep->at);
         }
         if (ep->el) {
             for (i = 0; i < ep->nel; i++) {
@@ -173,7 +252,8 @@ delXMLEle (XMLEle *ep)
 
                 delXMLEle (ep->el[i]);
             }
-            (*myfree) (ep->el);
+            if (!(ep->ar & AR_EL))
+                (*myfree) (ep->el);
         }
 
         /* remove from parent's list if known */
@@ -188,8 +268,11 @@ delXMLEle (XMLEle *ep)
             }
         }
 
-        /* delete ep itself */
-        (*myfree) (ep);
+        /* delete ep itself, then the arena it may be in */
+        arena = ep->arena;
+        if (!(ep->ar & AR_ELE))
+            (*myfree) (ep);
+        freeArena (arena);
 }
 
 /* process one more character of an XML file.
@@ -201,12 +284,161 @@ delXMLEle (XMLEle *ep)
 XMLEle *
 readXMLEle (LilXML *lp, int newc, char ynot[])
 {
-        XMLEle *root;
-        int s;
+        /* start optimistic */
+        ynot[0] = '\0';
+
+        return (readXMLChar (lp, newc, ynot));
+}
+
+/* process the nbuf chars at buf, passing each complete element to
+ * (*fn)(root, arg), which then owns it.
+ * return number of chars used: nbuf, or fewer if fn returned non-zero or on
+ * error with reason in ynot[]. call again with the rest to carry on.
+ */
+int
+readXMLBuf (LilXML *lp, const char *buf, int nbuf,
+int (*fn)(XMLEle *root, void *arg), void *arg, char ynot[])
+{
+        int i = 0;
 
         /* start optimistic */
         ynot[0] = '\0';
 
+        while (i < nbuf) {
+            XMLEle *root;
+            int n = scanXMLRun (lp, &buf[i], nbuf-i);
+
+            if (n > 0) {
+                i += n;
+                continue;
+            }
+
+            root = readXMLChar (lp, buf[i++], ynot);
+            if (root) {
+                if ((*fn) (root, arg))
+                    break;
+            } else if (ynot[0])
+                break;
+        }
+
+        return (i);
+}
+
+/* pass the pcdata of elements with the given tag to (*fn)() as it arrives,
+ * or stop if fn is NULL. see streamPCData().
+ */
+void
+streamXMLPCData (LilXML *lp, const char *tag, XMLPCDataFn fn, void *arg)
+{
+        if (lp->streamtag)
+            (*myfree) (lp->streamtag);
+        lp->streamtag = NULL;
+        lp->streamfn = fn;
+        lp->streamarg = arg;
+        if (fn) {
+            lp->streamtag = (char *) moremem (NULL, strlen(tag)+1);
+            strcpy (lp->streamtag, tag);
+        }
+}
+
+/* readXMLBuf() callback to keep just the first element, stops there */
+static int
+firstXMLEle (XMLEle *root, void *arg)
+{
+        *(XMLEle **)arg = root;
+        return (1);
+}
+
+/* return how many of the n chars at buf just extend what lp is reading,
+ * having added them to it, or 0 if buf[0] must go through readXMLChar().
+ * runs end before any char oneXMLchar() treats specially, before \0, which
+ * is always an error, and before '<' which readXMLChar() holds back.
+ */
+static int
+scanXMLRun (LilXML *lp, const char *buf, int n)
+{
+        const char *p;
+        int i;
+
+        /* binary pcdata is taken as is, including \0 */
+        if (lp->cs == INRAW) {
+            if (n > lp->rawleft)
+                n = lp->rawleft;
+            if (lp->ce->pcdata_stream)
+                streamPCData (lp, buf, n);
+            else
+                appendBytes (&lp->arena, &lp->ce->pcdata, buf, n);
+            if ((lp->rawleft -= n) == 0)
+                lp->cs = LOOK4CON;
+            return (n);
+        }
+
+        /* leave a pending '<' and whatever follows it to readXMLChar() */
+        if (lp->lastc == '<')
+            return (0);
+
+        if (lp->skipping) {
+            if ((p = memchr (buf, '>', n)) != NULL)
+                n = p - buf;
+        } else if (lp->cs == INCON) {
+            if ((p = memchr (buf, '<', n)) != NULL)
+                n = p - buf;
+            if ((p = memchr (buf, '&', n)) != NULL)
+                n = p - buf;
+        } else if (lp->cs == INATTRV) {
+            if ((p = memchr (buf, lp->delim, n)) != NULL)
+                n = p - buf;
+            for (i = 0; i < n; i++)
+                if (iscntrl((unsigned char)buf[i]) || buf[i] == '&' || buf[i] == '<')
+                    break;
+            n = i;
+        } else
+            return (0);
+
+        if ((p = memchr (buf, '\0', n)) != NULL)
+            n = p - buf;
+        if (n == 0)
+            return (0);
+
+        /* count lines, then add the run */
+        for (p = buf; (p = memchr (p, '\n', buf+n-p)) != NULL; p++)
+            lp->ln++;
+        if (lp->cs == INCON && !lp->skipping) {
+            if (lp->ce->pcdata_stream) {
+                /* hold back trailing whitespace, a '<' may yet chomp it */
+                for (i = n; i > 0 && isspace((unsigned char)buf[i-1]); i--)
+                    continue;
+                if (i > 0)
+                    streamPCData (lp, buf, i);
+                appendBytes (&lp->arena, &lp->ce->pcdata, buf+i, n-i);
+            } else
+                appendBytes (&lp->arena, &lp->ce->pcdata, buf, n);
+        }
+        else if (lp->cs == INATTRV && !lp->skipping)
+            appendBytes (&lp->arena, &lp->ce->at[lp->ce->nat-1]->valu, buf, n);
+        lp->lastc = buf[n-1];
+
+        return (n);
+}
+
+/* readXMLEle() for one char */
+static XMLEle *
+readXMLChar (LilXML *lp, int newc, char ynot[])
+{
+        XMLEle *root;
+        int s;
+
+        /* binary pcdata is taken as is, including \0 */
+        if (lp->cs == INRAW) {
+            growString (&lp->arena, &lp->ce->pcdata, newc);
+            if (--lp->rawleft == 0)
+                lp->cs = LOOK4CON;
+            if (lp->ce->pcdata_stream &&
+                        (lp->cs == LOOK4CON || lp->ce->pcdata.sl >= STREAMCHUNK))
+                streamPCData (lp, NULL, 0);
+            return (NULL);
+        }
+
         /* EOF? */
         if (newc == 0) {
             sprintf (ynot, "Line %d: early XML EOF", lp->ln);
@@ -259,7 +491,9 @@ readXMLEle (LilXML *lp, int newc, char ynot[])
          * N.B. up to caller to call delXMLEle with what we return.
          */
         root = lp->ce;
+        root->arena = lp->arena;
         lp->ce = NULL;
+        lp->arena = NULL;
         initParser(lp);
         return (root);
 }
@@ -271,11 +505,10 @@ XMLEle *
 parseXML (char buf[], char ynot[])
 {
         LilXML *lp = newLilXML();
-        XMLEle *root;
+        XMLEle *root = NULL;
 
-        do {
-            root = readXMLEle (lp, *buf++, ynot);
-        } while (!root && !ynot[0]);
+        /* including the \0, which is an early EOF if buf is incomplete */
+        readXMLBuf (lp, buf, strlen(buf)+1, firstXMLEle, &root, ynot);
 
         delLilXML (lp);
 
@@ -403,6 +636,13 @@ pcdatalenXMLEle (XMLEle *ep)
         return (ep->pcdata.sl);
 }
 
+/* return 1 if the pcdata of the given element was streamed, else 0 */
+int
+streamedXMLEle (XMLEle *ep)
+{
+        return (ep->pcdata_stream);
+}
+
 /* return the name of the given attribute */
 char *
 nameXMLAtt (XMLAtt *ap)
@@ -465,8 +705,8 @@ readXMLFile (FILE *fp, LilXML *lp, char ynot[])
 XMLEle *
 addXMLEle (XMLEle *parent, const char *tag)
 {
-        XMLEle *ep = growEle (parent);
-        appendString (&ep->tag, tag);
+        XMLEle *ep = growEle (NULL, parent);
+        appendString (NULL, &ep->tag, tag);
         return (ep);
 }
 
@@ -476,7 +716,7 @@ addXMLEle (XMLEle *parent, const char *tag)
 void
 appXMLEle (XMLEle *ep, XMLEle *newep)
 {
-        ep->el = (XMLEle **) moremem (ep->el, (ep->nel+1)*sizeof(XMLEle *));
+        ep->el = (XMLEle **) growPtrs (NULL, ep->el, ep->nel, &ep->ar, AR_EL);
         ep->el[ep->nel++] = newep;
 }
 
@@ -485,17 +725,18 @@ void
 editXMLEle (XMLEle *ep, const char *pcdata)
 {
         freeString (&ep->pcdata);
-        appendString (&ep->pcdata, pcdata);
+        appendString (NULL, &ep->pcdata, pcdata);
         ep->pcdata_hasent = (strpbrk (pcdata, entities) != NULL);
+        ep->pcdata_isbin = 0;
 }
 
 /* add an attribute to the given XML element */
 XMLAtt *
 addXMLAtt (XMLEle *ep, const char *name, const char *valu)
 {
-        XMLAtt *ap = growAtt (ep);
-        appendString (&ap->name, name);
-        appendString (&ap->valu, valu);
+        XMLAtt *ap = growAtt (NULL, ep);
+        appendString (NULL, &ap->name, name);
+        appendString (NULL, &ap->valu, valu);
         return (ap);
 }
 
@@ -519,7 +760,7 @@ void
 editXMLAtt (XMLAtt *ap, const char *str)
 {
         freeString (&ap->valu);
-        appendString (&ap->valu, str);
+        appendString (NULL, &ap->valu, str);
 }
 
 /* sample print ep to fp
@@ -541,7 +782,11 @@ prXMLEle (FILE *fp, XMLEle *ep, int level)
             for (i = 0; i < ep->nel; i++)
                 prXMLEle (fp, ep->el[i], level+1);
         }
-        if (ep->pcdata.sl > 0) {
+        if (ep->pcdata.sl > 0 && ep->pcdata_isbin) {
+            fprintf (fp, ">");
+            fwrite (ep->pcdata.s, 1, ep->pcdata.sl, fp);
+            fprintf (fp, "\n");
+        } else if (ep->pcdata.sl > 0) {
             if (ep->nel == 0)
                 fprintf (fp, ">\n");
             if (ep->pcdata_hasent)
@@ -578,7 +823,12 @@ sprXMLEle (char *s, XMLEle *ep, int level)
             for (i = 0; i < ep->nel; i++)
                 sl += sprXMLEle (s+sl, ep->el[i], level+1);
         }
-        if (ep->pcdata.sl > 0) {
+        if (ep->pcdata.sl > 0 && ep->pcdata_isbin) {
+            sl += sprintf (s+sl, ">");
+            memcpy (s+sl, ep->pcdata.s, ep->pcdata.sl);
+            sl += ep->pcdata.sl;
+            sl += sprintf (s+sl, "\n");
+        } else if (ep->pcdata.sl > 0) {
             if (ep->nel == 0)
                 sl += sprintf (s+sl, ">\n");
             if (ep->pcdata_hasent)
@@ -618,7 +868,9 @@ sprlXMLEle (XMLEle *ep, int level)
             for (i = 0; i < ep->nel; i++)
                 l += sprlXMLEle (ep->el[i], level+1);
         }
-        if (ep->pcdata.sl > 0) {
+        if (ep->pcdata.sl > 0 && ep->pcdata_isbin) {
+            l += 1 + ep->pcdata.sl + 1;
+        } else if (ep->pcdata.sl > 0) {
             if (ep->nel == 0)
                 l += 2;
             if (ep->pcdata_hasent)
@@ -746,7 +998,7 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
 
         case LOOK4TAG:			/* looking for element tag */
             if (isTokenChar (1, c)) {
-                growString (&lp->ce->tag, c);
+                growString (&lp->arena, &lp->ce->tag, c);
                 lp->cs = INTAG;
             } else if (!isspace(c)) {
                 sprintf (ynot, "Line %d: Bogus tag char %c", lp->ln, c);
@@ -756,9 +1008,9 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
 
         case INTAG:			/* reading tag */
             if (isTokenChar (0, c))
-                growString (&lp->ce->tag, c);
+                growString (&lp->arena, &lp->ce->tag, c);
             else if (c == '>')
-                lp->cs = LOOK4CON;
+                openXMLEle (lp);
             else if (c == '/')
                 lp->cs = SAWSLASH;
             else
@@ -767,12 +1019,12 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
 
         case LOOK4ATTRN:		/* looking for attr name, > or / */
             if (c == '>')
-                lp->cs = LOOK4CON;
+                openXMLEle (lp);
             else if (c == '/')
                 lp->cs = SAWSLASH;
             else if (isTokenChar (1, c)) {
-                XMLAtt *ap = growAtt(lp->ce);
-                growString (&ap->name, c);
+                XMLAtt *ap = growAtt(arenasize ? &lp->arena : NULL, lp->ce);
+                growString (&lp->arena, &ap->name, c);
                 lp->cs = INATTRN;
             } else if (!isspace(c)) {
                 sprintf (ynot, "Line %d: Bogus leading attr name char: %c",
@@ -795,7 +1047,7 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
 
         case INATTRN:			/* reading attr name */
             if (isTokenChar (0, c))
-                growString (&lp->ce->at[lp->ce->nat-1]->name, c);
+                growString (&lp->arena, &lp->ce->at[lp->ce->nat-1]->name, c);
             else if (isspace(c) || c == '=')
                 lp->cs = LOOK4ATTRV;
             else {
@@ -818,33 +1070,33 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
         case INATTRV:			/* in attr value */
             if (c == '&') {
                 newString (&lp->entity);
-                growString (&lp->entity, c);
+                growString (NULL, &lp->entity, c);
                 lp->cs = ENTINATTRV;
             } else if (c == lp->delim)
                 lp->cs = LOOK4ATTRN;
             else if (!iscntrl(c))
-                growString (&lp->ce->at[lp->ce->nat-1]->valu, c);
+                growString (&lp->arena, &lp->ce->at[lp->ce->nat-1]->valu, c);
             break;
 
         case ENTINATTRV:		/* working on entity in attr valu */
             if (c == ';') {
                 /* if find a recongized esp seq, add equiv char else raw seq */
-                growString (&lp->entity, c);
+                growString (NULL, &lp->entity, c);
                 if (decodeEntity (lp->entity.s, &c))
-                    growString (&lp->ce->at[lp->ce->nat-1]->valu, c);
+                    growString (&lp->arena, &lp->ce->at[lp->ce->nat-1]->valu, c);
                 else
-                    appendString(&lp->ce->at[lp->ce->nat-1]->valu,lp->entity.s);
+                    appendString (&lp->arena, &lp->ce->at[lp->ce->nat-1]->valu,lp->entity.s);
                 freeString (&lp->entity);
                 lp->cs = INATTRV;
             } else
-                growString (&lp->entity, c);
+                growString (NULL, &lp->entity, c);
             break;
 
         case LOOK4CON:			/* skipping leading content whitespace*/
             if (c == '<')
                 lp->cs = SAWLTINCON;
             else if (!isspace(c)) {
-                growString (&lp->ce->pcdata, c);
+                growString (&lp->arena, &lp->ce->pcdata, c);
                 lp->cs = INCON;
             }
             break;
@@ -852,33 +1104,38 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
         case INCON:			/* reading content */
             if (c == '&') {
                 newString (&lp->entity);
-                growString (&lp->entity, c);
+                growString (NULL, &lp->entity, c);
                 lp->cs = ENTINCON;
             } else if (c == '<') {
                 /* chomp trailing whitespace */
                 while (lp->ce->pcdata.sl > 0 &&
                             isspace(lp->ce->pcdata.s[lp->ce->pcdata.sl-1]))
                     lp->ce->pcdata.s[--(lp->ce->pcdata.sl)] = '\0';
+                if (lp->ce->pcdata_stream)
+                    streamPCData (lp, NULL, 0);
                 lp->cs = SAWLTINCON;
             } else {
-                growString (&lp->ce->pcdata, c);
+                growString (&lp->arena, &lp->ce->pcdata, c);
+                if (lp->ce->pcdata_stream && lp->ce->pcdata.sl >= STREAMCHUNK
+                                                            && !isspace(c))
+                    streamPCData (lp, NULL, 0);
             }
             break;
 
         case ENTINCON:			/* working on entity in content */
             if (c == ';') {
                 /* if find a recognized esc seq, add equiv char else raw seq */
-                growString (&lp->entity, c);
+                growString (NULL, &lp->entity, c);
                 if (decodeEntity (lp->entity.s, &c))
-                    growString (&lp->ce->pcdata, c);
+                    growString (&lp->arena, &lp->ce->pcdata, c);
                 else {
-                    appendString(&lp->ce->pcdata, lp->entity.s);
+                    appendString (&lp->arena, &lp->ce->pcdata, lp->entity.s);
                     lp->ce->pcdata_hasent = 1;
                 }
                 freeString (&lp->entity);
                 lp->cs = INCON;
             } else
-                growString (&lp->entity, c);
+                growString (NULL, &lp->entity, c);
             break;
 
         case SAWLTINCON:		/* saw < in content */
@@ -888,7 +1145,7 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
             } else {
                 pushXMLEle(lp);
                 if (isTokenChar(1,c)) {
-                    growString (&lp->ce->tag, c);
+                    growString (&lp->arena, &lp->ce->tag, c);
                     lp->cs = INTAG;
                 } else
                     lp->cs = LOOK4TAG;
@@ -897,7 +1154,7 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
 
         case LOOK4CLOSETAG:		/* looking for closing tag after < */
             if (isTokenChar (1, c)) {
-                growString (&lp->endtag, c);
+                growString (NULL, &lp->endtag, c);
                 lp->cs = INCLOSETAG;
             } else if (!isspace(c)) {
                 sprintf (ynot, "Line %d: Bogus preend tag char %c", lp->ln,c);
@@ -905,9 +1162,12 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
             }
             break;
 
+        case INRAW:			/* handled in readXMLEle() */
+            break;
+
         case INCLOSETAG:		/* reading closing tag */
             if (isTokenChar(0, c))
-                growString (&lp->endtag, c);
+                growString (NULL, &lp->endtag, c);
             else if (c == '>') {
                 if (strcmp (lp->ce->tag.s, lp->endtag.s)) {
                     sprintf (ynot,"Line %d: closing tag %s does not match %s",
@@ -928,18 +1188,80 @@ oneXMLchar (LilXML *lp, int c, char ynot[])
         return (0);
 }
 
-/* set up for a fresh start again */
+/* the opening tag of ce is complete, see what its pcdata is to be */
+static void
+openXMLEle (LilXML *lp)
+{
+        XMLEle *ep = lp->ce;
+
+        if (lp->streamfn && !strcmp (ep->tag.s, lp->streamtag) &&
+                            (*lp->streamfn) (ep, NULL, 0, lp->streamarg) == 0)
+            ep->pcdata_stream = 1;
+
+        lp->rawleft = rawLength (ep);
+        if (lp->rawleft > 0) {
+            ep->pcdata_isbin = 1;
+            lp->cs = INRAW;
+        } else
+            lp->cs = LOOK4CON;
+}
+
+/* pass the pcdata collected in ce so far, then the n chars at buf, to
+ * streamfn, leaving ce->pcdata empty.
+ */
+static void
+streamPCData (LilXML *lp, const char *buf, int n)
+{
+        XMLEle *ep = lp->ce;
+
+        if (ep->pcdata.sl > 0) {
+            (*lp->streamfn) (ep, ep->pcdata.s, ep->pcdata.sl, lp->streamarg);
+            ep->pcdata.s[0] = '\0';
+            ep->pcdata.sl = 0;
+        }
+        if (n > 0)
+            (*lp->streamfn) (ep, buf, n, lp->streamarg);
+}
+
+/* set up for a fresh start again, keeping endtag's memory and the stream */
 static void
 initParser(LilXML *lp)
 {
-        delXMLEle (lp->ce);
-        freeString (&lp->endtag);
+        String endtag;
+        char *streamtag;
+        XMLPCDataFn streamfn;
+        void *streamarg;
+
+        freeParse (lp);
+        endtag = lp->endtag;
+        streamtag = lp->streamtag;
+        streamfn = lp->streamfn;
+        streamarg = lp->streamarg;
         memset (lp, 0, sizeof(*lp));
-        newString (&lp->endtag);
+        lp->endtag = endtag;
+        lp->streamtag = streamtag;
+        lp->streamfn = streamfn;
+        lp->streamarg = streamarg;
+        resetEndTag(lp);
         lp->cs = LOOK4START;
         lp->ln = 1;
 }
 
+/* free whatever tree lp was building and its arena */
+static void
+freeParse(LilXML *lp)
+{
+        XMLEle *root = lp->ce;
+
+        while (root && root->pe)
+            root = root->pe;
+        delXMLEle (root);
+        freeArena (lp->arena);
+        freeString (&lp->entity);
+        lp->ce = NULL;
+        lp->arena = NULL;
+}
+
 /* start a new XMLEle.
  * point ce to a new XMLEle.
  * if ce already set up, add to its list of child elements too.
@@ -948,7 +1270,7 @@ initParser(LilXML *lp)
 static void
 pushXMLEle(LilXML *lp)
 {
-        lp->ce = growEle (lp->ce);
+        lp->ce = growEle (arenasize ? &lp->arena : NULL, lp->ce);
         resetEndTag(lp);
 }
 
@@ -962,42 +1284,94 @@ popXMLEle(LilXML *lp)
         resetEndTag(lp);
 }
 
-/* return one new XMLEle, added to the given element if given */
+/* return one new XMLEle, added to the given element if given.
+ * it is in the arena at *ap if given, else malloced.
+ */
 static XMLEle *
-growEle (XMLEle *pe)
+growEle (Block **ap, XMLEle *pe)
 {
-        XMLEle *newe = (XMLEle *) moremem (NULL, sizeof(XMLEle));
-
-        memset (newe, 0, sizeof(XMLEle));
-        newString (&newe->tag);
-        newString (&newe->pcdata);
+        XMLEle *newe;
+
+        if (ap) {
+            newe = (XMLEle *) allocArena (ap, sizeof(XMLEle));
+            memset (newe, 0, sizeof(XMLEle));
+            newe->ar = AR_ELE;
+            arenaString (&newe->tag);
+            arenaString (&newe->pcdata);
+        } else {
+            newe = (XMLEle *) moremem (NULL, sizeof(XMLEle));
+            memset (newe, 0, sizeof(XMLEle));
+            newString (&newe->tag);
+            newString (&newe->pcdata);
+        }
         newe->pe = pe;
 
         if (pe) {
-            pe->el = (XMLEle **) moremem (pe->el, (pe->nel+1)*sizeof(XMLEle *));
+            pe->el = (XMLEle **) growPtrs (ap, pe->el, pe->nel, &pe->ar, AR_EL);
             pe->el[pe->nel++] = newe;
         }
 
         return (newe);
 }
 
-/* add room for and return one new XMLAtt to the given element */
+/* add room for and return one new XMLAtt to the given element.
+ * it is in the arena at *ap if given, else malloced.
+ */
 static XMLAtt *
-growAtt(XMLEle *ep)
+growAtt(Block **ap, XMLEle *ep)
 {
-        XMLAtt *newa = (XMLAtt *) moremem (NULL, sizeof(XMLAtt));
-
-        memset (newa, 0, sizeof(*newa));
-        newString(&newa->name);
-        newString(&newa->valu);
+        XMLAtt *newa;
+
+        if (ap) {
+            newa = (XMLAtt *) allocArena (ap, sizeof(XMLAtt));
+            memset (newa, 0, sizeof(*newa));
+            newa->ar = 1;
+            arenaString(&newa->name);
+            arenaString(&newa->valu);
+        } else {
+            newa = (XMLAtt *) moremem (NULL, sizeof(XMLAtt));
+            memset (newa, 0, sizeof(*newa));
+            newString(&newa->name);
+            newString(&newa->valu);
+        }
         newa->ce = ep;
 
-        ep->at = (XMLAtt **) moremem (ep->at, (ep->nat+1)*sizeof(XMLAtt *));
+        ep->at = (XMLAtt **) growPtrs (ap, ep->at, ep->nat, &ep->ar, AR_AT);
         ep->at[ep->nat++] = newa;
 
         return (newa);
 }
 
+/* return room for n+1 pointers keeping the n at a, for el[] or at[].
+ * *arp & arbit says whether a is in an arena, where lists have room for the
+ * next power of 2 from 4 pointers and grow there if ap is given. lists
+ * that must grow without ap move to malloced memory and stay there.
+ */
+static void *
+growPtrs (Block **ap, void *a, int n, int *arp, int arbit)
+{
+        void *na;
+
+        if (!(*arp & arbit)) {
+            if (!ap || a)
+                return (moremem (a, (n+1)*sizeof(void *)));
+            *arp |= arbit;
+            return (allocArena (ap, 4*sizeof(void *)));
+        }
+
+        if (n < 4 || (n & (n-1)))
+            return (a);
+        if (ap)
+            na = growArena (ap, a, n*sizeof(void *), 2*n*sizeof(void *));
+        else {
+            na = (*mymalloc) ((n+1)*sizeof(void *));
+            *arp &= ~arbit;
+        }
+        if (na != a)
+            memcpy (na, a, n*sizeof(void *));
+        return (na);
+}
+
 /* free a and all it holds */
 static void
 freeAtt (XMLAtt *a)
@@ -1006,15 +1380,31 @@ freeAtt (XMLAtt *a)
             return;
         freeString (&a->name);
         freeString (&a->valu);
-        (*myfree)(a);
+        if (!a->ar)
+            (*myfree)(a);
 }
 
-/* reset endtag */
+/* reset endtag, keeping its memory */
 static void
 resetEndTag(LilXML *lp)
 {
-        freeString (&lp->endtag);
-        newString (&lp->endtag);
+        if (!lp->endtag.s)
+            newString (&lp->endtag);
+        lp->endtag.s[0] = '\0';
+        lp->endtag.sl = 0;
+}
+
+/* return number of bytes of binary pcdata announced by ep, else 0.
+ */
+static int
+rawLength (XMLEle *ep)
+{
+        XMLAtt *ap = findXMLAtt (ep, "encoding");
+
+        if (!ap || strcmp (ap->valu.s, "binary"))
+            return (0);
+        ap = findXMLAtt (ep, "enclen");
+        return (ap ? atoi (ap->valu.s) : 0);
 }
 
 /* 1 if c is a valid token character, else 0.
@@ -1028,16 +1418,12 @@ isTokenChar (int start, int c)
 
 /* grow the String storage at *sp to append c */
 static void
-growString (String *sp, int c)
+growString (Block **ap, String *sp, int c)
 {
         int l = sp->sl + 2;		/* need room for '\0' plus c */
 
-        if (l > sp->sm) {
-            if (!sp->s)
-                newString (sp);
-            else
-                sp->s = (char *) moremem (sp->s, sp->sm *= 2);
-        }
+        if (l > sp->sm)
+            roomString (ap, sp, l);
         sp->s[--l] = '\0';
         sp->s[--l] = (char)c;
         sp->sl++;
@@ -1045,19 +1431,54 @@ growString (String *sp, int c)
 
 /* append str to the String storage at *sp */
 static void
-appendString (String *sp, const char *str)
+appendString (Block **ap, String *sp, const char *str)
+{
+        appendBytes (ap, sp, str, strlen (str));
+}
+
+/* append the n chars at buf, which may include \0, to the String at *sp */
+static void
+appendBytes (Block **ap, String *sp, const char *buf, int n)
+{
+        int l = sp->sl + n + 1;		/* need room for '\0' */
+
+        if (l > sp->sm)
+            roomString (ap, sp, l);
+        memcpy (&sp->s[sp->sl], buf, n);
+        sp->sl += n;
+        sp->s[sp->sl] = '\0';
+}
+
+/* make room for at least l bytes at sp->s, keeping its string.
+ * grows by doubling so long strings are copied only a few times. a string
+ * in an arena grows there if ap is given and it stays short, else it moves
+ * to malloced memory.
+ */
+static void
+roomString (Block **ap, String *sp, int l)
 {
-        int strl = strlen (str);
-        int l = sp->sl + strl + 1;	/* need room for '\0' */
+        int m = sp->sm ? sp->sm : (sp->ar ? ARMINSTR : MINMEM);
+        char *s;
+
+        while (m < l)
+            m *= 2;
 
-        if (l > sp->sm) {
-            if (!sp->s)
-                newString (sp);
-            if (l > sp->sm)
-                sp->s = (char *) moremem (sp->s, (sp->sm = l));
+        if (!sp->ar) {
+            sp->s = (char *) moremem (sp->s, m);
+            if (!sp->sm)
+                sp->s[0] = '\0';
+        } else {
+            if (ap && m <= arenasize/4)
+                s = (char *) growArena (ap, sp->s, sp->sm, m);
+            else {
+                s = (char *) (*mymalloc) (m);
+                sp->ar = 0;
+            }
+            if (s != sp->s)
+                memcpy (s, sp->s, sp->sl+1);
+            sp->s = s;
         }
-        strcpy (&sp->s[sp->sl], str);
-        sp->sl += strl;
+        sp->sm = m;
 }
 
 /* init a String with a malloced string containing just \0 */
@@ -1070,15 +1491,92 @@ newString(String *sp)
         sp->sl = 0;
 }
 
+/* init a String in an arena, empty until it first grows */
+static void
+arenaString(String *sp)
+{
+        static char empty[1];
+
+        sp->s = empty;
+        sp->sm = 0;
+        sp->sl = 0;
+        sp->ar = 1;
+}
+
 /* free memory used by the given String */
 static void
 freeString (String *sp)
 {
-        if (sp->s)
+        if (sp->s && !sp->ar)
             (*myfree) (sp->s);
         sp->s = NULL;
         sp->sl = 0;
         sp->sm = 0;
+        sp->ar = 0;
+}
+
+/* return n bytes from the arena whose newest block is *ap.
+ * small requests share the newest block, starting a new one when it is full.
+ * a request over a quarter of arenasize gets a block of its own, linked in
+ * behind the newest so that stays in use.
+ */
+static void *
+allocArena (Block **ap, int n)
+{
+        Block *bp = *ap;
+        int big = n > arenasize/4;
+        char *p;
+
+        n = ARALIGN(n);
+        if (!bp || bp->used + n > bp->size) {
+            int size = big || n > arenasize - (int)sizeof(Block) ? n : arenasize - (int)sizeof(Block);
+            Block *nbp = (Block *) (*mymalloc) (sizeof(Block) + size);
+
+            nbp->size = size;
+            nbp->used = 0;
+            if (bp && big) {
+                nbp->next = bp->next;
+                bp->next = nbp;
+            } else {
+                nbp->next = bp;
+                *ap = nbp;
+            }
+            bp = nbp;
+        }
+
+        p = BLOCKDATA(bp) + bp->used;
+        bp->used += n;
+        return (p);
+}
+
+/* return room for newn bytes in place of the oldn at p, which came from
+ * the arena at *ap. p stays put if it was the last handed out from the
+ * newest block and that has room, else the caller must copy.
+ */
+static void *
+growArena (Block **ap, void *p, int oldn, int newn)
+{
+        Block *bp = *ap;
+
+        oldn = ARALIGN(oldn);
+        newn = ARALIGN(newn);
+        if (bp && (char *)p + oldn == BLOCKDATA(bp) + bp->used
+                                && bp->used - oldn + newn <= bp->size) {
+            bp->used += newn - oldn;
+            return (p);
+        }
+        return (allocArena (ap, newn));
+}
+
+/* free all blocks of the arena whose newest block is bp */
+static void
+freeArena (Block *bp)
+{
+        while (bp) {
+            Block *next = bp->next;
+            (*myfree) (bp);
+            bp = next;
+        }
 }
 
 /* like malloc but knows to use realloc if already started */
@@ -1088,6 +1586,182 @@ moremem (void *old, int n)
         return (old ? (*myrealloc)(old, n) : (*mymalloc)(n));
 }
 
+#if defined(LILXML_BENCHMARK)
+/* standalone benchmark that parses INDI traffic with readXMLEle() one char
+ * at a time and with readXMLBuf() a read buffer at a time, and checks both
+ * find the same elements, then counts the allocations readXMLBuf() makes per
+ * element with and without arenas. traffic is read from a file captured off
+ * an INDI connection, else made up of property definitions, number updates
+ * and a base64 BLOB.
+ * cc -O2 -o lilxml_benchmark -DLILXML_BENCHMARK lilxml.c
+ */
+
+#include <sys/time.h>
+
+#define	BENCHBUF	4096		/* bytes per read, as indiserver */
+
+static double
+now (void)
+{
+        struct timeval tv;
+
+        gettimeofday (&tv, NULL);
+        return (tv.tv_sec + tv.tv_usec*1e-6);
+}
+
+/* make up traffic like a CCD driver's into a malloced buffer */
+static char *
+makeTraffic (int *np)
+{
+        static const char b64[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        int nblob = 4*(1<<20);
+        int m = nblob + (1<<20), n = 0;
+        char *buf = (*mymalloc) (m);
+        int i;
+
+        for (i = 0; i < 500; i++) {
+            n += sprintf (buf+n, "<defNumberVector device='CCD Simulator' "
+                "name='PROP_%d' label='Property &amp; %d' group='Main Control' "
+                "state='Idle' perm='rw' timeout='60' "
+                "timestamp='2016-01-01T00:00:00'>\n", i, i);
+            n += sprintf (buf+n, "    <defNumber name='VALUE' label='Value' "
+                "format='%%8.3f' min='-50' max='50' step='0'>\n"
+                "%d.125\n    </defNumber>\n</defNumberVector>\n", i);
+            n += sprintf (buf+n, "<setNumberVector device='CCD Simulator' "
+                "name='CCD_EXPOSURE' state='Busy' timeout='60' "
+                "timestamp='2016-01-01T00:00:01'>\n    <oneNumber "
+                "name='CCD_EXPOSURE_VALUE'>\n%d\n    </oneNumber>\n"
+                "</setNumberVector>\n", 500-i);
+        }
+        n += sprintf (buf+n, "<setBLOBVector device='CCD Simulator' "
+            "name='CCD1' state='Ok' timeout='60' "
+            "timestamp='2016-01-01T00:00:02'>\n    <oneBLOB name='CCD1' "
+            "size='%d' format='.fits' len='%d'>\n", nblob/4*3, nblob);
+        for (i = 0; i < nblob; i++)
+            buf[n++] = b64[(i*7 + i/64) & 63];
+        n += sprintf (buf+n, "\n    </oneBLOB>\n</setBLOBVector>\n");
+
+        *np = n;
+        return (buf);
+}
+
+static int
+countEle (XMLEle *root, void *arg)
+{
+        *(int *)arg += nXMLEle (root) + 1;
+        delXMLEle (root);
+        return (0);
+}
+
+static long nallocs;
+
+static void *
+countMalloc (size_t size)
+{
+        nallocs++;
+        return (malloc (size));
+}
+
+static void *
+countRealloc (void *ptr, size_t size)
+{
+        nallocs++;
+        return (realloc (ptr, size));
+}
+
+/* parse buf reps times with readXMLBuf(), return seconds taken */
+static double
+bufPass (LilXML *lp, char *buf, int n, int reps, int *nep)
+{
+        char ynot[1024];
+        double t0 = now();
+        int i, j;
+
+        for (*nep = j = 0; j < reps; j++)
+            for (i = 0; i < n; i += BENCHBUF) {
+                int l = n-i < BENCHBUF ? n-i : BENCHBUF;
+                int k = 0;
+
+                while (k < l) {
+                    k += readXMLBuf (lp, buf+i+k, l-k, countEle, nep, ynot);
+                    if (ynot[0])
+                        fprintf (stderr, "readXMLBuf: %s\n", ynot);
+                }
+            }
+        return (now() - t0);
+}
+
+int
+main (int ac, char *av[])
+{
+        int reps = ac > 2 ? atoi(av[2]) : 10;
+        char ynot[1024], *buf;
+        int i, j, n, ne1, ne2, ne3;
+        double t0, t1, t2, t3;
+        long na2, na3;
+        LilXML *lp;
+
+        if (ac > 1 && strcmp (av[1], "-")) {
+            FILE *fp = fopen (av[1], "rb");
+            if (!fp) {
+                perror (av[1]);
+                return (1);
+            }
+            fseek (fp, 0, SEEK_END);
+            n = ftell (fp);
+            rewind (fp);
+            buf = (*mymalloc) (n);
+            if (fread (buf, 1, n, fp) != n) {
+                perror (av[1]);
+                return (1);
+            }
+            fclose (fp);
+        } else
+            buf = makeTraffic (&n);
+
+        lp = newLilXML();
+
+        t0 = now();
+        for (ne1 = j = 0; j < reps; j++)
+            for (i = 0; i < n; i++) {
+                XMLEle *root = readXMLEle (lp, buf[i], ynot);
+                if (root)
+                    countEle (root, &ne1);
+                else if (ynot[0])
+                    fprintf (stderr, "readXMLEle: %s\n", ynot);
+            }
+
+        t1 = now() - t0;
+
+        lilxmlMalloc (countMalloc, countRealloc, free);
+        nallocs = 0;
+        t2 = bufPass (lp, buf, n, reps, &ne2);
+        na2 = nallocs;
+
+        lilxmlArena (0);
+        nallocs = 0;
+        t3 = bufPass (lp, buf, n, reps, &ne3);
+        na3 = nallocs;
+
+        printf ("%d bytes, %d elements\n", n, ne1/reps);
+        printf ("readXMLEle %8.1f MB/s\n", 1e-6*n*reps/t1);
+        printf ("readXMLBuf %8.1f MB/s, %5.2f allocations per element\n",
+                    1e-6*n*reps/t2, (double)na2/ne2);
+        printf ("no arenas  %8.1f MB/s, %5.2f allocations per element\n",
+                    1e-6*n*reps/t3, (double)na3/ne3);
+
+        delLilXML (lp);
+        (*myfree) (buf);
+
+        if (ne1 != ne2 || ne1 != ne3) {
+            printf ("element counts differ: %d %d %d\n", ne1, ne2, ne3);
+            return (1);
+        }
+        return (0);
+}
+#endif
+
 #if defined(MAIN_TST)
 int
 main (int ac, char *av[])
@@ -22,6 +22,7 @@
     \brief A little DOM-style library to handle parsing and processing an XML file.
     
     It only handles elements, attributes and pcdata content. <! ... > and <? ... > are silently ignored. pcdata is collected into one string, sans leading whitespace first line. \n
+    An element with attributes encoding="binary" and enclen="n" carries exactly n bytes of raw pcdata, which may include \\0, immediately after its opening tag. Use pcdatalenXMLEle() for its length. \n
     
     The following is an example of a cannonical usage for the lilxml library. Initialize a lil xml context and read an XML file in a root element.
     
@@ -71,6 +72,9 @@ typedef struct _xml_att XMLAtt;
 typedef struct _xml_ele XMLEle;
 typedef struct _LilXML LilXML;
 
+/** \brief Called with pcdata streamed by streamXMLPCData(). */
+typedef int (*XMLPCDataFn)(XMLEle *ep, const char *data, int len, void *arg);
+
 /**
  * \defgroup lilxmlFunctions XML Functions: Functions to parse, process, and search XML.
  */
@@ -101,6 +105,29 @@ extern void delXMLEle (XMLEle *e);
  */
 extern XMLEle *readXMLEle (LilXML *lp, int c, char errmsg[]);
 
+/** \brief Process XML a buffer at a time.
+
+    Runs of pcdata, attribute values and binary pcdata are found with memchr() and copied whole, so this is much faster than calling readXMLEle() for each char of a buffer, and gives the same elements and errors.
+    \param lp a pointer to a lilxml parser.
+    \param buf the chars to process.
+    \param nbuf number of chars in buf.
+    \param fn called with each complete XML element in turn, which it must delete with delXMLEle() when done with it. Return 0 to go on, non-zero to stop after this element.
+    \param arg passed on to fn.
+    \param errmsg a buffer to store error messages if an error in parsing is encounterd, else set to an empty string.
+    \return Number of chars of buf used. This is nbuf unless fn asked to stop or a parsing error occurs, after which the parser starts afresh and the rest of buf may be passed in again.
+ */
+extern int readXMLBuf (LilXML *lp, const char *buf, int nbuf, int (*fn)(XMLEle *root, void *arg), void *arg, char errmsg[]);
+
+/** \brief Pass the pcdata of elements with a given tag on as it is read instead of collecting it.
+
+    Once the opening tag of such an element is read, fn is called with it, its attributes complete, and data NULL. If fn returns 0 it is then called with each piece of the element's pcdata as it arrives, until the closing tag, and the element is left with no pcdata. Else its pcdata is collected as usual. Entities are decoded and whitespace dropped as usual, so the pieces add up to the pcdata that would have been collected. This lets a large pcdata, such as a BLOB, be decoded while it is still arriving.
+    \param lp a pointer to a lilxml parser.
+    \param tag tag of the elements whose pcdata to stream.
+    \param fn called with each element and piece of pcdata, or NULL to stop streaming.
+    \param arg passed on to fn.
+ */
+extern void streamXMLPCData (LilXML *lp, const char *tag, XMLPCDataFn fn, void *arg);
+
 /* search functions */
 /** \brief Find an XML attribute within an XML element.
     \param e a pointer to the XML element to search.
@@ -173,6 +200,12 @@ extern char *valuXMLAtt (XMLAtt *ap);
 */
 extern int pcdatalenXMLEle (XMLEle *ep);
 
+/** \brief Return whether the pcdata of an XML element was streamed.
+    \param ep a pointer to an XML element.
+    \return 1 if its pcdata was passed on by streamXMLPCData(), else 0.
+*/
+extern int streamedXMLEle (XMLEle *ep);
+
 /** \brief Return the number of nested XML elements in a parent XML element.
     \param ep a pointer to an XML element.
     \return the number of nested XML elements.
@@ -260,6 +293,13 @@ extern int sprlXMLEle (XMLEle *ep, int level);
 extern void indi_xmlMalloc (void *(*newmalloc)(size_t size),
     void *(*newrealloc)(void *ptr, size_t size), void (*newfree)(void *ptr));
 
+/** \brief Set the size of the blocks parsed XML elements are built in.
+
+    Each parsed root element, with all its attributes, child elements and short strings, is allocated from a few blocks which delXMLEle() of the root frees together. Trees may still be edited as before.
+    \param blocksize bytes in each block, default 4096. 0 allocates each part of a tree on its own.
+*/
+extern void lilxmlArena (int blocksize);
+
 /*@}*/
 
 #ifdef __cplusplus
@@ -0,0 +1,638 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+/* Guide star detection.
+ *
+ * A region is scanned a row at a time. Two rows of column sums, over the 9 and the 3 rows
+ * around the current one, move down by adding the row entering and subtracting the row
+ * leaving, which SSE2 or AVX2 do 8 or 16 columns at a time. Sliding along them gives the
+ * 9x9 and 3x3 box sums at every pixel, and so its score: the mean of the 3x3 core less the
+ * mean of the rest of the 9x9 box. Scores that beat their 8 neighbours and the threshold are
+ * kept as candidates. Sums are unsigned 32 bits; they may wrap on the way but the box sums
+ * taken from them never do. Large regions are cut into bands of rows, one for each thread.
+ *
+ * The candidates are then measured brightest first, skipping any too close to a brighter
+ * star, and hot pixels are dropped.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "stardetect.h"
+
+#define MAXTHREADS  16              /* most threads one call starts */
+#define MINPIXELS   (256*1024)      /* fewest pixels worth a thread of their own */
+#define CORE        1               /* half size of the core box */
+#define BOX         4               /* half size of the box around it */
+#define APERTURE    6               /* half size of the box a star is measured in */
+#define ANNULUS     9               /* half size of the box the background is taken inside of */
+#define MINSEP      8               /* closest two stars may be */
+#define MAXSAMPLES  4096            /* most pixels the noise of a region is estimated from */
+#define MAXCAND     128             /* most candidates each band keeps */
+#define TRACKCAND   4               /* stars looked at in each tracking window */
+
+/* col[i] += add[i] - sub[i] for n 8 or 16 bit pixels, returning how many were done.
+ * the scalar loops in colUpdate() do the rest.
+ */
+typedef int (*ColKernel)(uint32_t *col, const void *add, const void *sub, int n);
+
+/* one local maximum of the score */
+typedef struct
+{
+    int x, y;
+    float score;
+} Cand;
+
+/* rows of a region searched by one thread */
+typedef struct
+{
+    int bpp;
+    const void *frame;
+    int width;
+    int x0, x1;                     /* columns maxima are looked for in */
+    int y0, y1;                     /* rows maxima are looked for in */
+    float thresh;
+    Cand cand[MAXCAND];             /* best candidates, best first */
+    int ncand;
+    int failed;
+} Band;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+#define STARDETECT_X86
+
+__attribute__((target("sse2"))) static int
+col8_sse2 (uint32_t *col, const void *add, const void *sub, int n)
+{
+	const uint8_t *a = (const uint8_t *)add, *s = (const uint8_t *)sub;
+	const __m128i zero = _mm_setzero_si128 ();
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+	    __m128i va = _mm_loadu_si128 ((const __m128i *)(a + i));
+	    __m128i vs = _mm_loadu_si128 ((const __m128i *)(s + i));
+	    /* differences fit 16 bits signed, sign extend them to 32 */
+	    __m128i dlo = _mm_sub_epi16 (_mm_unpacklo_epi8 (va, zero), _mm_unpacklo_epi8 (vs, zero));
+	    __m128i dhi = _mm_sub_epi16 (_mm_unpackhi_epi8 (va, zero), _mm_unpackhi_epi8 (vs, zero));
+	    __m128i *c = (__m128i *)(col + i);
+
+	    _mm_storeu_si128 (c, _mm_add_epi32 (_mm_loadu_si128 (c), _mm_srai_epi32 (_mm_unpacklo_epi16 (dlo, dlo), 16)));
+	    _mm_storeu_si128 (c + 1, _mm_add_epi32 (_mm_loadu_si128 (c + 1), _mm_srai_epi32 (_mm_unpackhi_epi16 (dlo, dlo), 16)));
+	    _mm_storeu_si128 (c + 2, _mm_add_epi32 (_mm_loadu_si128 (c + 2), _mm_srai_epi32 (_mm_unpacklo_epi16 (dhi, dhi), 16)));
+	    _mm_storeu_si128 (c + 3, _mm_add_epi32 (_mm_loadu_si128 (c + 3), _mm_srai_epi32 (_mm_unpackhi_epi16 (dhi, dhi), 16)));
+	}
+
+	return (i);
+}
+
+__attribute__((target("sse2"))) static int
+col16_sse2 (uint32_t *col, const void *add, const void *sub, int n)
+{
+	const uint16_t *a = (const uint16_t *)add, *s = (const uint16_t *)sub;
+	const __m128i zero = _mm_setzero_si128 ();
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+	    __m128i va = _mm_loadu_si128 ((const __m128i *)(a + i));
+	    __m128i vs = _mm_loadu_si128 ((const __m128i *)(s + i));
+	    __m128i *c = (__m128i *)(col + i);
+	    __m128i lo = _mm_sub_epi32 (_mm_unpacklo_epi16 (va, zero), _mm_unpacklo_epi16 (vs, zero));
+	    __m128i hi = _mm_sub_epi32 (_mm_unpackhi_epi16 (va, zero), _mm_unpackhi_epi16 (vs, zero));
+
+	    _mm_storeu_si128 (c, _mm_add_epi32 (_mm_loadu_si128 (c), lo));
+	    _mm_storeu_si128 (c + 1, _mm_add_epi32 (_mm_loadu_si128 (c + 1), hi));
+	}
+
+	return (i);
+}
+
+__attribute__((target("avx2"))) static int
+col8_avx2 (uint32_t *col, const void *add, const void *sub, int n)
+{
+	const uint8_t *a = (const uint8_t *)add, *s = (const uint8_t *)sub;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+	    __m256i va = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(a + i)));
+	    __m256i vs = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(s + i)));
+	    __m256i *c = (__m256i *)(col + i);
+	    _mm256_storeu_si256 (c, _mm256_add_epi32 (_mm256_loadu_si256 (c), _mm256_sub_epi32 (va, vs)));
+	}
+
+	return (i);
+}
+
+__attribute__((target("avx2"))) static int
+col16_avx2 (uint32_t *col, const void *add, const void *sub, int n)
+{
+	const uint16_t *a = (const uint16_t *)add, *s = (const uint16_t *)sub;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+	    __m256i va = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)(a + i)));
+	    __m256i vs = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)(s + i)));
+	    __m256i *c = (__m256i *)(col + i);
+	    _mm256_storeu_si256 (c, _mm256_add_epi32 (_mm256_loadu_si256 (c), _mm256_sub_epi32 (va, vs)));
+	}
+
+	return (i);
+}
+
+#endif
+
+/* kernel that does nothing, leaving it all to the scalar loops */
+static int
+col_none (uint32_t *col, const void *add, const void *sub, int n)
+{
+	(void) col;
+	(void) add;
+	(void) sub;
+	(void) n;
+	return (0);
+}
+
+static ColKernel col8kernel, col16kernel;
+
+/* pick the fastest kernels this cpu can run. they are the same each time,
+ * so racing threads may safely both set them. col16kernel goes last, starFind() tests it.
+ */
+static void
+pickColKernels (void)
+{
+#if defined(STARDETECT_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports ("avx2")) {
+	    col8kernel = col8_avx2;
+	    col16kernel = col16_avx2;
+	    return;
+	}
+	if (__builtin_cpu_supports ("sse2")) {
+	    col8kernel = col8_sse2;
+	    col16kernel = col16_sse2;
+	    return;
+	}
+#endif
+	col8kernel = col_none;
+	col16kernel = col_none;
+}
+
+/* pixel i of frame */
+static inline int
+pixel (int bpp, const void *frame, size_t i)
+{
+	return bpp == 16 ? ((const uint16_t *)frame)[i] : ((const uint8_t *)frame)[i];
+}
+
+/* add the n pixels at add and subtract those at sub from the column sums at col */
+static void
+colUpdate (int bpp, uint32_t *col, const void *add, const void *sub, int n)
+{
+	int i;
+
+	if (bpp == 16) {
+	    const uint16_t *a = (const uint16_t *)add, *s = (const uint16_t *)sub;
+	    for (i = col16kernel (col, a, s, n); i < n; i++)
+		col[i] += (uint32_t)a[i] - s[i];
+	} else {
+	    const uint8_t *a = (const uint8_t *)add, *s = (const uint8_t *)sub;
+	    for (i = col8kernel (col, a, s, n); i < n; i++)
+		col[i] += (uint32_t)a[i] - s[i];
+	}
+}
+
+/* scores along one row from its column sums, for the n pixels from the 5th column on */
+static void
+scoreRow (float *score, const uint32_t *col9, const uint32_t *col3, int n)
+{
+	uint32_t box9 = 0, box3 = 0;
+	int i;
+
+	for (i = 0; i < 2*BOX+1; i++)
+	    box9 += col9[i];
+	for (i = BOX-CORE; i <= BOX+CORE; i++)
+	    box3 += col3[i];
+
+	for (i = 0; i < n; i++) {
+	    score[i] = box3 * (1.0f/((2*CORE+1)*(2*CORE+1)))
+		- (box9 - box3) * (1.0f/((2*BOX+1)*(2*BOX+1) - (2*CORE+1)*(2*CORE+1)));
+	    if (i + 1 < n) {
+		box9 += col9[i + 2*BOX+1] - col9[i];
+		box3 += col3[i + BOX+CORE+1] - col3[i + BOX-CORE];
+	    }
+	}
+}
+
+/* keep c among the best candidates of bp */
+static void
+addCand (Band *bp, int x, int y, float score)
+{
+	int i;
+
+	if (bp->ncand == MAXCAND && score <= bp->cand[MAXCAND-1].score)
+	    return;
+
+	i = bp->ncand < MAXCAND ? bp->ncand++ : MAXCAND-1;
+	for (; i > 0 && bp->cand[i-1].score < score; i--)
+	    bp->cand[i] = bp->cand[i-1];
+	bp->cand[i].x = x;
+	bp->cand[i].y = y;
+	bp->cand[i].score = score;
+}
+
+/* find the local maxima of the score in one band. the scores of the rows and columns
+ * just outside it are worked out too, so every pixel of it has its 8 neighbours.
+ */
+static void *
+scanBand (void *arg)
+{
+	Band *bp = (Band *)arg;
+	int psize = bp->bpp / 8;
+	int nscore = bp->x1 - bp->x0 + 2;	/* columns x0-1 .. x1 */
+	int ncol = nscore + 2*BOX;		/* columns x0-1-BOX .. x1+BOX */
+	size_t rowbytes = (size_t)bp->width * psize;
+	const uint8_t *base = (const uint8_t *)bp->frame + (size_t)(bp->x0 - 1 - BOX) * psize;
+	uint32_t *col9, *col3;
+	float *rows, *s[3];
+	void *zeros;
+	int y, k, x;
+
+	col9 = (uint32_t *) calloc (ncol, sizeof(uint32_t));
+	col3 = (uint32_t *) calloc (ncol, sizeof(uint32_t));
+	rows = (float *) malloc (3 * nscore * sizeof(float));
+	zeros = calloc (ncol, psize);
+	if (!col9 || !col3 || !rows || !zeros) {
+	    free (col9);
+	    free (col3);
+	    free (rows);
+	    free (zeros);
+	    bp->failed = 1;
+	    return NULL;
+	}
+
+	/* columns for the row above the band */
+	y = bp->y0 - 1;
+	for (k = -BOX; k <= BOX; k++)
+	    colUpdate (bp->bpp, col9, base + (y + k) * rowbytes, zeros, ncol);
+	for (k = -CORE; k <= CORE; k++)
+	    colUpdate (bp->bpp, col3, base + (y + k) * rowbytes, zeros, ncol);
+
+	for (; y <= bp->y1; y++) {
+	    if (y > bp->y0 - 1) {
+		colUpdate (bp->bpp, col9, base + (y + BOX) * rowbytes, base + (y - BOX - 1) * rowbytes, ncol);
+		colUpdate (bp->bpp, col3, base + (y + CORE) * rowbytes, base + (y - CORE - 1) * rowbytes, ncol);
+	    }
+	    scoreRow (rows + (y % 3) * nscore, col9, col3, nscore);
+
+	    /* the row above now has both neighbours */
+	    if (y < bp->y0 + 1)
+		continue;
+	    s[0] = rows + ((y - 2) % 3) * nscore;
+	    s[1] = rows + ((y - 1) % 3) * nscore;
+	    s[2] = rows + (y % 3) * nscore;
+	    for (x = 1; x < nscore - 1; x++) {
+		float c = s[1][x];
+		/* strictly above the neighbours before, at least those after, so a flat top counts once */
+		if (c > bp->thresh && c > s[0][x-1] && c > s[0][x] && c > s[0][x+1] && c > s[1][x-1]
+			&& c >= s[1][x+1] && c >= s[2][x-1] && c >= s[2][x] && c >= s[2][x+1])
+		    addCand (bp, bp->x0 - 1 + x, y - 1, c);
+	    }
+	}
+
+	free (col9);
+	free (col3);
+	free (rows);
+	free (zeros);
+	bp->failed = 0;
+	return NULL;
+}
+
+static int
+cmpInt (const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* median of n values, which are reordered */
+static double
+median (int *v, int n)
+{
+	qsort (v, n, sizeof(int), cmpInt);
+	return n % 2 ? v[n/2] : (v[n/2-1] + v[n/2]) / 2.0;
+}
+
+/* estimate the background and its noise in a region from the median and the median absolute
+ * deviation of a grid of up to MAXSAMPLES pixels
+ */
+static void
+regionNoise (int bpp, const void *frame, int width, int x, int y, int w, int h,
+double *bg, double *sigma)
+{
+	int step = 1, n = 0, i, j;
+	int *v;
+
+	while ((size_t)(w/step + 1) * (h/step + 1) > MAXSAMPLES)
+	    step++;
+	v = (int *) malloc ((size_t)(w/step + 1) * (h/step + 1) * sizeof(int));
+	if (!v) {
+	    *bg = 0;
+	    *sigma = 1;
+	    return;
+	}
+
+	for (j = y; j < y + h; j += step)
+	    for (i = x; i < x + w; i += step)
+		v[n++] = pixel (bpp, frame, (size_t)j * width + i);
+	*bg = median (v, n);
+	for (i = 0; i < n; i++)
+	    v[i] = (int) fabs (v[i] - *bg);
+	/* quantising alone leaves about 0.3 */
+	*sigma = 1.4826 * median (v, n);
+	if (*sigma < 0.5)
+	    *sigma = 0.5;
+
+	free (v);
+}
+
+/* measure the star near cx,cy. return 0 if there is one, -1 if it is a hot pixel or nothing */
+static int
+measureStar (int bpp, const void *frame, int width, int height, int cx, int cy, double sigma,
+double bg, StarInfo *sp)
+{
+	int ring[(2*ANNULUS+1)*(2*ANNULUS+1)];
+	double sx, sy, sw, sr, vmax, b, x = cx, y = cy;
+	int i, j, n, nring = 0, iter;
+
+	/* background from the median of the pixels between the aperture and the annulus */
+	for (j = cy - ANNULUS; j <= cy + ANNULUS; j++)
+	    for (i = cx - ANNULUS; i <= cx + ANNULUS; i++)
+		if (i >= 0 && j >= 0 && i < width && j < height
+			&& (abs (i - cx) > APERTURE || abs (j - cy) > APERTURE))
+		    ring[nring++] = pixel (bpp, frame, (size_t)j * width + i);
+	b = nring > 0 ? median (ring, nring) : bg;
+
+	/* centroid of the pixels well above it, again around the new centre if it moved */
+	for (iter = 0; iter < 2; iter++) {
+	    sx = sy = sw = vmax = 0;
+	    n = 0;
+	    for (j = cy - APERTURE; j <= cy + APERTURE; j++)
+		for (i = cx - APERTURE; i <= cx + APERTURE; i++) {
+		    double v;
+		    if (i < 0 || j < 0 || i >= width || j >= height)
+			continue;
+		    v = pixel (bpp, frame, (size_t)j * width + i) - b;
+		    if (v <= 3*sigma)
+			continue;
+		    sx += i * v;
+		    sy += j * v;
+		    sw += v;
+		    if (v > vmax)
+			vmax = v;
+		    n++;
+		}
+	    /* a hot pixel has most of the flux in one pixel, any star we can guide on spreads it */
+	    if (n < 2 || vmax > 0.8*sw)
+		return (-1);
+	    x = sx / sw;
+	    y = sy / sw;
+	    if ((int)floor (x + 0.5) == cx && (int)floor (y + 0.5) == cy)
+		break;
+	    cx = (int)floor (x + 0.5);
+	    cy = (int)floor (y + 0.5);
+	}
+
+	sr = 0;
+	for (j = cy - APERTURE; j <= cy + APERTURE; j++)
+	    for (i = cx - APERTURE; i <= cx + APERTURE; i++) {
+		double v;
+		if (i < 0 || j < 0 || i >= width || j >= height)
+		    continue;
+		v = pixel (bpp, frame, (size_t)j * width + i) - b;
+		if (v > 3*sigma)
+		    sr += v * sqrt ((i - x)*(i - x) + (j - y)*(j - y));
+	    }
+
+	sp->x = x;
+	sp->y = y;
+	sp->flux = sw;
+	sp->hfr = sr / sw;
+	sp->snr = sw / (sigma * sqrt ((double)n));
+	return (0);
+}
+
+/* number of threads to use for npixels pixels in nrows rows */
+static int
+nThreads (int threads, size_t npixels, int nrows)
+{
+	if (threads <= 0) {
+	    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	    threads = ncpu > 0 ? (int)ncpu : 1;
+	    if ((size_t)threads > npixels / MINPIXELS)
+		threads = (int)(npixels / MINPIXELS);
+	}
+	if (threads > MAXTHREADS)
+	    threads = MAXTHREADS;
+	if (threads > nrows)
+	    threads = nrows;
+	return threads > 0 ? threads : 1;
+}
+
+static int
+cmpCand (const void *a, const void *b)
+{
+	float sa = ((const Cand *)a)->score, sb = ((const Cand *)b)->score;
+	return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+int
+starFind(int bpp, const void *frame, int width, int height, int x, int y, int w, int h,
+double minsnr, StarInfo *stars, int maxstars, int threads)
+{
+	pthread_t tids[MAXTHREADS];
+	int started[MAXTHREADS];
+	Band *bands;
+	Cand *cand;
+	double bg, sigma;
+	int x0, x1, y0, y1, nt, ncand, nstars, i, j;
+
+	if ((bpp != 8 && bpp != 16) || !frame || width <= 0 || height <= 0 || maxstars <= 0)
+	    return (-1);
+
+	if (w <= 0 || h <= 0) {
+	    x = y = 0;
+	    w = width;
+	    h = height;
+	}
+	if (x < 0) {
+	    w += x;
+	    x = 0;
+	}
+	if (y < 0) {
+	    h += y;
+	    y = 0;
+	}
+	if (x + w > width)
+	    w = width - x;
+	if (y + h > height)
+	    h = height - y;
+
+	/* maxima need the 9x9 box around them and around their neighbours */
+	x0 = x > BOX+1 ? x : BOX+1;
+	y0 = y > BOX+1 ? y : BOX+1;
+	x1 = x + w < width - BOX-1 ? x + w : width - BOX-1;
+	y1 = y + h < height - BOX-1 ? y + h : height - BOX-1;
+	if (x0 >= x1 || y0 >= y1)
+	    return (0);
+
+	if (!col16kernel)
+	    pickColKernels ();
+
+	regionNoise (bpp, frame, width, x, y, w, h, &bg, &sigma);
+
+	nt = nThreads (threads, (size_t)(x1 - x0) * (y1 - y0), y1 - y0);
+	bands = (Band *) malloc (nt * sizeof(Band));
+	if (!bands)
+	    return (-1);
+
+	/* the score of pure noise has sigma*sqrt(1/9 + 1/72) */
+	for (i = 0; i < nt; i++) {
+	    bands[i].bpp = bpp;
+	    bands[i].frame = frame;
+	    bands[i].width = width;
+	    bands[i].x0 = x0;
+	    bands[i].x1 = x1;
+	    bands[i].y0 = y0 + (int)((long)(y1 - y0) * i / nt);
+	    bands[i].y1 = y0 + (int)((long)(y1 - y0) * (i+1) / nt);
+	    bands[i].thresh = (float)(minsnr * sigma * sqrt (1.0/9 + 1.0/72));
+	    bands[i].ncand = 0;
+	    bands[i].failed = 1;
+	    started[i] = i > 0 && pthread_create (&tids[i], NULL, scanBand, &bands[i]) == 0;
+	}
+
+	for (i = 0; i < nt; i++) {
+	    if (started[i])
+		pthread_join (tids[i], NULL);
+	    else
+		scanBand (&bands[i]);	/* ours, or a thread that would not start */
+	}
+
+	/* all the candidates, best first */
+	for (i = 0, ncand = 0; i < nt; i++)
+	    ncand += bands[i].ncand;
+	cand = (Cand *) malloc ((ncand + 1) * sizeof(Cand));
+	if (!cand) {
+	    free (bands);
+	    return (-1);
+	}
+	for (i = 0, ncand = 0; i < nt; i++) {
+	    if (bands[i].failed) {
+		free (bands);
+		free (cand);
+		return (-1);
+	    }
+	    memcpy (cand + ncand, bands[i].cand, bands[i].ncand * sizeof(Cand));
+	    ncand += bands[i].ncand;
+	}
+	free (bands);
+	qsort (cand, ncand, sizeof(Cand), cmpCand);
+
+	for (i = 0, nstars = 0; i < ncand && nstars < maxstars; i++) {
+	    for (j = 0; j < nstars; j++)
+		if (fabs (stars[j].x - cand[i].x) < MINSEP && fabs (stars[j].y - cand[i].y) < MINSEP)
+		    break;
+	    if (j < nstars)
+		continue;
+	    if (measureStar (bpp, frame, width, height, cand[i].x, cand[i].y, sigma, bg, &stars[nstars]) < 0)
+		continue;
+	    stars[nstars++].peak = cand[i].score;
+	}
+
+	free (cand);
+	return (nstars);
+}
+
+void
+starTrackerInit(StarTracker *t, int maxstars, int window, double minsnr)
+{
+	memset (t, 0, sizeof(*t));
+	t->maxstars = maxstars < 1 ? 1 : maxstars > STAR_MAXTRACK ? STAR_MAXTRACK : maxstars;
+	t->window = window > BOX ? window : BOX+1;
+	t->minsnr = minsnr;
+}
+
+int
+starTrackerUpdate(StarTracker *t, int bpp, const void *frame, int width, int height, int threads)
+{
+	StarInfo found[TRACKCAND];
+	double sdx = 0, sdy = 0;
+	int i, j, n, best;
+
+	/* nothing to follow, search the whole frame */
+	if (t->nstars == 0) {
+	    n = starFind (bpp, frame, width, height, 0, 0, 0, 0, t->minsnr, t->stars, t->maxstars, threads);
+	    t->nfound = n > 0 ? n : 0;
+	    if (n <= 0)
+		return (0);
+	    t->nstars = n;
+	    for (i = 0; i < n; i++) {
+		t->refx[i] = t->stars[i].x;
+		t->refy[i] = t->stars[i].y;
+		t->found[i] = 1;
+	    }
+	    t->dx = t->dy = 0;
+	    t->x = t->refx[0];
+	    t->y = t->refy[0];
+	    return (n);
+	}
+
+	/* look for each star where the others say it should be, taking the one nearest that */
+	t->nfound = 0;
+	for (i = 0; i < t->nstars; i++) {
+	    double px = t->refx[i] + t->dx, py = t->refy[i] + t->dy;
+
+	    n = starFind (bpp, frame, width, height, (int)px - t->window, (int)py - t->window,
+		2*t->window + 1, 2*t->window + 1, t->minsnr, found, TRACKCAND, 1);
+	    t->found[i] = n > 0;
+	    if (n <= 0)
+		continue;
+	    for (j = 1, best = 0; j < n; j++)
+		if (hypot (found[j].x - px, found[j].y - py) < hypot (found[best].x - px, found[best].y - py))
+		    best = j;
+	    t->stars[i] = found[best];
+	    sdx += found[best].x - t->refx[i];
+	    sdy += found[best].y - t->refy[i];
+	    t->nfound++;
+	}
+
+	if (t->nfound == 0) {
+	    t->nstars = 0;
+	    return (0);
+	}
+
+	t->dx = sdx / t->nfound;
+	t->dy = sdy / t->nfound;
+	t->x = t->refx[0] + t->dx;
+	t->y = t->refy[0] + t->dy;
+	return (t->nfound);
+}
@@ -0,0 +1,115 @@
+#if 0
+    INDI
+    Copyright (C) 2016 INDI Library Developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#endif
+
+#ifndef STARDETECT_H
+#define STARDETECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \defgroup stardetect Star Detection Functions: Find and track guide stars in 8 and 16 bit frames
+ *
+ * Stars are found where the mean of a 3x3 box stands out from the mean of the 9x9 box around
+ * it by more than a few times the noise of the frame. Both boxes are summed separably, a
+ * column at a time with SSE2 or AVX2, and large frames are searched by several threads at once.
+ * Each star found is then measured in an aperture against the median of the background around
+ * it for a subpixel centroid, half flux radius and signal to noise ratio.
+ *
+ * A StarTracker follows up to STAR_MAXTRACK stars from frame to frame, only searching a window
+ * around each, and reports the guide position from the mean shift of the stars it still finds.
+ * The whole frame is searched again only when every star is lost.
+ */
+/*@{*/
+
+#define STAR_MAXTRACK   8       /*!< Most stars a StarTracker follows */
+
+/** \brief One star found in a frame */
+typedef struct
+{
+    double x;           /*!< Centroid, pixels from the left edge of the frame */
+    double y;           /*!< Centroid, pixels from the top edge of the frame */
+    double peak;        /*!< Mean of the 3x3 box over the star above the mean of the 9x9 box around it */
+    double flux;        /*!< Sum above the local background, counting only pixels above 3 sigma */
+    double hfr;         /*!< Half flux radius, pixels */
+    double snr;         /*!< Flux over the background noise of the pixels counted */
+} StarInfo;
+
+/** \brief Stars followed from frame to frame. Set up with starTrackerInit(), the rest is read only. */
+typedef struct
+{
+    int maxstars;                       /*!< Most stars to follow */
+    int window;                         /*!< Half size of the search window around each star */
+    double minsnr;                      /*!< Least detection significance, in sigmas of the noise */
+    int nstars;                         /*!< Stars followed, 0 until the first star is found */
+    int nfound;                         /*!< Stars found in the last frame */
+    double refx[STAR_MAXTRACK];         /*!< Position of each star when it was first found */
+    double refy[STAR_MAXTRACK];
+    int found[STAR_MAXTRACK];           /*!< Whether each star was found in the last frame */
+    StarInfo stars[STAR_MAXTRACK];      /*!< Last measurement of each star, stars[0] is the guide star */
+    double dx, dy;                      /*!< Mean shift of the stars found from their first positions */
+    double x, y;                        /*!< Guide position, the first position of stars[0] plus the mean shift */
+} StarTracker;
+
+/** \brief Find the brightest stars in a region of a frame.
+    \param bpp bits per pixel of frame, 8 or 16.
+    \param frame pixels, rows packed.
+    \param width width of frame.
+    \param height height of frame.
+    \param x left edge of the region to search.
+    \param y top edge of the region to search.
+    \param w width of the region, 0 for all of the frame.
+    \param h height of the region, 0 for all of the frame.
+    \param minsnr least detection significance, in sigmas of the noise of the region.
+    \param stars set to the stars found, brightest first.
+    \param maxstars most stars to return.
+    \param threads number of threads to use, 0 to use one for each CPU.
+    \return the number of stars found, -1 if an argument is out of range.
+ */
+extern int starFind(int bpp, const void *frame, int width, int height, int x, int y, int w, int h,
+    double minsnr, StarInfo *stars, int maxstars, int threads);
+
+/** \brief Set up a tracker. Also used to drop the stars it follows.
+    \param t tracker.
+    \param maxstars most stars to follow, up to STAR_MAXTRACK.
+    \param window half size of the search window around each star.
+    \param minsnr least detection significance, in sigmas of the noise.
+ */
+extern void starTrackerInit(StarTracker *t, int maxstars, int window, double minsnr);
+
+/** \brief Follow the stars of a tracker into the next frame, finding them afresh if it has none.
+    \param t tracker.
+    \param bpp bits per pixel of frame, 8 or 16.
+    \param frame pixels, rows packed.
+    \param width width of frame.
+    \param height height of frame.
+    \param threads number of threads to use for a search of the whole frame, 0 to use one for each CPU.
+    \return the number of stars found, 0 if they are all lost and the next frame is searched whole.
+ */
+extern int starTrackerUpdate(StarTracker *t, int bpp, const void *frame, int width, int height, int threads);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,9 +28,29 @@
 #include "ser_recorder.h"
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
 
 #define ERRMSGSIZ	1024
 
+#define SER_PAGE	4096			// O_DIRECT writes start and end on pages
+#define SER_RING_SIZE	(64*1024*1024)		// bytes of frames the ring holds, or 4 frames if more
+#define SER_CHUNK_SIZE	(4*1024*1024)		// bytes the writer waits for before writing
+#define SER_EPOCH	621355968000000000ULL	// 100ns ticks from 0001-01-01 to 1970-01-01
+
+#ifndef O_DIRECT
+#define O_DIRECT	0
+#endif
+
+// Time now in SER units, 100ns ticks since 0001-01-01 UTC
+static uint64_t ser_time() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return SER_EPOCH + (uint64_t)tv.tv_sec * 10000000ULL + (uint64_t)tv.tv_usec * 10ULL;
+}
+
 SER_Recorder::SER_Recorder() {
   useSER_V3=true;
   name="SER File Recorder";
@@ -44,10 +64,20 @@ SER_Recorder::SER_Recorder() {
   else
     serh.LittleEndian=SER_BIG_ENDIAN;
   streaming_active=false;
+  number_of_planes=1;
+  direct_io=false;
+  fd=-1;
+  ring=NULL;
+  head=tail=0;
+  dropped=0;
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
 }
 
 SER_Recorder::~SER_Recorder() {
-
+  close();
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&cond);
 }
 
 bool SER_Recorder::is_little_endian() {
@@ -56,42 +86,29 @@ bool SER_Recorder::is_little_endian() {
   return black_magic == 0x01;
 }
  
-void SER_Recorder::write_int_le(unsigned int *i) {
-  if (is_little_endian())
-    fwrite((const void *)(i), sizeof(int), 1, f);
-  else {
-    unsigned char *c=(unsigned char *)i;
-    fwrite((const void *)(c+3), sizeof(char), 1, f);
-    fwrite((const void *)(c+2), sizeof(char), 1, f);
-    fwrite((const void *)(c+1), sizeof(char), 1, f);
-    fwrite((const void *)(c), sizeof(char), 1, f);
-  }
+void SER_Recorder::put_int_le(unsigned char *p, unsigned int i) {
+  p[0]=i; p[1]=i >> 8; p[2]=i >> 16; p[3]=i >> 24;
 }
 
-void SER_Recorder::write_long_int_le(unsigned long *i) {
-  if (is_little_endian()) {
-    fwrite((const void *)((unsigned int *)i), sizeof(int), 1, f);
-    fwrite((const void *)((unsigned int *)(i) + 1), sizeof(int), 1, f);
-  } else {
-    write_int_le((unsigned int *)(i) + 1);
-    write_int_le((unsigned int *)(i));
-  }
+void SER_Recorder::put_long_int_le(unsigned char *p, uint64_t i) {
+  put_int_le(p, (unsigned int)i);
+  put_int_le(p + 4, (unsigned int)(i >> 32));
 }
 
-void SER_Recorder::write_header(ser_header *s) {
-  fwrite((const void *)(s->FileID), sizeof(char), 14, f);
-  write_int_le(&(s->LuID));
-  write_int_le(&(s->ColorID));
-  write_int_le(&(s->LittleEndian));
-  write_int_le(&(s->ImageWidth));
-  write_int_le(&(s->ImageHeight));
-  write_int_le(&(s->PixelDepth));
-  write_int_le(&(s->FrameCount));
-  fwrite((const void *)(s->Observer), sizeof(char), 40, f);
-  fwrite((const void *)(s->Instrume), sizeof(char), 40, f);
-  fwrite((const void *)(s->Telescope), sizeof(char), 40, f);
-  write_long_int_le(&(s->DateTime));
-  write_long_int_le(&(s->DateTime_UTC));
+void SER_Recorder::put_header(unsigned char *p, ser_header *s) {
+  memcpy(p, s->FileID, 14);
+  put_int_le(p + 14, s->LuID);
+  put_int_le(p + 18, s->ColorID);
+  put_int_le(p + 22, s->LittleEndian);
+  put_int_le(p + 26, s->ImageWidth);
+  put_int_le(p + 30, s->ImageHeight);
+  put_int_le(p + 34, s->PixelDepth);
+  put_int_le(p + 38, s->FrameCount);
+  memcpy(p + 42, s->Observer, 40);
+  memcpy(p + 82, s->Instrume, 40);
+  memcpy(p + 122, s->Telescope, 40);
+  put_long_int_le(p + 162, s->DateTime);
+  put_long_int_le(p + 170, s->DateTime_UTC);
 }
 
 void SER_Recorder::init() {
@@ -221,38 +238,191 @@ bool SER_Recorder::setsize(unsigned int width, unsigned int height) {
 bool SER_Recorder::open(const char *filename, char *errmsg) {
   if (streaming_active) return false;
   serh.FrameCount = 0;
-  serh.DateTime=0; // no timestamp
-  serh.DateTime_UTC=0; // no timestamp
-  if ((f=fopen(filename, "w")) == NULL) {
+  serh.DateTime=0; // set to the first frame on close
+  serh.DateTime_UTC=0;
+  frame_size=serh.ImageWidth * serh.ImageHeight * (serh.PixelDepth <= 8 ? 1 : 2) * number_of_planes;
+
+  fd=::open(filename, O_WRONLY | O_CREAT | O_TRUNC | (direct_io ? O_DIRECT : 0), 0644);
+  if (fd < 0 && direct_io && errno == EINVAL) // file system without O_DIRECT
+    fd=::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
     snprintf(errmsg, ERRMSGSIZ, "recorder open error %d, %s\n", errno, strerror (errno));
     return false;
   }
-  write_header(&serh);
-  frame_size=serh.ImageWidth * serh.ImageHeight * (serh.PixelDepth <= 8 ? 1 : 2) * number_of_planes;
+
+  ring_size=SER_RING_SIZE;
+  if (ring_size < 4 * (size_t)frame_size)
+    ring_size=(4 * (size_t)frame_size + SER_PAGE - 1) / SER_PAGE * SER_PAGE;
+  chunk_size=SER_CHUNK_SIZE;
+  if (chunk_size > ring_size / 4)
+    chunk_size=ring_size / 4 / SER_PAGE * SER_PAGE;
+  if (posix_memalign((void **)&ring, SER_PAGE, ring_size)) {
+    snprintf(errmsg, ERRMSGSIZ, "recorder cannot allocate %lu bytes for frames\n", (unsigned long)ring_size);
+    ring=NULL;
+    ::close(fd);
+    return false;
+  }
+
+  // the header goes first, it is written again with the frame count on close
+  put_header(ring, &serh);
+  head=SER_HEADER_SIZE;
+  tail=0;
+  closing=false;
+  write_error=false;
+  dropped=0;
+  timestamps.clear();
+
+  if (pthread_create(&writer, NULL, &SER_Recorder::writerHelper, this)) {
+    snprintf(errmsg, ERRMSGSIZ, "recorder cannot start writer thread\n");
+    free(ring);
+    ring=NULL;
+    ::close(fd);
+    return false;
+  }
+
   streaming_active = true;
   return true;
 }
 
 bool SER_Recorder::close() {
-  if (f)
-  {
-      fseek(f, 0L, SEEK_SET);
-      write_header(&serh);
-      fclose(f);
+  if (!streaming_active) return true;
+  bool ok=true;
+
+  // the writer writes what is left, the last of it unaligned
+#if O_DIRECT
+  if (direct_io)
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+  pthread_mutex_lock(&lock);
+  closing=true;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+  pthread_join(writer, NULL);
+
+  // only count frames that made it to disk
+  if (write_error && tail < head) {
+    serh.FrameCount=tail < SER_HEADER_SIZE ? 0 : (tail - SER_HEADER_SIZE) / frame_size;
+    ok=false;
   }
 
+  if (serh.FrameCount > 0) {
+    struct tm tm;
+    time_t t=(timestamps[0] - SER_EPOCH) / 10000000ULL;
+    localtime_r(&t, &tm);
+    serh.DateTime_UTC=timestamps[0];
+    serh.DateTime=timestamps[0] + (int64_t)tm.tm_gmtoff * 10000000LL;
+  }
+
+  unsigned char header[SER_HEADER_SIZE];
+  put_header(header, &serh);
+  if (pwrite(fd, header, SER_HEADER_SIZE, 0) != SER_HEADER_SIZE)
+    ok=false;
+
+  // SER v3 trailer, the UTC time of each frame
+  if (useSER_V3 && serh.FrameCount > 0) {
+    off_t end=SER_HEADER_SIZE + (off_t)serh.FrameCount * frame_size;
+    std::vector<unsigned char> trailer(serh.FrameCount * 8);
+    for (unsigned int i=0; i < serh.FrameCount; i++)
+      put_long_int_le(&trailer[i * 8], timestamps[i]);
+    if (pwrite(fd, &trailer[0], trailer.size(), end) != (ssize_t)trailer.size() || ftruncate(fd, end + trailer.size()))
+      ok=false;
+  }
+
+  if (::close(fd))
+    ok=false;
+  fd=-1;
+  free(ring);
+  ring=NULL;
   streaming_active = false;
-  return true;
+  return ok;
 }
 
+// Called on the capture path, so it only copies the frame into the ring or drops it
 bool SER_Recorder::writeFrame(unsigned char *frame) {
   if (!streaming_active) return false;
   //IDLog("recorder: writeFrame @ %p\n", frame);
-  fwrite(frame, frame_size, 1, f);
+
+  pthread_mutex_lock(&lock);
+  uint64_t pos=head;
+  bool room=!write_error && head + frame_size - tail <= ring_size;
+  if (!room)
+    dropped++;
+  pthread_mutex_unlock(&lock);
+  if (!room)
+    return false;
+
+  // the writer does not look past head, so the copy needs no lock
+  size_t at=pos % ring_size;
+  size_t n=frame_size < ring_size - at ? frame_size : ring_size - at;
+  memcpy(ring + at, frame, n);
+  memcpy(ring, frame + n, frame_size - n);
+  timestamps.push_back(ser_time());
+
+  pthread_mutex_lock(&lock);
+  head+=frame_size;
   serh.FrameCount+=1;
+  if (head - tail >= chunk_size)
+    pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
   return true;
 }
 
+void *SER_Recorder::writerHelper(void *context) {
+  static_cast<SER_Recorder *>(context)->runWriter();
+  return NULL;
+}
+
+// Write the ring out in whole pages at page offsets, until close() wants the rest
+void SER_Recorder::runWriter() {
+  pthread_mutex_lock(&lock);
+  while (!write_error) {
+    while (!closing && head - tail < chunk_size)
+      pthread_cond_wait(&cond, &lock);
+    uint64_t end=closing ? head : head / SER_PAGE * SER_PAGE;
+    if (end == tail)
+      break;
+    size_t at=tail % ring_size;
+    size_t n=end - tail < ring_size - at ? end - tail : ring_size - at;
+    pthread_mutex_unlock(&lock);
+
+    ssize_t w=write(fd, ring + at, n);
+    if (w < 0 && errno == EINTR)
+      w=0;
+
+    pthread_mutex_lock(&lock);
+    if (w < 0) {
+      IDLog("recorder: write error %d, %s\n", errno, strerror(errno));
+      write_error=true;
+    } else
+      tail+=w;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void SER_Recorder::setDirectIO(bool enable) {
+  direct_io=enable && O_DIRECT;
+}
+
+unsigned int SER_Recorder::getQueuedFrames() {
+  pthread_mutex_lock(&lock);
+  unsigned int n=frame_size ? (head - tail) / frame_size : 0;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+unsigned int SER_Recorder::getDroppedFrames() {
+  pthread_mutex_lock(&lock);
+  unsigned int n=dropped;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+unsigned long long SER_Recorder::getBytesWritten() {
+  pthread_mutex_lock(&lock);
+  unsigned long long n=tail;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
 
 // ajouter une gestion plus fine du mode par defaut
 // setMono/setColor appelee par ImageTypeSP
@@ -29,6 +29,9 @@
 #include <linux/videodev2.h>
 #endif
 #include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
 
 typedef struct ser_header {
   char FileID[14];
@@ -42,10 +45,12 @@ typedef struct ser_header {
   char Observer[40];
   char Instrume[40];
   char Telescope[40];
-  unsigned long int DateTime;
-  unsigned long int DateTime_UTC;
+  uint64_t DateTime;
+  uint64_t DateTime_UTC;
 } ser_header;
 
+#define SER_HEADER_SIZE 178
+
 enum ser_color_id {
   SER_MONO = 0,
   SER_BAYER_RGGB = 8,
@@ -81,19 +86,42 @@ class SER_Recorder: public V4L2_Recorder
   virtual bool writeFrameColor(unsigned char *frame); // default way to write a RGB3 frame
   virtual void setDefaultMono(); // prepare to write GREY frame
   virtual void setDefaultColor(); // prepare to write RGB24 frame
+  virtual void setDirectIO(bool enable);
+  virtual unsigned int getQueuedFrames();
+  virtual unsigned int getDroppedFrames();
+  virtual unsigned long long getBytesWritten();
 
 
  protected:
   bool is_little_endian();
-  void write_int_le(unsigned int *i);
-  void write_long_int_le(unsigned long *i);
-  void write_header(ser_header *s);
+  void put_int_le(unsigned char *p, unsigned int i);
+  void put_long_int_le(unsigned char *p, uint64_t i);
+  void put_header(unsigned char *p, ser_header *s);
   ser_header serh;
   bool streaming_active;
   bool useSER_V3;
-  FILE *f;
   unsigned int frame_size;
   unsigned int number_of_planes;
+
+  /* Frames are copied into a ring holding the file as it will be on disk, from the header on, and
+     a writer thread writes it out in large blocks at the same offsets, so it can bypass the page
+     cache with O_DIRECT. A frame that does not fit in the ring is dropped. */
+  static void *writerHelper(void *context);
+  void runWriter();
+  int fd;
+  bool direct_io;
+  unsigned char *ring;
+  size_t ring_size;
+  size_t chunk_size;
+  uint64_t head;                        // bytes of the file put in the ring
+  uint64_t tail;                        // bytes of the file written
+  bool closing;
+  bool write_error;
+  unsigned int dropped;
+  std::vector<uint64_t> timestamps;     // UTC time of each frame, the SER v3 trailer
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
 };
 
 #endif // SER_RECORDER_H
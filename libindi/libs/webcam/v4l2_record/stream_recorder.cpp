@@ -108,6 +108,16 @@ bool StreamRecorder::initProperties()
      IUFillSwitch(&RecordStreamS[3], "RECORD_OFF", "Record Off", ISS_ON);
      IUFillSwitchVector(&RecordStreamSP, RecordStreamS, NARRAY(RecordStreamS), getDeviceName(), "RECORD_STREAM", "Video Record", STREAM_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
 
+     /* Record Writer */
+     IUFillNumber(&RecordStatsN[0], "RECORD_QUEUE", "Queued frames", "%6.0f", 0.0, 999999.0, 0.0, 0);
+     IUFillNumber(&RecordStatsN[1], "RECORD_RATE", "Write rate (MB/s)", "%6.1f", 0.0, 99999.0, 0.0, 0);
+     IUFillNumber(&RecordStatsN[2], "RECORD_DROPPED", "Dropped frames", "%9.0f", 0.0, 999999999.0, 0.0, 0);
+     IUFillNumberVector(&RecordStatsNP, RecordStatsN, NARRAY(RecordStatsN), getDeviceName(), "RECORD_STATS", "Record Writer", STREAM_TAB, IP_RO, 60, IPS_IDLE);
+
+     IUFillSwitch(&RecordDirectS[0], "ENABLE", "Enable", ISS_OFF);
+     IUFillSwitch(&RecordDirectS[1], "DISABLE", "Disable", ISS_ON);
+     IUFillSwitchVector(&RecordDirectSP, RecordDirectS, NARRAY(RecordDirectS), getDeviceName(), "RECORD_DIRECT_IO", "Direct I/O", STREAM_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
 }
 
 void StreamRecorder::ISGetProperties(const char *dev)
@@ -124,6 +134,8 @@ void StreamRecorder::ISGetProperties(const char *dev)
       ccd->defineSwitch(&RecordStreamSP);
       ccd->defineText(&RecordFileTP);
       ccd->defineNumber(&RecordOptionsNP);
+      ccd->defineNumber(&RecordStatsNP);
+      ccd->defineSwitch(&RecordDirectSP);
     }
 }
 
@@ -141,6 +153,8 @@ bool StreamRecorder::updateProperties()
       ccd->defineSwitch(&RecordStreamSP);
       ccd->defineText(&RecordFileTP);
       ccd->defineNumber(&RecordOptionsNP);
+      ccd->defineNumber(&RecordStatsNP);
+      ccd->defineSwitch(&RecordDirectSP);
 
     }
     else
@@ -152,6 +166,8 @@ bool StreamRecorder::updateProperties()
       ccd->deleteProperty(RecordFileTP.name);
       ccd->deleteProperty(RecordStreamSP.name);
       ccd->deleteProperty(RecordOptionsNP.name);
+      ccd->deleteProperty(RecordStatsNP.name);
+      ccd->deleteProperty(RecordDirectSP.name);
 
       return true;
     }
@@ -182,6 +198,18 @@ void StreamRecorder::newFrame(unsigned char *buffer)
     if (mssum >= 1000.0)
     {
       FpsN[1].value=(framecountsec * 1000.0) / mssum;
+
+      if (is_recording)
+      {
+        unsigned long long bytes=recorder->getBytesWritten();
+        RecordStatsN[0].value=recorder->getQueuedFrames();
+        RecordStatsN[1].value=(bytes - recordBytes) / (mssum * 1000.0);
+        RecordStatsN[2].value=recorder->getDroppedFrames();
+        RecordStatsNP.s=RecordStatsN[2].value > 0 ? IPS_ALERT : IPS_BUSY;
+        IDSetNumber(&RecordStatsNP, NULL);
+        recordBytes=bytes;
+      }
+
       mssum=0; framecountsec=0;
     }
 
@@ -220,8 +248,7 @@ bool StreamRecorder::setPixelFormat(uint32_t format)
 
 bool StreamRecorder::uploadStream(uint8_t *buffer)
 {
-    int ret=0;
-    uLongf compressedBytes = 0;
+    size_t compressedBytes = 0;
     uLong totalBytes = ccd->PrimaryCCD.getFrameBufferSize() / (ccd->PrimaryCCD.getBinX()*ccd->PrimaryCCD.getBinY());
 
     //if (ccd->PrimaryCCD.getNAxis() == 2)
@@ -249,15 +276,19 @@ bool StreamRecorder::uploadStream(uint8_t *buffer)
     /* Do we want to compress ? */
      if (ccd->PrimaryCCD.isCompressed())
      {
-        /* Compress frame */
-        compressedFrame = (uint8_t *) realloc (compressedFrame, sizeof(uint8_t) * totalBytes + totalBytes / 64 + 16 + 3);
-        compressedBytes = sizeof(uint8_t) * totalBytes + totalBytes / 64 + 16 + 3;
+        /* Compress frame. Rice only applies to FITS, streams use zlib then, and favor speed over size unless told otherwise */
+        int codec = ccd->PrimaryCCD.getCodec() == CCDChip::CODEC_RICE ? (int) BLOB_CODEC_ZLIB : (int) ccd->PrimaryCCD.getCodec();
+        int level = ccd->PrimaryCCD.getCodecLevel();
+        if (level == 0 && codec == BLOB_CODEC_ZLIB)
+            level = 4;
+
+        compressedBytes = blobCompressBound(codec, totalBytes);
+        compressedFrame = (uint8_t *) realloc (compressedFrame, compressedBytes);
 
-        ret = compress2(compressedFrame, &compressedBytes, ccd->PrimaryCCD.getFrameBuffer(), totalBytes, 4);
-        if (ret != Z_OK)
+        if (blobCompress(codec, level, 0, compressedFrame, &compressedBytes, ccd->PrimaryCCD.getFrameBuffer(), totalBytes) < 0)
         {
              /* this should NEVER happen */
-             DEBUGF( INDI::Logger::DBG_ERROR, "internal error - compression failed: %d", ret);
+             DEBUGF( INDI::Logger::DBG_ERROR, "internal error - %s compression failed", blobCodecName(codec));
              return false;
          }
 
@@ -265,7 +296,7 @@ bool StreamRecorder::uploadStream(uint8_t *buffer)
         imageB->blob = compressedFrame;
         imageB->bloblen = compressedBytes;
         imageB->size = totalBytes;
-        strcpy(imageB->format, ".stream.z");
+        snprintf(imageB->format, MAXINDIBLOBFMT, ".stream%s", blobCodecSuffix(codec));
       }
       else
       {
@@ -286,10 +317,15 @@ void StreamRecorder::recordStream(double deltams, unsigned char *buffer)
   if (!is_recording)
       return;
 
+  bool accepted;
   if (ccd->PrimaryCCD.getNAxis() == 2)
-    recorder->writeFrameMono(buffer);
+    accepted = recorder->writeFrameMono(buffer);
   else
-    recorder->writeFrameColor(buffer);
+    accepted = recorder->writeFrameColor(buffer);
+
+  /* dropped frames do not count towards the record limits */
+  if (!accepted)
+      return;
 
   recordDuration+=deltams;
   recordframeCount+=1;
@@ -441,6 +477,7 @@ bool StreamRecorder::startRecording()
 
   getitimer(ITIMER_REAL, &tframe1);
   mssum=0; framecountsec=0;
+  recordBytes=0;
   if (is_streaming == false && ccd->StartStreaming() == false)
   {
       DEBUG(INDI::Logger::DBG_ERROR, "Failed to start recording.");
@@ -460,8 +497,17 @@ bool StreamRecorder::stopRecording()
       ccd->StopStreaming();
 
   is_recording=false;
-  recorder->close();
+  if (!recorder->close())
+      DEBUG(INDI::Logger::DBG_ERROR, "Error writing record file, it may be incomplete.");
   DEBUGF(INDI::Logger::DBG_SESSION, "Record Duration(millisec): %g -- Frame count: %d", recordDuration, recordframeCount);
+
+  RecordStatsN[0].value=0;
+  RecordStatsN[1].value=0;
+  RecordStatsN[2].value=recorder->getDroppedFrames();
+  RecordStatsNP.s=IPS_IDLE;
+  IDSetNumber(&RecordStatsNP, NULL);
+  if (RecordStatsN[2].value > 0)
+      DEBUGF(INDI::Logger::DBG_WARNING, "%d frames were dropped, the disk did not keep up.", (int)RecordStatsN[2].value);
   return true;
 }
 
@@ -489,6 +535,16 @@ bool StreamRecorder::ISNewSwitch (const char *dev, const char *name, ISState *st
       return true;
     }
 
+    /* Direct I/O, used from the next record */
+    if (!strcmp(name, RecordDirectSP.name))
+    {
+      IUUpdateSwitch(&RecordDirectSP, states, names, n);
+      recorder->setDirectIO(RecordDirectS[0].s == ISS_ON);
+      RecordDirectSP.s = IPS_OK;
+      IDSetSwitch(&RecordDirectSP, NULL);
+      return true;
+    }
+
     /* Record Stream */
     if (!strcmp(name, RecordStreamSP.name))
     {
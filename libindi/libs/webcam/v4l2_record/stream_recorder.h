@@ -117,6 +117,14 @@ private:
     INumber RecordOptionsN[2];
     INumberVectorProperty RecordOptionsNP;
 
+    /* Record writer queue, rate and drops */
+    INumber RecordStatsN[3];
+    INumberVectorProperty RecordStatsNP;
+
+    /* Record file bypasses the page cache */
+    ISwitch RecordDirectS[2];
+    ISwitchVectorProperty RecordDirectSP;
+
     /* BLOBs */
     IBLOBVectorProperty *imageBP;
     IBLOB *imageB;
@@ -142,6 +150,7 @@ private:
     // use bsd timers
     struct itimerval tframe1, tframe2;
     double mssum, framecountsec;
+    unsigned long long recordBytes;
 
 };
 
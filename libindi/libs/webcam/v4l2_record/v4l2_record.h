@@ -60,6 +60,10 @@ virtual bool writeFrameMono(unsigned char *frame)=0; // default way to write a G
 virtual bool writeFrameColor(unsigned char *frame)=0; // default way to write a RGB24 frame
 virtual void setDefaultMono()=0; // prepare to write GREY frame
 virtual void setDefaultColor()=0; // prepare to write RGB24 frame
+virtual void setDirectIO(bool enable) { } // bypass the page cache when writing, if the recorder can
+virtual unsigned int getQueuedFrames() { return 0; } // frames waiting to be written
+virtual unsigned int getDroppedFrames() { return 0; } // frames dropped since open() for lack of room
+virtual unsigned long long getBytesWritten() { return 0; } // bytes written since open()
 
 protected:
 const char *name;
@@ -22,7 +22,7 @@
 #include "indiapi.h"
 #include "lilxml.h"
 #include "base64.h"
-#include "zlib.h"
+#include "blobcodec.h"
 
 
 /* table of INDI definition elements, plus setBLOB.
@@ -544,7 +544,7 @@ oneBLOB (XMLEle *root, char *dev, char *nam, char *enam, char *p, int plen)
 	int bloblen;
 	unsigned char *blob;
 	int ucs;
-	int isz;
+	int codec;
 	char fn[128];
 	int i;
 
@@ -556,7 +556,7 @@ oneBLOB (XMLEle *root, char *dev, char *nam, char *enam, char *p, int plen)
 
 	/* get format and length */
         format = (char *) findXMLAttValu (root, "format");
-	isz = !strcmp (&format[strlen(format)-2], ".z");
+	codec = blobCodecFromFormat (format);
 
 	/* decode blob from base64 in p */
 	blob = malloc (3*plen/4);
@@ -566,14 +566,13 @@ oneBLOB (XMLEle *root, char *dev, char *nam, char *enam, char *p, int plen)
 	    exit(2);
 	}
 
-	/* uncompress effectively in place if z */
-	if (isz) {
-	    uLong nuncomp = ucs;
+	/* uncompress effectively in place if compressed */
+	if (codec != BLOB_CODEC_NONE) {
+	    size_t nuncomp = ucs;
 	    unsigned char *uncomp = malloc (ucs);
-	    int ok = uncompress (uncomp, &nuncomp, blob, bloblen);
-	    if (ok != Z_OK) {
-		fprintf (stderr, "%s.%s.%s uncompress error %d\n", dev, nam,
-								    enam, ok);
+	    if (blobUncompress (codec, 0, uncomp, &nuncomp, blob, bloblen) < 0) {
+		fprintf (stderr, "%s.%s.%s %s uncompress error\n", dev, nam,
+						    enam, blobCodecName(codec));
 		exit(2);
 	    }
 	    free (blob);
@@ -583,8 +582,8 @@ oneBLOB (XMLEle *root, char *dev, char *nam, char *enam, char *p, int plen)
 
 	/* rig up a file name from property name */
 	i = sprintf (fn, "%s.%s.%s%s", dev, nam, enam, format);
-	if (isz)
-	    fn[i-2] = '\0'; 	/* chop off .z */
+	if (codec != BLOB_CODEC_NONE)
+	    fn[i-strlen(blobCodecSuffix(codec))] = '\0'; 	/* chop off .z, .zst, ... */
 
 	/* save */
 	fp = fopen (fn, "w");